@@ -27,6 +27,7 @@
 	GEN_CMD_OBJ(DESTROY), \
 	GEN_CMD_OBJ(BLKRESCAN), \
 	GEN_CMD_OBJ(REGISTER_VM_EVENT_CLIENT), \
+	GEN_CMD_OBJ(GET_STATS), \
 
 struct command dm_command_list[CMDS_NUM] = {CMD_OBJS};
 
@@ -11,8 +11,9 @@
 #define DESTROY "destroy"
 #define BLKRESCAN "blkrescan"
 #define REGISTER_VM_EVENT_CLIENT "register_vm_event_client"
+#define GET_STATS "get_stats"
 
-#define CMDS_NUM 3U
+#define CMDS_NUM 4U
 #define CMD_NAME_MAX 32U
 #define CMD_ARG_MAX 320U
 
@@ -20,6 +20,10 @@
 #include "vmmapi.h"
 #include "log.h"
 #include "monitor.h"
+#include "iothread.h"
+#include "virtio_net.h"
+#include "block_cache.h"
+#include "mem.h"
 
 #define SUCCEEDED 0
 #define FAILED -1
@@ -194,3 +198,164 @@ int user_vm_blkrescan_handler(void *arg, void *command_para)
 	}
 	return ret;
 }
+
+static int send_socket_stats(struct socket_dev *sock, int fd, cJSON *stats)
+{
+	int ret = 0;
+	char *stats_msg;
+	struct socket_client *client = NULL;
+
+	client = find_socket_client(sock, fd);
+	if (client == NULL)
+		return -1;
+
+	stats_msg = cJSON_Print(stats);
+	if ((stats_msg != NULL) && (strlen(stats_msg) < CLIENT_BUF_LEN)) {
+		memset(client->buf, 0, CLIENT_BUF_LEN);
+		memcpy(client->buf, stats_msg, strlen(stats_msg));
+		client->len = strlen(stats_msg);
+		ret = write_socket_char(client);
+	} else {
+		pr_err("Failed to generate stats message.\n");
+		ret = -1;
+	}
+	free(stats_msg);
+	return ret;
+}
+
+static void add_asyncio_stats(cJSON *stats)
+{
+	uint32_t ele_num, fill, full_waits;
+	cJSON *obj;
+
+	if (vm_get_asyncio_stats(&ele_num, &fill, &full_waits) != 0)
+		return;
+
+	obj = cJSON_AddObjectToObject(stats, "asyncio");
+	if (obj == NULL)
+		return;
+	cJSON_AddNumberToObject(obj, "ele_num", ele_num);
+	cJSON_AddNumberToObject(obj, "fill", fill);
+	cJSON_AddNumberToObject(obj, "full_waits", full_waits);
+}
+
+static void add_mmio_hint_stats(cJSON *stats)
+{
+	uint64_t hit, miss;
+	cJSON *obj;
+
+	mem_get_hint_stats(&hit, &miss);
+	obj = cJSON_AddObjectToObject(stats, "mmio_hint");
+	if (obj == NULL)
+		return;
+	cJSON_AddNumberToObject(obj, "hit", hit);
+	cJSON_AddNumberToObject(obj, "miss", miss);
+}
+
+static void add_poll_stats(cJSON *stats)
+{
+	struct iothread_poll poll;
+	const char *name;
+	uint64_t hit, miss, sleep;
+	cJSON *obj;
+	int i;
+
+	if (vm_get_ioreq_poll_stats(&hit, &miss, &sleep) == 0) {
+		obj = cJSON_AddObjectToObject(stats, "ioreq_poll");
+		if (obj != NULL) {
+			cJSON_AddNumberToObject(obj, "hit", hit);
+			cJSON_AddNumberToObject(obj, "miss", miss);
+			cJSON_AddNumberToObject(obj, "sleep", sleep);
+		}
+	}
+
+	for (i = 0; iothread_get_poll_stats(i, &name, &poll) == 0; i++) {
+		if (poll.max_ns == 0U)
+			continue;
+		obj = cJSON_AddObjectToObject(stats, name);
+		if (obj == NULL)
+			continue;
+		cJSON_AddNumberToObject(obj, "hit", poll.hit);
+		cJSON_AddNumberToObject(obj, "miss", poll.miss);
+		cJSON_AddNumberToObject(obj, "sleep", poll.sleep);
+		cJSON_AddNumberToObject(obj, "poll_ns", poll.cur_ns);
+	}
+}
+
+static void add_vtnet_stats(cJSON *stats)
+{
+	struct virtio_net_rx_stats rx;
+	char name[32];
+	cJSON *obj;
+	int i;
+
+	for (i = 0; virtio_net_get_rx_stats(i, name, sizeof(name), &rx) == 0; i++) {
+		obj = cJSON_AddObjectToObject(stats, name);
+		if (obj == NULL)
+			continue;
+		cJSON_AddNumberToObject(obj, "packets", rx.packets);
+		cJSON_AddNumberToObject(obj, "batches", rx.batches);
+		cJSON_AddNumberToObject(obj, "max_batch", rx.max_batch);
+		cJSON_AddNumberToObject(obj, "drops", rx.drops);
+		cJSON_AddNumberToObject(obj, "pauses", rx.pauses);
+	}
+}
+
+static void add_rcache_stats(cJSON *stats)
+{
+	struct block_cache_stats cache;
+	char name[80];
+	cJSON *obj;
+	int i;
+
+	for (i = 0; block_cache_get_stats(i, name, sizeof(name), &cache) == 0; i++) {
+		obj = cJSON_AddObjectToObject(stats, name);
+		if (obj == NULL)
+			continue;
+		cJSON_AddNumberToObject(obj, "hits", cache.hits);
+		cJSON_AddNumberToObject(obj, "misses", cache.misses);
+		cJSON_AddNumberToObject(obj, "evictions", cache.evictions);
+		cJSON_AddNumberToObject(obj, "uncached", cache.uncached);
+		cJSON_AddNumberToObject(obj, "size", cache.size);
+		cJSON_AddNumberToObject(obj, "used", cache.used);
+	}
+}
+
+/* When a client issues the GET_STATS command, this handler replies with
+ * the runtime statistics of the device model, e.g.:
+ * {"ack": 0, "asyncio": {"ele_num": 504, "fill": 0, "full_waits": 0},
+ *  "mmio_hint": {"hit": 81920, "miss": 1024},
+ *  "ioreq_poll": {"hit": 10, "miss": 2, "sleep": 5},
+ *  "iothr-0-blk00:04": {"hit": 7, "miss": 1, "sleep": 3, "poll_ns": 40000},
+ *  "vtnet5:0-rx0": {"packets": 920, "batches": 40, "max_batch": 64,
+ *                   "drops": 0, "pauses": 3},
+ *  "rcache-base.img": {"hits": 5120, "misses": 830, "evictions": 0,
+ *                      "uncached": 0, "size": 67108864, "used": 54394880}}
+ * The poll statistics are only reported when the poll mode is enabled.
+ */
+int user_vm_get_stats_handler(void *arg, void *command_para)
+{
+	int ret;
+	struct command_parameters *cmd_para = (struct command_parameters *)command_para;
+	struct handler_args *hdl_arg = (struct handler_args *)arg;
+	struct socket_dev *sock = (struct socket_dev *)hdl_arg->channel_arg;
+	cJSON *stats;
+
+	stats = cJSON_CreateObject();
+	if (stats == NULL)
+		return send_socket_ack(sock, cmd_para->fd, false);
+
+	cJSON_AddNumberToObject(stats, "ack", SUCCEEDED);
+	add_asyncio_stats(stats);
+	add_mmio_hint_stats(stats);
+	add_poll_stats(stats);
+	add_vtnet_stats(stats);
+	add_rcache_stats(stats);
+
+	ret = send_socket_stats(sock, cmd_para->fd, stats);
+	if (ret < 0) {
+		pr_err("Failed to send stats by socket.\n");
+	}
+	cJSON_Delete(stats);
+	return ret;
+}
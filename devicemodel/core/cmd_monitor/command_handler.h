@@ -10,5 +10,6 @@ extern struct socket_dev *sock_server;
 int user_vm_destroy_handler(void *arg, void *command_para);
 int user_vm_blkrescan_handler(void *arg, void *command_para);
 int user_vm_register_vm_event_client_handler(void *arg, void *command_para);
+int user_vm_get_stats_handler(void *arg, void *command_para);
 
 #endif
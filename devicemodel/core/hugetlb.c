@@ -883,6 +883,23 @@ vm_find_memfd_region(struct vmctx *ctx, vm_paddr_t gpa,
 	return ret;
 }
 
+/*
+ * Fill @iov with the host virtual address ranges of the guest memory mapped
+ * from hugetlbfs, at most @max entries. Return the number of entries filled.
+ */
+int
+vm_get_mem_iovecs(struct iovec *iov, int max)
+{
+	int i;
+
+	for (i = 0; (i < mem_idx) && (i < max); i++) {
+		iov[i].iov_base = mmap_mem_regions[i].hva_base;
+		iov[i].iov_len = mmap_mem_regions[i].gpa_end - mmap_mem_regions[i].gpa_start;
+	}
+
+	return i;
+}
+
 bool vm_allow_dmabuf(struct vmctx *ctx)
 {
 	uint32_t mem_flags;
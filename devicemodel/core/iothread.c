@@ -15,11 +15,13 @@
 #include <pthread.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
 
 #include "iothread.h"
 #include "log.h"
 #include "mevent.h"
 #include "dm.h"
+#include "atomic.h"
 
 
 #define MEVENT_MAX 64
@@ -29,18 +31,139 @@ static int ioctx_active_cnt;
 /* mutex to protect the free ioctx slot allocation */
 static pthread_mutex_t ioctxes_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+uint64_t
+iothread_poll_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void
+iothread_poll_init(struct iothread_poll *poll, uint32_t max_ns)
+{
+	memset(poll, 0, sizeof(*poll));
+	poll->max_ns = max_ns;
+}
+
+/*
+ * Call @check(@arg) until it reports some work or the current poll window
+ * expires. Return true if work was found, the caller may skip sleeping then.
+ */
+bool
+iothread_poll_run(struct iothread_poll *poll, bool (*check)(void *), void *arg)
+{
+	uint64_t start, now;
+
+	if (poll->cur_ns == 0U)
+		return false;
+
+	start = iothread_poll_now();
+	do {
+		if ((*check)(arg)) {
+			poll->hit++;
+			return true;
+		}
+		now = iothread_poll_now();
+	} while ((now - start) < poll->cur_ns);
+
+	/* nothing came in the window, back off */
+	poll->miss++;
+	poll->cur_ns /= 2U;
+	if (poll->cur_ns < IOTHREAD_POLL_GROW_START_NS)
+		poll->cur_ns = 0U;
+
+	return false;
+}
+
+/*
+ * Account a sleep of @slept_ns. If the wakeup came within max_ns a longer poll
+ * window would have avoided the sleep, so grow the window.
+ */
+void
+iothread_poll_slept(struct iothread_poll *poll, uint64_t slept_ns)
+{
+	poll->sleep++;
+	if ((poll->max_ns == 0U) || (slept_ns > poll->max_ns))
+		return;
+
+	if (poll->cur_ns == 0U)
+		poll->cur_ns = IOTHREAD_POLL_GROW_START_NS;
+	else
+		poll->cur_ns *= 2U;
+	if (poll->cur_ns > poll->max_ns)
+		poll->cur_ns = poll->max_ns;
+}
+
+/*
+ * Call the poll callbacks once. They are called without mtx, from a copy of
+ * pollers that is refreshed only when the list changes. iothread_del() waits
+ * for a pass in progress, so a removed mevent is not used after it returns.
+ */
+static bool
+iothread_poll_check(void *arg)
+{
+	struct iothread_ctx *ioctx_x = (struct iothread_ctx *)arg;
+	struct iothread_mevent *aevp;
+	bool found = false;
+	uint32_t gen;
+	int i;
+
+	pthread_mutex_lock(&ioctx_x->mtx);
+	gen = ioctx_x->poll_gen;
+	if (ioctx_x->poll_snap_gen != gen) {
+		memcpy(ioctx_x->poll_snap, ioctx_x->pollers,
+			ioctx_x->npollers * sizeof(ioctx_x->pollers[0]));
+		ioctx_x->npoll_snap = ioctx_x->npollers;
+		ioctx_x->poll_snap_gen = gen;
+	}
+	ioctx_x->polling = true;
+	pthread_mutex_unlock(&ioctx_x->mtx);
+
+	for (i = 0; i < ioctx_x->npoll_snap; i++) {
+		/* a callback removed a poller, the copy is stale */
+		if (atomic_load(&ioctx_x->poll_gen) != gen)
+			break;
+		aevp = ioctx_x->poll_snap[i];
+		if ((*aevp->poll)(aevp->arg))
+			found = true;
+	}
+
+	pthread_mutex_lock(&ioctx_x->mtx);
+	ioctx_x->polling = false;
+	pthread_cond_broadcast(&ioctx_x->poll_cond);
+	pthread_mutex_unlock(&ioctx_x->mtx);
+
+	return found;
+}
+
 static void *
 io_thread(void *arg)
 {
 	struct epoll_event eventlist[MEVENT_MAX];
 	struct iothread_mevent *aevp;
-	int i, n;
+	int i, n, timeout;
+	uint64_t start;
 	struct iothread_ctx *ioctx_x = (struct iothread_ctx *)arg;
 
 	set_thread_priority(PRIO_IOTHREAD, true);
 
 	while(ioctx_x->started) {
-		n = epoll_wait(ioctx_x->epfd, eventlist, MEVENT_MAX, -1);
+		/*
+		 * In poll mode, take the events that are already signaled and
+		 * poll the devices before blocking. The fds are still checked
+		 * without waiting so a kick received while polling is consumed.
+		 */
+		timeout = -1;
+		if ((ioctx_x->poll.max_ns != 0U) &&
+			iothread_poll_run(&ioctx_x->poll, iothread_poll_check, ioctx_x))
+			timeout = 0;
+
+		start = iothread_poll_now();
+		n = epoll_wait(ioctx_x->epfd, eventlist, MEVENT_MAX, timeout);
+		if ((timeout != 0) && (n > 0))
+			iothread_poll_slept(&ioctx_x->poll, iothread_poll_now() - start);
 		if (n < 0) {
 			if (errno == EINTR) {
 				/* EINTR may happen when io_uring fd is monitored, it is harmless. */
@@ -116,6 +239,17 @@ iothread_add(struct iothread_ctx *ioctx_x, int fd, struct iothread_mevent *aevt)
 		return ret;
 	}
 
+	if (aevt->poll != NULL) {
+		pthread_mutex_lock(&ioctx_x->mtx);
+		if (ioctx_x->npollers < IOTHREAD_POLLER_MAX) {
+			ioctx_x->pollers[ioctx_x->npollers++] = aevt;
+			atomic_add_fetch(&ioctx_x->poll_gen, 1U);
+		} else {
+			pr_err("%s: too many pollers, fd %d is not polled\n", __func__, fd);
+		}
+		pthread_mutex_unlock(&ioctx_x->mtx);
+	}
+
 	/* Start the iothread after the first fd is added.*/
 	ret = iothread_start(ioctx_x);
 	if (ret < 0) {
@@ -129,12 +263,26 @@ int
 iothread_del(struct iothread_ctx *ioctx_x, int fd)
 {
 	int ret = 0;
+	int i;
 
 	if (ioctx_x == NULL) {
 		pr_err("%s: ioctx_x is NULL \n", __func__);
 		return -1;
 	}
 
+	pthread_mutex_lock(&ioctx_x->mtx);
+	for (i = 0; i < ioctx_x->npollers; i++) {
+		if (ioctx_x->pollers[i]->fd == fd) {
+			ioctx_x->pollers[i] = ioctx_x->pollers[--ioctx_x->npollers];
+			atomic_add_fetch(&ioctx_x->poll_gen, 1U);
+			break;
+		}
+	}
+	/* the removed mevent may be in use by a poll pass of the iothread */
+	while (ioctx_x->polling && !pthread_equal(pthread_self(), ioctx_x->tid))
+		pthread_cond_wait(&ioctx_x->poll_cond, &ioctx_x->mtx);
+	pthread_mutex_unlock(&ioctx_x->mtx);
+
 	if (ioctx_x->epfd) {
 		ret = epoll_ctl(ioctx_x->epfd, EPOLL_CTL_DEL, fd, NULL);
 		if (ret < 0)
@@ -167,6 +315,7 @@ iothread_deinit(void)
 			ioctx_x->epfd = -1;
 		}
 		pthread_mutex_destroy(&ioctx_x->mtx);
+		pthread_cond_destroy(&ioctx_x->poll_cond);
 		pr_info("%s stop \n", ioctx_x->name);
 	}
 	ioctx_active_cnt = 0;
@@ -221,6 +370,13 @@ iothread_create(struct iothreads_option *iothr_opt)
 			ioctx_x->tid = 0;
 			ioctx_x->started = false;
 			ioctx_x->epfd = epoll_create1(0);
+			ioctx_x->npollers = 0;
+			ioctx_x->poll_gen = 0U;
+			ioctx_x->poll_snap_gen = 0U;
+			ioctx_x->npoll_snap = 0;
+			ioctx_x->polling = false;
+			pthread_cond_init(&ioctx_x->poll_cond, NULL);
+			iothread_poll_init(&ioctx_x->poll, iothr_opt->poll_max_ns);
 
 			CPU_ZERO(&(ioctx_x->cpuset));
 			if (iothr_opt->cpusets != NULL) {
@@ -285,8 +441,20 @@ iothread_parse_options(char *str, struct iothreads_option *iothr_opt)
 	 *   - 2nd iothread instance <-> Service VM CPU 0,1
 	 *   - 3rd iothread instance <-> No CPU affinity settings
 	 *
+	 * - create 2 iothread instances for virtio-blk which busy-poll the
+	 *   virtqueues for up to 50us before sleeping
+	 *   ... virtio-blk iothread=2@0/1+poll=50,...
+	 *
 	 */
 	if (str != NULL) {
+		/* "+" is used to append the poll mode setting. */
+		tmp_num = strchr(str, '+');
+		if (tmp_num != NULL) {
+			*tmp_num++ = '\0';
+			if (iothread_parse_poll(tmp_num, &iothr_opt->poll_max_ns) < 0)
+				return -1;
+		}
+
 		/*
 		 * "@" is used to separate the following two settings:
 		 * - the number of iothread instances
@@ -347,6 +515,52 @@ iothread_parse_options(char *str, struct iothreads_option *iothr_opt)
 	return 0;
 }
 
+/*
+ * Parse the poll mode setting "poll=<max_us>" from @str, it is shared by the
+ * iothread options and the vm_loop ("--ioreq_poll") option.
+ * Return -1 if fails to parse. Otherwise, return 0.
+ */
+int
+iothread_parse_poll(char *str, uint32_t *max_ns)
+{
+	int max_us;
+
+	if ((str == NULL) || strncmp(str, "poll=", strlen("poll="))) {
+		pr_err("%s: invalid poll setting %s \n", __func__, str);
+		return -1;
+	}
+
+	str += strlen("poll=");
+	if (dm_strtoi(str, &str, 10, &max_us) || (max_us < 0) ||
+		(max_us > IOTHREAD_POLL_MAX_US)) {
+		pr_err("%s: invalid poll time %s \n", __func__, str);
+		return -1;
+	}
+	*max_ns = (uint32_t)max_us * 1000U;
+
+	return 0;
+}
+
+/*
+ * Get the poll statistics of the @idx-th iothread.
+ * Return -1 if there is no such iothread. Otherwise, return 0.
+ */
+int
+iothread_get_poll_stats(int idx, const char **name, struct iothread_poll *stats)
+{
+	int ret = -1;
+
+	pthread_mutex_lock(&ioctxes_mutex);
+	if ((idx >= 0) && (idx < ioctx_active_cnt)) {
+		*name = ioctxes[idx].name;
+		*stats = ioctxes[idx].poll;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&ioctxes_mutex);
+
+	return ret;
+}
+
 /*
  * This interface is used to free the elements that are allocated dynamically in iothread_parse_options(),
  * such as iothr_opt->cpusets.
@@ -132,8 +132,17 @@ struct dmstats {
 	uint64_t	cpu_switch_rotate;
 	uint64_t	cpu_switch_direct;
 	uint64_t	vmexit_mmio_emul;
+	uint64_t	ioreq_wakeup;
+	uint64_t	ioreq_drain_round;
+	uint64_t	ioreq_notify;
 } stats;
 
+/* cleared when the HSM does not support ACRN_IOCTL_NOTIFY_REQUEST_FINISH_BATCH */
+static bool ioreq_notify_batch = true;
+
+/* vm_loop polls the ioreq buffer before sleeping if ioreq_poll.max_ns != 0 */
+static struct iothread_poll ioreq_poll;
+
 struct mt_vmm_info {
 	pthread_t	mt_thr;
 	struct vmctx	*mt_ctx;
@@ -153,7 +162,7 @@ usage(int code)
 		"       %*s [--iasl iasl_compiler_path]\n"
 		"       %*s [--enable_trusty] [--intr_monitor param_setting]\n"
 		"       %*s [--acpidev_pt HID] [--mmiodev_pt MMIO_Regions]\n"
-		"       %*s [--vtpm2 sock_path] [--virtio_poll interval]\n"
+		"       %*s [--vtpm2 sock_path] [--virtio_poll interval] [--ioreq_poll poll=max_us]\n"
 		"       %*s [--cpu_affinity lapic_id] [--lapic_pt] [--rtvm] [--windows]\n"
 		"       %*s [--debugexit] [--logger_setting param_setting]\n"
 		"       %*s [--ssram] <vm>\n"
@@ -178,6 +187,7 @@ usage(int code)
 		"       --cmd_monitor: enable command monitor\n"
 		"            its params: unix domain socket path\n"
 		"       --virtio_poll: enable virtio poll mode with poll interval with ns\n"
+		"       --ioreq_poll: busy-poll the I/O requests for up to max_us before sleeping\n"
 		"       --acpidev_pt: ACPI device ID args: HID in ACPI Table\n"
 		"       --mmiodev_pt: MMIO resources args: physical MMIO regions\n"
 		"       --vtpm2: Virtual TPM2 args: sock_path=$PATH_OF_SWTPM_SOCKET\n"
@@ -399,7 +409,7 @@ vmexit_mmio_emul(struct vmctx *ctx, struct acrn_io_request *io_req, int *pvcpu)
 	int err;
 
 	stats.vmexit_mmio_emul++;
-	err = emulate_mem(ctx, &io_req->reqs.mmio_request);
+	err = emulate_mem(ctx, *pvcpu, &io_req->reqs.mmio_request);
 
 	if (err) {
 		if (err == -ESRCH)
@@ -465,7 +475,11 @@ static vmexit_handler_t handler[VM_EXITCODE_MAX] = {
 	[VM_EXITCODE_PCI_CFG] = vmexit_pci_emul,
 };
 
-static void
+/*
+ * Return 0 if the request completion may be notified, otherwise the request
+ * is left in processing state.
+ */
+static int
 handle_vmexit(struct vmctx *ctx, struct acrn_io_request *io_req, int vcpu)
 {
 	enum vm_exitcode exitcode;
@@ -488,9 +502,38 @@ handle_vmexit(struct vmctx *ctx, struct acrn_io_request *io_req, int vcpu)
 	 */
 	if ((VM_SUSPEND_SYSTEM_RESET == vm_get_suspend_mode()) ||
 		(VM_SUSPEND_SUSPEND == vm_get_suspend_mode()))
-		return;
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Notify the completion of the requests of the vCPUs in @vcpu_mask, with one
+ * notification if the HSM supports it. Return 0 if all are notified.
+ */
+static int
+notify_request_done(struct vmctx *ctx, uint64_t vcpu_mask)
+{
+	int vcpu_id, error = 0;
+
+	stats.ioreq_notify++;
+	if (ioreq_notify_batch) {
+		if (vm_notify_request_done_batch(ctx, vcpu_mask) == 0)
+			return 0;
+		if (errno != ENOTTY)
+			return -1;
+		pr_info("%s: no batch notification in the HSM, notify per request\n", __func__);
+		ioreq_notify_batch = false;
+	}
+
+	for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
+		if ((vcpu_mask & (1UL << vcpu_id)) != 0UL) {
+			if (vm_notify_request_done(ctx, vcpu_id) != 0)
+				error = -1;
+		}
+	}
 
-	vm_notify_request_done(ctx, vcpu);
+	return error;
 }
 
 static int
@@ -794,10 +837,26 @@ vm_suspend_resume(struct vmctx *ctx)
 	vm_run(ctx);
 }
 
+static bool
+ioreq_pending(void *arg)
+{
+	struct acrn_io_request *io_req;
+	int vcpu_id;
+
+	for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
+		io_req = &ioreq_buf[vcpu_id];
+		if ((atomic_load(&io_req->processed) == ACRN_IOREQ_STATE_PROCESSING)
+			&& !io_req->kernel_handled)
+			return true;
+	}
+	return false;
+}
+
 static void
 vm_loop(struct vmctx *ctx)
 {
 	int error;
+	uint64_t start;
 
 	ctx->ioreq_client = vm_create_ioreq_client(ctx);
 	if (ctx->ioreq_client < 0) {
@@ -812,18 +871,49 @@ vm_loop(struct vmctx *ctx)
 
 	while (1) {
 		int vcpu_id;
+		uint64_t done;
+		bool drain;
 		struct acrn_io_request *io_req;
 
-		error = vm_attach_ioreq_client(ctx);
-		if (error)
-			break;
-
-		for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
-			io_req = &ioreq_buf[vcpu_id];
-			if ((atomic_load(&io_req->processed) == ACRN_IOREQ_STATE_PROCESSING)
-				&& !io_req->kernel_handled)
-				handle_vmexit(ctx, io_req, vcpu_id);
+		/*
+		 * In poll mode, the requests dispatched to us can be handled
+		 * before the wakeup arrives. Skip the attach then, the pending
+		 * wakeup just finds an empty buffer next time.
+		 */
+		if (!iothread_poll_run(&ioreq_poll, ioreq_pending, NULL)) {
+			start = iothread_poll_now();
+			error = vm_attach_ioreq_client(ctx);
+			if (error)
+				break;
+			iothread_poll_slept(&ioreq_poll, iothread_poll_now() - start);
 		}
+		stats.ioreq_wakeup++;
+
+		/*
+		 * Keep draining the ioreq buffer as long as the previous round
+		 * found requests, so the requests raised by other vCPUs while
+		 * emulating are handled without another wakeup. The completions
+		 * of a round are notified together. A request whose completion
+		 * is not notified stays in processing state, so stop draining
+		 * then to avoid handling it twice.
+		 */
+		do {
+			done = 0UL;
+			drain = true;
+			for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
+				io_req = &ioreq_buf[vcpu_id];
+				if ((atomic_load(&io_req->processed) == ACRN_IOREQ_STATE_PROCESSING)
+					&& !io_req->kernel_handled) {
+					if (handle_vmexit(ctx, io_req, vcpu_id) == 0)
+						done |= 1UL << vcpu_id;
+					else
+						drain = false;
+				}
+			}
+			if ((done != 0UL) && (notify_request_done(ctx, done) != 0))
+				drain = false;
+			stats.ioreq_drain_round++;
+		} while (drain && (done != 0UL) && (VM_SUSPEND_NONE == vm_get_suspend_mode()));
 
 		if (VM_SUSPEND_FULL_RESET == vm_get_suspend_mode() ||
 		    VM_SUSPEND_POWEROFF == vm_get_suspend_mode()) {
@@ -884,6 +974,7 @@ enum {
 	CMD_OPT_PM_BY_VUART,
 	CMD_OPT_WINDOWS,
 	CMD_OPT_FORCE_VIRTIO_MSI,
+	CMD_OPT_IOREQ_POLL,
 };
 
 static struct option long_options[] = {
@@ -927,6 +1018,7 @@ static struct option long_options[] = {
 	{"pm_by_vuart",	required_argument,	0, CMD_OPT_PM_BY_VUART},
 	{"windows",		no_argument,		0, CMD_OPT_WINDOWS},
 	{"virtio_msi",		no_argument,		0, CMD_OPT_FORCE_VIRTIO_MSI},
+	{"ioreq_poll",		required_argument,	0, CMD_OPT_IOREQ_POLL},
 	{0,			0,			0,  0  },
 };
 
@@ -941,14 +1033,43 @@ vm_init_asyncio(struct vmctx *ctx, uint64_t base)
 	sbuf->ele_size = sizeof(uint64_t);
 	sbuf->ele_num = (4096 - SBUF_HEAD_SIZE) / sbuf->ele_size;
 	sbuf->size = sbuf->ele_size * sbuf->ele_num;
-	/* set flag to 0 to make sure not overrun! */
-	sbuf->flags = 0;
+	/* never overwrite, overrun_cnt counts the requests that waited for room */
+	sbuf->flags = OVERRUN_CNT_EN;
 	sbuf->overrun_cnt = 0;
 	sbuf->head = 0;
 	sbuf->tail = 0;
 	return vm_setup_asyncio(ctx, base);
 }
 
+int
+vm_get_asyncio_stats(uint32_t *ele_num, uint32_t *fill, uint32_t *full_waits)
+{
+	struct shared_buf *sbuf = (struct shared_buf *)asyncio_page;
+	uint32_t head, tail;
+
+	if ((sbuf->magic != SBUF_MAGIC) || (sbuf->ele_size == 0))
+		return -1;
+
+	head = sbuf->head;
+	tail = sbuf->tail;
+	*ele_num = sbuf->ele_num;
+	*fill = ((tail >= head) ? (tail - head) : (sbuf->size - head + tail)) / sbuf->ele_size;
+	*full_waits = sbuf->overrun_cnt;
+	return 0;
+}
+
+int
+vm_get_ioreq_poll_stats(uint64_t *hit, uint64_t *miss, uint64_t *sleep)
+{
+	if (ioreq_poll.max_ns == 0U)
+		return -1;
+
+	*hit = ioreq_poll.hit;
+	*miss = ioreq_poll.miss;
+	*sleep = ioreq_poll.sleep;
+	return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -1138,6 +1259,10 @@ main(int argc, char *argv[])
 		case CMD_OPT_FORCE_VIRTIO_MSI:
 			virtio_msix = 0;
 			break;
+		case CMD_OPT_IOREQ_POLL:
+			if (iothread_parse_poll(optarg, &ioreq_poll.max_ns) != 0)
+				errx(EX_USAGE, "invalid ioreq poll params %s", optarg);
+			break;
 		case 'h':
 			usage(0);
 		default:
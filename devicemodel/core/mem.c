@@ -30,14 +30,22 @@
  * Memory ranges are represented with an RB tree. On insertion, the range
  * is checked for overlaps. On lookup, the key has the same base and limit
  * so it can be searched within the range.
+ *
+ * The MMIO requests do not walk the trees: each change of them publishes
+ * an immutable snapshot of the ranges, sorted by address, which the
+ * requests search without taking a lock. A replaced snapshot is freed once
+ * no request is reading it anymore.
  */
 
 #include <errno.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 
+#include "atomic.h"
+#include "log.h"
 #include "mem.h"
 #include "tree.h"
 
@@ -53,14 +61,47 @@ struct mmio_rb_range {
 static RB_HEAD(mmio_rb_tree, mmio_rb_range) mmio_rb_root, mmio_rb_fallback;
 RB_PROTOTYPE_STATIC(mmio_rb_tree, mmio_rb_range, mr_link, mmio_rb_range_compare);
 
+struct mmio_snap_range {
+	uint64_t		base;
+	uint64_t		end;
+	struct mem_range	param;
+};
+
 /*
- * Per-VM cache. Since most accesses from a vCPU will be to
+ * The ranges of mmio_rb_root, then the ones of mmio_rb_fallback, each
+ * sorted by address.
+ */
+struct mmio_snapshot {
+	uint64_t		gen;
+	int			nr_root;
+	int			nr_fallback;
+	struct mmio_snap_range	ranges[];
+};
+
+/*
+ * Per-vCPU cache. Since most accesses from a vCPU will be to
  * consecutive addresses in a range, it makes sense to cache the
- * result of a lookup.
+ * result of a lookup. It is only valid for the snapshot of generation
+ * gen, and it is only used by the thread handling the vCPU's requests.
+ *
+ * epoch is odd while that thread reads mmio_snap. Keeping it in the
+ * slot means a request only writes the vCPU's own cache line.
  */
-static struct mmio_rb_range	*mmio_hint __aligned(sizeof(struct mmio_rb_range *));
+struct mmio_hint {
+	uint64_t		epoch;
+	uint64_t		gen;
+	int			idx;
+	uint64_t		hit;
+	uint64_t		miss;
+} __attribute__((aligned(64)));
+
+static struct mmio_hint mmio_hints[ACRN_PLATFORM_LAPIC_IDS_MAX];
 
-static pthread_rwlock_t mmio_rwlock;
+static struct mmio_snapshot *mmio_snap;
+static uint64_t mmio_snap_gen;
+
+/* serializes the changes of the trees and the snapshot publishing */
+static pthread_mutex_t mmio_mtx = PTHREAD_MUTEX_INITIALIZER;
 
 static int
 mmio_rb_range_compare(struct mmio_rb_range *a, struct mmio_rb_range *b)
@@ -116,12 +157,12 @@ mmio_rb_dump(struct mmio_rb_tree *rbt)
 {
 	struct mmio_rb_range *np;
 
-	pthread_rwlock_rdlock(&mmio_rwlock);
+	pthread_mutex_lock(&mmio_mtx);
 	RB_FOREACH(np, mmio_rb_tree, rbt) {
 		pr_dbg(" %lx:%lx, %s\n", np->mr_base, np->mr_end,
 		       np->mr_param.name);
 	}
-	pthread_rwlock_unlock(&mmio_rwlock);
+	pthread_mutex_unlock(&mmio_mtx);
 }
 #endif
 
@@ -149,50 +190,178 @@ mem_write(void *ctx, int vcpu, uint64_t gpa, uint64_t wval, int size, void *arg)
 	return error;
 }
 
-int
-emulate_mem(struct vmctx *ctx, struct acrn_mmio_request *mmio_req)
+static int
+mmio_snap_fill(struct mmio_snap_range *range, struct mmio_rb_tree *rbt)
 {
-	uint64_t paddr = mmio_req->address;
-	int size = mmio_req->size;
-	struct mmio_rb_range *hint, *entry = NULL;
-	int err;
+	struct mmio_rb_range *np;
+	int n = 0;
+
+	RB_FOREACH(np, mmio_rb_tree, rbt) {
+		range[n].base = np->mr_base;
+		range[n].end = np->mr_end;
+		range[n].param = np->mr_param;
+		n++;
+	}
+	return n;
+}
 
-	pthread_rwlock_rdlock(&mmio_rwlock);
+/*
+ * Publish the snapshot of the current trees, the previous one is
+ * returned in @old for mmio_snap_free().
+ * Called with mmio_mtx held.
+ */
+static int
+mmio_snap_publish(struct mmio_snapshot **old)
+{
+	struct mmio_snapshot *snap;
+	struct mmio_rb_range *np;
+	int n = 0;
 
-	/*
-	 * First check the per-VM cache
-	 */
-	hint = mmio_hint;
+	RB_FOREACH(np, mmio_rb_tree, &mmio_rb_root)
+		n++;
+	RB_FOREACH(np, mmio_rb_tree, &mmio_rb_fallback)
+		n++;
 
-	if (hint && paddr >= hint->mr_base && paddr <= hint->mr_end)
-		entry = hint;
-	else if (mmio_rb_lookup(&mmio_rb_root, paddr, &entry) == 0)
-		/* Update the per-VM cache */
-		mmio_hint = entry;
-	else if (mmio_rb_lookup(&mmio_rb_fallback, paddr, &entry)) {
-		pthread_rwlock_unlock(&mmio_rwlock);
-		return -ESRCH;
+	snap = malloc(sizeof(*snap) + n * sizeof(struct mmio_snap_range));
+	if (snap == NULL)
+		return -1;
+	snap->gen = ++mmio_snap_gen;
+	snap->nr_root = mmio_snap_fill(snap->ranges, &mmio_rb_root);
+	snap->nr_fallback = mmio_snap_fill(snap->ranges + snap->nr_root, &mmio_rb_fallback);
+
+	*old = atomic_xchg(&mmio_snap, snap);
+
+	return 0;
+}
+
+/*
+ * Free a snapshot replaced by mmio_snap_publish() once no request can
+ * still read it. A vCPU that is reading a snapshot when this starts
+ * only has to leave that one lookup: it loads mmio_snap again on its
+ * next request and gets the new one. So each slot is waited for at
+ * most once, whatever the rate of requests.
+ * Called without mmio_mtx held.
+ */
+static void
+mmio_snap_free(struct mmio_snapshot *old)
+{
+	uint64_t epoch;
+	int i;
+
+	if (old == NULL)
+		return;
+
+	for (i = 0; i < ACRN_PLATFORM_LAPIC_IDS_MAX; i++) {
+		epoch = atomic_load(&mmio_hints[i].epoch);
+		if ((epoch & 1UL) == 0UL)
+			continue;
+		while (atomic_load(&mmio_hints[i].epoch) == epoch)
+			sched_yield();
 	}
+	free(old);
+}
 
-	pthread_rwlock_unlock(&mmio_rwlock);
+/*
+ * Find the range containing @addr in the @nr sorted ranges from @first.
+ * Return its index in the snapshot, or -1.
+ */
+static int
+mmio_snap_lookup(const struct mmio_snapshot *snap, int first, int nr, uint64_t addr)
+{
+	int lo = first, hi = first + nr - 1, mid;
+
+	while (lo <= hi) {
+		mid = lo + (hi - lo) / 2;
+		if (addr < snap->ranges[mid].base)
+			hi = mid - 1;
+		else if (addr > snap->ranges[mid].end)
+			lo = mid + 1;
+		else
+			return mid;
+	}
+	return -1;
+}
+
+int
+emulate_mem(struct vmctx *ctx, int vcpu, struct acrn_mmio_request *mmio_req)
+{
+	uint64_t paddr = mmio_req->address;
+	int size = mmio_req->size;
+	struct mmio_hint *hint;
+	struct mmio_snapshot *snap;
+	struct mem_range mr;
+	int idx = -1;
+	int err;
 
-	if (entry == NULL)
+	if ((vcpu < 0) || (vcpu >= ACRN_PLATFORM_LAPIC_IDS_MAX))
 		return -EINVAL;
+	hint = &mmio_hints[vcpu];
+
+	atomic_add_fetch(&hint->epoch, 1);
+	snap = atomic_load(&mmio_snap);
+	if (snap != NULL) {
+		/*
+		 * First check the per-vCPU cache
+		 */
+		if ((hint->gen == snap->gen)
+				&& (paddr >= snap->ranges[hint->idx].base)
+				&& (paddr <= snap->ranges[hint->idx].end)) {
+			idx = hint->idx;
+			hint->hit++;
+		} else {
+			idx = mmio_snap_lookup(snap, 0, snap->nr_root, paddr);
+			if (idx < 0)
+				idx = mmio_snap_lookup(snap, snap->nr_root, snap->nr_fallback, paddr);
+			hint->miss++;
+			/*
+			 * Update the per-vCPU cache, not with a fallback
+			 * range as it may contain the other ranges
+			 */
+			if ((idx >= 0) && (idx < snap->nr_root)) {
+				hint->gen = snap->gen;
+				hint->idx = idx;
+			}
+		}
+		/* the handler may change the ranges, so it must not use the snapshot */
+		if (idx >= 0)
+			mr = snap->ranges[idx].param;
+	}
+	atomic_add_fetch(&hint->epoch, 1);
+
+	if (idx < 0)
+		return -ESRCH;
 
 	if (mmio_req->direction == ACRN_IOREQ_DIR_READ)
 		err = mem_read(ctx, 0, paddr, (uint64_t *)&mmio_req->value,
-				size, &entry->mr_param);
+				size, &mr);
 	else
 		err = mem_write(ctx, 0, paddr, mmio_req->value,
-				size, &entry->mr_param);
+				size, &mr);
 
 	return err;
 }
 
+/*
+ * Get the hits and misses of the per-vCPU lookup caches of all vCPUs.
+ */
+void
+mem_get_hint_stats(uint64_t *hit, uint64_t *miss)
+{
+	int i;
+
+	*hit = 0;
+	*miss = 0;
+	for (i = 0; i < ACRN_PLATFORM_LAPIC_IDS_MAX; i++) {
+		*hit += mmio_hints[i].hit;
+		*miss += mmio_hints[i].miss;
+	}
+}
+
 static int
 register_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 {
 	struct mmio_rb_range *entry, *mrp;
+	struct mmio_snapshot *old = NULL;
 	int err;
 
 	err = -1;
@@ -203,10 +372,15 @@ register_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 		mrp->mr_param = *memp;
 		mrp->mr_base = memp->base;
 		mrp->mr_end = memp->base + memp->size - 1;
-		pthread_rwlock_wrlock(&mmio_rwlock);
+		pthread_mutex_lock(&mmio_mtx);
 		if (mmio_rb_lookup(rbt, memp->base, &entry) != 0)
 			err = mmio_rb_add(rbt, mrp);
-		pthread_rwlock_unlock(&mmio_rwlock);
+		if ((err == 0) && (mmio_snap_publish(&old) != 0)) {
+			RB_REMOVE(mmio_rb_tree, rbt, mrp);
+			err = -1;
+		}
+		pthread_mutex_unlock(&mmio_mtx);
+		mmio_snap_free(old);
 		if (err)
 			free(mrp);
 	}
@@ -231,9 +405,10 @@ unregister_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 {
 	struct mem_range *mr;
 	struct mmio_rb_range *entry = NULL;
+	struct mmio_snapshot *old = NULL;
 	int err;
 
-	pthread_rwlock_wrlock(&mmio_rwlock);
+	pthread_mutex_lock(&mmio_mtx);
 	err = mmio_rb_lookup(rbt, memp->base, &entry);
 	if (err == 0) {
 		mr = &entry->mr_param;
@@ -244,14 +419,17 @@ unregister_mem_int(struct mmio_rb_tree *rbt, struct mem_range *memp)
 		} else {
 			RB_REMOVE(mmio_rb_tree, rbt, entry);
 
-			/* flush Per-VM cache */
-			if (mmio_hint == entry)
-				mmio_hint = NULL;
-
-			free(entry);
+			/* the new snapshot also invalidates the per-vCPU caches */
+			if (mmio_snap_publish(&old) != 0) {
+				RB_INSERT(mmio_rb_tree, rbt, entry);
+				err = -1;
+			} else {
+				free(entry);
+			}
 		}
 	}
-	pthread_rwlock_unlock(&mmio_rwlock);
+	pthread_mutex_unlock(&mmio_mtx);
+	mmio_snap_free(old);
 
 	return err;
 }
@@ -271,7 +449,13 @@ unregister_mem_fallback(struct mem_range *memp)
 void
 init_mem(void)
 {
+	struct mmio_snapshot *old = NULL;
+
 	RB_INIT(&mmio_rb_root);
 	RB_INIT(&mmio_rb_fallback);
-	pthread_rwlock_init(&mmio_rwlock, NULL);
+	pthread_mutex_lock(&mmio_mtx);
+	if (mmio_snap_publish(&old) != 0)
+		pr_err("%s: could not publish the mmio ranges\n", __func__);
+	pthread_mutex_unlock(&mmio_mtx);
+	mmio_snap_free(old);
 }
@@ -10,6 +10,7 @@
  * Author: TaoYuhong <yuhong.tao@intel.com>
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -450,6 +451,54 @@ static void handle_blkrescan(struct mngr_msg *msg, int client_fd, void *param)
 	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
 }
 
+static void handle_vmexit_stats(struct mngr_msg *msg, int client_fd, void *param)
+{
+	/* too big for the stack, the monitor thread is the only user */
+	static struct acrn_vmexit_stats stats;
+	struct vmctx *ctx = param;
+	struct vmexit_stats_msg *m;
+	struct mngr_msg ack;
+	uint64_t count;
+	int reason, i;
+
+	memset(&ack, 0, sizeof(ack));
+	ack.magic = MNGR_MSG_MAGIC;
+	ack.msgid = msg->msgid;
+	ack.timestamp = msg->timestamp;
+	m = &ack.data.vmexit_stats;
+	m->vcpu_id = msg->data.vmexit_stats.vcpu_id;
+
+	memset(&stats, 0, sizeof(stats));
+	stats.vcpu_id = m->vcpu_id;
+	if (vm_get_vmexit_stats(ctx, &stats)) {
+		m->err = -errno;
+		mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+		return;
+	}
+
+	/* keep the most frequent reasons that fit in the ack, by decreasing count */
+	for (reason = 0; reason < ACRN_VMEXIT_REASON_NUM; reason++) {
+		count = stats.reasons[reason].count;
+		if (count == 0UL)
+			continue;
+		m->nr_seen++;
+		if ((m->nr == VMEXIT_STATS_MSG_REASONS) &&
+			(count <= m->stats[VMEXIT_STATS_MSG_REASONS - 1].count))
+			continue;
+		if (m->nr < VMEXIT_STATS_MSG_REASONS)
+			m->nr++;
+		for (i = m->nr - 1; (i > 0) && (m->stats[i - 1].count < count); i--) {
+			m->reason[i] = m->reason[i - 1];
+			m->stats[i] = m->stats[i - 1];
+		}
+		m->reason[i] = reason;
+		m->stats[i] = stats.reasons[reason];
+	}
+	m->err = 0;
+
+	mngr_send_msg(client_fd, &ack, NULL, ACK_TIMEOUT);
+}
+
 static struct monitor_vm_ops pmc_ops = {
 	.stop       = NULL,
 	.resume     = vm_monitor_resume,
@@ -490,6 +539,7 @@ int monitor_init(struct vmctx *ctx)
 	ret += mngr_add_handler(monitor_fd, DM_RESUME, handle_resume, NULL);
 	ret += mngr_add_handler(monitor_fd, DM_QUERY, handle_query, NULL);
 	ret += mngr_add_handler(monitor_fd, DM_BLKRESCAN, handle_blkrescan, NULL);
+	ret += mngr_add_handler(monitor_fd, DM_VMEXIT_STATS, handle_vmexit_stats, ctx);
 
 	if (ret) {
 		pr_err("%s %d\r\n", __func__, __LINE__);
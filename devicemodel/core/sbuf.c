@@ -21,25 +21,37 @@ static inline uint32_t sbuf_next_ptr(uint32_t pos_arg,
 	return pos;
 }
 
+/*
+ * In overwrite mode the producer moves the head too when it drops the
+ * oldest elements, the element is read again if it was dropped meanwhile.
+ */
 uint32_t sbuf_get(struct shared_buf *sbuf, uint8_t *data)
 {
 	const void *from;
+	uint32_t head, next_head;
 
 	if ((sbuf == NULL) || (data == NULL))
 		return -EINVAL;
 
-	if (sbuf_is_empty(sbuf)) {
-		/* no data available */
-		return 0;
-	}
+	do {
+		if (sbuf_is_empty(sbuf)) {
+			/* no data available */
+			return 0;
+		}
 
-	from = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->head;
+		head = sbuf->head;
+		from = (void *)sbuf + SBUF_HEAD_SIZE + head;
 
-	memcpy(data, from, sbuf->ele_size);
+		memcpy(data, from, sbuf->ele_size);
 
-	mb();
+		mb();
 
-	sbuf->head = sbuf_next_ptr(sbuf->head, sbuf->ele_size, sbuf->size);
+		next_head = sbuf_next_ptr(head, sbuf->ele_size, sbuf->size);
+		if ((sbuf->flags & OVERWRITE_EN) == 0U) {
+			sbuf->head = next_head;
+			break;
+		}
+	} while (!__sync_bool_compare_and_swap(&sbuf->head, head, next_head));
 
 	return sbuf->ele_size;
 }
@@ -281,6 +281,27 @@ vm_notify_request_done(struct vmctx *ctx, int vcpu)
 	return error;
 }
 
+int
+vm_notify_request_done_batch(struct vmctx *ctx, uint64_t vcpu_mask)
+{
+	int error;
+	struct acrn_ioreq_notify_batch notify;
+
+	bzero(&notify, sizeof(notify));
+	notify.vmid = ctx->vmid;
+	notify.vcpu_mask = vcpu_mask;
+
+	error = ioctl(ctx->fd, ACRN_IOCTL_NOTIFY_REQUEST_FINISH_BATCH, &notify);
+
+	/* ENOTTY: the HSM predates the batch notification, the caller falls back */
+	if (error && (errno != ENOTTY)) {
+		pr_err("ACRN_IOCTL_NOTIFY_REQUEST_FINISH_BATCH ioctl() returned an error: %s\n",
+			errormsg(errno));
+	}
+
+	return error;
+}
+
 void
 vm_destroy(struct vmctx *ctx)
 {
@@ -727,6 +748,17 @@ vm_intr_monitor(struct vmctx *ctx, void *intr_buf)
 	return error;
 }
 
+int
+vm_get_vmexit_stats(struct vmctx *ctx, struct acrn_vmexit_stats *stats)
+{
+	int error;
+	error = ioctl(ctx->fd, ACRN_IOCTL_VM_VMEXIT_STATS, stats);
+	if (error) {
+		pr_err("ACRN_IOCTL_VM_VMEXIT_STATS ioctl() returned an error: %s\n", errormsg(errno));
+	}
+	return error;
+}
+
 int
 vm_ioeventfd(struct vmctx *ctx, struct acrn_ioeventfd *args)
 {
@@ -0,0 +1,1006 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Read cache of read-only images
+ *
+ * The blockif contexts that open the same read-only image, e.g. a golden
+ * image of several User VMs or the backing image of COW overlays, share one
+ * cache of the chunks recently read from it. The cache is a POSIX shared
+ * memory object named after the device and inode of the image. It is private
+ * to the DM unless it is shared on request with the other DMs that open the
+ * image, as each User VM has its own DM. The disks opened with nocache bypass
+ * the Service VM's page cache, so they would otherwise read the same hot
+ * blocks again and again when the VMs boot together.
+ *
+ * The object holds a header, the hash table and the chunk slots, then the
+ * chunk data. The object is mapped at a different address in each DM, so
+ * the slots are linked by index. A chunk is read into a slot that the other
+ * users do not see yet, and published once the read completes: the cache
+ * lock is never held across I/O, and io_uring reads the missed chunks
+ * asynchronously. The chunks are evicted in LRU order once the cache is
+ * full, except the ones being copied out.
+ *
+ * The lock is a robust mutex. If a DM dies while holding it, the cache is
+ * marked broken, its users read the image directly and the next DM opening
+ * the image creates a new cache. The image shall not be modified while it
+ * is cached, a cache left for another size or modification time of the
+ * image is replaced.
+ *
+ * Every slot index read from the object is checked before it is used, so a
+ * DM sharing the cache can't make the others access out of their mapping.
+ * A bad index breaks the cache the same way. The DMs sharing a cache can
+ * still corrupt the data read by the others, or stall them on the lock.
+ */
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/queue.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "block_cache.h"
+#include "log.h"
+
+#define CACHE_CHUNK_SHIFT	16U
+#define CACHE_CHUNK_SIZE	(1UL << CACHE_CHUNK_SHIFT)
+/* the chunks are read with O_DIRECT if the image is opened with nocache */
+#define CACHE_CHUNK_ALIGN	4096U
+#define CACHE_NAME_LEN		64
+/* the most chunks read at once, 4MB */
+#define CACHE_FILL_MAX_CHUNKS	64
+
+#define CACHE_SHM_PREFIX	"/acrn-rcache"
+#define CACHE_MAGIC		0x52434143U	/* "CACR" */
+#define CACHE_VERSION		1U
+#define CACHE_NIL		(-1)
+
+#define WPRINTF(params) (pr_err params)
+
+enum cache_slot_state {
+	CACHE_SLOT_FREE,
+	CACHE_SLOT_FILLING,	/* owned by the DM reading the chunk */
+	CACHE_SLOT_CACHED,
+};
+
+struct cache_slot {
+	uint64_t	idx;	/* offset in the image >> CACHE_CHUNK_SHIFT */
+	uint32_t	len;	/* less than a chunk at the end of the image */
+	uint32_t	state;
+	uint32_t	pins;	/* users copying the chunk out */
+	int32_t		hnext;	/* next slot of the hash bucket */
+	int32_t		prev;	/* LRU list */
+	int32_t		next;	/* LRU or free list */
+};
+
+/*
+ * Header of the shared memory object, followed by the hash table, the slots
+ * and, from data_off, the chunk data.
+ */
+struct cache_shm {
+	uint32_t		magic;
+	uint32_t		version;
+	uint64_t		img_dev;
+	uint64_t		img_ino;
+	int64_t			img_size;
+	int64_t			img_mtime_sec;
+	int64_t			img_mtime_nsec;
+	uint64_t		map_size;
+	uint64_t		data_off;
+	uint32_t		nr_slots;
+	uint32_t		hash_bits;
+	/* DMs mapping the cache, updated with the object flock()ed */
+	uint32_t		users;
+	uint32_t		broken;
+
+	/* protects the slots and the statistics */
+	pthread_mutex_t		mtx;
+	int32_t			lru_head;	/* the most recently used */
+	int32_t			lru_tail;
+	int32_t			free_head;
+	struct block_cache_stats stats;
+};
+
+struct block_cache {
+	dev_t			dev;
+	ino_t			ino;
+	bool			shared;
+	char			name[CACHE_NAME_LEN];
+	char			shm_name[CACHE_NAME_LEN];
+	int			refcnt;
+
+	/* the layout of the object, not read from it once it is checked */
+	int			shm_fd;
+	size_t			map_size;
+	uint32_t		nr_slots;
+	uint32_t		hash_bits;
+	bool			broken;
+	struct cache_shm	*shm;
+	int32_t			*hash;
+	struct cache_slot	*slots;
+	char			*data;
+
+	LIST_ENTRY(block_cache)	link;
+};
+
+/*
+ * Chunks being read into the cache for a read of @len bytes at @offset
+ */
+struct block_cache_fill {
+	off_t		offset;
+	size_t		len;
+	uint64_t	first;		/* index of the first chunk */
+	int		nr;
+	int32_t		slot[CACHE_FILL_MAX_CHUNKS];
+	struct iovec	iov[CACHE_FILL_MAX_CHUNKS];
+};
+
+static LIST_HEAD(, block_cache) block_caches = LIST_HEAD_INITIALIZER(block_caches);
+static pthread_mutex_t block_caches_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Read a slot index from the object once, the other DMs can write it.
+ */
+static inline int32_t
+cache_index(const int32_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline bool
+cache_index_ok(struct block_cache *cache, int32_t s)
+{
+	return (s >= 0) && ((uint32_t)s < cache->nr_slots);
+}
+
+/*
+ * Stop using the cache, its slots are not consistent.
+ */
+static void
+cache_corrupt(struct block_cache *cache)
+{
+	if (!cache->broken)
+		WPRINTF(("the read cache of %s is corrupted, stop caching\n", cache->name));
+	cache->broken = true;
+	cache->shm->broken = 1;
+}
+
+/*
+ * Lock the cache shared with the other DMs.
+ * Return false if the cache is broken, it is not locked then.
+ */
+static bool
+cache_lock(struct block_cache *cache)
+{
+	struct cache_shm *shm = cache->shm;
+	int err;
+
+	if (cache->broken)
+		return false;
+
+	err = pthread_mutex_lock(&shm->mtx);
+	if (err == EOWNERDEAD) {
+		/* the slots may be left half updated */
+		WPRINTF(("a DM died holding the read cache of %s, stop caching\n", cache->name));
+		shm->broken = 1;
+		pthread_mutex_consistent(&shm->mtx);
+	} else if (err) {
+		cache->broken = true;
+		shm->broken = 1;
+		return false;
+	}
+
+	if (shm->broken) {
+		cache->broken = true;
+		pthread_mutex_unlock(&shm->mtx);
+		return false;
+	}
+	return true;
+}
+
+static inline void
+cache_unlock(struct block_cache *cache)
+{
+	pthread_mutex_unlock(&cache->shm->mtx);
+}
+
+static inline int32_t *
+cache_bucket(struct block_cache *cache, uint64_t idx)
+{
+	return &cache->hash[(idx * 0x9E3779B97F4A7C15UL) >> (64U - cache->hash_bits)];
+}
+
+/*
+ * Return the slot of the chunk @idx, or CACHE_NIL if it is not cached or
+ * the cache is found corrupted.
+ */
+static int32_t
+cache_lookup(struct block_cache *cache, uint64_t idx)
+{
+	uint32_t n;
+	int32_t s;
+
+	s = cache_index(cache_bucket(cache, idx));
+	for (n = 0; (s != CACHE_NIL) && (n < cache->nr_slots); n++) {
+		if (!cache_index_ok(cache, s))
+			break;
+		if (cache->slots[s].idx == idx)
+			return s;
+		s = cache_index(&cache->slots[s].hnext);
+	}
+
+	if (s != CACHE_NIL)
+		cache_corrupt(cache);
+	return CACHE_NIL;
+}
+
+static bool
+cache_hash_del(struct block_cache *cache, int32_t s)
+{
+	int32_t *p = cache_bucket(cache, cache->slots[s].idx);
+	uint32_t n;
+	int32_t cur;
+
+	for (n = 0; n < cache->nr_slots; n++) {
+		cur = cache_index(p);
+		if (cur == s) {
+			*p = cache->slots[s].hnext;
+			return true;
+		}
+		if (!cache_index_ok(cache, cur))
+			break;
+		p = &cache->slots[cur].hnext;
+	}
+
+	cache_corrupt(cache);
+	return false;
+}
+
+static bool
+cache_lru_del(struct block_cache *cache, int32_t s)
+{
+	struct cache_slot *slot = &cache->slots[s];
+	struct cache_shm *shm = cache->shm;
+	int32_t prev = cache_index(&slot->prev), next = cache_index(&slot->next);
+
+	if (((prev != CACHE_NIL) && !cache_index_ok(cache, prev)) ||
+			((next != CACHE_NIL) && !cache_index_ok(cache, next))) {
+		cache_corrupt(cache);
+		return false;
+	}
+
+	if (prev != CACHE_NIL)
+		cache->slots[prev].next = next;
+	else
+		shm->lru_head = next;
+	if (next != CACHE_NIL)
+		cache->slots[next].prev = prev;
+	else
+		shm->lru_tail = prev;
+	return true;
+}
+
+static bool
+cache_lru_add(struct block_cache *cache, int32_t s)
+{
+	struct cache_slot *slot = &cache->slots[s];
+	struct cache_shm *shm = cache->shm;
+	int32_t head = cache_index(&shm->lru_head);
+
+	if ((head != CACHE_NIL) && !cache_index_ok(cache, head)) {
+		cache_corrupt(cache);
+		return false;
+	}
+
+	slot->prev = CACHE_NIL;
+	slot->next = head;
+	if (head != CACHE_NIL)
+		cache->slots[head].prev = s;
+	else
+		shm->lru_tail = s;
+	shm->lru_head = s;
+	return true;
+}
+
+/*
+ * Take a slot to read a chunk into: a free one, or the least recently used
+ * one that is not being copied out.
+ */
+static int32_t
+cache_alloc_slot(struct block_cache *cache)
+{
+	struct cache_shm *shm = cache->shm;
+	uint32_t n;
+	int32_t s;
+
+	s = cache_index(&shm->free_head);
+	if (s != CACHE_NIL) {
+		if (!cache_index_ok(cache, s)) {
+			cache_corrupt(cache);
+			return CACHE_NIL;
+		}
+		shm->free_head = cache->slots[s].next;
+	} else {
+		s = cache_index(&shm->lru_tail);
+		for (n = 0; (s != CACHE_NIL) && (n < cache->nr_slots); n++) {
+			if (!cache_index_ok(cache, s)) {
+				cache_corrupt(cache);
+				return CACHE_NIL;
+			}
+			if (cache->slots[s].pins == 0)
+				break;
+			s = cache_index(&cache->slots[s].prev);
+		}
+		if ((s == CACHE_NIL) || (n == cache->nr_slots))
+			return CACHE_NIL;
+		if (!cache_hash_del(cache, s) || !cache_lru_del(cache, s))
+			return CACHE_NIL;
+		shm->stats.used -= cache->slots[s].len;
+		shm->stats.evictions++;
+	}
+
+	cache->slots[s].state = CACHE_SLOT_FILLING;
+	return s;
+}
+
+static void
+cache_free_slot(struct block_cache *cache, int32_t s)
+{
+	cache->slots[s].state = CACHE_SLOT_FREE;
+	cache->slots[s].next = cache->shm->free_head;
+	cache->shm->free_head = s;
+}
+
+static inline char *
+cache_slot_data(struct block_cache *cache, int32_t s)
+{
+	return cache->data + ((size_t)s << CACHE_CHUNK_SHIFT);
+}
+
+/*
+ * Copy @len bytes of @src to the buffers of @iov, from the byte @skip of them.
+ */
+static void
+cache_copy_to_iov(const struct iovec *iov, int iovcnt, size_t skip, const char *src, size_t len)
+{
+	size_t n;
+	int i;
+
+	for (i = 0; (i < iovcnt) && (len > 0); i++) {
+		if (skip >= iov[i].iov_len) {
+			skip -= iov[i].iov_len;
+			continue;
+		}
+		n = MIN(iov[i].iov_len - skip, len);
+		memcpy((char *)iov[i].iov_base + skip, src, n);
+		src += n;
+		len -= n;
+		skip = 0;
+	}
+}
+
+/*
+ * Read @len bytes of @fd at @offset directly into the buffers of @iov, from
+ * the byte @skip of them.
+ * Return the number of bytes read, or -1 with errno set.
+ */
+static ssize_t
+cache_read_direct(int fd, const struct iovec *iov, int iovcnt, size_t skip, off_t offset, size_t len)
+{
+	size_t done = 0, n;
+	ssize_t r;
+	int i;
+
+	for (i = 0; (i < iovcnt) && (done < len); i++) {
+		if (skip >= iov[i].iov_len) {
+			skip -= iov[i].iov_len;
+			continue;
+		}
+		n = MIN(iov[i].iov_len - skip, len - done);
+		while (n > 0) {
+			r = pread(fd, (char *)iov[i].iov_base + skip, n, offset + done);
+			if (r < 0) {
+				if (errno == EINTR)
+					continue;
+				return -1;
+			}
+			if (r == 0)
+				return done;
+			done += r;
+			skip += r;
+			n -= r;
+		}
+		skip = 0;
+	}
+	return done;
+}
+
+/*
+ * Return true if all the chunks of @len bytes at @offset are cached.
+ */
+bool
+block_cache_cached(struct block_cache *cache, off_t offset, size_t len)
+{
+	uint64_t idx, last;
+	bool cached = true;
+
+	if (len == 0)
+		return true;
+
+	if (!cache_lock(cache))
+		return false;
+	last = (uint64_t)(offset + len - 1) >> CACHE_CHUNK_SHIFT;
+	for (idx = (uint64_t)offset >> CACHE_CHUNK_SHIFT; idx <= last; idx++) {
+		if (cache_lookup(cache, idx) == CACHE_NIL) {
+			cached = false;
+			break;
+		}
+	}
+	cache_unlock(cache);
+
+	return cached;
+}
+
+/*
+ * Start to read the chunks of @len bytes at @offset into the cache. The
+ * caller reads the image at *@foffset into the *@iovcnt buffers of *@iov,
+ * which the other users of the cache do not see, then calls
+ * block_cache_fill_end().
+ * Return NULL if the chunks can't be cached, the caller reads around the
+ * cache then.
+ */
+struct block_cache_fill *
+block_cache_fill_start(struct block_cache *cache, off_t offset, size_t len,
+		struct iovec **iov, int *iovcnt, off_t *foffset)
+{
+	struct block_cache_fill *fill;
+	uint64_t first, last;
+	int i, nr;
+	int32_t s;
+
+	if (len == 0)
+		return NULL;
+	first = (uint64_t)offset >> CACHE_CHUNK_SHIFT;
+	last = (uint64_t)(offset + len - 1) >> CACHE_CHUNK_SHIFT;
+	nr = last - first + 1;
+	if (nr > CACHE_FILL_MAX_CHUNKS)
+		return NULL;
+
+	fill = malloc(sizeof(*fill));
+	if (fill == NULL)
+		return NULL;
+
+	if (!cache_lock(cache)) {
+		free(fill);
+		return NULL;
+	}
+	for (i = 0; i < nr; i++) {
+		s = cache_alloc_slot(cache);
+		if (s == CACHE_NIL)
+			break;
+		fill->slot[i] = s;
+	}
+	if (i < nr) {
+		/* all the slots are being read or copied out */
+		while (i-- > 0)
+			cache_free_slot(cache, fill->slot[i]);
+		cache->shm->stats.uncached += nr;
+		cache_unlock(cache);
+		free(fill);
+		return NULL;
+	}
+	cache->shm->stats.misses += nr;
+	cache_unlock(cache);
+
+	for (i = 0; i < nr; i++) {
+		fill->iov[i].iov_base = cache_slot_data(cache, fill->slot[i]);
+		fill->iov[i].iov_len = CACHE_CHUNK_SIZE;
+	}
+	fill->offset = offset;
+	fill->len = len;
+	fill->first = first;
+	fill->nr = nr;
+
+	*iov = fill->iov;
+	*iovcnt = nr;
+	*foffset = first << CACHE_CHUNK_SHIFT;
+	return fill;
+}
+
+/*
+ * Complete @fill once @res bytes, or a negative errno, were read into its
+ * buffers. The bytes requested are copied to the buffers of @iov, from the
+ * byte @skip of them, and the chunks read are published to the cache. A
+ * chunk another user cached meanwhile is kept instead.
+ * Return the number of bytes copied, or -1 with errno set.
+ */
+ssize_t
+block_cache_fill_end(struct block_cache *cache, struct block_cache_fill *fill, ssize_t res,
+		const struct iovec *iov, int iovcnt, size_t skip)
+{
+	struct cache_shm *shm = cache->shm;
+	struct cache_slot *slot;
+	size_t pos, end, n, len;
+	ssize_t done = 0;
+	bool eof;
+	int i;
+
+	if (res >= 0) {
+		pos = fill->offset - (fill->first << CACHE_CHUNK_SHIFT);
+		end = MIN(pos + fill->len, (size_t)res);
+		while (pos < end) {
+			n = MIN(CACHE_CHUNK_SIZE - (pos & (CACHE_CHUNK_SIZE - 1)), end - pos);
+			cache_copy_to_iov(iov, iovcnt, skip + done,
+				(char *)fill->iov[pos >> CACHE_CHUNK_SHIFT].iov_base +
+				(pos & (CACHE_CHUNK_SIZE - 1)), n);
+			done += n;
+			pos += n;
+		}
+	}
+
+	/* the slots of a broken cache are not reused */
+	if (!cache_lock(cache)) {
+		free(fill);
+		goto out;
+	}
+
+	/* a short read only ends a chunk at the end of the image */
+	eof = (res >= 0) &&
+		((int64_t)((fill->first << CACHE_CHUNK_SHIFT) + res) >= shm->img_size);
+	for (i = 0; i < fill->nr; i++) {
+		len = 0;
+		if ((res >= 0) && ((size_t)res > ((size_t)i << CACHE_CHUNK_SHIFT)))
+			len = MIN((size_t)res - ((size_t)i << CACHE_CHUNK_SHIFT), CACHE_CHUNK_SIZE);
+		if ((len == 0) || ((len < CACHE_CHUNK_SIZE) && !eof) ||
+				(cache_lookup(cache, fill->first + i) != CACHE_NIL)) {
+			cache_free_slot(cache, fill->slot[i]);
+			continue;
+		}
+		if (cache->broken)
+			break;
+
+		slot = &cache->slots[fill->slot[i]];
+		slot->idx = fill->first + i;
+		slot->len = len;
+		slot->state = CACHE_SLOT_CACHED;
+		slot->pins = 0;
+		if (!cache_lru_add(cache, fill->slot[i]))
+			break;
+		slot->hnext = *cache_bucket(cache, slot->idx);
+		*cache_bucket(cache, slot->idx) = fill->slot[i];
+		shm->stats.used += len;
+	}
+	cache_unlock(cache);
+	free(fill);
+
+out:
+	if (res < 0) {
+		errno = -res;
+		return -1;
+	}
+	return done;
+}
+
+/*
+ * Read the chunk @idx into the buffers of @iov from the cache, from the byte
+ * @skip of them, and up to @len bytes from the byte @in of the chunk.
+ * Return the number of bytes copied, or -1 if the chunk is not cached.
+ */
+static ssize_t
+cache_read_hit(struct block_cache *cache, uint64_t idx, size_t in, size_t len,
+		const struct iovec *iov, int iovcnt, size_t skip)
+{
+	struct cache_shm *shm = cache->shm;
+	struct cache_slot *slot;
+	uint32_t slen;
+	int32_t s;
+	size_t n;
+
+	if (!cache_lock(cache))
+		return -1;
+	s = cache_lookup(cache, idx);
+	if (s == CACHE_NIL) {
+		cache_unlock(cache);
+		return -1;
+	}
+	slot = &cache->slots[s];
+	/* read the length once, the other DMs can write it */
+	slen = __atomic_load_n(&slot->len, __ATOMIC_RELAXED);
+	if ((slen > CACHE_CHUNK_SIZE) || !cache_lru_del(cache, s) || !cache_lru_add(cache, s)) {
+		cache_corrupt(cache);
+		cache_unlock(cache);
+		return -1;
+	}
+	shm->stats.hits++;
+	slot->pins++;
+	cache_unlock(cache);
+
+	/* a pinned chunk is not evicted, copy it out unlocked */
+	n = (slen > in) ? MIN(slen - in, len) : 0;
+	cache_copy_to_iov(iov, iovcnt, skip, cache_slot_data(cache, s) + in, n);
+
+	if (cache_lock(cache)) {
+		slot->pins--;
+		cache_unlock(cache);
+	}
+	return n;
+}
+
+/*
+ * Read the image @fd at @offset through @cache, like preadv.
+ */
+ssize_t
+block_cache_read(struct block_cache *cache, int fd, const struct iovec *iov, int iovcnt, off_t offset)
+{
+	struct block_cache_fill *fill;
+	struct iovec *fiov;
+	size_t total = 0, done = 0, in, len, got;
+	off_t foffset;
+	int i, fiovcnt;
+	uint64_t idx;
+	ssize_t n;
+
+	for (i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	while (done < total) {
+		idx = (uint64_t)(offset + done) >> CACHE_CHUNK_SHIFT;
+		in = (offset + done) & (CACHE_CHUNK_SIZE - 1);
+		len = MIN(CACHE_CHUNK_SIZE - in, total - done);
+
+		n = cache_read_hit(cache, idx, in, len, iov, iovcnt, done);
+		if (n < 0) {
+			fill = block_cache_fill_start(cache, offset + done, len, &fiov, &fiovcnt, &foffset);
+			if (fill != NULL) {
+				/* one chunk */
+				got = 0;
+				n = 0;
+				while (got < CACHE_CHUNK_SIZE) {
+					n = pread(fd, (char *)fiov[0].iov_base + got,
+						CACHE_CHUNK_SIZE - got, foffset + got);
+					if ((n < 0) && (errno == EINTR))
+						continue;
+					if (n <= 0)
+						break;
+					got += n;
+				}
+				n = block_cache_fill_end(cache, fill, (n < 0) ? -errno : (ssize_t)got,
+					iov, iovcnt, done);
+			} else {
+				/* no slot to read the chunk into, read it around the cache */
+				n = cache_read_direct(fd, iov, iovcnt, done, offset + done, len);
+			}
+			if (n < 0)
+				return -1;
+		}
+
+		/* end of the image */
+		if (n == 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+static inline size_t
+cache_data_off(uint32_t nr_slots, uint32_t hash_bits)
+{
+	return roundup(sizeof(struct cache_shm) + (sizeof(int32_t) << hash_bits) +
+			nr_slots * sizeof(struct cache_slot), CACHE_CHUNK_ALIGN);
+}
+
+static inline size_t
+cache_map_size(uint32_t nr_slots, uint32_t hash_bits)
+{
+	return cache_data_off(nr_slots, hash_bits) + ((size_t)nr_slots << CACHE_CHUNK_SHIFT);
+}
+
+static void
+cache_set_map(struct block_cache *cache, void *map)
+{
+	cache->shm = map;
+	cache->hash = (int32_t *)(cache->shm + 1);
+	cache->slots = (struct cache_slot *)(cache->hash + (1UL << cache->hash_bits));
+	cache->data = (char *)map + cache_data_off(cache->nr_slots, cache->hash_bits);
+}
+
+/*
+ * Create the cache of @size bytes of the image @img in the empty object @fd.
+ */
+static int
+cache_shm_create(struct block_cache *cache, int fd, const struct stat *img, size_t size)
+{
+	pthread_mutexattr_t attr;
+	struct cache_shm *shm;
+	uint32_t nr_slots, hash_bits, i;
+	size_t data_off, map_size;
+	void *map;
+	int err;
+
+	nr_slots = MAX(size >> CACHE_CHUNK_SHIFT, 1UL);
+	hash_bits = 1U;
+	while ((1UL << hash_bits) < nr_slots)
+		hash_bits++;
+	data_off = cache_data_off(nr_slots, hash_bits);
+	map_size = cache_map_size(nr_slots, hash_bits);
+
+	/* reserve the memory now, writing to a hole of a full tmpfs raises SIGBUS */
+	err = posix_fallocate(fd, 0, map_size);
+	if (err) {
+		WPRINTF(("could not allocate %lu bytes for the read cache: %d\n", map_size, err));
+		(void)ftruncate(fd, 0);
+		return -1;
+	}
+
+	map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		(void)ftruncate(fd, 0);
+		return -1;
+	}
+
+	shm = map;
+	shm->version = CACHE_VERSION;
+	shm->img_dev = img->st_dev;
+	shm->img_ino = img->st_ino;
+	shm->img_size = img->st_size;
+	shm->img_mtime_sec = img->st_mtim.tv_sec;
+	shm->img_mtime_nsec = img->st_mtim.tv_nsec;
+	shm->map_size = map_size;
+	shm->data_off = data_off;
+	shm->nr_slots = nr_slots;
+	shm->hash_bits = hash_bits;
+	cache->nr_slots = nr_slots;
+	cache->hash_bits = hash_bits;
+	cache->map_size = map_size;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&shm->mtx, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	cache_set_map(cache, map);
+	memset(cache->hash, 0xff, sizeof(int32_t) << hash_bits);
+	for (i = 0; i < nr_slots; i++) {
+		cache->slots[i].state = CACHE_SLOT_FREE;
+		cache->slots[i].next = (i + 1 < nr_slots) ? (int32_t)(i + 1) : CACHE_NIL;
+	}
+	shm->free_head = 0;
+	shm->lru_head = CACHE_NIL;
+	shm->lru_tail = CACHE_NIL;
+	shm->stats.size = (uint64_t)nr_slots << CACHE_CHUNK_SHIFT;
+
+	/* the object is flock()ed, the other DMs check the magic after this */
+	shm->magic = CACHE_MAGIC;
+	return 0;
+}
+
+/*
+ * Map the cache of the image @img that another DM created in the object @fd
+ * of @size bytes.
+ * Return -EAGAIN if the cache can't be used, the object is replaced then.
+ */
+static int
+cache_shm_attach(struct block_cache *cache, int fd, const struct stat *img, size_t size)
+{
+	struct cache_shm *shm;
+	void *map;
+
+	if (size < sizeof(struct cache_shm))
+		return -EAGAIN;
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return -1;
+
+	shm = map;
+	cache->nr_slots = shm->nr_slots;
+	cache->hash_bits = shm->hash_bits;
+	cache->map_size = size;
+	/* the layout is used from the local copy, checked against the mapped size */
+	if ((cache->nr_slots == 0) || (cache->nr_slots > INT32_MAX) ||
+			(cache->hash_bits == 0) || (cache->hash_bits > 31U) ||
+			(cache_map_size(cache->nr_slots, cache->hash_bits) != size) ||
+			(shm->magic != CACHE_MAGIC) || (shm->version != CACHE_VERSION) ||
+			(shm->map_size != size) || shm->broken ||
+			(shm->img_dev != img->st_dev) || (shm->img_ino != img->st_ino) ||
+			(shm->img_size != img->st_size) ||
+			(shm->img_mtime_sec != img->st_mtim.tv_sec) ||
+			(shm->img_mtime_nsec != img->st_mtim.tv_nsec)) {
+		munmap(map, size);
+		return -EAGAIN;
+	}
+
+	cache_set_map(cache, map);
+	return 0;
+}
+
+/*
+ * Map the cache of the image @img, creating it with @size bytes if this DM
+ * is its first user.
+ */
+static int
+cache_shm_open(struct block_cache *cache, const struct stat *img, size_t size)
+{
+	struct stat st;
+	int fd, ret, tries;
+
+	if (cache->shared)
+		snprintf(cache->shm_name, sizeof(cache->shm_name), "%s-%lx-%lx", CACHE_SHM_PREFIX,
+			(unsigned long)img->st_dev, (unsigned long)img->st_ino);
+	else
+		snprintf(cache->shm_name, sizeof(cache->shm_name), "%s-%lx-%lx-%d", CACHE_SHM_PREFIX,
+			(unsigned long)img->st_dev, (unsigned long)img->st_ino, getpid());
+
+	for (tries = 0; tries < 2; tries++) {
+		fd = shm_open(cache->shm_name, O_RDWR | O_CREAT, 0600);
+		if (fd < 0)
+			return -1;
+
+		/* serializes the creation and the users count with the other DMs */
+		if (flock(fd, LOCK_EX) < 0) {
+			close(fd);
+			return -1;
+		}
+
+		if (fstat(fd, &st) < 0)
+			ret = -1;
+		else if (st.st_size == 0)
+			ret = cache_shm_create(cache, fd, img, size);
+		else
+			ret = cache_shm_attach(cache, fd, img, st.st_size);
+
+		if (ret == 0) {
+			cache->shm->users++;
+			flock(fd, LOCK_UN);
+			cache->shm_fd = fd;
+			return 0;
+		}
+
+		/* left by a DM that crashed, or for another version of the image */
+		if (ret == -EAGAIN)
+			shm_unlink(cache->shm_name);
+		flock(fd, LOCK_UN);
+		close(fd);
+		if (ret != -EAGAIN)
+			break;
+	}
+	return -1;
+}
+
+static void
+cache_shm_close(struct block_cache *cache)
+{
+	struct stat cur, st;
+	int fd;
+
+	flock(cache->shm_fd, LOCK_EX);
+	if (--cache->shm->users == 0) {
+		/* unless the object was replaced already */
+		fd = shm_open(cache->shm_name, O_RDONLY, 0);
+		if (fd >= 0) {
+			if ((fstat(fd, &cur) == 0) && (fstat(cache->shm_fd, &st) == 0) &&
+					(cur.st_ino == st.st_ino))
+				shm_unlink(cache->shm_name);
+			close(fd);
+		}
+	}
+	flock(cache->shm_fd, LOCK_UN);
+
+	munmap(cache->shm, cache->map_size);
+	close(cache->shm_fd);
+}
+
+/*
+ * Get the cache of the image @fd, shared by all the users of the image in
+ * this DM and, if @shared, in the other DMs that share it too. The cache is
+ * created with @size bytes by its first user.
+ */
+struct block_cache *
+block_cache_get(int fd, size_t size, bool shared)
+{
+	struct block_cache *cache;
+	struct stat sbuf;
+	char link[32], path[PATH_MAX];
+	const char *base;
+	ssize_t n;
+
+	if (fstat(fd, &sbuf) < 0)
+		return NULL;
+
+	snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+	n = readlink(link, path, sizeof(path) - 1);
+	path[(n > 0) ? n : 0] = '\0';
+
+	pthread_mutex_lock(&block_caches_mtx);
+	LIST_FOREACH(cache, &block_caches, link) {
+		if ((cache->dev == sbuf.st_dev) && (cache->ino == sbuf.st_ino) &&
+				(cache->shared == shared)) {
+			cache->refcnt++;
+			goto out;
+		}
+	}
+
+	cache = calloc(1, sizeof(*cache));
+	if (cache == NULL)
+		goto out;
+
+	base = strrchr(path, '/');
+	snprintf(cache->name, sizeof(cache->name), "%s", (base != NULL) ? base + 1 : path);
+	cache->shared = shared;
+	if (cache_shm_open(cache, &sbuf, size) < 0) {
+		free(cache);
+		cache = NULL;
+		goto out;
+	}
+	if (shared && (size != cache->shm->stats.size))
+		pr_info("%s: shares the %lu bytes read cache of %s\n",
+			path, cache->shm->stats.size, cache->name);
+
+	cache->dev = sbuf.st_dev;
+	cache->ino = sbuf.st_ino;
+	cache->refcnt = 1;
+	LIST_INSERT_HEAD(&block_caches, cache, link);
+out:
+	pthread_mutex_unlock(&block_caches_mtx);
+	if (cache == NULL)
+		WPRINTF(("could not create the read cache of %s\n", path));
+	return cache;
+}
+
+void
+block_cache_put(struct block_cache *cache)
+{
+	pthread_mutex_lock(&block_caches_mtx);
+	if (--cache->refcnt > 0) {
+		pthread_mutex_unlock(&block_caches_mtx);
+		return;
+	}
+	LIST_REMOVE(cache, link);
+	pthread_mutex_unlock(&block_caches_mtx);
+
+	cache_shm_close(cache);
+	free(cache);
+}
+
+/*
+ * Get the statistics of the @idx-th image cache of this DM, named as
+ * rcache-<image>. They count the reads of all the DMs sharing the cache.
+ * The counters of a broken cache are read unlocked.
+ */
+int
+block_cache_get_stats(int idx, char *name, size_t len, struct block_cache_stats *stats)
+{
+	struct block_cache *cache;
+	int ret = -1;
+
+	pthread_mutex_lock(&block_caches_mtx);
+	LIST_FOREACH(cache, &block_caches, link) {
+		if (idx-- == 0) {
+			snprintf(name, len, "rcache-%s", cache->name);
+			if (cache_lock(cache)) {
+				*stats = cache->shm->stats;
+				cache_unlock(cache);
+			} else {
+				*stats = cache->shm->stats;
+			}
+			ret = 0;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&block_caches_mtx);
+
+	return ret;
+}
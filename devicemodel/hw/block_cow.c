@@ -0,0 +1,514 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+/*
+ * Copy-on-write overlay images
+ *
+ * An overlay stores the clusters written by the guest, all the other
+ * clusters are read from a read-only raw backing image. Many VMs can
+ * then be cloned from one image without copying it, and they share the
+ * page cache of its unmodified clusters.
+ *
+ * Layout of the overlay file, little endian:
+ *   cluster 0:		struct cow_header
+ *   cluster 1 - n:	L1 table, the offsets of the L2 tables
+ *   following:		L2 tables and data clusters, in allocation order
+ *
+ * An L2 table fills one cluster, its entries are the offsets of the data
+ * clusters. An offset of 0 means not allocated: an L2 table that is not
+ * allocated maps no data cluster, a data cluster that is not allocated
+ * is read from the backing image, or as zeroes beyond its end.
+ */
+
+#include <sys/param.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "block_cow.h"
+#include "log.h"
+
+#define COW_MAGIC		0x574f4341U	/* "ACOW" */
+#define COW_VERSION		1U
+#define COW_CLUSTER_BITS	16U		/* 64KB clusters */
+#define COW_MIN_CLUSTER_BITS	12U
+#define COW_MAX_CLUSTER_BITS	21U
+/* unit of the metadata reads and writes, it keeps them aligned for O_DIRECT */
+#define COW_BLOCK_SIZE		4096U
+#define COW_BACKING_MAX		1024U
+/* number of L2 tables cached in memory, one maps 512MB with 64KB clusters */
+#define COW_L2_CACHE_SIZE	32
+
+#define WPRINTF(params) (pr_err params)
+
+struct cow_header {
+	uint32_t	magic;
+	uint32_t	version;
+	uint64_t	size;		/* virtual disk size in bytes */
+	uint32_t	cluster_bits;
+	uint32_t	l1_entries;
+	uint64_t	l1_offset;
+	char		backing[COW_BACKING_MAX];	/* absolute path of the backing image */
+} __attribute__((packed));
+
+struct cow_l2 {
+	uint64_t	l1_idx;		/* UINT64_MAX if the slot holds no table */
+	uint64_t	*table;
+	uint64_t	last_use;
+};
+
+struct cow_image {
+	int		fd;
+	int		backing_fd;
+	off_t		size;
+	off_t		backing_size;
+	uint32_t	cluster_bits;
+	uint64_t	cluster_size;
+	uint32_t	l2_bits;
+	uint32_t	l1_entries;
+	uint64_t	l1_offset;
+	uint64_t	*l1;
+	off_t		next_free;	/* end of the allocated clusters */
+	void		*copy_buf;	/* one cluster, for copy on write */
+
+	/* protects the tables, the cache and the allocation */
+	pthread_mutex_t	mtx;
+	uint64_t	use_tick;
+	struct cow_l2	l2_cache[COW_L2_CACHE_SIZE];
+};
+
+static int
+cow_pread(int fd, void *buf, size_t len, off_t offset)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pread(fd, buf, len, offset);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (n == 0) {
+			/* beyond the end of file reads as zeroes */
+			memset(buf, 0, len);
+			break;
+		}
+		buf = (char *)buf + n;
+		len -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+static int
+cow_pwrite(int fd, const void *buf, size_t len, off_t offset)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(fd, buf, len, offset);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		if (n == 0)
+			return EIO;
+		buf = (const char *)buf + n;
+		len -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+static off_t
+cow_file_size(int fd)
+{
+	struct stat sbuf;
+	uint64_t size;
+
+	if (fstat(fd, &sbuf) < 0)
+		return -1;
+
+	if (S_ISBLK(sbuf.st_mode)) {
+		if (ioctl(fd, BLKGETSIZE64, &size))
+			return -1;
+		return size;
+	}
+	return sbuf.st_size;
+}
+
+/*
+ * Write back the block of @table, stored at file offset @table_off,
+ * that holds the entry @idx.
+ */
+static int
+cow_write_entry(struct cow_image *cow, uint64_t *table, uint64_t table_off, uint64_t idx)
+{
+	uint64_t first = idx & ~(uint64_t)(COW_BLOCK_SIZE / sizeof(uint64_t) - 1);
+
+	return cow_pwrite(cow->fd, table + first, COW_BLOCK_SIZE,
+			table_off + first * sizeof(uint64_t));
+}
+
+/*
+ * Return the L2 table of @l1_idx from the cache, loading it or, when @alloc
+ * is set, allocating it on a miss. The least recently used table is evicted,
+ * the cached tables are never dirty as every update is written through.
+ * Return NULL with *err == 0 if the table is not allocated.
+ */
+static uint64_t *
+cow_get_l2(struct cow_image *cow, uint64_t l1_idx, bool alloc, int *err)
+{
+	struct cow_l2 *l2, *victim = &cow->l2_cache[0];
+	uint64_t off;
+	void *table;
+	int i;
+
+	*err = 0;
+	cow->use_tick++;
+	for (i = 0; i < COW_L2_CACHE_SIZE; i++) {
+		l2 = &cow->l2_cache[i];
+		if ((l2->table != NULL) && (l2->l1_idx == l1_idx)) {
+			l2->last_use = cow->use_tick;
+			return l2->table;
+		}
+		if ((victim->table != NULL) &&
+				((l2->table == NULL) || (l2->last_use < victim->last_use)))
+			victim = l2;
+	}
+
+	off = le64toh(cow->l1[l1_idx]);
+	if ((off == 0) && !alloc)
+		return NULL;
+
+	if (victim->table == NULL) {
+		if (posix_memalign(&table, COW_BLOCK_SIZE, cow->cluster_size)) {
+			*err = ENOMEM;
+			return NULL;
+		}
+		victim->table = table;
+	}
+	victim->l1_idx = UINT64_MAX;
+
+	if (off == 0) {
+		off = cow->next_free;
+		memset(victim->table, 0, cow->cluster_size);
+		*err = cow_pwrite(cow->fd, victim->table, cow->cluster_size, off);
+		/* the table must be on disk before L1 links it */
+		if ((*err == 0) && fdatasync(cow->fd))
+			*err = errno;
+		if (*err == 0) {
+			cow->next_free += cow->cluster_size;
+			cow->l1[l1_idx] = htole64(off);
+			*err = cow_write_entry(cow, cow->l1, cow->l1_offset, l1_idx);
+			if (*err)
+				cow->l1[l1_idx] = 0;
+		}
+	} else {
+		*err = cow_pread(cow->fd, victim->table, cow->cluster_size, off);
+	}
+	if (*err) {
+		WPRINTF(("%s: failed to get L2 table %lu, error %d\n", __func__, l1_idx, *err));
+		return NULL;
+	}
+
+	victim->l1_idx = l1_idx;
+	victim->last_use = cow->use_tick;
+	return victim->table;
+}
+
+/*
+ * Allocate a data cluster for the guest @cluster and copy its content from
+ * the backing image, before the guest writes a part of it.
+ */
+static int
+cow_copy_cluster(struct cow_image *cow, uint64_t cluster, uint64_t *host)
+{
+	off_t goff = cluster << cow->cluster_bits;
+	int err;
+
+	if (goff < cow->backing_size) {
+		err = cow_pread(cow->backing_fd, cow->copy_buf, cow->cluster_size, goff);
+		if (err == 0)
+			err = cow_pwrite(cow->fd, cow->copy_buf, cow->cluster_size, cow->next_free);
+	} else {
+		/* nothing to copy, the cluster reads as zeroes once the file covers it */
+		err = ftruncate(cow->fd, cow->next_free + cow->cluster_size) ? errno : 0;
+	}
+	/* the data must be on disk before L2 maps it */
+	if ((err == 0) && fdatasync(cow->fd))
+		err = errno;
+	if (err) {
+		WPRINTF(("%s: failed to copy cluster %lu, error %d\n", __func__, cluster, err));
+		return err;
+	}
+
+	*host = cow->next_free;
+	cow->next_free += cow->cluster_size;
+	return 0;
+}
+
+/*
+ * Map the guest range [@offset, @offset + @len) to the first extent of it
+ * that is stored contiguously, in the overlay, in the backing image or
+ * nowhere. Clusters are allocated in the overlay when @write is set.
+ *
+ * Return 0 with the extent in @ext, or an error code.
+ */
+int
+cow_map(struct cow_image *cow, off_t offset, off_t len, bool write, struct cow_extent *ext)
+{
+	uint64_t cs = cow->cluster_size;
+	uint64_t l2_mask = (1UL << cow->l2_bits) - 1;
+	uint64_t cluster = (uint64_t)offset >> cow->cluster_bits;
+	uint64_t l1_idx = cluster >> cow->l2_bits;
+	uint64_t l2_idx = cluster & l2_mask;
+	off_t in_cluster = offset & (cs - 1);
+	off_t start = offset - in_cluster;
+	off_t end = start + cs;
+	uint64_t *l2, host, entry;
+	int err = 0;
+
+	if ((offset < 0) || (len <= 0) || (offset + len > cow->size))
+		return EINVAL;
+
+	pthread_mutex_lock(&cow->mtx);
+	l2 = cow_get_l2(cow, l1_idx, write, &err);
+	if (err)
+		goto out;
+
+	host = (l2 != NULL) ? le64toh(l2[l2_idx]) : 0;
+	if ((host == 0) && write) {
+		err = cow_copy_cluster(cow, cluster, &host);
+		if (err)
+			goto out;
+		l2[l2_idx] = htole64(host);
+		err = cow_write_entry(cow, l2, le64toh(cow->l1[l1_idx]), l2_idx);
+		if (err) {
+			/* the copied cluster is leaked */
+			l2[l2_idx] = 0;
+			goto out;
+		}
+	}
+
+	/* extend over the following clusters of this L2 table that are mapped alike */
+	while ((end < offset + len) && (l2_idx < l2_mask)) {
+		entry = (l2 != NULL) ? le64toh(l2[++l2_idx]) : 0;
+		if ((host != 0) ? (entry != host + (end - start)) : (entry != 0))
+			break;
+		end += cs;
+	}
+
+	if (host != 0) {
+		ext->fd = cow->fd;
+		ext->offset = host + in_cluster;
+	} else if (offset < cow->backing_size) {
+		ext->fd = cow->backing_fd;
+		ext->offset = offset;
+		end = MIN(end, cow->backing_size);
+	} else {
+		ext->fd = -1;
+		ext->offset = 0;
+	}
+	ext->len = MIN(end, offset + len) - offset;
+
+out:
+	pthread_mutex_unlock(&cow->mtx);
+	return err;
+}
+
+/*
+ * Initialize an empty overlay on top of @backing, its virtual size is the
+ * size of the backing image.
+ */
+static int
+cow_create(int fd, struct cow_header *hdr, const char *backing)
+{
+	char path[PATH_MAX];
+	uint64_t cs = 1UL << COW_CLUSTER_BITS;
+	uint64_t l1_bytes;
+	off_t size;
+	int bfd, err;
+
+	if ((backing == NULL) || (*backing == '\0')) {
+		WPRINTF(("an empty overlay needs a backing image, cow=<backing image>\n"));
+		return EINVAL;
+	}
+	if ((realpath(backing, path) == NULL) || (strlen(path) >= COW_BACKING_MAX)) {
+		WPRINTF(("invalid backing image %s\n", backing));
+		return EINVAL;
+	}
+
+	bfd = open(path, O_RDONLY);
+	if (bfd < 0) {
+		WPRINTF(("could not open backing image %s\n", path));
+		return errno;
+	}
+	size = cow_file_size(bfd);
+	close(bfd);
+	if ((size <= 0) || (size & (DEV_BSIZE - 1))) {
+		WPRINTF(("backing image size %ld is not a multiple of %d\n", size, DEV_BSIZE));
+		return EINVAL;
+	}
+
+	memset(hdr, 0, COW_BLOCK_SIZE);
+	hdr->magic = htole32(COW_MAGIC);
+	hdr->version = htole32(COW_VERSION);
+	hdr->size = htole64(size);
+	hdr->cluster_bits = htole32(COW_CLUSTER_BITS);
+	hdr->l1_entries = htole32(howmany(size, cs << (COW_CLUSTER_BITS - 3)));
+	hdr->l1_offset = htole64(cs);
+	strncpy(hdr->backing, path, COW_BACKING_MAX - 1);
+
+	/* the L1 table is the zeroed tail of the file */
+	l1_bytes = roundup(le32toh(hdr->l1_entries) * sizeof(uint64_t), cs);
+	err = cow_pwrite(fd, hdr, COW_BLOCK_SIZE, 0);
+	if ((err == 0) && ftruncate(fd, cs + l1_bytes))
+		err = errno;
+	if (err == 0)
+		err = fsync(fd) ? errno : 0;
+
+	return err;
+}
+
+struct cow_image *
+cow_open(int fd, const char *backing, bool ro, bool direct, off_t *size)
+{
+	struct cow_image *cow;
+	struct cow_header *hdr = NULL;
+	char path[PATH_MAX];
+	uint64_t l1_bytes;
+	off_t fsize;
+	void *buf;
+	int i;
+
+	cow = calloc(1, sizeof(struct cow_image));
+	if (cow == NULL)
+		return NULL;
+	cow->fd = fd;
+	cow->backing_fd = -1;
+	for (i = 0; i < COW_L2_CACHE_SIZE; i++)
+		cow->l2_cache[i].l1_idx = UINT64_MAX;
+
+	if (posix_memalign(&buf, COW_BLOCK_SIZE, COW_BLOCK_SIZE))
+		goto err;
+	hdr = buf;
+
+	fsize = cow_file_size(fd);
+	if (fsize == 0) {
+		if (ro) {
+			WPRINTF(("could not create a read-only overlay\n"));
+			goto err;
+		}
+		if (cow_create(fd, hdr, backing))
+			goto err;
+		fsize = cow_file_size(fd);
+	} else if ((fsize < 0) || cow_pread(fd, hdr, COW_BLOCK_SIZE, 0)) {
+		WPRINTF(("could not read the overlay header\n"));
+		goto err;
+	}
+
+	cow->size = le64toh(hdr->size);
+	cow->cluster_bits = le32toh(hdr->cluster_bits);
+	cow->l1_entries = le32toh(hdr->l1_entries);
+	cow->l1_offset = le64toh(hdr->l1_offset);
+	if ((le32toh(hdr->magic) != COW_MAGIC) || (le32toh(hdr->version) != COW_VERSION) ||
+			(cow->cluster_bits < COW_MIN_CLUSTER_BITS) ||
+			(cow->cluster_bits > COW_MAX_CLUSTER_BITS) ||
+			(cow->size <= 0) || (cow->size & (DEV_BSIZE - 1))) {
+		WPRINTF(("not a supported overlay image\n"));
+		goto err;
+	}
+	cow->cluster_size = 1UL << cow->cluster_bits;
+	cow->l2_bits = cow->cluster_bits - 3;
+	if ((cow->l1_entries < howmany(cow->size, cow->cluster_size << cow->l2_bits)) ||
+			(cow->l1_offset == 0) || (cow->l1_offset & (cow->cluster_size - 1))) {
+		WPRINTF(("corrupted overlay header\n"));
+		goto err;
+	}
+
+	hdr->backing[COW_BACKING_MAX - 1] = '\0';
+	if ((backing != NULL) && (*backing != '\0') &&
+			((realpath(backing, path) == NULL) || strcmp(path, hdr->backing))) {
+		WPRINTF(("the overlay is based on %s, not %s\n", hdr->backing, backing));
+		goto err;
+	}
+	if (hdr->backing[0] != '\0') {
+		cow->backing_fd = open(hdr->backing, O_RDONLY | (direct ? O_DIRECT : 0));
+		if (cow->backing_fd < 0) {
+			WPRINTF(("could not open backing image %s\n", hdr->backing));
+			goto err;
+		}
+		cow->backing_size = MIN(cow_file_size(cow->backing_fd), cow->size);
+	}
+
+	l1_bytes = roundup(cow->l1_entries * sizeof(uint64_t), cow->cluster_size);
+	if (posix_memalign(&buf, COW_BLOCK_SIZE, l1_bytes))
+		goto err;
+	cow->l1 = buf;
+	if (cow_pread(fd, cow->l1, l1_bytes, cow->l1_offset))
+		goto err;
+
+	if (posix_memalign(&cow->copy_buf, COW_BLOCK_SIZE, cow->cluster_size)) {
+		cow->copy_buf = NULL;
+		goto err;
+	}
+
+	cow->next_free = roundup(fsize, cow->cluster_size);
+	pthread_mutex_init(&cow->mtx, NULL);
+	free(hdr);
+
+	*size = cow->size;
+	return cow;
+
+err:
+	free(hdr);
+	free(cow->l1);
+	free(cow->copy_buf);
+	if (cow->backing_fd >= 0)
+		close(cow->backing_fd);
+	free(cow);
+	return NULL;
+}
+
+/*
+ * Release the overlay, the overlay file itself is closed by the caller
+ */
+void
+cow_close(struct cow_image *cow)
+{
+	int i;
+
+	for (i = 0; i < COW_L2_CACHE_SIZE; i++)
+		free(cow->l2_cache[i].table);
+	free(cow->l1);
+	free(cow->copy_buf);
+	if (cow->backing_fd >= 0)
+		close(cow->backing_fd);
+	pthread_mutex_destroy(&cow->mtx);
+	free(cow);
+}
+
+/*
+ * The read-only backing image of the overlay
+ */
+int
+cow_backing_fd(struct cow_image *cow)
+{
+	return cow->backing_fd;
+}
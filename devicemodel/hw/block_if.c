@@ -45,10 +45,13 @@
 
 #include "dm.h"
 #include "block_if.h"
+#include "block_cow.h"
+#include "block_cache.h"
 #include "ahci.h"
 #include "dm_string.h"
 #include "log.h"
 #include "iothread.h"
+#include "vmmapi.h"
 
 /*
  * Notes:
@@ -67,6 +70,18 @@
 #define BLOCKIF_NUMTHR	8
 #define BLOCKIF_MAXREQ	(64 + BLOCKIF_NUMTHR)
 #define MAX_DISCARD_SEGMENT	256
+#define MAX_WRITE_ZEROES_SEGMENT	MAX_DISCARD_SEGMENT
+/* largest discard/write zeroes range of one segment, 2GiB - 512 */
+#define MAX_RANGE_SECTORS	0x3fffffU
+
+/* the range of a write zeroes request may be deallocated */
+#define WRITE_ZEROES_FLAG_UNMAP	1U
+
+/* size of the zero buffer used when the filesystem can't zero ranges */
+#define ZERO_BUF_SIZE		(64 * 1024)
+
+/* default size of the read cache of a read-only image, in MB */
+#define RCACHE_DEFAULT_SIZE_MB	64
 
 #define AIO_MODE_THREAD_POOL	0
 #define AIO_MODE_IO_URING	1
@@ -74,6 +89,22 @@
 /* the max number of entries for the io_uring submission/completion queue */
 #define MAX_IO_URING_ENTRIES	256
 
+/*
+ * The guest memory is registered to io_uring as fixed buffers. The kernel
+ * limits the size of one fixed buffer to 1G, so the memory regions are split.
+ */
+#define IOU_FIXED_BUF_MAX_LEN	(1UL << 30)
+#define IOU_FIXED_BUF_MAX_NUM	64
+#define IOU_MEM_REGION_MAX_NUM	16
+/* idle time before the SQPOLL kernel thread goes to sleep */
+#define IOU_SQPOLL_IDLE_MS	100
+
+/* the registered file index of the backing file */
+#define IOU_FIXED_FILE_IDX	0
+
+/* tag of the user data of an SQE that is followed by linked SQEs of the same request */
+#define IOU_LINKED_SQE		1UL
+
 /*
  * Debug printf
  */
@@ -85,7 +116,8 @@ enum blockop {
 	BOP_READ,
 	BOP_WRITE,
 	BOP_FLUSH,
-	BOP_DISCARD
+	BOP_DISCARD,
+	BOP_WRITE_ZEROES
 };
 
 enum blockstat {
@@ -103,6 +135,9 @@ struct blockif_elem {
 	enum blockstat	     status;
 	pthread_t            tid;
 	off_t		     block;
+	int		     err;
+	/* chunks of the read cache read by io_uring, copied out on completion */
+	struct block_cache_fill *fill;
 };
 
 struct blockif_queue {
@@ -120,6 +155,9 @@ struct blockif_queue {
 
 	int			in_flight;
 	struct io_uring		ring;
+	bool			fixed_file;
+	int			nr_fixed_bufs;
+	struct iovec		fixed_bufs[IOU_FIXED_BUF_MAX_NUM];
 	struct iothread_mevent	iomvt;
 	struct iothread_ctx	*ioctx;
 
@@ -150,9 +188,17 @@ struct blockif_ctxt {
 	int			sectsz;
 	int			psectsz;
 	int			psectoff;
-	int			max_discard_sectors;
+	uint32_t		max_discard_sectors;
 	int			max_discard_seg;
 	int			discard_sector_alignment;
+	uint32_t		max_write_zeroes_sectors;
+	int			max_write_zeroes_seg;
+	/* the filesystem doesn't support FALLOC_FL_ZERO_RANGE */
+	bool			no_zero_range;
+	/* copy-on-write overlay over a backing image, NULL for raw images */
+	struct cow_image	*cow;
+	/* read cache shared with the other users of the read-only image */
+	struct block_cache	*rcache;
 	struct blockif_queue	*bqs;
 	int			bq_num;
 
@@ -165,6 +211,9 @@ struct blockif_ctxt {
 	/* whether bypass the Service VM's page cache or not */
 	uint8_t			bypass_host_cache;
 
+	/* whether let a kernel thread poll the io_uring submission queue or not */
+	uint8_t			sqpoll;
+
 	/*
 	 * whether enable BST_BLOCK logic in blockif_dequeue/blockif_complete or not.
 	 *
@@ -192,6 +241,13 @@ struct discard_range {
 	uint32_t flags;
 };
 
+/* a byte range of the backing file to discard or zero */
+struct blockif_range {
+	off_t	offset;
+	off_t	len;
+	bool	unmap;
+};
+
 static struct blockif_sig_elem *blockif_bse_head;
 
 static int
@@ -230,6 +286,7 @@ blockif_enqueue(struct blockif_queue *bq, struct blockif_req *breq,
 		case BOP_READ:
 		case BOP_WRITE:
 		case BOP_DISCARD:
+		case BOP_WRITE_ZEROES:
 			off = breq->offset;
 			for (i = 0; i < breq->iovcnt; i++)
 				off += breq->iov[i].iov_len;
@@ -315,68 +372,183 @@ discard_range_validate(struct blockif_ctxt *bc, off_t start, off_t size)
 }
 
 static int
-blockif_process_discard(struct blockif_ctxt *bc, struct blockif_req *br)
+write_zeroes_range_validate(struct blockif_ctxt *bc, off_t start, off_t size)
+{
+	if (!size || (start + size) > (bc->size + bc->sub_file_start_lba))
+		return -1;
+
+	if ((size / DEV_BSIZE) > bc->max_write_zeroes_sectors)
+		return -1;
+	return 0;
+}
+
+/*
+ * Parse the ranges of a discard or write zeroes request into @ranges,
+ * merging the adjacent ones so that they are issued with as few calls
+ * as possible.
+ *
+ * Return the number of ranges, or a negative error code.
+ */
+static int
+blockif_parse_ranges(struct blockif_ctxt *bc, struct blockif_req *br,
+		enum blockop op, struct blockif_range *ranges)
 {
-	int err;
 	struct discard_range *range;
-	int n_range, i, segment;
-	off_t arg[MAX_DISCARD_SEGMENT][2];
+	int n_range, i, n, max_seg;
+	off_t start, size;
+	bool unmap;
 
-	err = 0;
-	n_range = 0;
-	segment = 0;
-	if (!bc->candiscard)
-		return EOPNOTSUPP;
+	if (((op == BOP_DISCARD) && !bc->candiscard) ||
+			((op == BOP_WRITE_ZEROES) && (bc->cow != NULL)))
+		return -EOPNOTSUPP;
 
 	if (bc->rdonly)
-		return EROFS;
+		return -EROFS;
 
+	n = 0;
 	if (br->iovcnt == 1) {
-		/* virtio-blk use iov to transfer discard range */
+		/* virtio-blk use iov to transfer discard and write zeroes range */
 		n_range = br->iov[0].iov_len/sizeof(*range);
 		range = br->iov[0].iov_base;
+		max_seg = (op == BOP_DISCARD) ? bc->max_discard_seg : bc->max_write_zeroes_seg;
+		if (n_range > max_seg) {
+			WPRINTF(("segment > max_%s_seg\n", (op == BOP_DISCARD) ? "discard" : "write_zeroes"));
+			return -EINVAL;
+		}
 		for (i = 0; i < n_range; i++) {
-			arg[i][0] = range[i].sector * DEV_BSIZE +
-					bc->sub_file_start_lba;
-			arg[i][1] = range[i].num_sectors * DEV_BSIZE;
-			segment++;
-			if (segment > bc->max_discard_seg) {
-				WPRINTF(("segment > max_discard_seg\n"));
-				return EINVAL;
+			start = range[i].sector * DEV_BSIZE + bc->sub_file_start_lba;
+			size = (off_t)range[i].num_sectors * DEV_BSIZE;
+			unmap = (op == BOP_DISCARD) || ((range[i].flags & WRITE_ZEROES_FLAG_UNMAP) != 0);
+			if (((op == BOP_DISCARD) ? discard_range_validate : write_zeroes_range_validate)
+					(bc, start, size)) {
+				WPRINTF(("range [%ld: %ld] is invalid\n", start, size));
+				return -EINVAL;
 			}
-			if (discard_range_validate(bc, arg[i][0], arg[i][1])) {
-				WPRINTF(("range [%ld: %ld] is invalid\n", arg[i][0], arg[i][1]));
-				return EINVAL;
+
+			if ((n > 0) && (ranges[n - 1].offset + ranges[n - 1].len == start) &&
+					(ranges[n - 1].unmap == unmap)) {
+				ranges[n - 1].len += size;
+			} else {
+				ranges[n].offset = start;
+				ranges[n].len = size;
+				ranges[n].unmap = unmap;
+				n++;
 			}
 		}
-	} else {
+	} else if (op == BOP_DISCARD) {
 		/* ahci parse discard range to br->offset and br->reside */
-		arg[0][0] = br->offset + bc->sub_file_start_lba;
-		arg[0][1] = br->resid;
-		segment = 1;
+		ranges[0].offset = br->offset + bc->sub_file_start_lba;
+		ranges[0].len = br->resid;
+		ranges[0].unmap = true;
+		n = 1;
+	} else {
+		return -EINVAL;
+	}
+
+	return n;
+}
+
+/*
+ * The fallocate mode to discard or zero a range of a regular file:
+ * FALLOC_FL_PUNCH_HOLE:
+ *	Deallocates space in the byte range starting at offset and
+ *	continuing for length bytes.  After a successful call,
+ *	subsequent reads from this range will return zeroes.
+ * FALLOC_FL_ZERO_RANGE:
+ *	Zeroes the byte range, keeping it allocated.
+ * FALLOC_FL_KEEP_SIZE:
+ *	Do not modify the apparent length of the file.
+ *
+ * Write zeroes with the unmap flag punch holes when discard is enabled,
+ * which keeps sparse images sparse.
+ */
+static int
+blockif_falloc_mode(struct blockif_ctxt *bc, enum blockop op, bool unmap)
+{
+	if ((op == BOP_DISCARD) || (unmap && bc->candiscard))
+		return FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE;
+	else
+		return FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE;
+}
+
+static int
+blockif_write_zero_buf(struct blockif_ctxt *bc, off_t offset, off_t len)
+{
+	static const char zero_buf[ZERO_BUF_SIZE] __attribute__((aligned(4096)));
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(bc->fd, zero_buf, MIN(len, ZERO_BUF_SIZE), offset);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		offset += n;
+		len -= n;
 	}
-	for (i = 0; i < segment; i++) {
+	return 0;
+}
+
+static int
+blockif_zero_range(struct blockif_ctxt *bc, struct blockif_range *range)
+{
+	int mode = blockif_falloc_mode(bc, BOP_WRITE_ZEROES, range->unmap);
+
+	if ((mode & FALLOC_FL_ZERO_RANGE) && bc->no_zero_range)
+		return blockif_write_zero_buf(bc, range->offset, range->len);
+
+	if (fallocate(bc->fd, mode, range->offset, range->len) == 0)
+		return 0;
+
+	if ((errno == EOPNOTSUPP) && (mode & FALLOC_FL_ZERO_RANGE)) {
+		WPRINTF(("FALLOC_FL_ZERO_RANGE is not supported, write zero buffers\n"));
+		bc->no_zero_range = true;
+		return blockif_write_zero_buf(bc, range->offset, range->len);
+	}
+	return errno;
+}
+
+/*
+ * Process a discard or write zeroes request synchronously. The ranges are
+ * merged and synced to the backing file once for the whole request.
+ */
+static int
+blockif_process_ranges(struct blockif_ctxt *bc, struct blockif_req *br, enum blockop op)
+{
+	struct blockif_range ranges[MAX_DISCARD_SEGMENT];
+	uint64_t arg[2];
+	int err, n, i;
+
+	n = blockif_parse_ranges(bc, br, op, ranges);
+	if (n < 0)
+		return -n;
+
+	err = 0;
+	for (i = 0; i < n; i++) {
 		if (bc->isblk) {
-			err = ioctl(bc->fd, BLKDISCARD, arg[i]);
+			arg[0] = ranges[i].offset;
+			arg[1] = ranges[i].len;
+			if (ioctl(bc->fd, (op == BOP_DISCARD) ? BLKDISCARD : BLKZEROOUT, arg))
+				err = errno;
+		} else if (op == BOP_DISCARD) {
+			if (fallocate(bc->fd, blockif_falloc_mode(bc, op, true),
+					ranges[i].offset, ranges[i].len))
+				err = errno;
 		} else {
-			/* FALLOC_FL_PUNCH_HOLE:
-			 *	Deallocates space in the byte range starting at offset and
-			 *	continuing for length bytes.  After a successful call,
-			 *	subsequent reads from this range will return zeroes.
-			 * FALLOC_FL_KEEP_SIZE:
-			 *	Do not modify the apparent length of the file.
-			 */
-			err = fallocate(bc->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
-				arg[i][0], arg[i][1]);
-			if (!err)
-				err = fdatasync(bc->fd);
+			err = blockif_zero_range(bc, &ranges[i]);
 		}
 		if (err) {
-			WPRINTF(("Failed to discard offset=%ld nbytes=%ld err code: %d\n",
-				 arg[i][0], arg[i][1], err));
+			WPRINTF(("Failed to %s offset=%ld nbytes=%ld err code: %d\n",
+				 (op == BOP_DISCARD) ? "discard" : "write zeroes",
+				 ranges[i].offset, ranges[i].len, err));
 			return err;
 		}
 	}
+
+	if (!bc->isblk && (n > 0) && fdatasync(bc->fd))
+		return errno;
+
 	br->resid = 0;
 
 	return 0;
@@ -647,6 +819,87 @@ blockif_complete_bounced_read(struct blockif_req *br)
 	return;
 };
 
+/*
+ * Copy the part [@skip, @skip + @len) of the buffers of @iov to @sub.
+ * Return the number of segments in @sub.
+ */
+static int
+blockif_iov_slice(const struct iovec *iov, int iovcnt, size_t skip, size_t len, struct iovec *sub)
+{
+	int i, n = 0;
+
+	for (i = 0; (i < iovcnt) && (len > 0); i++) {
+		if (skip >= iov[i].iov_len) {
+			skip -= iov[i].iov_len;
+			continue;
+		}
+		sub[n].iov_base = (char *)iov[i].iov_base + skip;
+		sub[n].iov_len = MIN(iov[i].iov_len - skip, len);
+		len -= sub[n].iov_len;
+		skip = 0;
+		n++;
+	}
+	return n;
+}
+
+/*
+ * Read or write the image at @offset like preadv/pwritev. The requests to a
+ * COW overlay are split into the extents stored in the overlay, in the
+ * backing image, or nowhere for the zero extents that are only read.
+ * The reads of a read-only image, or of the backing image, go through the
+ * read cache if there is one.
+ */
+static ssize_t
+blockif_rw(struct blockif_ctxt *bc, enum blockop op, const struct iovec *iov, int iovcnt, off_t offset)
+{
+	struct iovec sub[BLOCKIF_IOV_MAX];
+	struct cow_extent ext;
+	size_t total = 0, done = 0;
+	ssize_t len;
+	int i, n, err;
+
+	if (bc->cow == NULL) {
+		if (op == BOP_WRITE)
+			return pwritev(bc->fd, iov, iovcnt, offset);
+		return (bc->rcache != NULL) ? block_cache_read(bc->rcache, bc->fd, iov, iovcnt, offset) :
+			preadv(bc->fd, iov, iovcnt, offset);
+	}
+
+	if (iovcnt > BLOCKIF_IOV_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	while (done < total) {
+		err = cow_map(bc->cow, offset + done, total - done, (op == BOP_WRITE), &ext);
+		if (err) {
+			errno = err;
+			return -1;
+		}
+
+		n = blockif_iov_slice(iov, iovcnt, done, ext.len, sub);
+		if (ext.fd < 0) {
+			for (i = 0; i < n; i++)
+				memset(sub[i].iov_base, 0, sub[i].iov_len);
+			len = ext.len;
+		} else if (op == BOP_READ) {
+			len = ((bc->rcache != NULL) && (ext.fd != bc->fd)) ?
+				block_cache_read(bc->rcache, ext.fd, sub, n, ext.offset) :
+				preadv(ext.fd, sub, n, ext.offset);
+		} else {
+			len = pwritev(ext.fd, sub, n, ext.offset);
+		}
+		if (len < 0)
+			return -1;
+		if (len == 0)
+			break;
+		done += len;
+	}
+	return done;
+}
+
 /*
  * It is used to read out the head/tail area to construct the bounced data.
  *
@@ -654,7 +907,7 @@ blockif_complete_bounced_read(struct blockif_req *br)
  * @offset shall be guaranteed to be aligned by caller (either aligned_dn_start or aligned_dn_end).
  */
 static int
-blockif_read_head_or_tail_area(int fd, struct iovec *b_iov, off_t offset, uint32_t alignment)
+blockif_read_head_or_tail_area(struct blockif_ctxt *bc, struct iovec *b_iov, off_t offset, uint32_t alignment)
 {
 	int ret = 0;
 	int bytes_read;
@@ -669,7 +922,7 @@ blockif_read_head_or_tail_area(int fd, struct iovec *b_iov, off_t offset, uint32
 
 	b_iov->iov_base = area;
 	b_iov->iov_len = alignment;
-	bytes_read = preadv(fd, b_iov, 1, offset);
+	bytes_read = blockif_rw(bc, BOP_READ, b_iov, 1, offset);
 
 	if (bytes_read < 0) {
 		pr_err("%s: read fails \n", __func__);
@@ -728,7 +981,7 @@ blockif_init_bounced_write(struct blockif_ctxt *bc, struct blockif_req *br)
 	 *  aligned_dn_start    | alignment
 	 */
 	if (head != 0) {
-		ret = blockif_read_head_or_tail_area(bc->fd, &head_iov, info->aligned_dn_start, alignment);
+		ret = blockif_read_head_or_tail_area(bc, &head_iov, info->aligned_dn_start, alignment);
 		if (ret < 0) {
 			pr_err("%s: fails to read out the head area \n", __func__);
 			goto end;
@@ -742,7 +995,7 @@ blockif_init_bounced_write(struct blockif_ctxt *bc, struct blockif_req *br)
 	 *  aligned_dn_end      | alignment
 	 */
 	if (tail != 0) {
-		ret = blockif_read_head_or_tail_area(bc->fd, &tail_iov, info->aligned_dn_end, alignment);
+		ret = blockif_read_head_or_tail_area(bc, &tail_iov, info->aligned_dn_end, alignment);
 		if (ret < 0) {
 			pr_err("%s: fails to read out the tail area \n", __func__);
 			goto end;
@@ -818,7 +1071,7 @@ blockif_proc(struct blockif_queue *bq, struct blockif_elem *be)
 
 	switch (be->op) {
 	case BOP_READ:
-		len = preadv(bc->fd, iovecs, iovcnt, offset);
+		len = blockif_rw(bc, BOP_READ, iovecs, iovcnt, offset);
 		if (info->need_conversion) {
 			blockif_complete_bounced_read(br);
 			blockif_deinit_bounce_iov(br);
@@ -835,7 +1088,7 @@ blockif_proc(struct blockif_queue *bq, struct blockif_elem *be)
 			break;
 		}
 
-		len = pwritev(bc->fd, iovecs, iovcnt, offset);
+		len = blockif_rw(bc, BOP_WRITE, iovecs, iovcnt, offset);
 		if (info->need_conversion) {
 			blockif_deinit_bounce_iov(br);
 		}
@@ -852,7 +1105,8 @@ blockif_proc(struct blockif_queue *bq, struct blockif_elem *be)
 			err = errno;
 		break;
 	case BOP_DISCARD:
-		err = blockif_process_discard(bc, br);
+	case BOP_WRITE_ZEROES:
+		err = blockif_process_ranges(bc, br, be->op);
 		break;
 	default:
 		err = EINVAL;
@@ -1038,24 +1292,89 @@ is_io_uring_supported_op(enum blockop op)
 	return ((op == BOP_READ) || (op == BOP_WRITE) || (op == BOP_FLUSH));
 }
 
+/*
+ * Return the index of the fixed buffer that contains @iov, or -1 if @iov is
+ * not in the registered guest memory, e.g. it is a bounce buffer.
+ */
+static int
+iou_find_fixed_buf(struct blockif_queue *bq, const struct iovec *iov)
+{
+	const char *base = iov->iov_base;
+	const char *buf;
+	int i;
+
+	for (i = 0; i < bq->nr_fixed_bufs; i++) {
+		buf = bq->fixed_bufs[i].iov_base;
+		if ((base >= buf) && ((base + iov->iov_len) <= (buf + bq->fixed_bufs[i].iov_len)))
+			return i;
+	}
+
+	return -1;
+}
+
+static void
+iou_prep_rw(struct blockif_queue *bq, struct io_uring_sqe *sqe, enum blockop op, int fd,
+		struct iovec *iovecs, size_t iovcnt, off_t offset)
+{
+	int idx = -1;
+
+	/* a single segment in the guest memory can use the registered buffer, no pinning per I/O */
+	if (iovcnt == 1)
+		idx = iou_find_fixed_buf(bq, iovecs);
+
+	if (op == BOP_READ) {
+		if (idx >= 0)
+			io_uring_prep_read_fixed(sqe, fd, iovecs->iov_base, iovecs->iov_len, offset, idx);
+		else
+			io_uring_prep_readv(sqe, fd, iovecs, iovcnt, offset);
+	} else {
+		if (idx >= 0)
+			io_uring_prep_write_fixed(sqe, fd, iovecs->iov_base, iovecs->iov_len, offset, idx);
+		else
+			io_uring_prep_writev(sqe, fd, iovecs, iovcnt, offset);
+	}
+}
+
+/*
+ * Queue the SQEs of @be, the caller submits them in batch.
+ * Return -1 if there is no enough submission queue entries, or 1 if the
+ * request has to be processed synchronously.
+ */
 static int
 iou_submit_sqe(struct blockif_queue *bq, struct blockif_elem *be)
 {
-	int ret;
 	struct io_uring *ring = &bq->ring;
-	struct io_uring_sqe *sqes = io_uring_get_sqe(ring);
+	struct io_uring_sqe *sqes, *flush_sqe;
 	struct blockif_req *br = be->req;
 	struct blockif_ctxt *bc = bq->bc;
 	struct br_align_info *info = &br->align_info;
 	struct iovec *iovecs;
-	size_t iovcnt;
-	off_t offset;
-
-	if (!sqes) {
-		pr_err("%s: io_uring_get_sqe fails. NO available submission queue entry. \n", __func__);
+	struct cow_extent ext;
+	struct iovec *fiov = NULL;
+	size_t iovcnt, i;
+	off_t offset, len, foffset = 0;
+	int fd, rw_fd, fiovcnt = 0;
+	uint8_t flags, rw_flags;
+	bool linked_flush, cached_fd;
+
+	be->fill = NULL;
+
+	/* In writethru mode, each write is followed by a linked fsync */
+	linked_flush = (be->op == BOP_WRITE) && !bc->wce;
+	if (io_uring_sq_space_left(ring) < (linked_flush ? 2U : 1U)) {
 		return -1;
 	}
 
+	if (bq->fixed_file) {
+		fd = IOU_FIXED_FILE_IDX;
+		flags = IOSQE_FIXED_FILE;
+	} else {
+		fd = bc->fd;
+		flags = 0;
+	}
+	rw_fd = fd;
+	rw_flags = flags;
+
 	if ((be->op == BOP_READ) || (be->op == BOP_WRITE)) {
 		if (info->need_conversion) {
 			/* bounce_iov has been initialized in blockif_request */
@@ -1068,31 +1387,133 @@ iou_submit_sqe(struct blockif_queue *bq, struct blockif_elem *be)
 			iovcnt = br->iovcnt;
 			offset = br->offset + bc->sub_file_start_lba;
 		}
+
+		for (i = 0, len = 0; i < iovcnt; i++)
+			len += iovecs[i].iov_len;
+
+		/* the cache holds a read-only image or the backing image of an overlay */
+		cached_fd = (bc->rcache != NULL) && (bc->cow == NULL);
+		if (bc->cow) {
+			/* only the COW requests within one stored extent go to io_uring */
+			if (cow_map(bc->cow, offset, len, (be->op == BOP_WRITE), &ext) ||
+					(ext.fd < 0) || (ext.len < len))
+				return 1;
+			offset = ext.offset;
+			if (ext.fd != bc->fd) {
+				/* the backing image is not a registered file */
+				rw_fd = ext.fd;
+				rw_flags = 0;
+				cached_fd = (bc->rcache != NULL);
+			}
+		}
+
+		/*
+		 * The reads of the cached image are copied synchronously from the
+		 * cache if it holds all their chunks. Otherwise, io_uring reads the
+		 * chunks into the cache and they are copied out on completion.
+		 */
+		if ((be->op == BOP_READ) && cached_fd) {
+			if (block_cache_cached(bc->rcache, offset, len))
+				return 1;
+			be->fill = block_cache_fill_start(bc->rcache, offset, len,
+					&fiov, &fiovcnt, &foffset);
+		}
 	}
 
+	sqes = io_uring_get_sqe(ring);
+	be->err = 0;
+
 	switch (be->op) {
 	case BOP_READ:
-		io_uring_prep_readv(sqes, bc->fd, iovecs, iovcnt, offset);
-		break;
 	case BOP_WRITE:
-		io_uring_prep_writev(sqes, bc->fd, iovecs, iovcnt, offset);
+		if (be->fill != NULL)
+			io_uring_prep_readv(sqes, rw_fd, fiov, fiovcnt, foffset);
+		else
+			iou_prep_rw(bq, sqes, be->op, rw_fd, iovecs, iovcnt, offset);
 		break;
 	case BOP_FLUSH:
-		io_uring_prep_fsync(sqes, bc->fd, IORING_FSYNC_DATASYNC);
+		io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
 		break;
 	default:
 		/* is_io_uring_supported_op guarantees that this case will not occur */
 		break;
 	}
 
-	io_uring_sqe_set_data(sqes, be);
-	bq->in_flight++;
-	ret = io_uring_submit(ring);
-	if (ret < 0) {
-		pr_err("%s: io_uring_submit fails, error %s \n", __func__, strerror(-ret));
+	if (linked_flush) {
+		/* the write completes quietly, @be is done when the fsync completes */
+		io_uring_sqe_set_flags(sqes, rw_flags | IOSQE_IO_LINK);
+		io_uring_sqe_set_data(sqes, (void *)((uintptr_t)be | IOU_LINKED_SQE));
+
+		flush_sqe = io_uring_get_sqe(ring);
+		io_uring_prep_fsync(flush_sqe, fd, IORING_FSYNC_DATASYNC);
+		io_uring_sqe_set_flags(flush_sqe, flags);
+		io_uring_sqe_set_data(flush_sqe, be);
+		bq->in_flight += 2;
+	} else {
+		io_uring_sqe_set_flags(sqes, rw_flags);
+		io_uring_sqe_set_data(sqes, be);
+		bq->in_flight++;
 	}
 
-	return ret;
+	return 0;
+}
+
+/*
+ * Queue one fallocate SQE per range of a discard or write zeroes request on
+ * a regular file, linked together and followed by one fsync, so that all the
+ * ranges go out in a single submission and @be is done when the fsync
+ * completes.
+ * Return -1 if the request can't be queued, the caller processes it
+ * synchronously then.
+ */
+static int
+iou_submit_ranges(struct blockif_queue *bq, struct blockif_elem *be)
+{
+	struct blockif_range ranges[MAX_DISCARD_SEGMENT];
+	struct io_uring *ring = &bq->ring;
+	struct io_uring_sqe *sqe;
+	struct blockif_ctxt *bc = bq->bc;
+	int fd, n, i, mode;
+	uint8_t flags;
+
+	if (bc->isblk)
+		return -1;
+
+	/* errors are reported by the synchronous path */
+	n = blockif_parse_ranges(bc, be->req, be->op, ranges);
+	if ((n <= 0) || (io_uring_sq_space_left(ring) < (unsigned int)(n + 1)))
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		mode = blockif_falloc_mode(bc, be->op, ranges[i].unmap);
+		if ((mode & FALLOC_FL_ZERO_RANGE) && bc->no_zero_range)
+			return -1;
+	}
+
+	if (bq->fixed_file) {
+		fd = IOU_FIXED_FILE_IDX;
+		flags = IOSQE_FIXED_FILE;
+	} else {
+		fd = bc->fd;
+		flags = 0;
+	}
+	be->err = 0;
+
+	for (i = 0; i < n; i++) {
+		sqe = io_uring_get_sqe(ring);
+		io_uring_prep_fallocate(sqe, fd, blockif_falloc_mode(bc, be->op, ranges[i].unmap),
+				ranges[i].offset, ranges[i].len);
+		io_uring_sqe_set_flags(sqe, flags | IOSQE_IO_LINK);
+		io_uring_sqe_set_data(sqe, (void *)((uintptr_t)be | IOU_LINKED_SQE));
+	}
+
+	sqe = io_uring_get_sqe(ring);
+	io_uring_prep_fsync(sqe, fd, IORING_FSYNC_DATASYNC);
+	io_uring_sqe_set_flags(sqe, flags);
+	io_uring_sqe_set_data(sqe, be);
+	bq->in_flight += n + 1;
+
+	return 0;
 }
 
 static void
@@ -1102,22 +1523,26 @@ iou_submit(struct blockif_queue *bq)
 	struct blockif_elem *be;
 	struct blockif_req *br;
 	struct blockif_ctxt *bc = bq->bc;
+	bool queued = false;
 
-	while (blockif_dequeue(bq, 0, &be)) {
-		if (is_io_uring_supported_op(be->op)) {
-			err = iou_submit_sqe(bq, be);
+	while (io_uring_sq_space_left(&bq->ring) >= 2U) {
+		if (!blockif_dequeue(bq, 0, &be))
+			break;
 
-			/*
-			 * -1 means that there is NO available submission queue entry (SQE) in the submission queue.
-			 * Break the while loop here. Request can only be submitted when SQE is available.
-			 */
-			if (err == -1) {
-				break;
-			}
+		if (is_io_uring_supported_op(be->op) && (iou_submit_sqe(bq, be) == 0)) {
+			/* there is always room for the SQEs of one request here */
+			queued = true;
+		} else if (((be->op == BOP_DISCARD) || (be->op == BOP_WRITE_ZEROES)) &&
+				(iou_submit_ranges(bq, be) == 0)) {
+			queued = true;
+		} else if ((be->op == BOP_READ) || (be->op == BOP_WRITE)) {
+			/* COW requests spanning several extents and cache hits */
+			blockif_proc(bq, be);
+			blockif_complete(bq, be);
 		} else {
 			br = be->req;
-			if (be->op == BOP_DISCARD) {
-				err = blockif_process_discard(bc, br);
+			if ((be->op == BOP_DISCARD) || (be->op == BOP_WRITE_ZEROES)) {
+				err = blockif_process_ranges(bc, br, be->op);
 			} else {
 				pr_err("%s: op %d is not supported \n", __func__, be->op);
 				err = EINVAL;
@@ -1127,6 +1552,17 @@ iou_submit(struct blockif_queue *bq)
 			blockif_complete(bq, be);
 		}
 	}
+
+	/*
+	 * Submit all the queued SQEs with one syscall. In SQPOLL mode, it only
+	 * wakes up the kernel thread if it went to sleep.
+	 */
+	if (queued) {
+		err = io_uring_submit(&bq->ring);
+		if (err < 0) {
+			pr_err("%s: io_uring_submit fails, error %s \n", __func__, strerror(-err));
+		}
+	}
 	return;
 }
 
@@ -1137,7 +1573,8 @@ iou_process_completions(struct blockif_queue *bq)
 	struct blockif_elem *be;
 	struct blockif_req *br;
 	struct io_uring *ring = &bq->ring;
-	int err = 0;
+	uintptr_t data;
+	int err, res;
 
 	while (io_uring_peek_cqe(ring, &cqes) == 0) {
 		if (!cqes) {
@@ -1145,21 +1582,43 @@ iou_process_completions(struct blockif_queue *bq)
 			break;
 		}
 
-		be = io_uring_cqe_get_data(cqes);
+		data = (uintptr_t)io_uring_cqe_get_data(cqes);
+		res = cqes->res;
 		bq->in_flight--;
 		io_uring_cqe_seen(ring, cqes);
 		cqes = NULL;
+
+		be = (struct blockif_elem *)(data & ~IOU_LINKED_SQE);
 		if (!be) {
 			pr_err("%s: be is NULL \n", __func__);
 			break;
 		}
 
+		/* keep the first error, the following linked SQEs fail with ECANCELED */
+		if ((res < 0) && (be->err == 0))
+			be->err = -res;
+
+		/* the last linked SQE completes the request */
+		if (data & IOU_LINKED_SQE)
+			continue;
+
 		br = be->req;
 		if (!br) {
 			pr_err("%s: br is NULL \n", __func__);
 			break;
 		}
 
+		if (be->fill != NULL) {
+			/* the errors are kept in be->err already */
+			if (br->align_info.need_conversion)
+				(void)block_cache_fill_end(bq->bc->rcache, be->fill, res,
+						&br->align_info.bounce_iov, 1, 0);
+			else
+				(void)block_cache_fill_end(bq->bc->rcache, be->fill, res,
+						br->iov, br->iovcnt, 0);
+			be->fill = NULL;
+		}
+
 		/* when a misaligned request is converted to an aligned one, need to do some post-work */
 		if (br->align_info.need_conversion) {
 			if (be->op == BOP_READ) {
@@ -1168,8 +1627,13 @@ iou_process_completions(struct blockif_queue *bq)
 			blockif_deinit_bounce_iov(br);
 		}
 
-		if (be->op == BOP_WRITE) {
-			err = blockif_flush_cache(bq->bc);
+		err = be->err;
+		if ((be->op == BOP_WRITE_ZEROES) && (err == EOPNOTSUPP) && !bq->bc->no_zero_range) {
+			/* the filesystem can't zero ranges, redo it with zero buffers */
+			bq->bc->no_zero_range = true;
+			err = blockif_process_ranges(bq->bc, br, be->op);
+		} else if ((err == 0) && ((be->op == BOP_DISCARD) || (be->op == BOP_WRITE_ZEROES))) {
+			br->resid = 0;
 		}
 
 		be->status = BST_DONE;
@@ -1241,23 +1705,80 @@ iou_del_iothread(struct blockif_queue *bq)
 	return ret;
 }
 
+/*
+ * Register the backing file and the guest memory to the ring, so that the
+ * kernel does not look up the file and pin the pages for each request.
+ * Failing to register is not fatal, the requests fall back to the plain fd
+ * and iovecs.
+ */
+static void
+iou_register(struct blockif_queue *bq)
+{
+	struct iovec regions[IOU_MEM_REGION_MAX_NUM];
+	struct io_uring *ring = &bq->ring;
+	size_t off, len;
+	int i, n, ret;
+
+	ret = io_uring_register_files(ring, &bq->bc->fd, 1);
+	if (ret < 0) {
+		pr_err("%s: io_uring_register_files fails, error %d \n", __func__, ret);
+	} else {
+		bq->fixed_file = true;
+	}
+
+	bq->nr_fixed_bufs = 0;
+	n = vm_get_mem_iovecs(regions, IOU_MEM_REGION_MAX_NUM);
+	for (i = 0; i < n; i++) {
+		for (off = 0; off < regions[i].iov_len; off += len) {
+			if (bq->nr_fixed_bufs == IOU_FIXED_BUF_MAX_NUM) {
+				pr_err("%s: too many fixed buffers, part of the guest memory is not registered \n",
+					__func__);
+				break;
+			}
+			len = regions[i].iov_len - off;
+			if (len > IOU_FIXED_BUF_MAX_LEN)
+				len = IOU_FIXED_BUF_MAX_LEN;
+			bq->fixed_bufs[bq->nr_fixed_bufs].iov_base = (char *)regions[i].iov_base + off;
+			bq->fixed_bufs[bq->nr_fixed_bufs].iov_len = len;
+			bq->nr_fixed_bufs++;
+		}
+	}
+
+	if (bq->nr_fixed_bufs > 0) {
+		ret = io_uring_register_buffers(ring, bq->fixed_bufs, bq->nr_fixed_bufs);
+		if (ret < 0) {
+			pr_err("%s: io_uring_register_buffers fails, error %d \n", __func__, ret);
+			bq->nr_fixed_bufs = 0;
+		}
+	}
+}
+
 static int
 iou_init(struct blockif_queue *bq, char *tag __attribute__((unused)))
 {
 	int ret = 0;
 	struct io_uring *ring = &bq->ring;
+	struct io_uring_params params;
 
 	/*
-	 * - When Service VM owns more dedicated cores, IORING_SETUP_SQPOLL and IORING_SETUP_IOPOLL, along with NVMe
-	 *   polling mechanism could benefit the performance.
+	 * - When Service VM owns more dedicated cores, IORING_SETUP_SQPOLL along with the registered file and
+	 *   buffers removes the syscall of each submission.
 	 * - When Service VM owns limited cores, the benefit of polling is also limited.
-	 * As in most of the use cases, Service VM does not own much dedicated cores, IORING_SETUP_SQPOLL and
-	 * IORING_SETUP_IOPOLL are not enabled by default.
+	 * As in most of the use cases, Service VM does not own much dedicated cores, IORING_SETUP_SQPOLL is
+	 * only enabled by the "sqpoll" option.
 	 */
-	ret = io_uring_queue_init(MAX_IO_URING_ENTRIES, ring, 0);
+	memset(&params, 0, sizeof(params));
+	if (bq->bc->sqpoll) {
+		params.flags |= IORING_SETUP_SQPOLL;
+		params.sq_thread_idle = IOU_SQPOLL_IDLE_MS;
+	}
+
+	ret = io_uring_queue_init_params(MAX_IO_URING_ENTRIES, ring, &params);
 	if (ret < 0) {
 		pr_err("%s: io_uring_queue_init fails, error %d \n", __func__, ret);
 	} else {
+		iou_register(bq);
+
 		ret = iou_set_iothread(bq);
 		if (ret < 0) {
 			pr_err("%s: iou_set_iothread fails \n", __func__);
@@ -1273,6 +1794,7 @@ iou_deinit(struct blockif_queue *bq)
 	struct io_uring *ring = &bq->ring;
 
 	iou_del_iothread(bq);
+	/* the registered file and buffers are released with the ring */
 	io_uring_queue_exit(ring);
 }
 
@@ -1310,7 +1832,12 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 	int max_discard_sectors, max_discard_seg, discard_sector_alignment;
 	off_t probe_arg[] = {0, 0};
 	int aio_mode;
-	int bypass_host_cache, open_flag, bst_block;
+	int bypass_host_cache, open_flag, bst_block, sqpoll;
+	int cow;
+	char *cow_backing;
+	struct cow_image *cow_img = NULL;
+	int rcache_size;
+	bool rcache_shared;
 
 	pthread_once(&blockif_once, blockif_init);
 
@@ -1338,8 +1865,19 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 	/* By default, bst_block is 1, meaning that the BST_BLOCK logic in blockif_dequeue is enabled. */
 	bst_block = 1;
 
+	/* By default, the io_uring submission queue is not polled by a kernel thread. */
+	sqpoll = 0;
+
 	candiscard = 0;
 
+	/* By default, the image is a raw file or block device. */
+	cow = 0;
+	cow_backing = NULL;
+
+	/* By default, the reads are not cached by the DM. */
+	rcache_size = 0;
+	rcache_shared = false;
+
 	if (queue_num <= 0)
 		queue_num = 1;
 
@@ -1366,6 +1904,8 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 			bypass_host_cache = 1;
 		else if (!strcmp(cp, "no_bst_block"))
 			bst_block = 0;
+		else if (!strcmp(cp, "sqpoll"))
+			sqpoll = 1;
 		else if (!strncmp(cp, "discard", strlen("discard"))) {
 			strsep(&cp, "=");
 			if (cp != NULL) {
@@ -1400,6 +1940,29 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 				sub_file_assign = 1;
 			else
 				goto err;
+		} else if (!strncmp(cp, "cow", strlen("cow"))) {
+			/*
+			 *  cow
+			 * or
+			 *  cow=<backing image>, to create the overlay if it is empty
+			 */
+			strsep(&cp, "=");
+			cow = 1;
+			cow_backing = cp;
+		} else if (!strncmp(cp, "rcache", strlen("rcache"))) {
+			/*
+			 *  rcache or rcache=<size in MB>, a cache of this DM
+			 * or
+			 *  rcache_shared or rcache_shared=<size in MB>, a cache shared with
+			 *  the other DMs that open the image with rcache_shared. Any of them
+			 *  can corrupt the data the others read from the cache, or stall
+			 *  their reads, so only use it for User VMs trusted alike.
+			 */
+			rcache_shared = !strncmp(cp, "rcache_shared", strlen("rcache_shared"));
+			strsep(&cp, "=");
+			rcache_size = RCACHE_DEFAULT_SIZE_MB;
+			if ((cp != NULL) && (dm_strtoi(cp, &cp, 10, &rcache_size) || (rcache_size <= 0)))
+				goto err;
 		} else if (!strncmp(cp, "aio", strlen("aio"))) {
 			/* aio=threads or aio=io_uring */
 			strsep(&cp, "=");
@@ -1429,7 +1992,11 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 	if (bypass_host_cache == 1) {
 		open_flag |= O_DIRECT;
 	}
-	fd = open(nopt, open_flag);
+	/* a new overlay can be created over its backing image */
+	if (cow && (cow_backing != NULL) && !ro) {
+		open_flag |= O_CREAT;
+	}
+	fd = open(nopt, open_flag, 0600);
 
 	if (fd < 0 && !ro) {
 		/* Attempt a r/w fail with a r/o open */
@@ -1454,6 +2021,25 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 	sectsz = DEV_BSIZE;
 	psectsz = psectoff = 0;
 
+	/*
+	 * Deal with COW overlays, the size is the virtual disk size
+	 */
+	if (cow) {
+		if (!S_ISREG(sbuf.st_mode) || sub_file_assign) {
+			pr_err("COW overlay %s shall be a regular file without range\n", nopt);
+			goto err;
+		}
+		cow_img = cow_open(fd, cow_backing, ro, bypass_host_cache, &size);
+		if (cow_img == NULL) {
+			pr_err("Could not open COW overlay %s\n", nopt);
+			goto err;
+		}
+		if (candiscard) {
+			WPRINTF(("discard is not supported by COW overlays\n"));
+			candiscard = 0;
+		}
+	}
+
 	if (S_ISBLK(sbuf.st_mode)) {
 		/* get size */
 		err_code = ioctl(fd, BLKGETSIZE, &sz);
@@ -1558,17 +2144,31 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 	}
 
 	bc->fd = fd;
+	bc->cow = cow_img;
+	if (rcache_size > 0) {
+		/* only the data that is never written can be cached */
+		if (cow_img != NULL)
+			bc->rcache = block_cache_get(cow_backing_fd(cow_img), (size_t)rcache_size << 20,
+					rcache_shared);
+		else if (ro)
+			bc->rcache = block_cache_get(fd, (size_t)rcache_size << 20, rcache_shared);
+		else
+			WPRINTF(("rcache needs a read-only image or a COW overlay, ignored\n"));
+	}
 	bc->isblk = S_ISBLK(sbuf.st_mode);
 	bc->candiscard = candiscard;
 	if (candiscard) {
-		bc->max_discard_sectors =
-			(max_discard_sectors != -1) ?
-				max_discard_sectors : (size / DEV_BSIZE);
+		if ((max_discard_sectors < 0) || ((uint32_t)max_discard_sectors > MAX_RANGE_SECTORS))
+			max_discard_sectors = MAX_RANGE_SECTORS;
+		bc->max_discard_sectors = max_discard_sectors;
 		bc->max_discard_seg =
 			(max_discard_seg != -1) ? max_discard_seg : 1;
 		bc->discard_sector_alignment =
 			(discard_sector_alignment != -1) ? discard_sector_alignment : 0;
 	}
+	/* the limit is per segment, the whole disk takes several segments */
+	bc->max_write_zeroes_sectors = MAX_RANGE_SECTORS;
+	bc->max_write_zeroes_seg = MAX_WRITE_ZEROES_SEGMENT;
 	bc->rdonly = ro;
 	bc->size = size;
 	bc->sectsz = sectsz;
@@ -1577,6 +2177,7 @@ blockif_open(const char *optstr, const char *ident, int queue_num, struct iothre
 	bc->wce = writeback;
 	bc->bypass_host_cache = bypass_host_cache;
 	bc->aio_mode = aio_mode;
+	bc->sqpoll = sqpoll;
 
 	if (bc->aio_mode == AIO_MODE_IO_URING) {
 		bc->ops = &blockif_ops_iou;
@@ -1637,6 +2238,10 @@ err:
 	/* handle failure case: free strdup memory*/
 	if (nopt)
 		free(nopt);
+	if (bc && bc->rcache)
+		block_cache_put(bc->rcache);
+	if (cow_img)
+		cow_close(cow_img);
 	if (fd >= 0)
 		close(fd);
 	if (bc) {
@@ -1730,6 +2335,12 @@ blockif_discard(struct blockif_ctxt *bc, struct blockif_req *breq)
 	return blockif_request(bc, breq, BOP_DISCARD);
 }
 
+int
+blockif_write_zeroes(struct blockif_ctxt *bc, struct blockif_req *breq)
+{
+	return blockif_request(bc, breq, BOP_WRITE_ZEROES);
+}
+
 int
 blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 {
@@ -1839,6 +2450,10 @@ blockif_close(struct blockif_ctxt *bc)
 	/*
 	 * Release resources
 	 */
+	if (bc->rcache)
+		block_cache_put(bc->rcache);
+	if (bc->cow)
+		cow_close(bc->cow);
 	close(bc->fd);
 	if (bc->bqs)
 		free(bc->bqs);
@@ -1934,7 +2549,7 @@ blockif_candiscard(struct blockif_ctxt *bc)
 	return bc->candiscard;
 }
 
-int
+uint32_t
 blockif_max_discard_sectors(struct blockif_ctxt *bc)
 {
 	return bc->max_discard_sectors;
@@ -1952,6 +2567,24 @@ blockif_discard_sector_alignment(struct blockif_ctxt *bc)
 	return bc->discard_sector_alignment;
 }
 
+int
+blockif_canzero(struct blockif_ctxt *bc)
+{
+	return !bc->rdonly && (bc->cow == NULL);
+}
+
+uint32_t
+blockif_max_write_zeroes_sectors(struct blockif_ctxt *bc)
+{
+	return bc->max_write_zeroes_sectors;
+}
+
+int
+blockif_max_write_zeroes_seg(struct blockif_ctxt *bc)
+{
+	return bc->max_write_zeroes_seg;
+}
+
 uint8_t
 blockif_get_wce(struct blockif_ctxt *bc)
 {
@@ -82,6 +82,34 @@ void iothread_handler(void *arg)
 	}
 }
 
+/*
+ * Called by the iothread in poll mode, handle the vq if the guest has queued
+ * buffers. Only report work when some chains were consumed: a receive queue
+ * keeps posted buffers while there is nothing to receive, and they must not
+ * keep the iothread spinning.
+ */
+static
+bool iothread_poll_handler(void *arg)
+{
+	struct virtio_iothread *viothrd = arg;
+	struct virtio_base *base = viothrd->base;
+	struct virtio_vq_info *vq = &base->queues[viothrd->idx];
+	uint16_t last_avail;
+	bool avail_wrap;
+	bool found = false;
+
+	if (viothrd->iothread_run && vq_has_descs(vq)) {
+		pthread_mutex_lock(&vq->mtx);
+		last_avail = vq->last_avail;
+		avail_wrap = vq->avail_wrap;
+		(*viothrd->iothread_run)(base, vq);
+		found = (vq->last_avail != last_avail) || (vq->avail_wrap != avail_wrap);
+		pthread_mutex_unlock(&vq->mtx);
+	}
+
+	return found;
+}
+
 void
 virtio_set_iothread(struct virtio_base *base,
 			  bool is_register)
@@ -110,6 +138,7 @@ virtio_set_iothread(struct virtio_base *base,
 			vq->viothrd.idx = idx;
 			vq->viothrd.iomvt.arg = &vq->viothrd;
 			vq->viothrd.iomvt.run = iothread_handler;
+			vq->viothrd.iomvt.poll = iothread_poll_handler;
 			vq->viothrd.iomvt.fd = vq->viothrd.kick_fd;
 
 			if (!iothread_add(vq->viothrd.ioctx, vq->viothrd.kick_fd, &vq->viothrd.iomvt))
@@ -167,7 +196,7 @@ virtio_poll_timer(void *arg, uint64_t nexp)
 		vq = &base->queues[i];
 		if(!vq_ring_ready(vq))
 			continue;
-		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+		vq_set_used_ring_flags(vq);
 		/* TODO: call notify when necessary */
 		if (vq->notify)
 			(*vq->notify)(DEV_STRUCT(base), vq);
@@ -278,6 +307,9 @@ virtio_reset_dev(struct virtio_base *base)
 		vq->gpa_used[0] = 0;
 		vq->gpa_used[1] = 0;
 		vq->enabled = 0;
+		vq->packed = false;
+		free(vq->chain_ndesc);
+		vq->chain_ndesc = NULL;
 	}
 	base->negotiated_caps = 0;
 	base->curq = 0;
@@ -419,6 +451,53 @@ error:
 	pr_err("%s: vq enable failed\n", __func__);
 }
 
+/*
+ * Map the packed ring of a virtqueue: the descriptor ring, and the driver
+ * and device event suppression structures in place of the avail and used
+ * rings.
+ */
+static int
+virtio_vq_enable_packed(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	uint16_t qsz = vq->qsize;
+	uint64_t phys;
+	void *vb;
+
+	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+		qsz * sizeof(struct vring_packed_desc));
+	if (!vb)
+		return -1;
+	vq->pdesc = vb;
+
+	phys = (((uint64_t)vq->gpa_avail[1]) << 32) | vq->gpa_avail[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+		sizeof(struct vring_packed_desc_event));
+	if (!vb)
+		return -1;
+	vq->driver_event = vb;
+
+	phys = (((uint64_t)vq->gpa_used[1]) << 32) | vq->gpa_used[0];
+	vb = paddr_guest2host(base->dev->vmctx, phys,
+		sizeof(struct vring_packed_desc_event));
+	if (!vb)
+		return -1;
+	vq->device_event = vb;
+
+	free(vq->chain_ndesc);
+	vq->chain_ndesc = calloc(2 * qsz, sizeof(uint16_t));
+	if (!vq->chain_ndesc)
+		return -1;
+
+	vq->packed = true;
+	vq->avail_wrap = true;
+	vq->used_wrap = true;
+	vq->save_used_wrap = true;
+	vq->used_idx = 0;
+
+	return 0;
+}
+
 /*
  * Initialize the currently-selected virtio queue (base->curq).
  * The guest just gave us the gpa of desc array, avail ring and
@@ -437,6 +516,12 @@ virtio_vq_enable(struct virtio_base *base)
 	vq = &base->queues[base->curq];
 	qsz = vq->qsize;
 
+	if (base->negotiated_caps & (1UL << VIRTIO_F_RING_PACKED)) {
+		if (virtio_vq_enable_packed(base, vq) < 0)
+			goto error;
+		goto enabled;
+	}
+
 	/* descriptors */
 	phys = (((uint64_t)vq->gpa_desc[1]) << 32) | vq->gpa_desc[0];
 	size = qsz * sizeof(struct vring_desc);
@@ -462,6 +547,7 @@ virtio_vq_enable(struct virtio_base *base)
 		goto error;
 	vq->used = (struct vring_used *)vb;
 
+enabled:
 	/* Start at 0 when we use it. */
 	vq->last_avail = 0;
 	vq->save_used = 0;
@@ -485,24 +571,120 @@ virtio_vq_enable(struct virtio_base *base)
  *        fails.
  */
 static inline int
-_vq_record(int i, volatile struct vring_desc *vd, struct vmctx *ctx,
-	   struct iovec *iov, int n_iov, uint16_t *flags) {
+_vq_record(int i, uint64_t addr, uint32_t len, uint16_t vd_flags,
+	   struct vmctx *ctx, struct iovec *iov, int n_iov, uint16_t *flags) {
 
 	void *host_addr;
 
 	if (i >= n_iov)
 		return -1;
-	host_addr = paddr_guest2host(ctx, vd->addr, vd->len);
+	host_addr = paddr_guest2host(ctx, addr, len);
 	if (!host_addr)
 		return -1;
 	iov[i].iov_base = host_addr;
-	iov[i].iov_len = vd->len;
+	iov[i].iov_len = len;
 	if (flags != NULL)
-		flags[i] = vd->flags;
+		flags[i] = vd_flags;
 	return 0;
 }
 #define	VQ_MAX_DESCRIPTORS	512	/* see below */
 
+/*
+ * vq_getchain() for the packed ring layout. The chain is made of the
+ * descriptors following each other in the ring, the last one carries the
+ * buffer id. An indirect descriptor points to a table of descriptors
+ * without "next" links.
+ *
+ * As with the split ring, the chain is consumed even if it is invalid, so
+ * that the caller can return it with vq_relchain().
+ */
+static int
+vq_getchain_packed(struct virtio_vq_info *vq, uint16_t *pidx,
+		   struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	volatile struct vring_packed_desc *vd, *vindir;
+	struct virtio_base *base = vq->base;
+	const char *name = base->vops->name;
+	struct vmctx *ctx = base->dev->vmctx;
+	uint16_t idx, ndesc, vd_flags;
+	u_int j, n_indir;
+	int i = 0;
+	bool err = false;
+
+	if (!vq_packed_desc_avail(vq, vq->last_avail, vq->avail_wrap))
+		return 0;
+
+	/* read the descriptors only after their avail flag */
+	atomic_thread_fence();
+
+	for (ndesc = 0; ndesc < vq->qsize; ) {
+		idx = vq->last_avail;
+		vd = &vq->pdesc[idx];
+		vd_flags = vd->flags;
+		*pidx = vd->id;
+
+		ndesc++;
+		if (++vq->last_avail == vq->qsize) {
+			vq->last_avail = 0;
+			vq->avail_wrap = !vq->avail_wrap;
+		}
+
+		if (err) {
+			/* skip to the end of the invalid chain */
+		} else if ((vd_flags & VRING_DESC_F_INDIRECT) == 0) {
+			if (_vq_record(i, vd->addr, vd->len, vd_flags,
+					ctx, iov, n_iov, flags)) {
+				pr_err("%s: mapping to host failed\r\n", name);
+				err = true;
+			}
+			i++;
+		} else if ((base->device_caps &
+		    (1 << VIRTIO_RING_F_INDIRECT_DESC)) == 0) {
+			pr_err("%s: descriptor has forbidden INDIRECT flag, "
+			    "driver confused?\r\n", name);
+			err = true;
+		} else {
+			n_indir = vd->len / 16;
+			vindir = paddr_guest2host(ctx, vd->addr, vd->len);
+			if ((vd->len & 0xf) || n_indir == 0 || !vindir) {
+				pr_err("%s: invalid indir len 0x%x, "
+				    "driver confused?\r\n", name, (u_int)vd->len);
+				err = true;
+				n_indir = 0;
+			}
+			for (j = 0; j < n_indir; j++) {
+				if (i >= VQ_MAX_DESCRIPTORS) {
+					pr_err("%s: descriptor loop? count > %d - "
+					    "driver confused?\r\n", name, i);
+					err = true;
+					break;
+				}
+				if (_vq_record(i, vindir[j].addr, vindir[j].len,
+						vindir[j].flags, ctx, iov, n_iov, flags)) {
+					pr_err("%s: mapping to host failed\r\n", name);
+					err = true;
+					break;
+				}
+				i++;
+			}
+		}
+
+		if ((vd_flags & VRING_DESC_F_NEXT) == 0) {
+			/* keep the chain length for vq_relchain() and vq_retchain() */
+			if (*pidx < vq->qsize)
+				vq->chain_ndesc[*pidx] = ndesc;
+			else
+				err = true;
+			vq->chain_ndesc[vq->qsize + idx] = ndesc;
+			return err ? -1 : i;
+		}
+	}
+
+	pr_err("%s: descriptor loop? count > %d - driver confused?\r\n",
+	    name, (int)ndesc);
+	return -1;
+}
+
 /*
  * Examine the chain of descriptors starting at the "next one" to
  * make sure that they describe a sensible request.  If so, return
@@ -542,57 +724,22 @@ _vq_record(int i, volatile struct vring_desc *vd, struct vmctx *ctx,
  * You are assumed to have done a vq_ring_ready() if needed (note
  * that vq_has_descs() does one).
  */
-int
-vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
-	    struct iovec *iov, int n_iov, uint16_t *flags)
+/*
+ * Walk the chain of a split ring starting at descriptor @next, see
+ * vq_getchain().
+ */
+static int
+_vq_getchain_split(struct virtio_vq_info *vq, u_int next,
+		   struct iovec *iov, int n_iov, uint16_t *flags)
 {
 	int i;
-	u_int ndesc, n_indir;
-	u_int idx, next;
+	u_int n_indir;
 
 	volatile struct vring_desc *vdir, *vindir, *vp;
-	struct vmctx *ctx;
-	struct virtio_base *base;
-	const char *name;
+	struct virtio_base *base = vq->base;
+	struct vmctx *ctx = base->dev->vmctx;
+	const char *name = base->vops->name;
 
-	base = vq->base;
-	name = base->vops->name;
-
-	/*
-	 * Note: it's the responsibility of the guest not to
-	 * update vq->avail->idx until all of the descriptors
-	 * the guest has written are valid (including all their
-	 * next fields and vd_flags).
-	 *
-	 * Compute (last_avail - idx) in integers mod 2**16.  This is
-	 * the number of descriptors the device has made available
-	 * since the last time we updated vq->last_avail.
-	 *
-	 * We just need to do the subtraction as an unsigned int,
-	 * then trim off excess bits.
-	 */
-	idx = vq->last_avail;
-	ndesc = (uint16_t)((u_int)vq->avail->idx - idx);
-	if (ndesc == 0)
-		return 0;
-	if (ndesc > vq->qsize) {
-		/* XXX need better way to diagnose issues */
-		pr_err("%s: ndesc (%u) out of range, driver confused?\r\n",
-		    name, (u_int)ndesc);
-		return -1;
-	}
-
-	/*
-	 * Now count/parse "involved" descriptors starting from
-	 * the head of the chain.
-	 *
-	 * To prevent loops, we could be more complicated and
-	 * check whether we're re-visiting a previously visited
-	 * index, but we just abort if the count gets excessive.
-	 */
-	ctx = base->dev->vmctx;
-	*pidx = next = vq->avail->ring[idx & (vq->qsize - 1)];
-	vq->last_avail++;
 	for (i = 0; i < VQ_MAX_DESCRIPTORS; next = vdir->next) {
 		if (next >= vq->qsize) {
 			pr_err("%s: descriptor index %u out of range, "
@@ -602,7 +749,8 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 		}
 		vdir = &vq->desc[next];
 		if ((vdir->flags & VRING_DESC_F_INDIRECT) == 0) {
-			if (_vq_record(i, vdir, ctx, iov, n_iov, flags)) {
+			if (_vq_record(i, vdir->addr, vdir->len, vdir->flags,
+					ctx, iov, n_iov, flags)) {
 				pr_err("%s: mapping to host failed\r\n", name);
 				return -1;
 			}
@@ -644,7 +792,8 @@ vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 					    name);
 					return -1;
 				}
-				if (_vq_record(i, vp, ctx, iov, n_iov, flags)) {
+				if (_vq_record(i, vp->addr, vp->len, vp->flags,
+						ctx, iov, n_iov, flags)) {
 					pr_err("%s: mapping to host failed\r\n", name);
 					return -1;
 				}
@@ -670,6 +819,133 @@ loopy:
 	return -1;
 }
 
+int
+vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
+	    struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	u_int ndesc, idx, next;
+	struct virtio_base *base;
+	const char *name;
+
+	if (vq->packed)
+		return vq_getchain_packed(vq, pidx, iov, n_iov, flags);
+
+	base = vq->base;
+	name = base->vops->name;
+
+	/*
+	 * Note: it's the responsibility of the guest not to
+	 * update vq->avail->idx until all of the descriptors
+	 * the guest has written are valid (including all their
+	 * next fields and vd_flags).
+	 *
+	 * Compute (last_avail - idx) in integers mod 2**16.  This is
+	 * the number of descriptors the device has made available
+	 * since the last time we updated vq->last_avail.
+	 *
+	 * We just need to do the subtraction as an unsigned int,
+	 * then trim off excess bits.
+	 */
+	idx = vq->last_avail;
+	ndesc = (uint16_t)((u_int)vq->avail->idx - idx);
+	if (ndesc == 0)
+		return 0;
+	if (ndesc > vq->qsize) {
+		/* XXX need better way to diagnose issues */
+		pr_err("%s: ndesc (%u) out of range, driver confused?\r\n",
+		    name, (u_int)ndesc);
+		return -1;
+	}
+
+	/*
+	 * Now count/parse "involved" descriptors starting from
+	 * the head of the chain.
+	 *
+	 * To prevent loops, we could be more complicated and
+	 * check whether we're re-visiting a previously visited
+	 * index, but we just abort if the count gets excessive.
+	 */
+	*pidx = next = vq->avail->ring[idx & (vq->qsize - 1)];
+	vq->last_avail++;
+
+	return _vq_getchain_split(vq, next, iov, n_iov, flags);
+}
+
+/*
+ * Fetch up to @max_chains chains at once. The chains are placed one after
+ * the other in @iov (and @flags), each one may take up to @chain_iov
+ * entries; fetching stops when less than that is left.
+ *
+ * With the split ring, the avail index is read once for the batch and the
+ * heads of the chains are prefetched before the chains are walked.
+ *
+ * A chain failing as in vq_getchain() is consumed and reported with
+ * n < 0, so that the caller can return it with the others.
+ *
+ * Returns the number of chains fetched.
+ */
+int
+vq_getchains_batch(struct virtio_vq_info *vq, struct vq_chain *chains,
+		   int max_chains, struct iovec *iov, int n_iov,
+		   uint16_t *flags, int chain_iov)
+{
+	u_int ndesc, idx, mask;
+	uint16_t avail_idx;
+	int i, used_iov = 0;
+
+	if (!vq_has_descs(vq))
+		return 0;
+
+	if (vq->packed) {
+		for (i = 0; (i < max_chains) && (n_iov - used_iov >= chain_iov); i++) {
+			chains[i].idx = vq->qsize;
+			chains[i].iov = &iov[used_iov];
+			chains[i].flags = flags ? &flags[used_iov] : NULL;
+			chains[i].n = vq_getchain_packed(vq, &chains[i].idx,
+				chains[i].iov, chain_iov, chains[i].flags);
+			if (chains[i].n == 0)
+				break;
+			if (chains[i].n > 0)
+				used_iov += chains[i].n;
+		}
+		return i;
+	}
+
+	/* the guest may have moved the avail index since vq_has_descs() */
+	avail_idx = vq->avail->idx;
+	idx = vq->last_avail;
+	ndesc = (uint16_t)((u_int)avail_idx - idx);
+	if (ndesc > vq->qsize) {
+		pr_err("%s: ndesc (%u) out of range, driver confused?\r\n",
+			vq->base->vops->name, ndesc);
+		return 0;
+	}
+	if (ndesc > (u_int)max_chains)
+		ndesc = max_chains;
+	mask = vq->qsize - 1;
+
+	/* the avail entries are not to be read before the avail index */
+	atomic_thread_fence();
+
+	for (i = 0; i < ndesc; i++) {
+		chains[i].idx = vq->avail->ring[(idx + i) & mask];
+		if (chains[i].idx < vq->qsize)
+			__builtin_prefetch((const void *)&vq->desc[chains[i].idx]);
+	}
+
+	for (i = 0; (i < ndesc) && (n_iov - used_iov >= chain_iov); i++) {
+		chains[i].iov = &iov[used_iov];
+		chains[i].flags = flags ? &flags[used_iov] : NULL;
+		vq->last_avail++;
+		chains[i].n = _vq_getchain_split(vq, chains[i].idx,
+			chains[i].iov, chain_iov, chains[i].flags);
+		if (chains[i].n > 0)
+			used_iov += chains[i].n;
+	}
+
+	return i;
+}
+
 /*
  * Return the currently-first request chain back to the available queue.
  *
@@ -679,6 +955,20 @@ loopy:
 void
 vq_retchain(struct virtio_vq_info *vq)
 {
+	uint16_t tail, ndesc;
+
+	if (vq->packed) {
+		/* step back over the descriptors of the last chain */
+		tail = (vq->last_avail == 0) ? vq->qsize - 1 : vq->last_avail - 1;
+		ndesc = vq->chain_ndesc[vq->qsize + tail];
+		if (vq->last_avail < ndesc) {
+			vq->last_avail += vq->qsize - ndesc;
+			vq->avail_wrap = !vq->avail_wrap;
+		} else
+			vq->last_avail -= ndesc;
+		return;
+	}
+
 	vq->last_avail--;
 }
 
@@ -695,6 +985,28 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	uint16_t uidx, mask;
 	volatile struct vring_used *vuh;
 	volatile struct vring_used_elem *vue;
+	volatile struct vring_packed_desc *vd;
+
+	if (vq->packed) {
+		/*
+		 * The used descriptor is written in the next used position,
+		 * which then skips the descriptors of the chain, as the driver
+		 * does when it frees the buffer.
+		 */
+		vd = &vq->pdesc[vq->used_idx];
+		vd->id = idx;
+		vd->len = iolen;
+		atomic_thread_fence();
+		vd->flags = vq->used_wrap ?
+			((1 << VRING_PACKED_DESC_F_AVAIL) | (1 << VRING_PACKED_DESC_F_USED)) : 0;
+
+		vq->used_idx += (idx < vq->qsize) ? vq->chain_ndesc[idx] : 1;
+		if (vq->used_idx >= vq->qsize) {
+			vq->used_idx -= vq->qsize;
+			vq->used_wrap = !vq->used_wrap;
+		}
+		return;
+	}
 
 	/*
 	 * Notes:
@@ -716,6 +1028,78 @@ vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
 	vuh->idx = uidx;
 }
 
+/*
+ * vq_endchains() for the packed ring layout, the driver event suppression
+ * structure tells whether to interrupt: always, never, or once the used
+ * position crosses a given one (with VIRTIO_RING_F_EVENT_IDX).
+ */
+static void
+vq_endchains_packed(struct virtio_vq_info *vq, int used_all_avail)
+{
+	struct virtio_base *base = vq->base;
+	uint16_t old_idx, new_idx, off_wrap, off, event_flags;
+	bool old_wrap;
+	int intr;
+
+	old_idx = vq->save_used;
+	old_wrap = vq->save_used_wrap;
+	vq->save_used = new_idx = vq->used_idx;
+	vq->save_used_wrap = vq->used_wrap;
+
+	event_flags = vq->driver_event->flags;
+	if (used_all_avail &&
+	    (base->negotiated_caps & (1 << VIRTIO_F_NOTIFY_ON_EMPTY)))
+		intr = 1;
+	else if ((new_idx == old_idx) && (old_wrap == vq->used_wrap))
+		intr = 0;
+	else if (event_flags == VRING_PACKED_EVENT_FLAG_DESC) {
+		atomic_thread_fence();
+		off_wrap = vq->driver_event->off_wrap;
+		off = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+		/* make the positions comparable across the wrap */
+		if (new_idx <= old_idx)
+			old_idx -= vq->qsize;
+		if (!!(off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) != vq->used_wrap)
+			off -= vq->qsize;
+		intr = (uint16_t)(new_idx - off - 1) < (uint16_t)(new_idx - old_idx);
+	} else
+		intr = (event_flags != VRING_PACKED_EVENT_FLAG_DISABLE);
+
+	if (intr)
+		vq_interrupt(base, vq);
+}
+
+/*
+ * Return @nchains chains to the guest with the I/O length of each.
+ *
+ * With the split ring, the used index is published once for the batch.
+ */
+void
+vq_relchains_batch(struct virtio_vq_info *vq, struct vq_chain *chains, int nchains)
+{
+	uint16_t uidx, mask;
+	volatile struct vring_used *vuh;
+	volatile struct vring_used_elem *vue;
+	int i;
+
+	if (vq->packed) {
+		for (i = 0; i < nchains; i++)
+			vq_relchain(vq, chains[i].idx, chains[i].len);
+		return;
+	}
+
+	mask = vq->qsize - 1;
+	vuh = vq->used;
+
+	uidx = vuh->idx;
+	for (i = 0; i < nchains; i++) {
+		vue = &vuh->ring[uidx++ & mask];
+		vue->id = chains[i].idx;
+		vue->len = chains[i].len;
+	}
+	vuh->idx = uidx;
+}
+
 /*
  * Driver has finished processing "available" chains and calling
  * vq_relchain on each one.  If driver used all the available
@@ -738,7 +1122,7 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 	uint16_t event_idx, new_idx, old_idx;
 	int intr;
 
-	if (!vq || !vq->used)
+	if (!vq || !vq_ring_ready(vq))
 		return;
 
 	/*
@@ -753,6 +1137,11 @@ vq_endchains(struct virtio_vq_info *vq, int used_all_avail)
 
 	atomic_thread_fence();
 
+	if (vq->packed) {
+		vq_endchains_packed(vq, used_all_avail);
+		return;
+	}
+
 	base = vq->base;
 	old_idx = vq->save_used;
 	vq->save_used = new_idx = vq->used->idx;
@@ -794,9 +1183,31 @@ void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *v
 	if (virtio_poll_enabled && backend_type == BACKEND_VBSU && polling_in_progress == 1)
 		return;
 
+	if (vq->packed) {
+		vq->device_event->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+		return;
+	}
 	vq->used->flags &= ~VRING_USED_F_NO_NOTIFY;
 }
 
+/**
+ * @brief Helper function for setting used ring flags.
+ *
+ * Asks the driver not to notify the device of new available buffers. With
+ * the packed layout, the device event suppression flags are used instead
+ * of the used ring flags.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ */
+void vq_set_used_ring_flags(struct virtio_vq_info *vq)
+{
+	if (vq->packed) {
+		vq->device_event->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+		return;
+	}
+	vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+}
+
 struct config_reg {
 	uint16_t	offset;	/* register offset */
 	uint8_t		size;	/* size (bytes) */
@@ -1347,6 +1758,22 @@ static struct cap_region {
 		VIRTIO_PCI_CAP_NOTIFY_CFG},
 };
 
+/*
+ * The features offered to the driver of a modern device. The packed ring
+ * layout is handled by the vq_* helpers, so it is offered whenever the
+ * rings are processed in the device model.
+ */
+static uint64_t
+virtio_offered_caps(struct virtio_base *base)
+{
+	uint64_t caps = base->device_caps;
+
+	if (base->backend_type == BACKEND_VBSU)
+		caps |= 1UL << VIRTIO_F_RING_PACKED;
+
+	return caps;
+}
+
 static inline int
 virtio_get_cap_id(uint64_t offset, int size)
 {
@@ -1395,9 +1822,9 @@ virtio_common_cfg_read(struct pci_vdev *dev, uint64_t offset, int size)
 		break;
 	case VIRTIO_PCI_COMMON_DF:
 		if (base->device_feature_select == 0)
-			value = base->device_caps & 0xffffffff;
+			value = virtio_offered_caps(base) & 0xffffffff;
 		else if (base->device_feature_select == 1)
-			value = (base->device_caps >> 32) & 0xffffffff;
+			value = (virtio_offered_caps(base) >> 32) & 0xffffffff;
 		else /* present 0, see 4.1.4.3.1 */
 			value = 0;
 		break;
@@ -1521,11 +1948,11 @@ virtio_common_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 		if (base->driver_feature_select < 2) {
 			value &= 0xffffffff;
 			if (base->driver_feature_select == 0) {
-				features = base->device_caps & value;
+				features = virtio_offered_caps(base) & value;
 				base->negotiated_caps &= ~0xffffffffULL;
 			} else {
 				features = (value << 32)
-					& base->device_caps;
+					& virtio_offered_caps(base);
 				base->negotiated_caps &= 0xffffffffULL;
 			}
 			base->negotiated_caps |= features;
@@ -46,6 +46,10 @@
 #define VIRTIO_BLK_RINGSZ	64
 #define VIRTIO_BLK_MAX_OPTS_LEN	256
 
+/* chains fetched at once, and the iov[] entries for room for a few large ones */
+#define VIRTIO_BLK_BATCH	32
+#define VIRTIO_BLK_BATCH_IOV	(4 * (BLOCKIF_IOV_MAX + 2))
+
 #define VIRTIO_BLK_S_OK	0
 #define VIRTIO_BLK_S_IOERR	1
 #define	VIRTIO_BLK_S_UNSUPP	2
@@ -63,6 +67,7 @@
 #define	VIRTIO_BLK_F_CONFIG_WCE	(1 << 11)
 #define	VIRTIO_BLK_F_MQ		(1 << 12)	/* support more than one vq */
 #define	VIRTIO_BLK_F_DISCARD	(1 << 13)
+#define	VIRTIO_BLK_F_WRITE_ZEROES	(1 << 14)
 
 /*
  * Basic device capabilities
@@ -109,6 +114,13 @@ struct virtio_blk_config {
 	uint32_t max_discard_seg;
 	/* Discard commands must be aligned to this number of sectors. */
 	uint32_t discard_sector_alignment;
+	/* The maximum write zeroes sectors (in 512-byte sectors) for one segment */
+	uint32_t max_write_zeroes_sectors;
+	/* The maximum number of write zeroes segments */
+	uint32_t max_write_zeroes_seg;
+	/* Whether the ranges of write zeroes commands may be deallocated */
+	uint8_t write_zeroes_may_unmap;
+	uint8_t unused1[3];
 } __attribute__((packed));
 
 /*
@@ -121,6 +133,7 @@ struct virtio_blk_hdr {
 #define	VBH_OP_FLUSH_OUT	5
 #define	VBH_OP_IDENT		8
 #define	VBH_OP_DISCARD		11
+#define	VBH_OP_WRITE_ZEROES	13
 #define	VBH_FLAG_BARRIER	0x80000000	/* OR'ed into type */
 	uint32_t type;
 	uint32_t ioprio;
@@ -223,7 +236,8 @@ virtio_blk_abort(struct virtio_vq_info *vq, uint16_t idx)
 }
 
 static void
-virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
+virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq,
+		struct vq_chain *chain)
 {
 	struct virtio_blk_hdr *vbh;
 	struct virtio_blk_ioreq *io;
@@ -231,23 +245,22 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	int err;
 	ssize_t iolen;
 	int writeop, type;
-	struct iovec iov[BLOCKIF_IOV_MAX + 2];
-	uint16_t idx, flags[BLOCKIF_IOV_MAX + 2];
+	struct iovec *iov = chain->iov;
+	uint16_t idx = chain->idx, *flags = chain->flags;
 
 	qidx = vq - blk->vqs;
-	idx = vq->qsize;
-	n = vq_getchain(vq, &idx, iov, BLOCKIF_IOV_MAX + 2, flags);
+	n = chain->n;
 
 	/*
 	 * The first descriptor will be the read-only fixed header,
-	 * and the last is for status (hence +2 above and below).
+	 * and the last is for status (hence +2 in the batch fetch and below).
 	 * The remaining iov's are the actual data I/O vectors.
 	 *
 	 * XXX - note - this fails on crash dump, which does a
 	 * VIRTIO_BLK_T_FLUSH with a zero transfer length
 	 */
 	if (n < 2 || n > BLOCKIF_IOV_MAX + 2) {
-		WPRINTF(("%s: vq_getchain failed\n", __func__));
+		WPRINTF(("%s: vq_getchains_batch failed\n", __func__));
 		virtio_blk_abort(vq, idx);
 		return;
 	}
@@ -284,7 +297,8 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	 */
 	type = vbh->type & ~VBH_FLAG_BARRIER;
 	writeop = ((type == VBH_OP_WRITE) ||
-			(type == VBH_OP_DISCARD));
+			(type == VBH_OP_DISCARD) ||
+			(type == VBH_OP_WRITE_ZEROES));
 
 	if (blk->dummy_bctxt) {
 		WPRINTF(("Block context invalid: Operation cannot be permitted!\n"));
@@ -316,7 +330,7 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	io->req.resid = iolen;
 
 	DPRINTF(("virtio_blk: %s op, %zd bytes, %d segs, offset %ld\n\r",
-		 writeop ? "write/discard" : "read/ident", iolen, i - 1,
+		 writeop ? "write/discard/zeroes" : "read/ident", iolen, i - 1,
 		 io->req.offset));
 
 	switch (type) {
@@ -348,6 +362,9 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	case VBH_OP_DISCARD:
 		err = blockif_discard(blk->bc, &io->req);
 		break;
+	case VBH_OP_WRITE_ZEROES:
+		err = blockif_write_zeroes(blk->bc, &io->req);
+		break;
 	case VBH_OP_FLUSH:
 	case VBH_OP_FLUSH_OUT:
 		err = blockif_flush(blk->bc, &io->req);
@@ -368,6 +385,23 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 		WPRINTF(("%s: request process failed\n", __func__));
 }
 
+/*
+ * Fetch the requests in batches of up to VIRTIO_BLK_BATCH chains
+ */
+static void
+virtio_blk_proc_batch(struct virtio_blk *blk, struct virtio_vq_info *vq)
+{
+	struct vq_chain chains[VIRTIO_BLK_BATCH];
+	struct iovec iov[VIRTIO_BLK_BATCH_IOV];
+	uint16_t flags[VIRTIO_BLK_BATCH_IOV];
+	int i, n;
+
+	n = vq_getchains_batch(vq, chains, VIRTIO_BLK_BATCH, iov,
+			VIRTIO_BLK_BATCH_IOV, flags, BLOCKIF_IOV_MAX + 2);
+	for (i = 0; i < n; i++)
+		virtio_blk_proc(blk, vq, &chains[i]);
+}
+
 static void
 virtio_blk_notify(void *vdev, struct virtio_vq_info *vq)
 {
@@ -390,7 +424,7 @@ virtio_blk_notify(void *vdev, struct virtio_vq_info *vq)
 		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
 		mb();
 		do {
-			virtio_blk_proc(blk, vq);
+			virtio_blk_proc_batch(blk, vq);
 		} while (vq_has_descs(vq));
 
 		vq_clear_used_ring_flags(&blk->base, vq);
@@ -410,6 +444,9 @@ virtio_blk_get_caps(struct virtio_blk *blk, bool wb)
 	if (blockif_candiscard(blk->bc))
 		caps |= VIRTIO_BLK_F_DISCARD;
 
+	if (blockif_canzero(blk->bc))
+		caps |= VIRTIO_BLK_F_WRITE_ZEROES;
+
 	if (blockif_is_ro(blk->bc))
 		caps |= VIRTIO_BLK_F_RO;
 
@@ -450,6 +487,12 @@ virtio_blk_update_config_space(struct virtio_blk *blk)
 		blk->cfg.max_discard_seg = blockif_max_discard_seg(blk->bc);
 		blk->cfg.discard_sector_alignment = blockif_discard_sector_alignment(blk->bc);
 	}
+	if (blockif_canzero(blk->bc)) {
+		blk->cfg.max_write_zeroes_sectors = blockif_max_write_zeroes_sectors(blk->bc);
+		blk->cfg.max_write_zeroes_seg = blockif_max_write_zeroes_seg(blk->bc);
+		/* punching holes keeps sparse images sparse */
+		blk->cfg.write_zeroes_may_unmap = blockif_candiscard(blk->bc) ? 1 : 0;
+	}
 	blk->base.device_caps =
 		virtio_blk_get_caps(blk, !!blk->cfg.writeback);
 }
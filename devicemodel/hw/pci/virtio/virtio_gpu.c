@@ -217,6 +217,7 @@ struct virtio_gpu_resource_2d {
 	pixman_image_t *image;
 	struct iovec *iov;
 	uint32_t iovcnt;
+	uint64_t *iov_offset;	/* offset of each iov in the backing store */
 	bool blob;
 	struct dma_buf_info *dma_info;
 	LIST_ENTRY(virtio_gpu_resource_2d) link;
@@ -445,6 +446,93 @@ virtio_gpu_set_status(void *vdev, uint64_t status)
 	gpu->base.status = status;
 }
 
+/*
+ * Allocate the @nr_entries backing iovecs of @r2d, followed by the index
+ * of their offsets in the backing store.
+ */
+static struct iovec *
+virtio_gpu_alloc_backing(struct virtio_gpu_resource_2d *r2d, uint32_t nr_entries)
+{
+	struct iovec *iov;
+
+	iov = malloc(nr_entries * (sizeof(struct iovec) + sizeof(uint64_t)));
+	if (iov) {
+		r2d->iov = iov;
+		r2d->iovcnt = nr_entries;
+		r2d->iov_offset = (uint64_t *)(iov + nr_entries);
+	}
+	return iov;
+}
+
+/*
+ * Index the offsets of the backing iovecs once they are filled, the
+ * unmapped ones are skipped by the transfers so they take no room.
+ */
+static void
+virtio_gpu_index_backing(struct virtio_gpu_resource_2d *r2d)
+{
+	uint64_t offset = 0;
+	uint32_t i;
+
+	for (i = 0; i < r2d->iovcnt; i++) {
+		r2d->iov_offset[i] = offset;
+		if (r2d->iov[i].iov_base)
+			offset += r2d->iov[i].iov_len;
+	}
+}
+
+static void
+virtio_gpu_free_backing(struct virtio_gpu_resource_2d *r2d)
+{
+	free(r2d->iov);
+	r2d->iov = NULL;
+	r2d->iov_offset = NULL;
+	r2d->iovcnt = 0;
+}
+
+/*
+ * Copy @len bytes from @offset in the backing store of @r2d to @dst.
+ * Return the number of bytes copied, less than @len if the backing store
+ * ends before.
+ */
+static size_t
+virtio_gpu_copy_from_backing(struct virtio_gpu_resource_2d *r2d, uint64_t offset,
+		void *dst, size_t len)
+{
+	uint32_t lo, hi, mid, i;
+	uint64_t in;
+	size_t done = 0, bytes;
+
+	if ((r2d->iov == NULL) || (r2d->iovcnt == 0))
+		return 0;
+
+	/* the last iov starting at or before offset */
+	lo = 0;
+	hi = r2d->iovcnt - 1;
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		if (r2d->iov_offset[mid] <= offset)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	for (i = lo; (i < r2d->iovcnt) && (done < len); i++) {
+		if ((r2d->iov[i].iov_base == NULL) || (r2d->iov[i].iov_len == 0))
+			continue;
+		if (offset + done < r2d->iov_offset[i])
+			break;
+		in = offset + done - r2d->iov_offset[i];
+		if (in >= r2d->iov[i].iov_len)
+			continue;
+		bytes = ((len - done) < (r2d->iov[i].iov_len - in)) ?
+			(len - done) : (r2d->iov[i].iov_len - in);
+		memcpy(dst + done, r2d->iov[i].iov_base + in, bytes);
+		done += bytes;
+	}
+	return done;
+}
+
 static void
 virtio_gpu_reset(void *vdev)
 {
@@ -466,10 +554,7 @@ virtio_gpu_reset(void *vdev)
 				r2d->blob = false;
 			}
 			LIST_REMOVE(r2d, link);
-			if (r2d->iov) {
-				free(r2d->iov);
-				r2d->iov = NULL;
-			}
+			virtio_gpu_free_backing(r2d);
 			free(r2d);
 		}
 	}
@@ -755,10 +840,7 @@ virtio_gpu_cmd_resource_unref(struct virtio_gpu_command *cmd)
 			r2d->blob = false;
 		}
 		LIST_REMOVE(r2d, link);
-		if (r2d->iov) {
-			free(r2d->iov);
-			r2d->iov = NULL;
-		}
+		virtio_gpu_free_backing(r2d);
 		free(r2d);
 		resp.type = VIRTIO_GPU_RESP_OK_NODATA;
 	} else {
@@ -802,17 +884,15 @@ virtio_gpu_cmd_resource_attach_backing(struct virtio_gpu_command *cmd)
 
 	r2d = virtio_gpu_find_resource_2d(cmd->gpu, req.resource_id);
 	if (r2d && req.nr_entries > 0) {
-		iov = malloc(req.nr_entries * sizeof(struct iovec));
+		iov = virtio_gpu_alloc_backing(r2d, req.nr_entries);
 		if (!iov) {
 			resp.type = VIRTIO_GPU_RESP_ERR_OUT_OF_MEMORY;
 			goto exit;
 		}
 
-		r2d->iov = iov;
-		r2d->iovcnt = req.nr_entries;
 		entries = calloc(req.nr_entries, sizeof(struct virtio_gpu_mem_entry));
 		if (!entries) {
-			free(iov);
+			virtio_gpu_free_backing(r2d);
 			resp.type = VIRTIO_GPU_RESP_ERR_OUT_OF_MEMORY;
 			goto exit;
 		}
@@ -828,6 +908,7 @@ virtio_gpu_cmd_resource_attach_backing(struct virtio_gpu_command *cmd)
 					entries[i].length);
 			r2d->iov[i].iov_len = entries[i].length;
 		}
+		virtio_gpu_index_backing(r2d);
 		free(entries);
 		resp.type = VIRTIO_GPU_RESP_OK_NODATA;
 	} else {
@@ -851,10 +932,8 @@ virtio_gpu_cmd_resource_detach_backing(struct virtio_gpu_command *cmd)
 	memset(&resp, 0, sizeof(resp));
 
 	r2d = virtio_gpu_find_resource_2d(cmd->gpu, req.resource_id);
-	if (r2d && r2d->iov) {
-		free(r2d->iov);
-		r2d->iov = NULL;
-	}
+	if (r2d)
+		virtio_gpu_free_backing(r2d);
 
 	cmd->iolen = sizeof(resp);
 	resp.type = VIRTIO_GPU_RESP_OK_NODATA;
@@ -936,10 +1015,9 @@ virtio_gpu_cmd_transfer_to_host_2d(struct virtio_gpu_command *cmd)
 	struct virtio_gpu_transfer_to_host_2d req;
 	struct virtio_gpu_resource_2d *r2d;
 	struct virtio_gpu_ctrl_hdr resp;
-	uint32_t src_offset, dst_offset, stride, bpp, h;
+	uint32_t dst_offset, stride, bpp, h;
 	pixman_format_code_t format;
-	void *img_data, *dst, *src;
-	int i, done, bytes, total;
+	void *img_data;
 	int width, height;
 
 	memcpy(&req, cmd->iov[0].iov_base, sizeof(req));
@@ -977,30 +1055,16 @@ virtio_gpu_cmd_transfer_to_host_2d(struct virtio_gpu_command *cmd)
 		img_data = pixman_image_get_data(r2d->image);
 		width = (req.r.width < r2d->width) ? req.r.width : r2d->width;
 		height = (req.r.height < r2d->height) ? req.r.height : r2d->height;
-		for (h = 0; h < height; h++) {
-			src_offset = req.offset + stride * h;
-			dst_offset = (req.r.y + h) * stride + (req.r.x * bpp);
-			dst = img_data + dst_offset;
-			done = 0;
-			total = width * bpp;
-			for (i = 0; i < r2d->iovcnt; i++) {
-				if ((r2d->iov[i].iov_base == 0) || (r2d->iov[i].iov_len == 0)) {
-					continue;
-				}
-
-				if (src_offset < r2d->iov[i].iov_len) {
-					src = r2d->iov[i].iov_base + src_offset;
-					bytes = ((total - done) < (r2d->iov[i].iov_len - src_offset)) ?
-						 (total - done) : (r2d->iov[i].iov_len - src_offset);
-					memcpy((dst + done), src, bytes);
-					src_offset = 0;
-					done += bytes;
-					if (done >= total) {
-						break;
-					}
-				} else {
-					src_offset -= r2d->iov[i].iov_len;
-				}
+		if ((req.r.x == 0) && (width * bpp == stride)) {
+			/* the rows are contiguous in both the backing store and the image */
+			dst_offset = req.r.y * stride;
+			virtio_gpu_copy_from_backing(r2d, req.offset,
+					img_data + dst_offset, (size_t)stride * height);
+		} else {
+			for (h = 0; h < height; h++) {
+				dst_offset = (req.r.y + h) * stride + (req.r.x * bpp);
+				virtio_gpu_copy_from_backing(r2d, req.offset + (uint64_t)stride * h,
+						img_data + dst_offset, width * bpp);
 			}
 		}
 		pixman_image_unref(r2d->image);
@@ -1061,6 +1125,7 @@ virtio_gpu_cmd_resource_flush(struct virtio_gpu_command *cmd)
 	struct virtio_gpu *gpu;
 	int i;
 	struct virtio_gpu_scanout *gpu_scanout;
+	pixman_region16_t damage;
 	int bytes_pp;
 
 	gpu = cmd->gpu;
@@ -1084,7 +1149,7 @@ virtio_gpu_cmd_resource_flush(struct virtio_gpu_command *cmd)
 
 			surf.dma_info.dmabuf_fd = r2d->dma_info->dmabuf_fd;
 			surf.surf_type = SURFACE_DMABUF;
-			vdpy_surface_update(gpu->vdpy_handle, i, &surf);
+			vdpy_surface_update(gpu->vdpy_handle, i, &surf, NULL);
 		}
 		virtio_gpu_dmabuf_unref(r2d->dma_info);
 		resp.type = VIRTIO_GPU_RESP_OK_NODATA;
@@ -1107,7 +1172,15 @@ virtio_gpu_cmd_resource_flush(struct virtio_gpu_command *cmd)
 		surf.surf_format = r2d->format;
 		surf.surf_type = SURFACE_PIXMAN;
 		surf.pixel += bytes_pp * surf.x + surf.y * surf.stride;
-		vdpy_surface_update(gpu->vdpy_handle, i, &surf);
+
+		/* the flushed area of the scanout, in the scanout coordinates */
+		pixman_region_init_rect(&damage, req.r.x, req.r.y,
+					req.r.width, req.r.height);
+		pixman_region_intersect_rect(&damage, &damage, surf.x, surf.y,
+					surf.width, surf.height);
+		pixman_region_translate(&damage, -(int)surf.x, -(int)surf.y);
+		vdpy_surface_update(gpu->vdpy_handle, i, &surf, &damage);
+		pixman_region_fini(&damage);
 	}
 	pixman_image_unref(r2d->image);
 
@@ -1291,7 +1364,7 @@ virtio_gpu_cmd_create_blob(struct virtio_gpu_command *cmd)
 			r2d->image = pixman_image_create_bits(
 					r2d->format, r2d->width, r2d->height, NULL, 0);
 
-			iov = malloc(req.nr_entries * sizeof(struct iovec));
+			iov = virtio_gpu_alloc_backing(r2d, req.nr_entries);
 			if (!iov) {
 				free(entries);
 				free(r2d);
@@ -1299,9 +1372,6 @@ virtio_gpu_cmd_create_blob(struct virtio_gpu_command *cmd)
 				memcpy(cmd->iov[cmd->iovcnt - 1].iov_base, &resp, sizeof(resp));
 				return;
 			}
-			r2d->iov = iov;
-
-			r2d->iovcnt = req.nr_entries;
 			for (i = 0; i < req.nr_entries; i++) {
 				r2d->iov[i].iov_base = paddr_guest2host(
 						cmd->gpu->base.dev->vmctx,
@@ -1309,6 +1379,7 @@ virtio_gpu_cmd_create_blob(struct virtio_gpu_command *cmd)
 						entries[i].length);
 				r2d->iov[i].iov_len = entries[i].length;
 			}
+			virtio_gpu_index_backing(r2d);
 		}
 
 		free(entries);
@@ -1610,7 +1681,7 @@ virtio_gpu_vga_bh(void *param)
 		vdpy_surface_set(gpu->vdpy_handle, 0, &gpu->vga.surf);
 	}
 
-	vdpy_surface_update(gpu->vdpy_handle, 0, &gpu->vga.surf);
+	vdpy_surface_update(gpu->vdpy_handle, 0, &gpu->vga.surf, NULL);
 }
 
 static void *
@@ -1924,10 +1995,7 @@ virtio_gpu_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 				r2d->blob = false;
 			}
 			LIST_REMOVE(r2d, link);
-			if (r2d->iov) {
-				free(r2d->iov);
-				r2d->iov = NULL;
-			}
+			virtio_gpu_free_backing(r2d);
 			free(r2d);
 		}
 	}
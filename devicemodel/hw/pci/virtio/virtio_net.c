@@ -43,18 +43,34 @@
 #include <net/if.h>
 #include <linux/if_tun.h>
 #include <sys/socket.h>
+#include <sys/queue.h>
 #include <linux/vhost.h>
 
 #include "dm.h"
+#include "atomic.h"
 #include "pci_core.h"
 #include "mevent.h"
 #include "virtio.h"
 #include "vhost.h"
 #include "dm_string.h"
+#include "iothread.h"
+#include "virtio_net.h"
 
 #define VIRTIO_NET_RINGSZ	1024
 #define VIRTIO_NET_MAXSEGS	256
 
+/* frames sent per tx batch, and the iov[] entries for room for a large one */
+#define VIRTIO_NET_TX_BATCH	32
+#define VIRTIO_NET_TX_BATCH_IOV	(2 * VIRTIO_NET_MAXSEGS)
+
+/* frames passed to the guest per tap queue wakeup */
+#define VIRTIO_NET_RX_BUDGET	64
+
+/* largest frame from the tap device, with a VLAN tag */
+#define VIRTIO_NET_RX_MAXLEN	(ETHER_HDR_LEN + 4 + ETHERMTU)
+/* largest frame with TSO */
+#define VIRTIO_NET_RX_TSO_MAXLEN	(ETHER_HDR_LEN + 4 + 65535)
+
 /*
  * Host capabilities.  Note that we only offer a few of these.
  */
@@ -77,11 +93,20 @@
 #define	VIRTIO_NET_F_CTRL_VLAN	(1 << 19) /* control channel VLAN filtering */
 #define	VIRTIO_NET_F_GUEST_ANNOUNCE \
 				(1 << 21) /* guest can send gratuitous pkts */
+#define	VIRTIO_NET_F_MQ		(1 << 22) /* multiple queue pairs */
 
 #define VIRTIO_NET_S_HOSTCAPS      \
 	(VIRTIO_NET_F_MAC | VIRTIO_NET_F_MRG_RXBUF | VIRTIO_NET_F_STATUS | \
 	(1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC))
 
+/*
+ * Offloads passed through to the tap device, only offered if the tap device
+ * carries the virtio-net header (IFF_VNET_HDR)
+ */
+#define VIRTIO_NET_S_OFFLOADCAPS      \
+	(VIRTIO_NET_F_CSUM | VIRTIO_NET_F_HOST_TSO4 | VIRTIO_NET_F_HOST_TSO6 | \
+	VIRTIO_NET_F_GUEST_CSUM | VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6)
+
 #define VIRTIO_NET_S_VHOSTCAPS      \
 	((1 << VIRTIO_F_NOTIFY_ON_EMPTY) | (1 << VIRTIO_RING_F_INDIRECT_DESC) | \
 	(1 << VIRTIO_RING_F_EVENT_IDX) | VIRTIO_NET_F_MRG_RXBUF | \
@@ -96,16 +121,40 @@
 struct virtio_net_config {
 	uint8_t  mac[6];
 	uint16_t status;
+	uint16_t max_virtqueue_pairs;
 } __attribute__((packed));
 
 /*
  * Queue definitions.
+ *
+ * The rx and tx queues of the queue pair n are 2n and 2n + 1. The control
+ * queue follows the last pair, it is only present if more than one queue
+ * pair is configured with the "mq=" option.
  */
-#define VIRTIO_NET_RXQ	0
-#define VIRTIO_NET_TXQ	1
-#define VIRTIO_NET_CTLQ	2	/* NB: not yet supported */
+#define VIRTIO_NET_MAX_QPAIRS	8
+#define VIRTIO_NET_RXQ(n)	(2 * (n))
+#define VIRTIO_NET_TXQ(n)	(2 * (n) + 1)
+#define VIRTIO_NET_CTLQ(n)	(2 * (n))	/* n is the number of queue pairs */
+#define VIRTIO_NET_QPAIR(vq)	((vq)->num / 2)
 
-#define VIRTIO_NET_MAXQ	3
+#define VIRTIO_NET_MAXQ	(2 * VIRTIO_NET_MAX_QPAIRS + 1)
+
+/*
+ * Control queue commands
+ */
+struct virtio_net_ctrl_hdr {
+	uint8_t		class;
+	uint8_t		cmd;
+} __attribute__((packed));
+
+#define VIRTIO_NET_OK	0
+#define VIRTIO_NET_ERR	1
+
+#define VIRTIO_NET_CTRL_MQ			4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET		0
+
+#define VIRTIO_NET_CTRL_MAXSEGS	8
+#define VIRTIO_NET_CTRL_MAXLEN	64
 
 /*
  * Fixed network header size
@@ -132,21 +181,67 @@ static int virtio_net_debug;
  */
 struct vhost_net {
 	struct vhost_dev vdev;
-	struct vhost_vq vqs[VIRTIO_NET_MAXQ - 1];
+	struct vhost_vq vqs[2];
 	int tapfd;
 	bool vhost_started;
 };
 
+struct virtio_net;
+
+/*
+ * The rx chains gathered for the next frame. With merged rx bufs a frame
+ * may span many chains; those it does not fill are kept for the next one.
+ */
+struct virtio_net_rx_chains {
+	struct iovec	iov[VIRTIO_NET_MAXSEGS];
+	uint16_t	idx[VIRTIO_NET_MAXSEGS];
+	size_t		clen[VIRTIO_NET_MAXSEGS];	/* bytes of each chain */
+	int		ciov[VIRTIO_NET_MAXSEGS];	/* iovs of each chain */
+	int		nchains;
+	int		niov;
+	size_t		total;
+};
+
+/*
+ * Per queue pair struct, each pair is backed by one queue of the tap device
+ */
+struct virtio_net_qpair {
+	struct virtio_net *net;
+	int		idx;
+	int		tapfd;
+
+	struct mevent	*mevp;		/* rx event on the mevent thread */
+	struct iothread_ctx *ioctx;	/* the iothread serving this pair, or NULL */
+	struct iothread_mevent iomvt;	/* rx event on the iothread */
+
+	pthread_mutex_t	rx_mtx;
+	int		rx_in_progress;
+	pthread_mutex_t	rx_pause_mtx;
+	bool		rx_paused;	/* tap queue not read until the guest kicks */
+	struct virtio_net_rx_chains rx_chains;	/* taken from the ring, not used yet */
+	struct virtio_net_rx_stats rx_stats;
+
+	pthread_t	tx_tid;		/* only used if ioctx is NULL */
+	pthread_mutex_t	tx_mtx;
+	pthread_cond_t	tx_cond;
+	int		tx_in_progress;
+
+	struct vhost_net *vhost_net;
+};
+
 /*
  * Per-device struct
  */
 struct virtio_net {
 	struct virtio_base base;
-	struct virtio_vq_info queues[VIRTIO_NET_MAXQ - 1];
+	struct virtio_ops ops;
+	struct virtio_vq_info queues[VIRTIO_NET_MAXQ];
 	pthread_mutex_t mtx;
-	struct mevent	*mevp;
 
-	int		tapfd;
+	struct virtio_net_qpair qpairs[VIRTIO_NET_MAX_QPAIRS];
+	int		max_qpairs;	/* queue pairs offered to the guest */
+	int		curr_qpairs;	/* queue pairs enabled by the guest */
+	int		teardown_refs;	/* mevents not torn down yet */
 
 	int		rx_ready;
 
@@ -157,25 +252,26 @@ struct virtio_net {
 
 	struct virtio_net_config config;
 
-	pthread_mutex_t	rx_mtx;
-	int		rx_in_progress;
 	int		rx_vhdrlen;
 	int		rx_merge;	/* merged rx bufs in use */
-	pthread_t	tx_tid;
-	pthread_mutex_t	tx_mtx;
-	pthread_cond_t	tx_cond;
-	int		tx_in_progress;
+	size_t		rx_maxlen;	/* largest frame from the tap device */
+	bool		tap_vnet_hdr;	/* the tap device reads/writes the virtio-net header */
 
-	void (*virtio_net_rx)(struct virtio_net *net);
-	void (*virtio_net_tx)(struct virtio_net *net, struct iovec *iov,
+	void (*virtio_net_rx)(struct virtio_net_qpair *qp);
+	void (*virtio_net_tx)(struct virtio_net_qpair *qp, struct iovec *iov,
 			     int iovcnt, int len);
 
-	struct vhost_net *vhost_net;
 	bool		use_vhost;
+
+	LIST_ENTRY(virtio_net) link;	/* in vtnet_devs */
 };
 
+/* the devices reporting statistics */
+static LIST_HEAD(, virtio_net) vtnet_devs = LIST_HEAD_INITIALIZER(vtnet_devs);
+static pthread_mutex_t vtnet_devs_mtx = PTHREAD_MUTEX_INITIALIZER;
+
 static void virtio_net_reset(void *vdev);
-static void virtio_net_tx_stop(struct virtio_net *net);
+static void virtio_net_tx_stop(struct virtio_net_qpair *qp);
 static int virtio_net_cfgread(void *vdev, int offset, int size,
 	uint32_t *retval);
 static int virtio_net_cfgwrite(void *vdev, int offset, int size,
@@ -183,6 +279,7 @@ static int virtio_net_cfgwrite(void *vdev, int offset, int size,
 static void virtio_net_neg_features(void *vdev, uint64_t negotiated_features);
 static void virtio_net_set_status(void *vdev, uint64_t status);
 static void virtio_net_teardown(void *param);
+static void virtio_net_qpair_teardown(void *param);
 static struct vhost_net *vhost_net_init(struct virtio_base *base, int vhostfd,
 	int tapfd, int vq_idx);
 static int vhost_net_deinit(struct vhost_net *vhost_net);
@@ -191,7 +288,7 @@ static int vhost_net_stop(struct vhost_net *vhost_net);
 
 static struct virtio_ops virtio_net_ops = {
 	"vtnet",			/* our name */
-	VIRTIO_NET_MAXQ - 1,		/* we currently support 2 virtqueues */
+	2,				/* one queue pair, updated per device */
 	sizeof(struct virtio_net_config), /* config reg size */
 	virtio_net_reset,		/* reset */
 	NULL,				/* device-wide qnotify -- not used */
@@ -268,36 +365,67 @@ ether_aton(const char *a, struct ether_addr *e)
  * If the transmit thread is active then stall until it is done.
  */
 static void
-virtio_net_txwait(struct virtio_net *net)
+virtio_net_txwait(struct virtio_net_qpair *qp)
 {
-	pthread_mutex_lock(&net->tx_mtx);
-	while (net->tx_in_progress) {
-		pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	while (qp->tx_in_progress) {
+		pthread_mutex_unlock(&qp->tx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&qp->tx_mtx);
 	}
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
  * If the receive thread is active then stall until it is done.
  */
 static void
-virtio_net_rxwait(struct virtio_net *net)
+virtio_net_rxwait(struct virtio_net_qpair *qp)
 {
-	pthread_mutex_lock(&net->rx_mtx);
-	while (net->rx_in_progress) {
-		pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_lock(&qp->rx_mtx);
+	while (qp->rx_in_progress) {
+		pthread_mutex_unlock(&qp->rx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->rx_mtx);
+		pthread_mutex_lock(&qp->rx_mtx);
+	}
+	pthread_mutex_unlock(&qp->rx_mtx);
+}
+
+/*
+ * Attach the tap queues of the first @n queue pairs and detach the others,
+ * so that the tap device only steers the received packets to the queue
+ * pairs in use by the guest.
+ */
+static int
+virtio_net_set_qpairs(struct virtio_net *net, int n)
+{
+	struct ifreq ifr;
+	int i, ret = 0;
+
+	if (net->max_qpairs > 1) {
+		for (i = 0; i < net->max_qpairs; i++) {
+			if (net->qpairs[i].tapfd < 0)
+				continue;
+
+			memset(&ifr, 0, sizeof(ifr));
+			ifr.ifr_flags = (i < n) ? IFF_ATTACH_QUEUE : IFF_DETACH_QUEUE;
+			if (ioctl(net->qpairs[i].tapfd, TUNSETQUEUE, (void *)&ifr) < 0) {
+				WPRINTF(("vtnet: failed to %s tap queue %d: %d\n",
+					(i < n) ? "attach" : "detach", i, errno));
+				ret = -1;
+			}
+		}
 	}
-	pthread_mutex_unlock(&net->rx_mtx);
+	net->curr_qpairs = n;
+
+	return ret;
 }
 
 static void
 virtio_net_reset(void *vdev)
 {
 	struct virtio_net *net = vdev;
+	int i;
 
 	DPRINTF(("vtnet: device reset requested !\n"));
 
@@ -307,12 +435,21 @@ virtio_net_reset(void *vdev)
 	 * Wait for the transmit and receive threads to finish their
 	 * processing.
 	 */
-	virtio_net_txwait(net);
-	virtio_net_rxwait(net);
+	for (i = 0; i < net->max_qpairs; i++) {
+		virtio_net_txwait(&net->qpairs[i]);
+		virtio_net_rxwait(&net->qpairs[i]);
+		net->qpairs[i].rx_chains.nchains = 0;
+		net->qpairs[i].rx_chains.niov = 0;
+		net->qpairs[i].rx_chains.total = 0;
+	}
 
 	net->rx_ready = 0;
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
+	net->rx_maxlen = VIRTIO_NET_RX_MAXLEN;
+
+	/* only the first queue pair is used until the guest enables more */
+	virtio_net_set_qpairs(net, 1);
 
 	/* now reset rings, MSI-X vectors, and negotiated capabilities */
 	virtio_reset_dev(&net->base);
@@ -325,54 +462,53 @@ virtio_net_reset(void *vdev)
  * Send signal to tx I/O thread and wait till it exits
  */
 static void
-virtio_net_tx_stop(struct virtio_net *net)
+virtio_net_tx_stop(struct virtio_net_qpair *qp)
 {
 	void *jval;
 
-	pthread_mutex_lock(&net->tx_mtx);
-	net->closing = 1;
-	pthread_cond_broadcast(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	if (qp->ioctx != NULL)
+		return;
+
+	pthread_mutex_lock(&qp->tx_mtx);
+	qp->net->closing = 1;
+	pthread_cond_broadcast(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 
-	pthread_join(net->tx_tid, &jval);
+	pthread_join(qp->tx_tid, &jval);
 }
 
 /*
  * Called to send a buffer chain out to the tap device
  */
 static void
-virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
+virtio_net_tap_tx(struct virtio_net_qpair *qp, struct iovec *iov, int iovcnt,
 		  int len)
 {
 	static char pad[60]; /* all zero bytes */
+	struct iovec piov[VIRTIO_NET_MAXSEGS + 1];
 	ssize_t ret;
 
-	if (net->tapfd == -1)
+	if (qp->tapfd == -1)
 		return;
 
 	/*
 	 * If the length is < 60, pad out to that and add the
-	 * extra zero'd segment to the iov. It is guaranteed that
-	 * there is always an extra iov available by the caller.
+	 * extra zero'd segment to the iov. The iov of the caller
+	 * is followed by the next frame of the batch, so the short
+	 * frame is sent from a copy.
 	 */
-	if (len < 60) {
-		iov[iovcnt].iov_base = pad;
-		iov[iovcnt].iov_len = 60 - len;
+	if ((len < 60) && (iovcnt <= VIRTIO_NET_MAXSEGS)) {
+		memcpy(piov, iov, iovcnt * sizeof(struct iovec));
+		piov[iovcnt].iov_base = pad;
+		piov[iovcnt].iov_len = 60 - len;
+		iov = piov;
 		iovcnt++;
 	}
-	ret = writev(net->tapfd, iov, iovcnt);
+	ret = writev(qp->tapfd, iov, iovcnt);
 	(void)ret; /*avoid compiler warning*/
 }
 
-/*
- *  Called when there is read activity on the tap file descriptor.
- * Each buffer posted by the guest is assumed to be able to contain
- * an entire ethernet frame + rx header.
- *  MP note: the dummybuf is only used for discarding frames, so there
- * is no need for it to be per-vtnet or locked.
- */
-static uint8_t dummybuf[2048];
-
+/* Skip the first @tlen bytes of @iov, which hold the rx header */
 static inline struct iovec *
 rx_iov_trim(struct iovec *iov, int *niov, int tlen)
 {
@@ -400,20 +536,233 @@ rx_iov_trim(struct iovec *iov, int *niov, int tlen)
 	return riov;
 }
 
+/*
+ * Stop reading the tap queue until the guest posts rx buffers.
+ * Returns false if buffers were posted meanwhile, the caller resumes
+ * the tap queue then.
+ *
+ * The pause state has its own lock since the rx queue is kicked with
+ * the device lock held, which the receive path takes to interrupt.
+ */
+static bool
+virtio_net_rx_pause(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
+{
+	struct virtio_net *net = qp->net;
+	bool paused = true;
+
+	pthread_mutex_lock(&qp->rx_pause_mtx);
+	if (!qp->rx_paused) {
+		if (qp->ioctx != NULL)
+			iothread_del(qp->ioctx, qp->tapfd);
+		else
+			mevent_disable(qp->mevp);
+		qp->rx_paused = true;
+		qp->rx_stats.pauses++;
+	}
+
+	if (net->rx_ready && !net->resetting) {
+		/* ask for a kick when buffers are posted, then check for a racing post */
+		vq_clear_used_ring_flags(&net->base, vq);
+		atomic_thread_fence();
+		if (vq->avail->idx != vq->last_avail)
+			paused = false;
+	}
+	pthread_mutex_unlock(&qp->rx_pause_mtx);
+
+	return paused;
+}
+
+/*
+ * Read the paused tap queue again if the guest posted enough rx buffers.
+ */
+static void
+virtio_net_rx_resume(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
+{
+	pthread_mutex_lock(&qp->rx_pause_mtx);
+	if (qp->rx_paused && (qp->tapfd >= 0) && vq_ring_ready(vq) &&
+		(vq->avail->idx != vq->last_avail)) {
+		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+		qp->rx_paused = false;
+
+		if (qp->ioctx != NULL)
+			iothread_add(qp->ioctx, qp->tapfd, &qp->iomvt);
+		else
+			mevent_enable(qp->mevp);
+	}
+	pthread_mutex_unlock(&qp->rx_pause_mtx);
+}
+
+/*
+ * Release the first @nused gathered chains, the others are kept for the
+ * next frame.
+ */
+static void
+rx_chains_consume(struct virtio_net_rx_chains *rc, int nused)
+{
+	int i, niov = 0;
+
+	for (i = 0; i < nused; i++) {
+		niov += rc->ciov[i];
+		rc->total -= rc->clen[i];
+	}
+	rc->nchains -= nused;
+	rc->niov -= niov;
+	memmove(rc->iov, rc->iov + niov, rc->niov * sizeof(rc->iov[0]));
+	memmove(rc->idx, rc->idx + nused, rc->nchains * sizeof(rc->idx[0]));
+	memmove(rc->clen, rc->clen + nused, rc->nchains * sizeof(rc->clen[0]));
+	memmove(rc->ciov, rc->ciov + nused, rc->nchains * sizeof(rc->ciov[0]));
+}
+
+/*
+ * Receive one frame from the tap queue. Chains are gathered until they
+ * can hold the largest frame the tap device may pass; with merged rx bufs
+ * the frame spans as many chains as needed, otherwise one chain holds the
+ * frame. The chains the frame does not fill stay gathered, so each frame
+ * only takes as many chains from the ring as the previous one used.
+ * vq_getchains_batch() is not used here: how many chains a frame needs is
+ * only known once their lengths are, and its fixed iov share per chain
+ * does not fit chains of any length.
+ *
+ * Returns 1 if a frame was received, 0 if the tap queue is empty, and
+ * -1 if the guest has to post more rx buffers first.
+ */
+static int
+virtio_net_rx_frame(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
+{
+	struct virtio_net_rx_chains *rc = &qp->rx_chains;
+	struct iovec hdr_iov, *riov;
+	struct virtio_net *net = qp->net;
+	struct virtio_net_rxhdr *vrxh;
+	size_t need, used, clen;
+	int nused, n, i;
+	ssize_t len;
+
+	need = net->rx_vhdrlen + net->rx_maxlen;
+	while ((rc->nchains == 0) ||
+		(net->rx_merge && (rc->total < need) && (rc->niov < VIRTIO_NET_MAXSEGS))) {
+		if (!vq_has_descs(vq))
+			break;
+		n = vq_getchain(vq, &rc->idx[rc->nchains], &rc->iov[rc->niov],
+			VIRTIO_NET_MAXSEGS - rc->niov, NULL);
+		if (n < 1) {
+			/*
+			 * The chain is consumed. Keep it for the next frame if
+			 * it overflows the iov[] of this one, or drop it.
+			 */
+			if (rc->nchains > 0) {
+				vq_retchain(vq);
+				break;
+			}
+			WPRINTF(("vtnet: virtio_net_rx_frame: vq_getchain = %d\n", n));
+			vq_relchain(vq, rc->idx[0], 0);
+			qp->rx_stats.drops++;
+			return 1;
+		}
+
+		clen = 0;
+		for (i = rc->niov; i < rc->niov + n; i++)
+			clen += rc->iov[i].iov_len;
+		rc->clen[rc->nchains] = clen;
+		rc->ciov[rc->nchains] = n;
+		rc->total += clen;
+		rc->niov += n;
+		rc->nchains++;
+	}
+
+	if (rc->nchains == 0)
+		return -1;
+
+	/*
+	 * Wait for more buffers rather than truncating a large frame, unless
+	 * the whole ring is gathered already.
+	 */
+	if (net->rx_merge && (rc->total < need) && (rc->niov < VIRTIO_NET_MAXSEGS) &&
+		(rc->nchains < vq->qsize))
+		return -1;
+
+	/*
+	 * Get a pointer to the rx header, and use the
+	 * data immediately following it for the packet buffer.
+	 * The tap device fills the header itself if it carries it.
+	 * Trimming the header changes the first iov, which is restored
+	 * if no frame is read. The header is written after the frame is
+	 * read on both paths, so the first iov has to hold all of it.
+	 */
+	hdr_iov = rc->iov[0];
+	vrxh = hdr_iov.iov_base;
+	n = rc->niov;
+	if (hdr_iov.iov_len < net->rx_vhdrlen)
+		riov = NULL;
+	else if (net->tap_vnet_hdr)
+		riov = rc->iov;
+	else
+		riov = rx_iov_trim(rc->iov, &n, net->rx_vhdrlen);
+	if (riov == NULL) {
+		WPRINTF(("vtnet: rx chain too short for the header: iov_len=%lu\n",
+			hdr_iov.iov_len));
+		rc->iov[0] = hdr_iov;
+		for (i = 0; i < rc->nchains; i++)
+			vq_relchain(vq, rc->idx[i], 0);
+		rx_chains_consume(rc, rc->nchains);
+		qp->rx_stats.drops++;
+		return 1;
+	}
+
+	len = readv(qp->tapfd, riov, n);
+	if (len <= 0) {
+		rc->iov[0] = hdr_iov;
+		if ((len < 0) && (errno != EWOULDBLOCK)) {
+			WPRINTF(("vtnet: tap queue %d read failed: %d\n", qp->idx, errno));
+			qp->rx_stats.drops++;
+		}
+		return 0;
+	}
+
+	/*
+	 * Without the header from the tap device, the only valid
+	 * field in the rx packet header is the number of buffers
+	 * if merged rx bufs were negotiated.
+	 */
+	if (!net->tap_vnet_hdr) {
+		memset(vrxh, 0, net->rx_vhdrlen);
+		len += net->rx_vhdrlen;
+	}
+
+	/* release the chains the frame spans, keep the others */
+	used = len;
+	for (nused = 0; (nused < rc->nchains) && (used > 0); nused++) {
+		clen = (used < rc->clen[nused]) ? used : rc->clen[nused];
+		vq_relchain(vq, rc->idx[nused], clen);
+		used -= clen;
+	}
+	rx_chains_consume(rc, nused);
+
+	if (net->rx_merge)
+		vrxh->vrh_bufs = nused;
+
+	qp->rx_stats.packets++;
+	return 1;
+}
+
+/*
+ *  Called when there is read activity on the tap file descriptor.
+ * The frames are passed to the guest in batches of up to
+ * VIRTIO_NET_RX_BUDGET frames, with one interrupt per batch. If the guest
+ * has not posted enough rx buffers, the tap queue is paused and the frames
+ * stay queued in the tap device until the guest kicks the rx queue.
+ */
 static void
-virtio_net_tap_rx(struct virtio_net *net)
+virtio_net_tap_rx(struct virtio_net_qpair *qp)
 {
-	struct iovec iov[VIRTIO_NET_MAXSEGS], *riov;
+	struct virtio_net *net = qp->net;
 	struct virtio_vq_info *vq;
-	void *vrx;
-	int len, n;
-	uint16_t idx;
-	ssize_t ret;
+	uint64_t batch = 0;
+	int ret = 0;
 
 	/*
 	 * Should never be called without a valid tap fd
 	 */
-	if (net->tapfd == -1) {
+	if (qp->tapfd == -1) {
 		WPRINTF(("vtnet: tapfd == -1\n"));
 		return;
 	}
@@ -421,97 +770,59 @@ virtio_net_tap_rx(struct virtio_net *net)
 	/*
 	 * But, will be called when the rx ring hasn't yet
 	 * been set up or the guest is resetting the device.
+	 * Keep the packets in the tap device until the first kick.
 	 */
+	vq = &net->queues[VIRTIO_NET_RXQ(qp->idx)];
 	if (!net->rx_ready || net->resetting) {
-		/*
-		 * Drop the packet and try later.
-		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
-		(void)ret; /*avoid compiler warning*/
-
+		virtio_net_rx_pause(qp, vq);
 		return;
 	}
 
-	/*
-	 * Check for available rx buffers
-	 */
-	vq = &net->queues[VIRTIO_NET_RXQ];
-	if (!vq_has_descs(vq)) {
-		/*
-		 * Drop the packet and try later.  Interrupt on
-		 * empty, if that's negotiated.
-		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
-		(void)ret; /*avoid compiler warning*/
-
-		vq_endchains(vq, 1);
-		return;
+	while (batch < VIRTIO_NET_RX_BUDGET) {
+		ret = virtio_net_rx_frame(qp, vq);
+		if (ret <= 0)
+			break;
+		batch++;
 	}
 
-	do {
-		/*
-		 * Get descriptor chain.
-		 */
-		n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
-		if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
-			WPRINTF(("vtnet: virtio_net_tap_rx: vq_getchain = %d\n", n));
-			return;
-		}
-		/*
-		 * Get a pointer to the rx header, and use the
-		 * data immediately following it for the packet buffer.
-		 */
-		vrx = iov[0].iov_base;
-		riov = rx_iov_trim(iov, &n, net->rx_vhdrlen);
-		if (riov == NULL)
-			return;
+	if (batch > 0) {
+		qp->rx_stats.batches++;
+		if (batch > qp->rx_stats.max_batch)
+			qp->rx_stats.max_batch = batch;
+	}
 
-		len = readv(net->tapfd, riov, n);
+	/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
+	vq_endchains(vq, ret < 0);
 
-		if (len < 0 && errno == EWOULDBLOCK) {
-			/*
-			 * No more packets, but still some avail ring
-			 * entries.  Interrupt if needed/appropriate.
-			 */
-			vq_retchain(vq);
+	/*
+	 * Out of rx buffers, pause the tap queue instead of dropping the
+	 * packets. The frames left in the tap queue are read right away
+	 * if buffers were posted meanwhile.
+	 */
+	while ((ret < 0) && !virtio_net_rx_pause(qp, vq)) {
+		virtio_net_rx_resume(qp, vq);
+		ret = virtio_net_rx_frame(qp, vq);
+		if (ret > 0)
 			vq_endchains(vq, 0);
-			return;
-		}
-
-		/*
-		 * The only valid field in the rx packet header is the
-		 * number of buffers if merged rx bufs were negotiated.
-		 */
-		memset(vrx, 0, net->rx_vhdrlen);
-
-		if (net->rx_merge) {
-			struct virtio_net_rxhdr *vrxh;
-
-			vrxh = vrx;
-			vrxh->vrh_bufs = 1;
-		}
+	}
+}
 
-		/*
-		 * Release this chain and handle more chains.
-		 */
-		vq_relchain(vq, idx, len + net->rx_vhdrlen);
-	} while (vq_has_descs(vq));
+static void
+virtio_net_rx_iothread(void *param)
+{
+	struct virtio_net_qpair *qp = param;
 
-	/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
-	vq_endchains(vq, 1);
+	pthread_mutex_lock(&qp->rx_mtx);
+	qp->rx_in_progress = 1;
+	qp->net->virtio_net_rx(qp);
+	qp->rx_in_progress = 0;
+	pthread_mutex_unlock(&qp->rx_mtx);
 }
 
 static void
 virtio_net_rx_callback(int fd, enum ev_type type, void *param)
 {
-	struct virtio_net *net = param;
-
-	pthread_mutex_lock(&net->rx_mtx);
-	net->rx_in_progress = 1;
-	net->virtio_net_rx(net);
-	net->rx_in_progress = 0;
-	pthread_mutex_unlock(&net->rx_mtx);
-
+	virtio_net_rx_iothread(param);
 }
 
 static void
@@ -528,44 +839,101 @@ virtio_net_ping_rxq(void *vdev, struct virtio_vq_info *vq)
 			vq->used->flags |= VRING_USED_F_NO_NOTIFY;
 		}
 	}
+
+	/* rx buffers are posted, read the paused tap queue again */
+	virtio_net_rx_resume(&net->qpairs[VIRTIO_NET_QPAIR(vq)], vq);
 }
 
+/*
+ * Send up to VIRTIO_NET_TX_BATCH frames, the chains are fetched and
+ * returned to the guest as a batch.
+ */
 static void
-virtio_net_proctx(struct virtio_net *net, struct virtio_vq_info *vq)
+virtio_net_proctx(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
 {
-	struct iovec iov[VIRTIO_NET_MAXSEGS + 1];
-	int i, n;
+	struct vq_chain chains[VIRTIO_NET_TX_BATCH];
+	struct iovec iov[VIRTIO_NET_TX_BATCH_IOV];
+	struct vq_chain *c;
+	int i, j, nchains, nrel;
 	int plen, tlen;
-	uint16_t idx;
 
-	/*
-	 * Obtain chain of descriptors.  The first one is
-	 * really the header descriptor, so we need to sum
-	 * up two lengths: packet length and transfer length.
-	 */
-	n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
-	if (n < 1 || n > VIRTIO_NET_MAXSEGS) {
-		WPRINTF(("vtnet: virtio_net_proctx: vq_getchain = %d\n", n));
-		return;
-	}
-	plen = 0;
-	tlen = iov[0].iov_len;
-	for (i = 1; i < n; i++) {
-		plen += iov[i].iov_len;
-		tlen += iov[i].iov_len;
+	nchains = vq_getchains_batch(vq, chains, VIRTIO_NET_TX_BATCH, iov,
+			VIRTIO_NET_TX_BATCH_IOV, NULL, VIRTIO_NET_MAXSEGS);
+
+	for (i = 0, nrel = 0; i < nchains; i++) {
+		c = &chains[i];
+		if (c->n < 1) {
+			WPRINTF(("vtnet: virtio_net_proctx: vq_getchain = %d\n", c->n));
+			/* return the invalid chain unless its head is bogus */
+			if (c->idx < vq->qsize) {
+				c->len = 0;
+				chains[nrel++] = *c;
+			}
+			continue;
+		}
+
+		/*
+		 * The first descriptor of the chain is
+		 * really the header descriptor, so we need to sum
+		 * up two lengths: packet length and transfer length.
+		 */
+		plen = 0;
+		tlen = c->iov[0].iov_len;
+		for (j = 1; j < c->n; j++) {
+			plen += c->iov[j].iov_len;
+			tlen += c->iov[j].iov_len;
+		}
+
+		DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r", plen, c->n));
+		/* the tap device takes the header with the offload requests of the guest */
+		if (qp->net->tap_vnet_hdr)
+			qp->net->virtio_net_tx(qp, c->iov, c->n, plen);
+		else
+			qp->net->virtio_net_tx(qp, &c->iov[1], c->n - 1, plen);
+
+		c->len = tlen;
+		chains[nrel++] = *c;
 	}
 
-	DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r", plen, n));
-	net->virtio_net_tx(net, &iov[1], n - 1, plen);
+	/* chains are processed, release them and set tlen */
+	vq_relchains_batch(vq, chains, nrel);
+}
 
-	/* chain is processed, release it and set tlen */
-	vq_relchain(vq, idx, tlen);
+/*
+ * Process the tx queue in the iothread of the queue pair, which is woken up
+ * by the guest kick. Guest kicks are suppressed while the ring is drained.
+ */
+static void
+virtio_net_proctx_iothread(struct virtio_net_qpair *qp, struct virtio_vq_info *vq)
+{
+	struct virtio_net *net = qp->net;
+
+	pthread_mutex_lock(&qp->tx_mtx);
+	qp->tx_in_progress = 1;
+	pthread_mutex_unlock(&qp->tx_mtx);
+
+	while (!net->resetting && vq_has_descs(vq)) {
+		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
+		do {
+			virtio_net_proctx(qp, vq);
+		} while (!net->resetting && vq_has_descs(vq));
+
+		/* re-enable the kick and catch the buffers queued meanwhile */
+		vq_clear_used_ring_flags(&net->base, vq);
+		mb();
+	}
+	vq_endchains(vq, 1);
+
+	pthread_mutex_lock(&qp->tx_mtx);
+	qp->tx_in_progress = 0;
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 static void
 virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_net *net = vdev;
+	struct virtio_net_qpair *qp = &net->qpairs[VIRTIO_NET_QPAIR(vq)];
 
 	/*
 	 * Any ring entries to process?
@@ -573,12 +941,17 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 	if (!vq_has_descs(vq))
 		return;
 
+	if (qp->ioctx != NULL) {
+		virtio_net_proctx_iothread(qp, vq);
+		return;
+	}
+
 	/* Signal the tx thread for processing */
-	pthread_mutex_lock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
 	vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-	if (net->tx_in_progress == 0)
-		pthread_cond_signal(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	if (qp->tx_in_progress == 0)
+		pthread_cond_signal(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
@@ -587,27 +960,28 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 static void *
 virtio_net_tx_thread(void *param)
 {
-	struct virtio_net *net = param;
-	struct virtio_vq_info *vq = &net->queues[VIRTIO_NET_TXQ];
+	struct virtio_net_qpair *qp = param;
+	struct virtio_net *net = qp->net;
+	struct virtio_vq_info *vq = &net->queues[VIRTIO_NET_TXQ(qp->idx)];
 
 	/*
 	 * Let us wait till the tx queue pointers get initialised &
 	 * first tx signaled
 	 */
-	pthread_mutex_lock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
 
 	while (!net->closing && !vq_ring_ready(vq))
-		pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+		pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 
 	if (net->closing) {
 		WPRINTF(("vtnet tx thread closing...\n"));
-		pthread_mutex_unlock(&net->tx_mtx);
+		pthread_mutex_unlock(&qp->tx_mtx);
 		return NULL;
 	}
 
 	for (;;) {
 		/* note - tx mutex is locked here */
-		net->tx_in_progress = 0;
+		qp->tx_in_progress = 0;
 
 		/*
 		 * Checking the avail ring here serves two purposes:
@@ -621,18 +995,18 @@ virtio_net_tx_thread(void *param)
 			if (!net->resetting && vq_has_descs(vq))
 				break;
 
-			pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+			pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 
 			if (net->closing) {
 				WPRINTF(("vtnet tx thread closing...\n"));
-				pthread_mutex_unlock(&net->tx_mtx);
+				pthread_mutex_unlock(&qp->tx_mtx);
 				return NULL;
 			}
 		}
 
 		vq->used->flags |= VRING_USED_F_NO_NOTIFY;
-		net->tx_in_progress = 1;
-		pthread_mutex_unlock(&net->tx_mtx);
+		qp->tx_in_progress = 1;
+		pthread_mutex_unlock(&qp->tx_mtx);
 
 		do {
 			/*
@@ -640,7 +1014,7 @@ virtio_net_tx_thread(void *param)
 			 * iovecs and sending when an end-of-packet
 			 * is found
 			 */
-			virtio_net_proctx(net, vq);
+			virtio_net_proctx(qp, vq);
 		} while (vq_has_descs(vq));
 
 		/*
@@ -648,17 +1022,80 @@ virtio_net_tx_thread(void *param)
 		 */
 		vq_endchains(vq, 1);
 
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&qp->tx_mtx);
 	}
 }
 
-#ifdef notyet
+static uint8_t
+virtio_net_ctrl_mq(struct virtio_net *net, uint8_t cmd, uint8_t *data, int len)
+{
+	uint16_t pairs;
+
+	if ((cmd != VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET) || (len < sizeof(pairs)))
+		return VIRTIO_NET_ERR;
+
+	memcpy(&pairs, data, sizeof(pairs));
+	if ((pairs < 1) || (pairs > net->max_qpairs)) {
+		WPRINTF(("vtnet: invalid number of queue pairs %d\n", pairs));
+		return VIRTIO_NET_ERR;
+	}
+
+	DPRINTF(("vtnet: %d queue pairs enabled\n", pairs));
+	return (virtio_net_set_qpairs(net, pairs) == 0) ? VIRTIO_NET_OK : VIRTIO_NET_ERR;
+}
+
 static void
 virtio_net_ping_ctlq(void *vdev, struct virtio_vq_info *vq)
 {
-	DPRINTF(("vtnet: control qnotify!\n\r"));
+	struct virtio_net *net = vdev;
+	struct iovec iov[VIRTIO_NET_CTRL_MAXSEGS];
+	uint16_t flags[VIRTIO_NET_CTRL_MAXSEGS];
+	struct virtio_net_ctrl_hdr *hdr;
+	uint8_t buf[VIRTIO_NET_CTRL_MAXLEN];
+	uint8_t *ack;
+	uint16_t idx;
+	int i, n, len, seg;
+
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, VIRTIO_NET_CTRL_MAXSEGS, flags);
+		if (n <= 0) {
+			WPRINTF(("vtnet: virtio_net_ping_ctlq: vq_getchain = %d\n", n));
+			break;
+		}
+
+		/* a command needs a readable header and a writable ack byte */
+		if (n < 2 || n > VIRTIO_NET_CTRL_MAXSEGS ||
+		    !(flags[n - 1] & VRING_DESC_F_WRITE) || iov[n - 1].iov_len < 1) {
+			WPRINTF(("vtnet: virtio_net_ping_ctlq: malformed chain, %d descs\n", n));
+			vq_relchain(vq, idx, 0);
+			continue;
+		}
+
+		/* the command is in the readable segments, the ack is the last byte of the chain */
+		len = 0;
+		for (i = 0; (i < n - 1) && !(flags[i] & VRING_DESC_F_WRITE); i++) {
+			seg = iov[i].iov_len;
+			if (len + seg > sizeof(buf))
+				seg = sizeof(buf) - len;
+			memcpy(buf + len, iov[i].iov_base, seg);
+			len += seg;
+		}
+		ack = (uint8_t *)iov[n - 1].iov_base + iov[n - 1].iov_len - 1;
+
+		*ack = VIRTIO_NET_ERR;
+		if (len >= sizeof(*hdr)) {
+			hdr = (struct virtio_net_ctrl_hdr *)buf;
+			if (hdr->class == VIRTIO_NET_CTRL_MQ)
+				*ack = virtio_net_ctrl_mq(net, hdr->cmd, buf + sizeof(*hdr),
+					len - sizeof(*hdr));
+			else
+				DPRINTF(("vtnet: unsupported control class %d\n", hdr->class));
+		}
+
+		vq_relchain(vq, idx, 1);
+	}
+	vq_endchains(vq, 1);
 }
-#endif
 
 static int
 virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
@@ -738,7 +1175,7 @@ virtio_net_is_macvtap(char *devname, int *ifindex)
 }
 
 static int
-virtio_net_tap_open(char *devname)
+virtio_net_tap_open(char *devname, bool multi_queue, bool vnet_hdr)
 {
 	char tbuf[IFNAMSIZ];
 	int tunfd, rc, macvtap_index;
@@ -764,6 +1201,10 @@ virtio_net_tap_open(char *devname)
 
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+	if (multi_queue)
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
+	if (vnet_hdr)
+		ifr.ifr_flags |= IFF_VNET_HDR;
 
 	if (*devname) {
 		strncpy(ifr.ifr_name, devname, IFNAMSIZ);
@@ -782,37 +1223,65 @@ virtio_net_tap_open(char *devname)
 	return tunfd;
 }
 
+/*
+ * Offer @n queue pairs to the guest. The control queue follows the last
+ * queue pair, it is only needed to enable more than one queue pair, so
+ * the single queue pair layout is kept otherwise.
+ */
 static void
-virtio_net_tap_setup(struct virtio_net *net, char *devname)
+virtio_net_set_max_qpairs(struct virtio_net *net, int n)
 {
-	char tbuf[IFNAMSIZ];
-	int vhost_fd = -1;
-	int rc;
+	struct virtio_vq_info *ctlq = &net->queues[VIRTIO_NET_CTLQ(n)];
 
-	rc = snprintf(tbuf, IFNAMSIZ, "%s", devname);
-	if (rc < 0 || rc >= IFNAMSIZ) /* give warning if error or truncation happens */
-		WPRINTF(("Failed to set tap device name %s\n", tbuf));
+	net->max_qpairs = n;
+	net->ops.nvq = 2 * n + ((n > 1) ? 1 : 0);
+	net->config.max_virtqueue_pairs = n;
 
-	net->virtio_net_rx = virtio_net_tap_rx;
-	net->virtio_net_tx = virtio_net_tap_tx;
+	if (n > 1) {
+		net->base.device_caps |= VIRTIO_NET_F_MQ | VIRTIO_NET_F_CTRL_VQ;
+		ctlq->qsize = VIRTIO_NET_RINGSZ;
+		ctlq->notify = virtio_net_ping_ctlq;
+		ctlq->viothrd.ioctx = net->qpairs[0].ioctx;
+	} else
+		net->base.device_caps &= ~(VIRTIO_NET_F_MQ | VIRTIO_NET_F_CTRL_VQ);
+}
 
-	net->tapfd = virtio_net_tap_open(tbuf);
-	if (net->tapfd == -1) {
-		WPRINTF(("open of tap device %s failed\n", tbuf));
-		return;
+/*
+ * Open the tap queue of the queue pair @qp and register its rx event
+ */
+static int
+virtio_net_qpair_setup(struct virtio_net_qpair *qp, char *devname)
+{
+	struct virtio_net *net = qp->net;
+	int vhost_fd = -1;
+	int opt = 1;
+	int hdrlen;
+
+	qp->tapfd = virtio_net_tap_open(devname, net->max_qpairs > 1, net->tap_vnet_hdr);
+	if (qp->tapfd == -1) {
+		WPRINTF(("open of tap device %s queue %d failed\n", devname, qp->idx));
+		return -1;
 	}
-	DPRINTF(("open of tap device %s success!\n", tbuf));
+	DPRINTF(("open of tap device %s queue %d success!\n", devname, qp->idx));
 
 	/*
 	 * Set non-blocking and register for read
 	 * notifications with the event loop
 	 */
-	int opt = 1;
-
-	if (ioctl(net->tapfd, FIONBIO, &opt) < 0) {
+	if (ioctl(qp->tapfd, FIONBIO, &opt) < 0) {
 		WPRINTF(("tap device O_NONBLOCK failed\n"));
-		close(net->tapfd);
-		net->tapfd = -1;
+		close(qp->tapfd);
+		qp->tapfd = -1;
+		return -1;
+	}
+
+	/* the header length is set again once the features are negotiated */
+	hdrlen = sizeof(struct virtio_net_rxhdr);
+	if (net->tap_vnet_hdr && (ioctl(qp->tapfd, TUNSETVNETHDRSZ, &hdrlen) < 0)) {
+		WPRINTF(("tap device TUNSETVNETHDRSZ failed\n"));
+		close(qp->tapfd);
+		qp->tapfd = -1;
+		return -1;
 	}
 
 	if (net->use_vhost) {
@@ -820,9 +1289,9 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 		if (vhost_fd < 0)
 			WPRINTF(("open of vhost-net failed\n"));
 		else {
-			net->vhost_net = vhost_net_init(&net->base, vhost_fd,
-				net->tapfd, 0);
-			if (!net->vhost_net) {
+			qp->vhost_net = vhost_net_init(&net->base, vhost_fd,
+				qp->tapfd, VIRTIO_NET_RXQ(qp->idx));
+			if (!qp->vhost_net) {
 				WPRINTF(("vhost_net_init failed, fallback "
 					"to userspace virtio\n"));
 				close(vhost_fd);
@@ -832,15 +1301,106 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 	}
 
 	if (vhost_fd < 0) {
-		net->mevp = mevent_add(net->tapfd, EVF_READ,
-				       virtio_net_rx_callback, net,
-				       virtio_net_teardown, net);
-		if (net->mevp == NULL) {
-			WPRINTF(("Could not register event\n"));
-			close(net->tapfd);
-			net->tapfd = -1;
+		if (qp->ioctx != NULL) {
+			qp->iomvt.run = virtio_net_rx_iothread;
+			qp->iomvt.arg = qp;
+			qp->iomvt.fd = qp->tapfd;
+			if (iothread_add(qp->ioctx, qp->tapfd, &qp->iomvt) < 0) {
+				WPRINTF(("Could not add tap queue %d to iothread\n", qp->idx));
+				close(qp->tapfd);
+				qp->tapfd = -1;
+				return -1;
+			}
+		} else {
+			qp->mevp = mevent_add(qp->tapfd, EVF_READ,
+					       virtio_net_rx_callback, qp,
+					       virtio_net_qpair_teardown, qp);
+			if (qp->mevp == NULL) {
+				WPRINTF(("Could not register event\n"));
+				close(qp->tapfd);
+				qp->tapfd = -1;
+				return -1;
+			}
+			net->teardown_refs++;
 		}
 	}
+
+	return 0;
+}
+
+static void
+virtio_net_tap_setup(struct virtio_net *net, char *devname)
+{
+	char tbuf[IFNAMSIZ];
+	int rc, i;
+
+	rc = snprintf(tbuf, IFNAMSIZ, "%s", devname);
+	if (rc < 0 || rc >= IFNAMSIZ) /* give warning if error or truncation happens */
+		WPRINTF(("Failed to set tap device name %s\n", tbuf));
+
+	net->virtio_net_rx = virtio_net_tap_rx;
+	net->virtio_net_tx = virtio_net_tap_tx;
+
+	/*
+	 * vhost-net adds and strips the virtio-net header itself. Otherwise,
+	 * let the tap device carry the header so that checksum and
+	 * segmentation offloads are passed through.
+	 */
+	net->tap_vnet_hdr = !net->use_vhost;
+
+	/*
+	 * A multiqueue tap device is opened once per queue pair. The first
+	 * open returns the device name, which the other queues attach to.
+	 */
+	for (i = 0; i < net->max_qpairs; i++) {
+		if (virtio_net_qpair_setup(&net->qpairs[i], tbuf) < 0)
+			break;
+	}
+
+	/* only offer the queue pairs whose tap queue is open */
+	if ((i > 0) && (i < net->max_qpairs)) {
+		WPRINTF(("vtnet: tap queue %d of %s failed, %d queue pairs offered\n",
+			i, tbuf, i));
+		virtio_net_set_max_qpairs(net, i);
+	}
+
+	if (net->tap_vnet_hdr && (net->qpairs[0].tapfd >= 0))
+		net->base.device_caps |= VIRTIO_NET_S_OFFLOADCAPS;
+	else
+		net->tap_vnet_hdr = false;
+}
+
+/*
+ * Tell the tap devices the header size and which offloaded packets the
+ * guest is able to receive.
+ */
+static void
+virtio_net_tap_set_offload(struct virtio_net *net)
+{
+	unsigned int offload = 0;
+	int i;
+
+	if (!net->tap_vnet_hdr)
+		return;
+
+	if (net->features & VIRTIO_NET_F_GUEST_CSUM) {
+		offload |= TUN_F_CSUM;
+		if (net->features & VIRTIO_NET_F_GUEST_TSO4)
+			offload |= TUN_F_TSO4;
+		if (net->features & VIRTIO_NET_F_GUEST_TSO6)
+			offload |= TUN_F_TSO6;
+	}
+	if (offload & (TUN_F_TSO4 | TUN_F_TSO6))
+		net->rx_maxlen = VIRTIO_NET_RX_TSO_MAXLEN;
+
+	for (i = 0; i < net->max_qpairs; i++) {
+		if (net->qpairs[i].tapfd < 0)
+			continue;
+		if (ioctl(net->qpairs[i].tapfd, TUNSETVNETHDRSZ, &net->rx_vhdrlen) < 0)
+			WPRINTF(("vtnet: TUNSETVNETHDRSZ failed: %d\n", errno));
+		if (ioctl(net->qpairs[i].tapfd, TUNSETOFFLOAD, offload) < 0)
+			WPRINTF(("vtnet: TUNSETOFFLOAD failed: %d\n", errno));
+	}
 }
 
 static int
@@ -860,7 +1420,13 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char *opt = NULL;
 	int mac_provided;
 	pthread_mutexattr_t attr;
-	int rc;
+	struct iothreads_option iot_opt;
+	struct iothread_ctx *ioctx_base = NULL;
+	bool use_iothread = false;
+	struct virtio_net_qpair *qp;
+	int rc, i, max_qpairs = 1;
+
+	memset(&iot_opt, 0, sizeof(iot_opt));
 
 	net = calloc(1, sizeof(struct virtio_net));
 	if (!net) {
@@ -886,7 +1452,6 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	 * Read the MAC address if specified
 	 */
 	mac_provided = 0;
-	net->vhost_net = NULL;
 	if (opts != NULL) {
 		int err;
 
@@ -911,28 +1476,86 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 					return err;
 				}
 				mac_provided = 1;
+			} else if (!strncmp(opt, "mq=", 3)) {
+				/* mq=<number of queue pairs> */
+				if (dm_strtoi(opt + 3, &opt, 10, &max_qpairs) ||
+					(max_qpairs <= 0) || (max_qpairs > VIRTIO_NET_MAX_QPAIRS)) {
+					pr_err("Invalid number of queue pairs %s\n", opt);
+					free(devopts);
+					free(net);
+					return -1;
+				}
+			} else if (!strncmp(opt, "iothread", strlen("iothread"))) {
+				/* iothread=<iothread options>, queue pairs are served by the iothreads round robin */
+				use_iothread = true;
+				strsep(&opt, "=");
+				if (iothread_parse_options(opt, &iot_opt) < 0) {
+					free(devopts);
+					free(net);
+					return -1;
+				}
 			}
 		}
 	}
 
-	virtio_linkup(&net->base, &virtio_net_ops, net, dev, net->queues,
+	if (use_iothread && net->use_vhost) {
+		WPRINTF(("virtio_net: iothread is ignored with vhost\n"));
+		use_iothread = false;
+	}
+
+	if (use_iothread) {
+		/* one iothread per queue pair at most */
+		if (iot_opt.num > max_qpairs)
+			iot_opt.num = max_qpairs;
+
+		if (snprintf(iot_opt.tag, sizeof(iot_opt.tag), "net%d:%d", dev->slot, dev->func)
+			>= sizeof(iot_opt.tag))
+			pr_err("%s: virtio-net ioctx_tag too long \n", __func__);
+
+		ioctx_base = iothread_create(&iot_opt);
+		if (ioctx_base == NULL) {
+			pr_err("%s: Fails to create iothread context instance \n", __func__);
+			iothread_free_options(&iot_opt);
+			free(devopts);
+			free(net);
+			return -1;
+		}
+	}
+	iothread_free_options(&iot_opt);
+
+	net->curr_qpairs = 1;
+	net->ops = virtio_net_ops;
+
+	virtio_linkup(&net->base, &net->ops, net, dev, net->queues,
 		      net->use_vhost ? BACKEND_VHOST : BACKEND_VBSU);
 	net->base.mtx = &net->mtx;
 	net->base.device_caps = VIRTIO_NET_S_HOSTCAPS;
-
-	net->queues[VIRTIO_NET_RXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_RXQ].notify = virtio_net_ping_rxq;
-	net->queues[VIRTIO_NET_TXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_TXQ].notify = virtio_net_ping_txq;
-#ifdef notyet
-	net->queues[VIRTIO_NET_CTLQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_CTLQ].notify = virtio_net_ping_ctlq;
-#endif
-
-	/*
-	 * Attempt to open the tap device
-	 */
-	net->tapfd = -1;
+	net->base.iothread = use_iothread;
+
+	for (i = 0; i < max_qpairs; i++) {
+		qp = &net->qpairs[i];
+		qp->net = net;
+		qp->idx = i;
+		/* Attempt to open the tap device later */
+		qp->tapfd = -1;
+		if (use_iothread)
+			qp->ioctx = ioctx_base + i % iot_opt.num;
+
+		net->queues[VIRTIO_NET_RXQ(i)].qsize = VIRTIO_NET_RINGSZ;
+		net->queues[VIRTIO_NET_RXQ(i)].notify = virtio_net_ping_rxq;
+		net->queues[VIRTIO_NET_RXQ(i)].viothrd.ioctx = qp->ioctx;
+		net->queues[VIRTIO_NET_TXQ(i)].qsize = VIRTIO_NET_RINGSZ;
+		net->queues[VIRTIO_NET_TXQ(i)].notify = virtio_net_ping_txq;
+		net->queues[VIRTIO_NET_TXQ(i)].viothrd.ioctx = qp->ioctx;
+
+		qp->rx_in_progress = 0;
+		pthread_mutex_init(&qp->rx_mtx, NULL);
+		pthread_mutex_init(&qp->rx_pause_mtx, NULL);
+		qp->tx_in_progress = 0;
+		pthread_mutex_init(&qp->tx_mtx, NULL);
+		pthread_cond_init(&qp->tx_cond, NULL);
+	}
+	virtio_net_set_max_qpairs(net, max_qpairs);
 
 	if (!devopts) {
 		WPRINTF(("virtio_net: invalid optional argument\n"));
@@ -951,7 +1574,7 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	if ((tmp != NULL) && (strncmp(tmp, "mac_seed", 8) == 0)) {
 		strsep(&tmp, "=");
-		mac_seed = tmp;
+		mac_seed = strsep(&tmp, ",");
 	}
 
 	if ((type != NULL) && (name != NULL)) {
@@ -1008,7 +1631,7 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
 
 	/* Link is up if we managed to open tap device */
-	net->config.status = (opts == NULL || net->tapfd >= 0);
+	net->config.status = (opts == NULL || net->qpairs[0].tapfd >= 0);
 
 	/* use BAR 1 to map MSI-X table and PBA, if we're using MSI-X */
 	if (virtio_interrupt_init(&net->base, virtio_uses_msix())) {
@@ -1025,26 +1648,66 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
-	net->rx_in_progress = 0;
-	pthread_mutex_init(&net->rx_mtx, NULL);
+	net->rx_maxlen = VIRTIO_NET_RX_MAXLEN;
+
+	/* only the first queue pair is used until the guest enables more */
+	virtio_net_set_qpairs(net, 1);
 
 	/*
-	 * Initialize tx semaphore & spawn TX processing thread.
-	 * As of now, only one thread for TX desc processing is
-	 * spawned.
+	 * Spawn one TX processing thread per queue pair, unless the
+	 * pair is served by an iothread.
 	 */
-	net->tx_in_progress = 0;
-	pthread_mutex_init(&net->tx_mtx, NULL);
-	pthread_cond_init(&net->tx_cond, NULL);
-	pthread_create(&net->tx_tid, NULL, virtio_net_tx_thread,
-		       (void *)net);
-	snprintf(tname, sizeof(tname), "vtnet-%d:%d tx", dev->slot,
-		 dev->func);
-	pthread_setname_np(net->tx_tid, tname);
+	for (i = 0; i < net->max_qpairs; i++) {
+		qp = &net->qpairs[i];
+		if (qp->ioctx != NULL)
+			continue;
+
+		pthread_create(&qp->tx_tid, NULL, virtio_net_tx_thread,
+			       (void *)qp);
+		if (net->max_qpairs > 1)
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx%d", dev->slot,
+				 dev->func, i);
+		else
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx", dev->slot,
+				 dev->func);
+		pthread_setname_np(qp->tx_tid, tname);
+	}
+
+	pthread_mutex_lock(&vtnet_devs_mtx);
+	LIST_INSERT_HEAD(&vtnet_devs, net, link);
+	pthread_mutex_unlock(&vtnet_devs_mtx);
 
 	return 0;
 }
 
+/*
+ * Get the receive statistics of the @idx-th queue pair among all the
+ * virtio-net devices, named as vtnet<slot>:<func>-rx<queue pair>.
+ */
+int
+virtio_net_get_rx_stats(int idx, char *name, size_t len, struct virtio_net_rx_stats *stats)
+{
+	struct virtio_net *net;
+	int ret = -1;
+
+	pthread_mutex_lock(&vtnet_devs_mtx);
+	LIST_FOREACH(net, &vtnet_devs, link) {
+		if (net->use_vhost)
+			continue;
+		if (idx < net->max_qpairs) {
+			snprintf(name, len, "vtnet%d:%d-rx%d", net->base.dev->slot,
+				 net->base.dev->func, idx);
+			*stats = net->qpairs[idx].rx_stats;
+			ret = 0;
+			break;
+		}
+		idx -= net->max_qpairs;
+	}
+	pthread_mutex_unlock(&vtnet_devs_mtx);
+
+	return ret;
+}
+
 static int
 virtio_net_cfgwrite(void *vdev, int offset, int size, uint32_t value)
 {
@@ -1092,32 +1755,39 @@ virtio_net_neg_features(void *vdev, uint64_t negotiated_features)
 		/* non-merge rx header is 2 bytes shorter */
 		net->rx_vhdrlen -= 2;
 	}
+
+	virtio_net_tap_set_offload(net);
 }
 
 static void
 virtio_net_set_status(void *vdev, uint64_t status)
 {
 	struct virtio_net *net = vdev;
-	int rc;
-
-	if (!net->vhost_net)
-		return;
-
-	if (!net->vhost_net->vhost_started &&
-		(status & VIRTIO_CONFIG_S_DRIVER_OK)) {
-		if (net->mevp)
-			mevent_disable(net->mevp);
+	struct virtio_net_qpair *qp;
+	int rc, i;
 
-		rc = vhost_net_start(net->vhost_net);
-		if (rc < 0) {
-			WPRINTF(("vhost_net_start failed\n"));
-			return;
+	/* vhost serves all the queue pairs, the control queue stays in the device model */
+	for (i = 0; i < net->max_qpairs; i++) {
+		qp = &net->qpairs[i];
+		if (!qp->vhost_net)
+			continue;
+
+		if (!qp->vhost_net->vhost_started &&
+			(status & VIRTIO_CONFIG_S_DRIVER_OK)) {
+			if (qp->mevp)
+				mevent_disable(qp->mevp);
+
+			rc = vhost_net_start(qp->vhost_net);
+			if (rc < 0) {
+				WPRINTF(("vhost_net_start failed on queue pair %d\n", i));
+				return;
+			}
+		} else if (qp->vhost_net->vhost_started &&
+			((status & VIRTIO_CONFIG_S_DRIVER_OK) == 0)) {
+			rc = vhost_net_stop(qp->vhost_net);
+			if (rc < 0)
+				WPRINTF(("vhost_net_stop failed on queue pair %d\n", i));
 		}
-	} else if (net->vhost_net->vhost_started &&
-		((status & VIRTIO_CONFIG_S_DRIVER_OK) == 0)) {
-		rc = vhost_net_stop(net->vhost_net);
-		if (rc < 0)
-			WPRINTF(("vhost_net_stop failed\n"));
 	}
 }
 
@@ -1125,41 +1795,75 @@ static void
 virtio_net_teardown(void *param)
 {
 	struct virtio_net *net;
+	int i;
 
 	net = (struct virtio_net *)param;
 	if (!net)
 		return;
 
-	if (net->tapfd >= 0) {
-		close(net->tapfd);
-		net->tapfd = -1;
-	} else
-		pr_err("net->tapfd is -1!\n");
+	for (i = 0; i < net->max_qpairs; i++) {
+		if (net->qpairs[i].tapfd >= 0) {
+			close(net->qpairs[i].tapfd);
+			net->qpairs[i].tapfd = -1;
+		}
+	}
 
 	virtio_reset_dev(&net->base);
 	free(net);
 }
 
+/*
+ * The rx mevents of the queue pairs are torn down asynchronously, the last
+ * one frees the device.
+ */
+static void
+virtio_net_qpair_teardown(void *param)
+{
+	struct virtio_net_qpair *qp = param;
+	struct virtio_net *net = qp->net;
+
+	if (__sync_sub_and_fetch(&net->teardown_refs, 1) == 0)
+		virtio_net_teardown(net);
+}
+
 static void
 virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct virtio_net *net;
+	struct virtio_net_qpair *qp;
+	bool deferred = false;
+	int i;
 
 	if (dev->arg) {
 		net = (struct virtio_net *) dev->arg;
 
-		virtio_net_tx_stop(net);
+		pthread_mutex_lock(&vtnet_devs_mtx);
+		LIST_REMOVE(net, link);
+		pthread_mutex_unlock(&vtnet_devs_mtx);
+
+		for (i = 0; i < net->max_qpairs; i++) {
+			qp = &net->qpairs[i];
+
+			virtio_net_tx_stop(qp);
 
-		if (net->vhost_net) {
-			vhost_net_stop(net->vhost_net);
-			vhost_net_deinit(net->vhost_net);
-			free(net->vhost_net);
-			net->vhost_net = NULL;
+			if (qp->vhost_net) {
+				vhost_net_stop(qp->vhost_net);
+				vhost_net_deinit(qp->vhost_net);
+				free(qp->vhost_net);
+				qp->vhost_net = NULL;
+			}
+
+			if ((qp->ioctx != NULL) && (qp->tapfd >= 0) && !qp->rx_paused)
+				iothread_del(qp->ioctx, qp->tapfd);
 		}
 
-		if (net->mevp != NULL)
-			mevent_delete(net->mevp);
-		else
+		for (i = 0; i < net->max_qpairs; i++) {
+			if (net->qpairs[i].mevp != NULL) {
+				mevent_delete(net->qpairs[i].mevp);
+				deferred = true;
+			}
+		}
+		if (!deferred)
 			virtio_net_teardown(net);
 
 		DPRINTF(("%s: done\n", __func__));
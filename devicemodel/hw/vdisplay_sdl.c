@@ -33,6 +33,8 @@
 #define VDPY_MIN_HEIGHT 480
 #define transto_10bits(color) (uint16_t)(color * 1024 + 0.5)
 #define VSCREEN_MAX_NUM 2
+/* above it, the bounding box of the damage is uploaded */
+#define VDPY_MAX_DAMAGE_RECTS 16
 
 static unsigned char default_raw_argb[VDPY_DEFAULT_WIDTH * VDPY_DEFAULT_HEIGHT * 4];
 
@@ -68,7 +70,9 @@ struct vscreen {
 	SDL_Texture *surf_tex;
 	SDL_Texture *cur_tex;
 	SDL_Texture *bogus_tex;
+	/* updates merged in the frame to present, and the damage to upload */
 	int surf_updates;
+	pixman_region16_t damage;
 	int cur_updates;
 	SDL_Window *win;
 	SDL_Renderer *renderer;
@@ -636,6 +640,86 @@ static void sdl_gl_prepare_draw(struct vscreen *vscr)
 	return;
 }
 
+void
+vdpy_cursor_position_transformation(struct display *vdpy, int scanout_id, SDL_Rect *rect)
+{
+	struct vscreen *vscr;
+
+	if (scanout_id >= vdpy->vscrs_num) {
+		return;
+	}
+
+	vscr = vdpy->vscrs + scanout_id;
+	rect->x = (vscr->cur.x * vscr->width) / vscr->guest_width;
+	rect->y = (vscr->cur.y * vscr->height) / vscr->guest_height;
+	rect->w = (vscr->cur.width * vscr->width) / vscr->guest_width;
+	rect->h = (vscr->cur.height * vscr->height) / vscr->guest_height;
+}
+
+/*
+ * Upload the damaged area of the surface to its texture, as separate
+ * rectangles unless there are too many of them.
+ */
+static void
+vdpy_surface_upload(struct vscreen *vscr)
+{
+	pixman_box16_t *boxes;
+	SDL_Rect rect;
+	int i, n, bytes_pp;
+
+	if (!pixman_region_not_empty(&vscr->damage))
+		return;
+
+	bytes_pp = PIXMAN_FORMAT_BPP(vscr->surf.surf_format) / 8;
+	boxes = pixman_region_rectangles(&vscr->damage, &n);
+	if (n > VDPY_MAX_DAMAGE_RECTS) {
+		boxes = pixman_region_extents(&vscr->damage);
+		n = 1;
+	}
+	for (i = 0; i < n; i++) {
+		rect.x = boxes[i].x1;
+		rect.y = boxes[i].y1;
+		rect.w = boxes[i].x2 - boxes[i].x1;
+		rect.h = boxes[i].y2 - boxes[i].y1;
+		SDL_UpdateTexture(vscr->surf_tex, &rect,
+				(uint8_t *)vscr->surf.pixel + rect.y * vscr->surf.stride +
+				rect.x * bytes_pp,
+				vscr->surf.stride);
+	}
+	pixman_region_clear(&vscr->damage);
+}
+
+/*
+ * Render the frame merging the updates of the surface since the last one,
+ * their pixels are in the texture already.
+ */
+static void
+vdpy_surface_present(struct vscreen *vscr, int scanout_id)
+{
+	SDL_Rect cursor_rect;
+
+	if (vscr->surf_updates == 0)
+		return;
+	vscr->surf_updates = 0;
+
+	sdl_gl_prepare_draw(vscr);
+	SDL_RenderCopy(vscr->renderer, vscr->surf_tex, NULL, NULL);
+
+	/* This should be handled after rendering the surface_texture.
+	 * Otherwise it will be hidden
+	 */
+	if (vscr->cur_tex) {
+		vdpy_cursor_position_transformation(&vdpy, scanout_id, &cursor_rect);
+		SDL_RenderCopy(vscr->renderer, vscr->cur_tex,
+				NULL, &cursor_rect);
+	}
+
+	SDL_RenderPresent(vscr->renderer);
+
+	/* update the rendering time */
+	clock_gettime(CLOCK_MONOTONIC, &vscr->last_time);
+}
+
 void
 vdpy_surface_set(int handle, int scanout_id, struct surface *surf)
 {
@@ -660,6 +744,9 @@ vdpy_surface_set(int handle, int scanout_id, struct surface *surf)
 
 	vscr = vdpy.vscrs + scanout_id;
 
+	/* present the updates of the previous surface */
+	vdpy_surface_present(vscr, scanout_id);
+
 	if (surf == NULL ) {
 		vscr->surf.width = 0;
 		vscr->surf.height = 0;
@@ -736,6 +823,12 @@ vdpy_surface_set(int handle, int scanout_id, struct surface *surf)
 	}
 
 	/* For the surf_switch, it will be updated in surface_update */
+	pixman_region_fini(&vscr->damage);
+	if (surf && (surf->surf_type == SURFACE_PIXMAN))
+		pixman_region_init_rect(&vscr->damage, 0, 0, surf->width, surf->height);
+	else
+		pixman_region_init(&vscr->damage);
+
 	if (!surf) {
 		SDL_UpdateTexture(vscr->surf_tex, NULL,
 				  pixman_image_get_data(src_img),
@@ -800,26 +893,20 @@ vdpy_surface_set(int handle, int scanout_id, struct surface *surf)
 	vscr->img = src_img;
 }
 
+/*
+ * Upload the updated area of the surface to its texture and merge the
+ * update into the frame to present. The frames are presented once the
+ * display thread handled the pending requests, so the updates of one batch
+ * of virtio-gpu commands are rendered together. The pixels are uploaded
+ * right away as the following commands of the batch may change or free
+ * them.
+ * @damage is the updated area in the surface coordinates, NULL for the
+ * whole surface.
+ */
 void
-vdpy_cursor_position_transformation(struct display *vdpy, int scanout_id, SDL_Rect *rect)
-{
-	struct vscreen *vscr;
-
-	if (scanout_id >= vdpy->vscrs_num) {
-		return;
-	}
-
-	vscr = vdpy->vscrs + scanout_id;
-	rect->x = (vscr->cur.x * vscr->width) / vscr->guest_width;
-	rect->y = (vscr->cur.y * vscr->height) / vscr->guest_height;
-	rect->w = (vscr->cur.width * vscr->width) / vscr->guest_width;
-	rect->h = (vscr->cur.height * vscr->height) / vscr->guest_height;
-}
-
-void
-vdpy_surface_update(int handle, int scanout_id, struct surface *surf)
+vdpy_surface_update(int handle, int scanout_id, struct surface *surf,
+		pixman_region16_t *damage)
 {
-	SDL_Rect cursor_rect;
 	struct vscreen *vscr;
 
 	if (handle != vdpy.s.n_connect) {
@@ -842,27 +929,19 @@ vdpy_surface_update(int handle, int scanout_id, struct surface *surf)
 	}
 
 	vscr = vdpy.vscrs + scanout_id;
-	if (surf->surf_type == SURFACE_PIXMAN)
-		SDL_UpdateTexture(vscr->surf_tex, NULL,
-			  surf->pixel,
-			  surf->stride);
-
-	sdl_gl_prepare_draw(vscr);
-	SDL_RenderCopy(vscr->renderer, vscr->surf_tex, NULL, NULL);
-
-	/* This should be handled after rendering the surface_texture.
-	 * Otherwise it will be hidden
-	 */
-	if (vscr->cur_tex) {
-		vdpy_cursor_position_transformation(&vdpy, scanout_id, &cursor_rect);
-		SDL_RenderCopy(vscr->renderer, vscr->cur_tex,
-				NULL, &cursor_rect);
+	if (surf->surf_type == SURFACE_PIXMAN) {
+		vscr->surf.pixel = surf->pixel;
+		vscr->surf.stride = surf->stride;
+		if (damage)
+			pixman_region_union(&vscr->damage, &vscr->damage, damage);
+		else
+			pixman_region_union_rect(&vscr->damage, &vscr->damage,
+					0, 0, vscr->guest_width, vscr->guest_height);
+		pixman_region_intersect_rect(&vscr->damage, &vscr->damage,
+				0, 0, vscr->guest_width, vscr->guest_height);
+		vdpy_surface_upload(vscr);
 	}
-
-	SDL_RenderPresent(vscr->renderer);
-
-	/* update the rendering time */
-	clock_gettime(CLOCK_MONOTONIC, &vscr->last_time);
+	vscr->surf_updates++;
 }
 
 void
@@ -1095,6 +1174,7 @@ vdpy_sdl_display_thread(void *data)
 			goto sdl_fail;
 		}
 		clock_gettime(CLOCK_MONOTONIC, &vscr->last_time);
+		pixman_region_init(&vscr->damage);
 	}
 	sdl_gl_display_init();
 	pthread_mutex_init(&vdpy.vdisplay_mutex, NULL);
@@ -1144,6 +1224,9 @@ vdpy_sdl_display_thread(void *data)
 			}
 		}
 
+		for (i = 0; i < vdpy.vscrs_num; i++)
+			vdpy_surface_present(vdpy.vscrs + i, i);
+
 		pthread_mutex_unlock(&vdpy.vdisplay_mutex);
 	} while (1);
 
@@ -1158,6 +1241,7 @@ vdpy_sdl_display_thread(void *data)
 			pixman_image_unref(vscr->img);
 			vscr->img = NULL;
 		}
+		pixman_region_fini(&vscr->damage);
 		/* Continue to thread cleanup */
 		if (vscr->surf_tex) {
 			SDL_DestroyTexture(vscr->surf_tex);
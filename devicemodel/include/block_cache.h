@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef _BLOCK_CACHE_H_
+#define _BLOCK_CACHE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+struct block_cache;
+struct block_cache_fill;
+
+/*
+ * Statistics of the read cache of one image, counted by all the DMs sharing it
+ */
+struct block_cache_stats {
+	uint64_t hits;		/* chunks read from the cache */
+	uint64_t misses;	/* chunks read from the image */
+	uint64_t evictions;	/* chunks dropped to cache others */
+	uint64_t uncached;	/* misses read around the cache, no slot free */
+	uint64_t size;		/* capacity in bytes */
+	uint64_t used;		/* bytes cached */
+};
+
+struct block_cache *block_cache_get(int fd, size_t size, bool shared);
+void	block_cache_put(struct block_cache *cache);
+ssize_t	block_cache_read(struct block_cache *cache, int fd, const struct iovec *iov, int iovcnt, off_t offset);
+bool	block_cache_cached(struct block_cache *cache, off_t offset, size_t len);
+struct block_cache_fill *block_cache_fill_start(struct block_cache *cache, off_t offset, size_t len,
+		struct iovec **iov, int *iovcnt, off_t *foffset);
+ssize_t	block_cache_fill_end(struct block_cache *cache, struct block_cache_fill *fill, ssize_t res,
+		const struct iovec *iov, int iovcnt, size_t skip);
+int	block_cache_get_stats(int idx, char *name, size_t len, struct block_cache_stats *stats);
+
+#endif
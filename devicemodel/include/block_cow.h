@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef _BLOCK_COW_H_
+#define _BLOCK_COW_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+struct cow_image;
+
+/*
+ * A contiguous part of a guest range of a COW image, and where it is stored
+ */
+struct cow_extent {
+	int	fd;	/* overlay or backing image, -1 if it reads as zeroes */
+	off_t	offset;	/* offset in fd */
+	off_t	len;	/* length in bytes */
+};
+
+struct cow_image *cow_open(int fd, const char *backing, bool ro, bool direct, off_t *size);
+void	cow_close(struct cow_image *cow);
+int	cow_map(struct cow_image *cow, off_t offset, off_t len, bool write, struct cow_extent *ext);
+int	cow_backing_fd(struct cow_image *cow);
+
+#endif
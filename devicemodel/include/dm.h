@@ -79,4 +79,30 @@ size_t high_bios_size(void);
 void init_debugexit(void);
 void deinit_debugexit(void);
 void set_thread_priority(int priority, bool reset_on_fork);
+
+/**
+ * @brief Get the usage of the asyncio shared ring
+ *
+ * The hypervisor never drops an asyncio request: a vCPU that finds the ring
+ * full waits for the Service VM to consume it. Such waits are counted in the
+ * overrun_cnt of the ring header.
+ *
+ * @param ele_num Output, the number of elements of the ring.
+ * @param fill Output, the number of elements not consumed yet.
+ * @param full_waits Output, how many requests waited for room in the ring.
+ *
+ * @return 0 on success, -1 if the ring is not set up.
+ */
+int vm_get_asyncio_stats(uint32_t *ele_num, uint32_t *fill, uint32_t *full_waits);
+
+/**
+ * @brief Get the statistics of the vm_loop poll mode
+ *
+ * @param hit Output, how many poll windows found I/O requests.
+ * @param miss Output, how many poll windows expired.
+ * @param sleep Output, how many times vm_loop slept waiting for I/O requests.
+ *
+ * @return 0 on success, -1 if the poll mode is not enabled.
+ */
+int vm_get_ioreq_poll_stats(uint64_t *hit, uint64_t *miss, uint64_t *sleep);
 #endif
@@ -8,6 +8,7 @@
 #define	_iothread_CTX_H_
 
 #define IOTHREAD_NUM			40
+#define IOTHREAD_POLLER_MAX		64
 
 /*
  * The pthread_setname_np() function can be used to set a unique name for a thread,
@@ -17,8 +18,32 @@
  */
 #define PTHREAD_NAME_MAX_LEN		16
 
+/*
+ * Adaptive busy-poll: before going to sleep, a thread polls for new work for
+ * up to cur_ns. cur_ns grows when a sleep turns out to be shorter than max_ns
+ * (polling a bit longer would have caught the wakeup) and shrinks when a poll
+ * window expires without finding work, so an idle thread backs off to plain
+ * blocking. max_ns == 0 disables polling.
+ */
+#define IOTHREAD_POLL_GROW_START_NS	10000U
+#define IOTHREAD_POLL_MAX_US		(1000U * 1000U)
+
+struct iothread_poll {
+	uint32_t max_ns;
+	uint32_t cur_ns;
+	uint64_t hit;		/* poll windows that found work */
+	uint64_t miss;		/* poll windows that expired */
+	uint64_t sleep;		/* times the thread went to sleep */
+};
+
 struct iothread_mevent {
 	void (*run)(void *);
+	/*
+	 * Optional, called repeatedly while the iothread is polling. It handles
+	 * the pending work of @arg, if any, without waiting for the fd to be
+	 * signaled and returns true if there was some.
+	 */
+	bool (*poll)(void *);
 	void *arg;
 	int fd;
 };
@@ -31,12 +56,24 @@ struct iothread_ctx {
 	int idx;
 	cpu_set_t cpuset;
 	char name[PTHREAD_NAME_MAX_LEN];
+	struct iothread_poll poll;
+	/* the mevents with a poll callback, protected by mtx */
+	struct iothread_mevent *pollers[IOTHREAD_POLLER_MAX];
+	int npollers;
+	uint32_t poll_gen;	/* bumped on every change of pollers */
+	bool polling;		/* the poll callbacks are being called */
+	pthread_cond_t poll_cond;	/* signaled when polling is cleared */
+	/* the iothread's copy of pollers at poll_snap_gen, called without mtx */
+	struct iothread_mevent *poll_snap[IOTHREAD_POLLER_MAX];
+	int npoll_snap;
+	uint32_t poll_snap_gen;
 };
 
 struct iothreads_option {
 	char tag[PTHREAD_NAME_MAX_LEN];
 	int num;
 	cpu_set_t *cpusets;
+	uint32_t poll_max_ns;
 };
 
 struct iothreads_info {
@@ -50,5 +87,11 @@ void iothread_deinit(void);
 struct iothread_ctx *iothread_create(struct iothreads_option *iothr_opt);
 int iothread_parse_options(char *str, struct iothreads_option *iothr_opt);
 void iothread_free_options(struct iothreads_option *iothr_opt);
+int iothread_parse_poll(char *str, uint32_t *max_ns);
+void iothread_poll_init(struct iothread_poll *poll, uint32_t max_ns);
+bool iothread_poll_run(struct iothread_poll *poll, bool (*check)(void *), void *arg);
+void iothread_poll_slept(struct iothread_poll *poll, uint64_t slept_ns);
+uint64_t iothread_poll_now(void);
+int iothread_get_poll_stats(int idx, const char **name, struct iothread_poll *stats);
 
 #endif
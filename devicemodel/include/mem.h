@@ -50,11 +50,12 @@ struct mem_range {
 #define	MEM_F_RW		(MEM_F_READ | MEM_F_WRITE)
 #define	MEM_F_IMMUTABLE		0x4	/* mem_range cannot be unregistered */
 
-int	emulate_mem(struct vmctx *ctx, struct acrn_mmio_request *mmio_req);
+int	emulate_mem(struct vmctx *ctx, int vcpu, struct acrn_mmio_request *mmio_req);
 int	register_mem(struct mem_range *memp);
 int	register_mem_fallback(struct mem_range *memp);
 int	unregister_mem(struct mem_range *memp);
 int	unregister_mem_fallback(struct mem_range *memp);
 void	init_mem(void);
+void	mem_get_hint_stats(uint64_t *hit, uint64_t *miss);
 
 #endif	/* _MEM_H_ */
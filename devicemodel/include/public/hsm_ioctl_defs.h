@@ -89,6 +89,8 @@
 	_IOW(ACRN_IOCTL_TYPE, 0x24, unsigned long)
 #define ACRN_IOCTL_SET_IRQLINE		\
 	_IOW(ACRN_IOCTL_TYPE, 0x25, __u64)
+#define ACRN_IOCTL_VM_VMEXIT_STATS	\
+	_IOWR(ACRN_IOCTL_TYPE, 0x26, struct acrn_vmexit_stats)
 
 /* DM ioreq management */
 #define ACRN_IOCTL_NOTIFY_REQUEST_FINISH \
@@ -101,6 +103,8 @@
 	_IO(ACRN_IOCTL_TYPE, 0x34)
 #define ACRN_IOCTL_CLEAR_VM_IOREQ	\
 	_IO(ACRN_IOCTL_TYPE, 0x35)
+#define ACRN_IOCTL_NOTIFY_REQUEST_FINISH_BATCH \
+	_IOW(ACRN_IOCTL_TYPE, 0x36, struct acrn_ioreq_notify_batch)
 
 /* Guest memory management */
 #define ACRN_IOCTL_SET_MEMSEG		\
@@ -228,6 +232,17 @@ struct acrn_ioreq_notify {
 	__u32	vcpu;
 };
 
+/**
+ * @brief data strcture to notify hypervisor a batch of ioreqs is handled
+ */
+struct acrn_ioreq_notify_batch {
+	/** VM id to identify ioreq client */
+	__u16	vmid;
+	__u16	reserved[3];
+	/** identify the ioreq submitters, bit n for vCPU n */
+	__u64	vcpu_mask;
+};
+
 #define ACRN_PLATFORM_LAPIC_IDS_MAX	64
 struct acrn_ioeventfd {
 #define ACRN_IOEVENTFD_FLAG_PIO		0x01
@@ -461,6 +461,24 @@ struct virtio_vq_info {
 	uint32_t gpa_avail[2];	/**< gpa of avail_ring */
 	uint32_t gpa_used[2];	/**< gpa of used_ring */
 	bool enabled;		/**< whether the virtqueue is enabled */
+
+	/*
+	 * Packed ring layout, used instead of desc/avail/used if
+	 * VIRTIO_F_RING_PACKED is negotiated. last_avail and save_used are
+	 * then positions in the descriptor ring.
+	 */
+	bool packed;		/**< whether the packed ring layout is used */
+	bool avail_wrap;	/**< wrap counter at last_avail */
+	bool used_wrap;		/**< wrap counter at used_idx */
+	bool save_used_wrap;	/**< wrap counter at save_used */
+	uint16_t used_idx;	/**< position of the next used descriptor */
+	uint16_t *chain_ndesc;	/**< ring descriptors of each buffer id, then of each chain tail */
+	volatile struct vring_packed_desc *pdesc;
+				/**< packed descriptor ring */
+	volatile struct vring_packed_desc_event *driver_event;
+				/**< event suppression written by the driver */
+	volatile struct vring_packed_desc_event *device_event;
+				/**< event suppression written by the device */
 };
 
 /* as noted above, these are sort of backwards, name-wise */
@@ -482,6 +500,24 @@ vq_ring_ready(struct virtio_vq_info *vq)
 	return ((vq->flags & VQ_ALLOC) == VQ_ALLOC);
 }
 
+/**
+ * @brief Is the descriptor at the given position of a packed ring available?
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param idx Position in the descriptor ring.
+ * @param wrap Wrap counter at the position.
+ *
+ * @return false on not available and true on available.
+ */
+static inline bool
+vq_packed_desc_avail(struct virtio_vq_info *vq, uint16_t idx, bool wrap)
+{
+	uint16_t flags = vq->pdesc[idx].flags;
+
+	return (!!(flags & (1 << VRING_PACKED_DESC_F_AVAIL)) == wrap) &&
+		(!!(flags & (1 << VRING_PACKED_DESC_F_USED)) != wrap);
+}
+
 /**
  * @brief Are there "available" descriptors?
  *
@@ -495,6 +531,10 @@ static inline bool
 vq_has_descs(struct virtio_vq_info *vq)
 {
 	bool ret = false;
+
+	if (vq_ring_ready(vq) && vq->packed)
+		return vq_packed_desc_avail(vq, vq->last_avail, vq->avail_wrap);
+
 	if (vq_ring_ready(vq) && vq->last_avail != vq->avail->idx) {
 		if ((uint16_t)((u_int)vq->avail->idx - vq->last_avail) > vq->qsize)
 			pr_err ("%s: no valid descriptor\n", vq->base->vops->name);
@@ -636,7 +676,8 @@ void virtio_set_io_bar(struct virtio_base *base, int barnum);
  * and put them into a given iov[] array.
  *
  * @param vq Pointer to struct virtio_vq_info.
- * @param pidx Pointer to available ring position.
+ * @param pidx Pointer to available ring position, or to buffer id with
+ * the packed ring layout.
  * @param iov Pointer to iov[] array prepared by caller.
  * @param n_iov Size of iov[] array.
  * @param flags Pointer to a uint16_t array which will contain flag of
@@ -647,6 +688,38 @@ void virtio_set_io_bar(struct virtio_base *base, int barnum);
 int vq_getchain(struct virtio_vq_info *vq, uint16_t *pidx,
 		struct iovec *iov, int n_iov, uint16_t *flags);
 
+/**
+ * @brief Descriptor chain fetched by vq_getchains_batch()
+ */
+struct vq_chain {
+	uint16_t idx;		/**< as returned by vq_getchain() in pidx */
+	int n;			/**< as returned by vq_getchain() */
+	struct iovec *iov;	/**< the iov[] entries of the chain */
+	uint16_t *flags;	/**< the flags of the chain, if requested */
+	uint32_t len;		/**< I/O length for vq_relchains_batch() */
+};
+
+/**
+ * @brief Walk through up to max_chains available chains at once.
+ *
+ * The chains take consecutive entries of iov[] and flags[], fetching
+ * stops when less than chain_iov entries are left. A chain failing as in
+ * vq_getchain() is returned with n < 0.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param chains Pointer to chains[] array prepared by caller.
+ * @param max_chains Size of chains[] array.
+ * @param iov Pointer to iov[] array prepared by caller.
+ * @param n_iov Size of iov[] array.
+ * @param flags Pointer to a uint16_t array of the size of iov[], or NULL.
+ * @param chain_iov Maximum number of iov[] entries of one chain.
+ *
+ * @return number of chains fetched.
+ */
+int vq_getchains_batch(struct virtio_vq_info *vq, struct vq_chain *chains,
+		int max_chains, struct iovec *iov, int n_iov,
+		uint16_t *flags, int chain_iov);
+
 /**
  * @brief Return the currently-first request chain back to the
  * available ring.
@@ -665,6 +738,17 @@ void vq_retchain(struct virtio_vq_info *vq);
  */
 void vq_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen);
 
+/**
+ * @brief Return chains to the guest at once, setting the I/O length of
+ * each one to its len.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ * @param chains Pointer to chains[] array, from vq_getchains_batch().
+ * @param nchains Number of chains to return.
+ */
+void vq_relchains_batch(struct virtio_vq_info *vq, struct vq_chain *chains,
+		int nchains);
+
 /**
  * @brief Driver has finished processing "available" chains and calling
  * vq_relchain on each one.
@@ -688,6 +772,17 @@ void vq_endchains(struct virtio_vq_info *vq, int used_all_avail);
  */
 void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *vq);
 
+/**
+ * @brief Helper function for setting used ring flags.
+ *
+ * Asks the driver not to notify the device of new available buffers. With
+ * the packed layout, the device event suppression flags are used instead
+ * of the used ring flags.
+ *
+ * @param vq Pointer to struct virtio_vq_info.
+ */
+void vq_set_used_ring_flags(struct virtio_vq_info *vq);
+
 /**
  * @brief Handle PCI configuration space reads.
  *
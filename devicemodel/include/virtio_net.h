@@ -0,0 +1,26 @@
+/* Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ *
+ */
+
+#ifndef _VIRTIO_NET_H_
+#define _VIRTIO_NET_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Receive statistics of one queue pair
+ */
+struct virtio_net_rx_stats {
+	uint64_t packets;	/* frames passed to the guest */
+	uint64_t batches;	/* wakeups of the tap queue passing frames */
+	uint64_t max_batch;	/* most frames passed in one wakeup */
+	uint64_t drops;		/* frames or rx buffers dropped on errors */
+	uint64_t pauses;	/* times the tap queue waited for rx buffers */
+};
+
+int virtio_net_get_rx_stats(int idx, char *name, size_t len, struct virtio_net_rx_stats *stats);
+
+#endif
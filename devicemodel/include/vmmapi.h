@@ -30,6 +30,7 @@
 #define	_VMMAPI_H_
 
 #include <sys/param.h>
+#include <sys/uio.h>
 #include "types.h"
 #include "macros.h"
 #include "pm.h"
@@ -107,6 +108,7 @@ int	vm_create_ioreq_client(struct vmctx *ctx);
 int	vm_destroy_ioreq_client(struct vmctx *ctx);
 int	vm_attach_ioreq_client(struct vmctx *ctx);
 int	vm_notify_request_done(struct vmctx *ctx, int vcpu);
+int	vm_notify_request_done_batch(struct vmctx *ctx, uint64_t vcpu_mask);
 int	vm_setup_asyncio(struct vmctx *ctx, uint64_t base);
 void	vm_clear_ioreq(struct vmctx *ctx);
 const char *vm_state_to_str(enum vm_suspend_how idx);
@@ -125,6 +127,7 @@ bool	init_hugetlb(void);
 void	uninit_hugetlb(void);
 int	hugetlb_setup_memory(struct vmctx *ctx);
 void	hugetlb_unsetup_memory(struct vmctx *ctx);
+int	vm_get_mem_iovecs(struct iovec *iov, int max);
 void	*vm_map_gpa(struct vmctx *ctx, vm_paddr_t gaddr, size_t len);
 uint32_t vm_get_lowmem_limit(struct vmctx *ctx);
 size_t	vm_get_lowmem_size(struct vmctx *ctx);
@@ -154,6 +157,7 @@ int	vm_set_vcpu_regs(struct vmctx *ctx, struct acrn_vcpu_regs *cpu_regs);
 
 int	vm_get_cpu_state(struct vmctx *ctx, void *state_buf);
 int	vm_intr_monitor(struct vmctx *ctx, void *intr_buf);
+int	vm_get_vmexit_stats(struct vmctx *ctx, struct acrn_vmexit_stats *stats);
 void	vm_stop_watchdog(struct vmctx *ctx);
 void	vm_reset_watchdog(struct vmctx *ctx);
 
@@ -617,9 +617,9 @@ int32_t ptirq_prepare_msix_remap(struct acrn_vm *vm, uint16_t virt_bdf, uint16_t
 	 * adds the mapping entries at runtime, if the
 	 * entry already be held by others, return error.
 	 */
-	spinlock_obtain(&ptdev_lock);
+	write_lock(&ptdev_lock);
 	entry = add_msix_remapping(vm, virt_bdf, phys_bdf, entry_nr);
-	spinlock_release(&ptdev_lock);
+	write_unlock(&ptdev_lock);
 
 	if (entry != NULL) {
 		ret = 0;
@@ -730,8 +730,16 @@ int32_t ptirq_intx_pin_remap(struct acrn_vm *vm, uint32_t virt_gsi, enum intx_ct
 
 	/* no remap for vuart intx */
 	if (!is_vuart_intx(vm, virt_sid.intx_id.gsi)) {
-		/* query if we have virt to phys mapping */
-		spinlock_obtain(&ptdev_lock);
+		/* query if we have virt to phys mapping, the pin is mapped already in most cases */
+		read_lock(&ptdev_lock);
+		entry = find_ptirq_entry(PTDEV_INTR_INTX, &virt_sid, vm);
+		read_unlock(&ptdev_lock);
+	} else {
+		status = -EINVAL;
+	}
+
+	if ((status == 0) && (entry == NULL)) {
+		write_lock(&ptdev_lock);
 		entry = find_ptirq_entry(PTDEV_INTR_INTX, &virt_sid, vm);
 		if (entry == NULL) {
 			if (is_service_vm(vm)) {
@@ -792,9 +800,7 @@ int32_t ptirq_intx_pin_remap(struct acrn_vm *vm, uint32_t virt_gsi, enum intx_ct
 				status = -ENODEV;
 			}
 		}
-		spinlock_release(&ptdev_lock);
-	} else {
-		status = -EINVAL;
+		write_unlock(&ptdev_lock);
 	}
 
 	if (status == 0) {
@@ -817,9 +823,9 @@ int32_t ptirq_add_intx_remapping(struct acrn_vm *vm, uint32_t virt_gsi, uint32_t
 	struct ptirq_remapping_info *entry;
 	enum intx_ctlr vgsi_ctlr = pic_pin ? INTX_CTLR_PIC : INTX_CTLR_IOAPIC;
 
-	spinlock_obtain(&ptdev_lock);
+	write_lock(&ptdev_lock);
 	entry = add_intx_remapping(vm, virt_gsi, phys_gsi, vgsi_ctlr);
-	spinlock_release(&ptdev_lock);
+	write_unlock(&ptdev_lock);
 
 	return (entry != NULL) ? 0 : -ENODEV;
 }
@@ -831,9 +837,9 @@ void ptirq_remove_intx_remapping(const struct acrn_vm *vm, uint32_t gsi, bool pi
 {
 	enum intx_ctlr vgsi_ctlr = pic_pin ? INTX_CTLR_PIC : INTX_CTLR_IOAPIC;
 
-	spinlock_obtain(&ptdev_lock);
+	write_lock(&ptdev_lock);
 	remove_intx_remapping(vm, gsi, vgsi_ctlr, is_phy_gsi);
-	spinlock_release(&ptdev_lock);
+	write_unlock(&ptdev_lock);
 }
 
 /*
@@ -845,9 +851,9 @@ void ptirq_remove_msix_remapping(const struct acrn_vm *vm, uint16_t phys_bdf,
 	uint32_t i;
 
 	for (i = 0U; i < vector_count; i++) {
-		spinlock_obtain(&ptdev_lock);
+		write_lock(&ptdev_lock);
 		remove_msix_remapping(vm, phys_bdf, i);
-		spinlock_release(&ptdev_lock);
+		write_unlock(&ptdev_lock);
 	}
 }
 
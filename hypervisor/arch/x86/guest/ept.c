@@ -83,8 +83,8 @@ static void reserve_ept_bitmap(void)
 	uint64_t bitmap_size;
 	uint64_t bitmap_offset;
 
-	bitmap_size = (get_ept_page_num() * CONFIG_MAX_VM_NUM) / 8;
-	bitmap_offset = get_ept_page_num() / 8;
+	bitmap_offset = page_pool_bitmap_size(get_ept_page_num());
+	bitmap_size = bitmap_offset * CONFIG_MAX_VM_NUM;
 
 	bitmap_base = e820_alloc_memory(bitmap_size, MEM_SIZE_MAX);
 	set_paging_supervisor(bitmap_base, bitmap_size);
@@ -176,10 +176,8 @@ void init_ept_pgtable(struct pgtable *table, uint16_t vm_id)
 	ept_page_pool[vm_id].bitmap_size = get_ept_page_num() / 64;
 	ept_page_pool[vm_id].bitmap = ept_page_bitmap[vm_id];
 	ept_page_pool[vm_id].dummy_page = &ept_dummy_pages[vm_id];
-
-	spinlock_init(&ept_page_pool[vm_id].lock);
-	memset((void *)ept_page_pool[vm_id].bitmap, 0, ept_page_pool[vm_id].bitmap_size * sizeof(uint64_t));
-	ept_page_pool[vm_id].last_hint_id = 0UL;
+	ept_page_pool[vm_id].pcpu_cache = true;
+	init_page_pool(&ept_page_pool[vm_id]);
 
 	table->pool = &ept_page_pool[vm_id];
 	table->default_access_right = EPT_RWX;
@@ -56,7 +56,7 @@ static void init_vept_pool(void)
 	set_paging_supervisor(page_base, calc_sept_size());
 
 	sept_pages = (struct page *)page_base;
-	sept_page_bitmap = (uint64_t *)e820_alloc_memory((calc_sept_page_num() / 64U), MEM_SIZE_MAX);
+	sept_page_bitmap = (uint64_t *)e820_alloc_memory(page_pool_bitmap_size(calc_sept_page_num()), MEM_SIZE_MAX);
 }
 
 static bool is_present_ept_entry(uint64_t ept_entry)
@@ -549,9 +549,8 @@ void init_vept(void)
 	sept_page_pool.bitmap_size = calc_sept_page_num() / 64U;
 	sept_page_pool.bitmap = sept_page_bitmap;
         sept_page_pool.dummy_page = NULL;
-	spinlock_init(&sept_page_pool.lock);
-	memset((void *)sept_page_pool.bitmap, 0, sept_page_pool.bitmap_size * sizeof(uint64_t));
-	sept_page_pool.last_hint_id = 0UL;
+	sept_page_pool.pcpu_cache = true;
+	init_page_pool(&sept_page_pool);
 
 	spinlock_init(&vept_desc_bucket_lock);
 }
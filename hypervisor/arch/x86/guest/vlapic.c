@@ -46,6 +46,7 @@
 #include <logmsg.h>
 #include <asm/irq.h>
 #include <ticks.h>
+#include <hash.h>
 #include "vlapic_priv.h"
 
 #define VLAPIC_VERBOS 0
@@ -59,6 +60,13 @@
 #define LOGICAL_ID_MASK		0xFU
 #define CLUSTER_ID_MASK		0xFFFF0U
 
+/* Logical destination models a vLAPIC is published under in vlapic_dest_map */
+#define VLAPIC_DEST_MODEL_NONE		0U
+#define VLAPIC_DEST_MODEL_FLAT		1U
+#define VLAPIC_DEST_MODEL_CLUSTER	2U
+#define VLAPIC_DEST_MODEL_X2APIC	3U
+#define VLAPIC_DEST_MODEL_X2APIC_OTHER	4U
+
 #define DBG_LEVEL_VLAPIC		6U
 
 static inline struct acrn_vcpu *vlapic2vcpu(const struct acrn_vlapic *vlapic)
@@ -125,19 +133,54 @@ vm_lapic_from_vcpu_id(struct acrn_vm *vm, uint16_t vcpu_id)
 	return vcpu_vlapic(vcpu);
 }
 
-static uint16_t vm_apicid2vcpu_id(struct acrn_vm *vm, uint32_t lapicid)
+static inline uint32_t vlapic_apicid_hash(uint32_t lapicid)
+{
+	return (uint32_t)hash64(lapicid, VLAPIC_APICID_HASH_BITS);
+}
+
+/*
+ * Add the vCPU of the vlapic to the APIC ID hash table of its VM.
+ * The APIC ID of a vCPU never changes after creation, so entries
+ * are only dropped when the table is cleared for the BSP.
+ */
+static void vlapic_apicid_hash_add(struct acrn_vlapic *vlapic)
+{
+	struct acrn_vcpu *vcpu = vlapic2vcpu(vlapic);
+	struct vlapic_dest_map *map = &vcpu->vm->arch_vm.vlapic_dest_map;
+	uint32_t i = vlapic_apicid_hash(vlapic->vapic_id);
+
+	/* MAX_VCPUS_PER_VM is at most half of the table, it can't be full */
+	while (map->apicid_hash[i] != INVALID_CPU_ID) {
+		i = (i + 1U) & (VLAPIC_APICID_HASH_SIZE - 1U);
+	}
+	map->apicid_hash[i] = vcpu->vcpu_id;
+}
+
+static uint16_t vlapic_apicid_lookup(struct acrn_vm *vm, uint32_t lapicid)
 {
-	uint16_t i;
+	const struct vlapic_dest_map *map = &vm->arch_vm.vlapic_dest_map;
+	uint32_t i = vlapic_apicid_hash(lapicid);
 	struct acrn_vcpu *vcpu;
 	uint16_t cpu_id = INVALID_CPU_ID;
 
-	foreach_vcpu(i, vm, vcpu) {
+	while (map->apicid_hash[i] != INVALID_CPU_ID) {
+		vcpu = vcpu_from_vid(vm, map->apicid_hash[i]);
 		if (vcpu_vlapic(vcpu)->vapic_id == lapicid) {
-			cpu_id = vcpu->vcpu_id;
+			if (vcpu->state != VCPU_OFFLINE) {
+				cpu_id = vcpu->vcpu_id;
+			}
 			break;
 		}
+		i = (i + 1U) & (VLAPIC_APICID_HASH_SIZE - 1U);
 	}
 
+	return cpu_id;
+}
+
+static uint16_t vm_apicid2vcpu_id(struct acrn_vm *vm, uint32_t lapicid)
+{
+	uint16_t cpu_id = vlapic_apicid_lookup(vm, lapicid);
+
 	if (cpu_id == INVALID_CPU_ID) {
 		pr_err("%s: bad lapicid %lu", __func__, lapicid);
 	}
@@ -146,6 +189,91 @@ static uint16_t vm_apicid2vcpu_id(struct acrn_vm *vm, uint32_t lapicid)
 
 }
 
+static void vlapic_dest_map_change(struct vlapic_dest_map *map, uint16_t vcpu_id,
+		uint32_t model, uint32_t logical_id, bool set)
+{
+	volatile uint64_t *entries[8];
+	uint32_t i, n = 0U, bits = 0U;
+
+	switch (model) {
+	case VLAPIC_DEST_MODEL_FLAT:
+		bits = logical_id & 0xffU;
+		for (i = 0U; i < 8U; i++) {
+			entries[i] = &map->flat[i];
+		}
+		n = 8U;
+		break;
+	case VLAPIC_DEST_MODEL_CLUSTER:
+		bits = logical_id & 0xfU;
+		for (i = 0U; i < 4U; i++) {
+			entries[i] = &map->cluster[(logical_id >> 4U) & 0xfU][i];
+		}
+		n = 4U;
+		break;
+	case VLAPIC_DEST_MODEL_X2APIC:
+		bits = 1U;
+		entries[0] = &map->x2apic;
+		n = 1U;
+		break;
+	case VLAPIC_DEST_MODEL_X2APIC_OTHER:
+		bits = 1U;
+		entries[0] = &map->x2apic_other;
+		n = 1U;
+		break;
+	default:
+		/* Not published in any map */
+		break;
+	}
+
+	for (i = 0U; i < n; i++) {
+		if ((bits & (1U << i)) != 0U) {
+			if (set) {
+				bitmap_set_lock(vcpu_id, entries[i]);
+			} else {
+				bitmap_clear_lock(vcpu_id, entries[i]);
+			}
+		}
+	}
+}
+
+/*
+ * Republish the vlapic in the logical destination map of its VM. This
+ * must be called whenever the LDR, the DFR or the x2APIC mode of the
+ * vlapic changes.
+ */
+static void vlapic_update_dest_map(struct acrn_vlapic *vlapic)
+{
+	struct acrn_vcpu *vcpu = vlapic2vcpu(vlapic);
+	struct vlapic_dest_map *map = &vcpu->vm->arch_vm.vlapic_dest_map;
+	const struct lapic_regs *lapic = &(vlapic->apic_page);
+	uint32_t model, logical_id = 0U, x2apic_ldr;
+
+	if (is_x2apic_enabled(vlapic)) {
+		x2apic_ldr = ((vlapic->vapic_id & CLUSTER_ID_MASK) << 12U) |
+			(1U << (vlapic->vapic_id & LOGICAL_ID_MASK));
+		if (lapic->ldr.v == x2apic_ldr) {
+			model = VLAPIC_DEST_MODEL_X2APIC;
+		} else {
+			model = VLAPIC_DEST_MODEL_X2APIC_OTHER;
+		}
+	} else if ((lapic->dfr.v & APIC_DFR_MODEL_MASK) == APIC_DFR_MODEL_FLAT) {
+		model = VLAPIC_DEST_MODEL_FLAT;
+		logical_id = lapic->ldr.v >> 24U;
+	} else if ((lapic->dfr.v & APIC_DFR_MODEL_MASK) == APIC_DFR_MODEL_CLUSTER) {
+		model = VLAPIC_DEST_MODEL_CLUSTER;
+		logical_id = lapic->ldr.v >> 24U;
+	} else {
+		model = VLAPIC_DEST_MODEL_NONE;
+	}
+
+	if ((model != vlapic->dest_map_model) || (logical_id != vlapic->dest_map_ldr)) {
+		vlapic_dest_map_change(map, vcpu->vcpu_id, vlapic->dest_map_model, vlapic->dest_map_ldr, false);
+		vlapic_dest_map_change(map, vcpu->vcpu_id, model, logical_id, true);
+		vlapic->dest_map_model = model;
+		vlapic->dest_map_ldr = logical_id;
+	}
+}
+
 static inline void vlapic_build_x2apic_id(struct acrn_vlapic *vlapic)
 {
 	struct lapic_regs *lapic;
@@ -196,6 +324,8 @@ vlapic_write_dfr(struct acrn_vlapic *vlapic)
 	} else {
 		dev_dbg(DBG_LEVEL_VLAPIC, "DFR in Unknown Model %#x", lapic->dfr);
 	}
+
+	vlapic_update_dest_map(vlapic);
 }
 
 static void
@@ -206,6 +336,8 @@ vlapic_write_ldr(struct acrn_vlapic *vlapic)
 	lapic = &(vlapic->apic_page);
 	lapic->ldr.v &= ~APIC_LDR_RESERVED;
 	dev_dbg(DBG_LEVEL_VLAPIC, "vlapic LDR set to %#x", lapic->ldr);
+
+	vlapic_update_dest_map(vlapic);
 }
 
 static inline uint32_t
@@ -990,6 +1122,56 @@ static inline bool is_dest_field_matched(const struct acrn_vlapic *vlapic, uint3
 	return ret;
 }
 
+/*
+ * This function returns the set of vcpus whose logical destination
+ * may match 'dest', looked up from the logical destination map of
+ * the VM. Every candidate still has to be checked against its LDR.
+ */
+static uint64_t vlapic_logical_dest_candidates(struct acrn_vm *vm, uint32_t dest)
+{
+	const struct vlapic_dest_map *map = &vm->arch_vm.vlapic_dest_map;
+	uint64_t cands = map->x2apic_other;
+	uint32_t bits, cluster_id;
+	uint16_t bit, vcpu_id;
+
+	/* xAPIC flat model: the MDA is an 8-bit mask of logical APIC IDs */
+	bits = dest & 0xffU;
+	while (bits != 0U) {
+		bit = ffs64(bits);
+		bits &= ~(1U << bit);
+		cands |= map->flat[bit];
+	}
+
+	/* xAPIC cluster model: cluster in MDA bits 7:4, member mask in bits 3:0 */
+	cluster_id = (dest >> 4U) & 0xfU;
+	bits = dest & 0xfU;
+	while (bits != 0U) {
+		bit = ffs64(bits);
+		bits &= ~(1U << bit);
+		cands |= map->cluster[cluster_id][bit];
+	}
+
+	/*
+	 * x2APIC mode: the logical ID is derived from the x2APIC ID, so every
+	 * bit of the member mask in bits 15:0 names one APIC ID in the cluster
+	 * given by bits 31:16.
+	 */
+	if (map->x2apic != 0UL) {
+		cluster_id = dest >> 16U;
+		bits = dest & 0xffffU;
+		while (bits != 0U) {
+			bit = ffs64(bits);
+			bits &= ~(1U << bit);
+			vcpu_id = vlapic_apicid_lookup(vm, (cluster_id << 4U) | bit);
+			if ((vcpu_id != INVALID_CPU_ID) && bitmap_test(vcpu_id, &map->x2apic)) {
+				bitmap_set_nolock(vcpu_id, &cands);
+			}
+		}
+	}
+
+	return cands;
+}
+
 /*
  * This function populates 'dmask' with the set of vcpus that match the
  * addressing specified by the (dest, phys, lowprio) tuple.
@@ -998,9 +1180,8 @@ uint64_t
 vlapic_calc_dest_noshort(struct acrn_vm *vm, bool is_broadcast,
 		uint32_t dest, bool phys, bool lowprio)
 {
-	uint64_t dmask = 0UL;
+	uint64_t dmask = 0UL, cands;
 	struct acrn_vlapic *vlapic, *lowprio_dest = NULL;
-	struct acrn_vcpu *vcpu;
 	uint16_t vcpu_id;
 
 	if (is_broadcast) {
@@ -1014,7 +1195,15 @@ vlapic_calc_dest_noshort(struct acrn_vm *vm, bool is_broadcast,
 		 * Logical mode: "dest" is message destination addr
 		 * to be compared with the logical APIC ID in LDR.
 		 */
-		foreach_vcpu(vcpu_id, vm, vcpu) {
+		cands = vlapic_logical_dest_candidates(vm, dest);
+		while (cands != 0UL) {
+			vcpu_id = ffs64(cands);
+			bitmap_clear_nolock(vcpu_id, &cands);
+			if ((vcpu_id >= vm->hw.created_vcpus) ||
+					(vcpu_from_vid(vm, vcpu_id)->state == VCPU_OFFLINE)) {
+				continue;
+			}
+
 			vlapic = vm_lapic_from_vcpu_id(vm, vcpu_id);
 			if (!is_dest_field_matched(vlapic, dest)) {
 				continue;
@@ -1599,6 +1788,8 @@ vlapic_reset(struct acrn_vlapic *vlapic, const struct acrn_apicv_ops *ops, enum
 	vlapic->isrv = 0U;
 
 	vlapic->ops = ops;
+
+	vlapic_update_dest_map(vlapic);
 }
 
 void vlapic_restore(struct acrn_vlapic *vlapic, const struct lapic_regs *regs)
@@ -1613,6 +1804,7 @@ void vlapic_restore(struct acrn_vlapic *vlapic, const struct lapic_regs *regs)
 	lapic->ppr = regs->ppr;
 	lapic->ldr = regs->ldr;
 	lapic->dfr = regs->dfr;
+	vlapic_update_dest_map(vlapic);
 	for (i = 0; i < 8; i++) {
 		lapic->tmr[i].v = regs->tmr[i].v;
 	}
@@ -1700,6 +1892,7 @@ int32_t vlapic_set_apicbase(struct acrn_vlapic *vlapic, uint64_t new)
 				}
 				vlapic->msr_apicbase = new;
 				vlapic_build_x2apic_id(vlapic);
+				vlapic_update_dest_map(vlapic);
 				switch_apicv_mode_x2apic(vcpu);
 				update_vm_vlapic_state(vcpu->vm);
 			} else {
@@ -2186,6 +2379,7 @@ void vlapic_create(struct acrn_vcpu *vcpu, uint16_t pcpu_id)
 	struct acrn_vlapic *vlapic = vcpu_vlapic(vcpu);
 
 	if (is_vcpu_bsp(vcpu)) {
+		struct vlapic_dest_map *map = &vcpu->vm->arch_vm.vlapic_dest_map;
 		uint64_t *pml4_page =
 			(uint64_t *)vcpu->vm->arch_vm.nworld_eptp;
 		/* only need unmap it from Service VM as User VM never mapped it */
@@ -2198,12 +2392,19 @@ void vlapic_create(struct acrn_vcpu *vcpu, uint16_t pcpu_id)
 			vlapic_apicv_get_apic_access_addr(),
 			DEFAULT_APIC_BASE, PAGE_SIZE,
 			EPT_WR | EPT_RD | EPT_UNCACHED);
+
+		/* The BSP is created first, start with an empty destination map */
+		(void)memset((void *)map, 0U, sizeof(struct vlapic_dest_map));
+		(void)memset((void *)map->apicid_hash, 0xFFU, sizeof(map->apicid_hash));
 	}
 
 	vlapic_init_timer(vlapic);
 
 	/* Set vLAPIC ID to be same as pLAPIC ID */
 	vlapic->vapic_id = per_cpu(lapic_id, pcpu_id);
+	vlapic_apicid_hash_add(vlapic);
+	vlapic->dest_map_model = VLAPIC_DEST_MODEL_NONE;
+	vlapic->dest_map_ldr = 0U;
 
 	dev_dbg(DBG_LEVEL_VLAPIC, "vlapic APIC ID : 0x%04x", vlapic->vapic_id);
 }
@@ -2217,6 +2418,9 @@ void vlapic_free(struct acrn_vcpu *vcpu)
 
 	del_timer(&vlapic->vtimer.timer);
 
+	vlapic_dest_map_change(&vcpu->vm->arch_vm.vlapic_dest_map, vcpu->vcpu_id,
+			vlapic->dest_map_model, vlapic->dest_map_ldr, false);
+	vlapic->dest_map_model = VLAPIC_DEST_MODEL_NONE;
 }
 
 /**
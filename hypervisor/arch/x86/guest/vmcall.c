@@ -64,6 +64,8 @@ static const struct hc_dispatch hc_dispatch_table[] = {
 		.handler = hcall_asyncio_deassign},
 	[HC_IDX(HC_NOTIFY_REQUEST_FINISH)] = {
 		.handler = hcall_notify_ioreq_finish},
+	[HC_IDX(HC_NOTIFY_REQUEST_FINISH_BATCH)] = {
+		.handler = hcall_notify_ioreq_finish_batch},
 	[HC_IDX(HC_VM_SET_MEMORY_REGIONS)] = {
 		.handler = hcall_set_vm_memory_regions},
 	[HC_IDX(HC_VM_WRITE_PROTECT_PAGE)] = {
@@ -98,6 +100,8 @@ static const struct hc_dispatch hc_dispatch_table[] = {
 		.handler = hcall_profiling_ops},
 	[HC_IDX(HC_GET_HW_INFO)] = {
 		.handler = hcall_get_hw_info},
+	[HC_IDX(HC_VM_VMEXIT_STATS)] = {
+		.handler = hcall_get_vmexit_stats},
 	[HC_IDX(HC_INITIALIZE_TRUSTY)] = {
 		.handler = hcall_initialize_trusty,
 		.permission_flags = GUEST_FLAG_SECURE_WORLD_ENABLED},
@@ -210,6 +210,30 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 		.handler = loadiwkey_vmexit_handler}
 };
 
+/*
+ * Account the time from the last VM exit of @vcpu to now, which shall be
+ * right before the next VM entry, to the exit reason of that VM exit.
+ */
+void update_vmexit_stats(struct acrn_vcpu *vcpu)
+{
+	struct acrn_vmexit_reason_stats *stats;
+	uint16_t basic_exit_reason = (uint16_t)(vcpu->arch.exit_reason & 0xFFFFU);
+	uint64_t delta;
+	uint16_t bucket;
+
+	if ((vcpu->arch.exit_tsc != 0UL) && (basic_exit_reason < ACRN_VMEXIT_REASON_NUM)) {
+		delta = cpu_ticks() - vcpu->arch.exit_tsc;
+		bucket = (delta >> ACRN_VMEXIT_HIST_SHIFT) == 0UL ? 0U :
+			(fls64(delta >> ACRN_VMEXIT_HIST_SHIFT) + 1U);
+		bucket = min(bucket, (uint16_t)(ACRN_VMEXIT_HIST_NUM - 1U));
+
+		stats = &vcpu->arch.exit_stats[basic_exit_reason];
+		stats->count++;
+		stats->total_cycles += delta;
+		stats->hist[bucket]++;
+	}
+}
+
 int32_t vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	struct vm_exit_dispatch *dispatch = NULL;
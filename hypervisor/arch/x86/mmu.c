@@ -239,16 +239,16 @@ void set_paging_x(uint64_t base, uint64_t size)
 void allocate_ppt_pages(void)
 {
 	uint64_t page_base;
-	uint64_t bitmap_size = get_ppt_page_num() / 8;
 
 	page_base = e820_alloc_memory(sizeof(struct page) * get_ppt_page_num(), MEM_4G);
-	ppt_page_pool.bitmap = (uint64_t *)e820_alloc_memory(bitmap_size, MEM_4G);
+	ppt_page_pool.bitmap = (uint64_t *)e820_alloc_memory(page_pool_bitmap_size(get_ppt_page_num()), MEM_4G);
 
 	ppt_page_pool.start_page = (struct page *)(void *)page_base;
-	ppt_page_pool.bitmap_size = bitmap_size / sizeof(uint64_t);
+	ppt_page_pool.bitmap_size = get_ppt_page_num() / 64U;
 	ppt_page_pool.dummy_page = NULL;
-
-	memset(ppt_page_pool.bitmap, 0, bitmap_size);
+	/* the host page tables are built on BSP before the physical CPU ID is available */
+	ppt_page_pool.pcpu_cache = false;
+	init_page_pool(&ppt_page_pool);
 }
 
 void init_paging(void)
@@ -6,6 +6,7 @@
 #include <types.h>
 #include <asm/lib/bits.h>
 #include <asm/page.h>
+#include <asm/cpu.h>
 #include <logmsg.h>
 
 /**
@@ -22,53 +23,202 @@
  * support to manage memory resources.
  */
 
-struct page *alloc_page(struct page_pool *pool)
+/*
+ * Refresh the summary bits covering bitmap word @idx
+ * @pre pool->lock is held
+ */
+static void update_page_summary(struct page_pool *pool, uint64_t idx)
+{
+	uint64_t l1_idx = idx >> 6U;
+	uint64_t l2_idx = pool->summary_size + (l1_idx >> 6U);
+
+	if (*(pool->bitmap + idx) != ~0UL) {
+		bitmap_set_nolock((uint16_t)(idx & 0x3fUL), pool->summary + l1_idx);
+	} else {
+		bitmap_clear_nolock((uint16_t)(idx & 0x3fUL), pool->summary + l1_idx);
+	}
+
+	if (*(pool->summary + l1_idx) != 0UL) {
+		bitmap_set_nolock((uint16_t)(l1_idx & 0x3fUL), pool->summary + l2_idx);
+	} else {
+		bitmap_clear_nolock((uint16_t)(l1_idx & 0x3fUL), pool->summary + l2_idx);
+	}
+}
+
+/*
+ * @pre pool->lock is held
+ */
+static struct page *pool_alloc_page(struct page_pool *pool)
 {
 	struct page *page = NULL;
-	uint64_t loop_idx, idx, bit;
+	uint64_t l2_idx, l1_idx, idx, bit;
+	uint64_t l2_size = (pool->summary_size + 63UL) >> 6U;
 
-	spinlock_obtain(&pool->lock);
-	for (loop_idx = pool->last_hint_id;
-		loop_idx < (pool->last_hint_id + pool->bitmap_size); loop_idx++) {
-		idx = loop_idx % pool->bitmap_size;
-		if (*(pool->bitmap + idx) != ~0UL) {
+	for (l2_idx = 0UL; l2_idx < l2_size; l2_idx++) {
+		if (*(pool->summary + pool->summary_size + l2_idx) != 0UL) {
+			l1_idx = (l2_idx << 6U) + ffs64(*(pool->summary + pool->summary_size + l2_idx));
+			idx = (l1_idx << 6U) + ffs64(*(pool->summary + l1_idx));
 			bit = ffz64(*(pool->bitmap + idx));
-			bitmap_set_nolock(bit, pool->bitmap + idx);
+			bitmap_set_nolock((uint16_t)bit, pool->bitmap + idx);
+			update_page_summary(pool, idx);
 			page = pool->start_page + ((idx << 6U) + bit);
+			break;
+		}
+	}
 
-			pool->last_hint_id = idx;
+	return page;
+}
+
+/*
+ * @pre pool->lock is held
+ * @pre ((page - pool->start_page) >> 6U) < pool->bitmap_size
+ */
+static void pool_free_page(struct page_pool *pool, const struct page *page)
+{
+	uint64_t idx, bit;
+
+	idx = (page - pool->start_page) >> 6U;
+	bit = (page - pool->start_page) & 0x3fUL;
+	bitmap_clear_nolock((uint16_t)bit, pool->bitmap + idx);
+	update_page_summary(pool, idx);
+}
+
+void init_page_pool(struct page_pool *pool)
+{
+	uint64_t idx;
+	uint16_t pcpu_id;
+
+	spinlock_init(&pool->lock);
+	pool->summary = pool->bitmap + pool->bitmap_size;
+	pool->summary_size = (pool->bitmap_size + 63UL) >> 6U;
+	(void)memset((void *)pool->bitmap, 0U, page_pool_bitmap_size(pool->bitmap_size << 6U));
+	for (idx = 0UL; idx < pool->bitmap_size; idx++) {
+		update_page_summary(pool, idx);
+	}
+
+	for (pcpu_id = 0U; pcpu_id < MAX_PCPU_NUM; pcpu_id++) {
+		spinlock_init(&pool->magazine[pcpu_id].lock);
+		pool->magazine[pcpu_id].count = 0U;
+	}
+}
+
+uint32_t alloc_pages(struct page_pool *pool, struct page **pages, uint32_t num)
+{
+	uint32_t i, count = 0U;
+
+	spinlock_obtain(&pool->lock);
+	while (count < num) {
+		pages[count] = pool_alloc_page(pool);
+		if (pages[count] == NULL) {
 			break;
 		}
+		count++;
 	}
 	spinlock_release(&pool->lock);
 
+	for (i = 0U; i < count; i++) {
+		(void)memset(pages[i], 0U, PAGE_SIZE);
+	}
+
+	return count;
+}
+
+void free_pages(struct page_pool *pool, struct page * const *pages, uint32_t num)
+{
+	uint32_t i;
+
+	spinlock_obtain(&pool->lock);
+	for (i = 0U; i < num; i++) {
+		pool_free_page(pool, pages[i]);
+	}
+	spinlock_release(&pool->lock);
+}
+
+/*
+ * Pop a zeroed page from the magazine of @pcpu_id, refill the magazine
+ * from the pool in a batch when it is empty
+ */
+static struct page *magazine_alloc_page(struct page_pool *pool, uint16_t pcpu_id, bool refill)
+{
+	struct page_magazine *mag = &pool->magazine[pcpu_id];
+	struct page *page = NULL;
+
+	spinlock_obtain(&mag->lock);
+	if (refill && (mag->count == 0U)) {
+		mag->count = alloc_pages(pool, mag->pages, PAGE_MAGAZINE_BATCH);
+	}
+	if (mag->count != 0U) {
+		mag->count--;
+		page = mag->pages[mag->count];
+	}
+	spinlock_release(&mag->lock);
+
+	return page;
+}
+
+struct page *alloc_page(struct page_pool *pool)
+{
+	struct page *page = NULL;
+	uint16_t pcpu_id, i;
+
+	if (pool->pcpu_cache) {
+		pcpu_id = get_pcpu_id();
+		page = magazine_alloc_page(pool, pcpu_id, true);
+
+		/* the pool is empty, take a page cached by other physical CPUs */
+		for (i = 0U; (page == NULL) && (i < MAX_PCPU_NUM); i++) {
+			if (i != pcpu_id) {
+				page = magazine_alloc_page(pool, i, false);
+			}
+		}
+	} else if (alloc_pages(pool, &page, 1U) == 0U) {
+		page = NULL;
+	} else {
+		/* page is allocated and zeroed */
+	}
+
 	ASSERT(page != NULL, "no page aviable!");
-	page = (page != NULL) ? page : pool->dummy_page;
 	if (page == NULL) {
-		/* For HV MMU page-table mapping, we didn't use dummy page when there's no page
-		 * available in the page pool. This because we only do MMU page-table mapping on
-		 * the early boot time and we reserve enough pages for it. After that, we would
-		 * not do any MMU page-table mapping. We would let the system boot fail when page
-		 * allocation failed.
-		 */
-		panic("no dummy aviable!");
+		page = pool->dummy_page;
+		if (page == NULL) {
+			/* For HV MMU page-table mapping, we didn't use dummy page when there's no page
+			 * available in the page pool. This because we only do MMU page-table mapping on
+			 * the early boot time and we reserve enough pages for it. After that, we would
+			 * not do any MMU page-table mapping. We would let the system boot fail when page
+			 * allocation failed.
+			 */
+			panic("no dummy aviable!");
+		}
+		(void)memset(page, 0U, PAGE_SIZE);
 	}
-	(void)memset(page, 0U, PAGE_SIZE);
 	return page;
 }
 
 /*
- *@pre: ((page - pool->start_page) >> 6U) < pool->bitmap_size
+ *@pre: (page == pool->dummy_page) || (((page - pool->start_page) >> 6U) < pool->bitmap_size)
  */
 void free_page(struct page_pool *pool, struct page *page)
 {
-	uint64_t idx, bit;
+	struct page_magazine *mag;
 
-	spinlock_obtain(&pool->lock);
-	idx = (page - pool->start_page) >> 6U;
-	bit = (page - pool->start_page) & 0x3fUL;
-	bitmap_clear_nolock(bit, pool->bitmap + idx);
-	spinlock_release(&pool->lock);
+	if (page == pool->dummy_page) {
+		/* the dummy page is shared and never comes from the pool */
+	} else if (pool->pcpu_cache) {
+		/* keep the pages in the magazine zeroed so that alloc_page() can hand them out directly */
+		(void)memset(page, 0U, PAGE_SIZE);
+
+		mag = &pool->magazine[get_pcpu_id()];
+		spinlock_obtain(&mag->lock);
+		if (mag->count == PAGE_MAGAZINE_SIZE) {
+			mag->count -= PAGE_MAGAZINE_BATCH;
+			free_pages(pool, &mag->pages[mag->count], PAGE_MAGAZINE_BATCH);
+		}
+		mag->pages[mag->count] = page;
+		mag->count++;
+		spinlock_release(&mag->lock);
+	} else {
+		free_pages(pool, &page, 1U);
+	}
 }
 
 /**
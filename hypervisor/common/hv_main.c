@@ -43,6 +43,7 @@ void vcpu_thread(struct thread_object *obj)
 
 		reset_event(&vcpu->events[VCPU_EVENT_VIRTUAL_INTERRUPT]);
 		profiling_vmenter_handler(vcpu);
+		update_vmexit_stats(vcpu);
 
 		TRACE_2L(TRACE_VM_ENTER, 0UL, 0UL);
 		ret = run_vcpu(vcpu);
@@ -54,6 +55,7 @@ void vcpu_thread(struct thread_object *obj)
 			/* Fatal error happened (resume vcpu failed). Stop the vcpu running. */
 			continue;
 		}
+		vcpu->arch.exit_tsc = cpu_ticks();
 		TRACE_2L(TRACE_VM_EXIT, vcpu->arch.exit_reason, vcpu_get_rip(vcpu));
 
 		profiling_pre_vmexit_handler(vcpu);
@@ -608,6 +608,51 @@ int32_t hcall_notify_ioreq_finish(__unused struct acrn_vcpu *vcpu, struct acrn_v
 	return ret;
 }
 
+/**
+ * @brief notify a batch of requests done
+ *
+ * Notify the requestor VCPUs for the completion of their ioreqs, so that
+ * the Service VM completes a batch of requests with one hypercall.
+ *
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 bitmap of the requestor VCPU IDs, bit n for VCPU n
+ *
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_notify_ioreq_finish_batch(__unused struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vcpu *target_vcpu;
+	uint64_t vcpu_mask = param2;
+	uint16_t vcpu_id;
+	int32_t ret = -1;
+
+	if (is_severity_pass(target_vm->vm_id) &&
+	    (!is_poweroff_vm(target_vm)) && (target_vm->sw.io_shared_page != NULL)) {
+		dev_dbg(DBG_LEVEL_HYCALL, "[%d] NOTIFY_FINISH_BATCH for vcpus 0x%lx",
+			target_vm->vm_id, vcpu_mask);
+
+		/* fls64(0) is INVALID_BIT_INDEX, an empty bitmap is rejected too */
+		if (fls64(vcpu_mask) >= target_vm->hw.created_vcpus) {
+			pr_err("%s, invalid VCPU bitmap 0x%lx for VM %d\n",
+				__func__, vcpu_mask, target_vm->vm_id);
+		} else {
+			if (!target_vm->sw.is_polling_ioreq) {
+				vcpu_id = ffs64(vcpu_mask);
+				while (vcpu_id != INVALID_BIT_INDEX) {
+					bitmap_clear_nolock(vcpu_id, &vcpu_mask);
+					target_vcpu = vcpu_from_vid(target_vm, vcpu_id);
+					signal_event(&target_vcpu->events[VCPU_EVENT_IOREQ]);
+					vcpu_id = ffs64(vcpu_mask);
+				}
+			}
+			ret = 0;
+		}
+	}
+
+	return ret;
+}
+
 /**
  *@pre is_service_vm(vm)
  *@pre gpa2hpa(vm, region->service_vm_gpa) != INVALID_HPA
@@ -1000,9 +1045,9 @@ int32_t hcall_set_ptdev_intr_info(struct acrn_vcpu *vcpu, struct acrn_vm *target
 				union pci_bdf bdf = {.value = irq.virt_bdf};
 				struct acrn_vpci *vpci = &target_vm->vpci;
 
-				spinlock_obtain(&vpci->lock);
+				read_lock(&vpci->lock);
 				vdev = pci_find_vdev(vpci, bdf);
-				spinlock_release(&vpci->lock);
+				read_unlock(&vpci->lock);
 				/*
 				 * TODO: Change the hc_ptdev_irq structure member names
 				 * virt_pin to virt_gsi
@@ -1053,9 +1098,9 @@ int32_t hcall_reset_ptdev_intr_info(struct acrn_vcpu *vcpu, struct acrn_vm *targ
 				union pci_bdf bdf = {.value = irq.virt_bdf};
 				struct acrn_vpci *vpci = &target_vm->vpci;
 
-				spinlock_obtain(&vpci->lock);
+				read_lock(&vpci->lock);
 				vdev = pci_find_vdev(vpci, bdf);
-				spinlock_release(&vpci->lock);
+				read_unlock(&vpci->lock);
 				/*
 				 * TODO: Change the hc_ptdev_irq structure member names
 				 * virt_pin to virt_gsi
@@ -20,7 +20,7 @@
 #define PTIRQ_BITMAP_ARRAY_SIZE	INT_DIV_ROUNDUP(CONFIG_MAX_PT_IRQ_ENTRIES, 64U)
 struct ptirq_remapping_info ptirq_entries[CONFIG_MAX_PT_IRQ_ENTRIES];
 static uint64_t ptirq_entry_bitmaps[PTIRQ_BITMAP_ARRAY_SIZE];
-spinlock_t ptdev_lock = { .head = 0U, .tail = 0U, };
+rwlock_t ptdev_lock = { .cnt = 0U, };
 
 /* lookup mapping info from phyical sid, hashing from sid + acrn_vm structure address (NULL) */
 static struct hlist_head phys_sid_htable[PTIRQ_ENTRY_HASHSIZE];
@@ -272,13 +272,13 @@ void ptdev_release_all_entries(const struct acrn_vm *vm)
 	for (idx = 0U; idx < CONFIG_MAX_PT_IRQ_ENTRIES; idx++) {
 		entry = &ptirq_entries[idx];
 		if ((entry->vm == vm) && is_entry_active(entry)) {
-			spinlock_obtain(&ptdev_lock);
+			write_lock(&ptdev_lock);
 			if (entry->release_cb != NULL) {
 				entry->release_cb(entry);
 			}
 			ptirq_deactivate_entry(entry);
 			ptirq_release_entry(entry);
-			spinlock_release(&ptdev_lock);
+			write_unlock(&ptdev_lock);
 		}
 	}
 
@@ -11,8 +11,10 @@
 
 #include <types.h>
 #include <rtl.h>
+#include <util.h>
 #include <errno.h>
 #include <asm/cpu.h>
+#include <asm/lib/atomic.h>
 #include <asm/per_cpu.h>
 #include <vm_event.h>
 
@@ -25,6 +27,97 @@ uint32_t sbuf_next_ptr(uint32_t pos_arg,
 	return pos;
 }
 
+/*
+ * Free bytes between @tail and @head. One byte is always left unused, so
+ * that a full sbuf (next tail == head) is not taken for an empty one.
+ */
+static inline uint32_t sbuf_room(const struct shared_buf *sbuf, uint32_t head, uint32_t tail)
+{
+	return (tail >= head) ? (sbuf->size - (tail - head) - 1U) : (head - tail - 1U);
+}
+
+/**
+ * Reserve len bytes at the tail of sbuf, to be filled with sbuf_copy_in()
+ * and published with sbuf_commit().
+ *
+ * If there is not enough room and both overwrite and the OVERWRITE_EN flag
+ * of sbuf are set, the oldest elements are dropped to make room. The head is
+ * moved with cmpxchg then, as the consumer in the Service VM moves it too.
+ *
+ * The producers of one sbuf shall be serialized, and the caller shall
+ * allow the access to the sbuf with stac().
+ *
+ * return:
+ * offset:	offset of the reserved bytes from the start of the data
+ * UINT32_MAX:	not enough room for len bytes
+ */
+uint32_t sbuf_reserve(struct shared_buf *sbuf, uint32_t len, bool overwrite)
+{
+	uint32_t head, new_head, room, drop;
+	uint32_t ele_size = sbuf->ele_size;
+	uint32_t tail = sbuf->tail;
+	uint32_t pos = UINT32_MAX;
+	bool retry = true;
+
+	/* as sbuf is shared with the Service VM, its header is not trusted */
+	if ((len >= sbuf->size) || (tail >= sbuf->size)) {
+		retry = false;
+	}
+
+	while (retry) {
+		head = *(volatile uint32_t *)&sbuf->head;
+		room = sbuf_room(sbuf, head, tail);
+		if (len <= room) {
+			pos = tail;
+			retry = false;
+		} else if (overwrite && ((sbuf->flags & OVERWRITE_EN) != 0U) && (ele_size != 0U)) {
+			/* drop the oldest whole elements */
+			drop = (((len - room) + (ele_size - 1U)) / ele_size) * ele_size;
+			if (drop > (sbuf->size - 1U - room)) {
+				retry = false;
+			} else {
+				new_head = sbuf_next_ptr(head, drop, sbuf->size);
+				if (atomic_cmpxchg32(&sbuf->head, head, new_head) == head) {
+					if ((sbuf->flags & OVERRUN_CNT_EN) != 0U) {
+						sbuf->overrun_cnt += drop / ele_size;
+					}
+					pos = tail;
+					retry = false;
+				}
+			}
+		} else {
+			retry = false;
+		}
+	}
+
+	return pos;
+}
+
+/**
+ * Copy len bytes of data to the bytes reserved at pos of sbuf, wrapping
+ * around the end of the data area.
+ */
+void sbuf_copy_in(struct shared_buf *sbuf, uint32_t pos, const void *data, uint32_t len)
+{
+	void *base = (void *)sbuf + SBUF_HEAD_SIZE;
+	uint32_t first = min(len, sbuf->size - pos);
+
+	memcpy_erms(base + pos, data, first);
+	if (len > first) {
+		memcpy_erms(base, data + first, len - first);
+	}
+}
+
+/**
+ * Publish the len bytes reserved at pos of sbuf to the consumer.
+ */
+void sbuf_commit(struct shared_buf *sbuf, uint32_t pos, uint32_t len)
+{
+	/* make sure write data before update tail */
+	cpu_write_memory_barrier();
+	sbuf->tail = sbuf_next_ptr(pos, len, sbuf->size);
+}
+
 /**
  * The high caller should guarantee each time there must have
  * sbuf->ele_size data can be write form data.
@@ -37,8 +130,7 @@ uint32_t sbuf_next_ptr(uint32_t pos_arg,
  *
  * flag:
  * If OVERWRITE_EN set, buf can store (ele_num - 1) elements at most.
- * Should use lock to guarantee that only one read or write at
- * the same time.
+ * The oldest element is dropped to make room for the new one.
  * if OVERWRITE_EN not set, buf can store (ele_num - 1) elements
  * at most. Shouldn't modify the sbuf->head.
  *
@@ -50,39 +142,22 @@ uint32_t sbuf_next_ptr(uint32_t pos_arg,
 
 uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data, uint32_t max_len)
 {
-	void *to;
-	uint32_t next_tail;
-	uint32_t ele_size, ret;
-	bool trigger_overwrite = false;
+	uint32_t ele_size, pos, ret;
 
 	stac();
 	ele_size = sbuf->ele_size;
-	next_tail = sbuf_next_ptr(sbuf->tail, ele_size, sbuf->size);
-
-	if ((next_tail == sbuf->head) && ((sbuf->flags & OVERWRITE_EN) == 0U)) {
-		/* if overrun is not enabled, return 0 directly */
-		ret = 0U;
-	} else if (ele_size <= max_len) {
-		if (next_tail == sbuf->head) {
-			/* accumulate overrun count if necessary */
-			sbuf->overrun_cnt += sbuf->flags & OVERRUN_CNT_EN;
-			trigger_overwrite = true;
-		}
-		to = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->tail;
-
-		(void)memcpy_s(to, ele_size, data, max_len);
-		/* make sure write data before update head */
-		cpu_write_memory_barrier();
-
-		if (trigger_overwrite) {
-			sbuf->head = sbuf_next_ptr(sbuf->head,
-					ele_size, sbuf->size);
-		}
-		sbuf->tail = next_tail;
-		ret = ele_size;
-	} else {
+	if (ele_size > max_len) {
 		/* there must be something wrong */
 		ret = UINT32_MAX;
+	} else {
+		pos = sbuf_reserve(sbuf, ele_size, true);
+		if (pos == UINT32_MAX) {
+			ret = 0U;
+		} else {
+			sbuf_copy_in(sbuf, pos, data, ele_size);
+			sbuf_commit(sbuf, pos, ele_size);
+			ret = ele_size;
+		}
 	}
 	clac();
 
@@ -116,6 +191,9 @@ int32_t sbuf_setup_common(struct acrn_vm *vm, uint16_t cpu_id, uint32_t sbuf_id,
 
 /* try put a batch of elememts from data to sbuf
  * data_size should be equel to n*elem_size, data not enough to fill the elem_size will be ignored.
+ * The elements that fit are copied at once and published with one tail
+ * update. If OVERWRITE_EN set, the oldest elements are dropped to make room,
+ * and only the last (ele_num - 1) elements of data are kept at most.
  *
  * return:
  * elem_size * n:   bytes put in sbuf
@@ -123,19 +201,42 @@ int32_t sbuf_setup_common(struct acrn_vm *vm, uint16_t cpu_id, uint32_t sbuf_id,
  */
 uint32_t sbuf_put_many(struct shared_buf *sbuf, uint32_t elem_size, uint8_t *data, uint32_t data_size)
 {
-	uint32_t ret, sent = 0U;
-	uint32_t i;
+	uint32_t n, max_n, len, pos, sent;
+	uint8_t *from = data;
 
-	for (i = 0U; i < (data_size / elem_size); i++) {
-		ret = sbuf_put(sbuf, data + i * elem_size, elem_size);
-		if (ret == elem_size) {
-			sent += ret;
+	stac();
+	if ((elem_size == 0U) || (elem_size != sbuf->ele_size) || (sbuf->size < elem_size)) {
+		sent = UINT32_MAX;
+	} else {
+		n = data_size / elem_size;
+		if ((sbuf->flags & OVERWRITE_EN) != 0U) {
+			max_n = (sbuf->size / elem_size) - 1U;
 		} else {
-			if (ret == UINT32_MAX) {
-				sent = UINT32_MAX;
+			max_n = sbuf_room(sbuf, *(volatile uint32_t *)&sbuf->head, sbuf->tail) / elem_size;
+		}
+		if (n > max_n) {
+			if ((sbuf->flags & OVERWRITE_EN) != 0U) {
+				/* the elements that would be overwritten at once are skipped */
+				from += (n - max_n) * elem_size;
+				if ((sbuf->flags & OVERRUN_CNT_EN) != 0U) {
+					sbuf->overrun_cnt += n - max_n;
+				}
+			}
+			n = max_n;
+		}
+
+		len = n * elem_size;
+		sent = 0U;
+		if (len != 0U) {
+			pos = sbuf_reserve(sbuf, len, true);
+			if (pos != UINT32_MAX) {
+				sbuf_copy_in(sbuf, pos, from, len);
+				sbuf_commit(sbuf, pos, len);
+				sent = len;
 			}
-			break;
 		}
 	}
+	clac();
+
 	return sent;
 }
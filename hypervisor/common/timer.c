@@ -52,6 +52,224 @@ static void run_timer(const struct hv_timer *timer)
 	TRACE_2L(TRACE_TIMER_ACTION_PCKUP, timer->timeout, 0UL);
 }
 
+#ifdef CONFIG_TIMER_WHEEL_ENABLED
+/*
+ * Hierarchical timing wheel.
+ *
+ * A timer sits in the lowest level whose slot distance from cpu_timer->clk,
+ * counted in that level's granularity, is below TIMER_WHEEL_SIZE. So a level 0
+ * slot only holds timers of one wheel tick while a level N (N > 0) slot is
+ * never the current slot of its level. When the wheel moves to a new clk, the
+ * higher level slots that become current are cascaded down to lower levels.
+ *
+ * Slots are not sorted. del_timer() only unlinks the timer, the pending bit of
+ * a slot which becomes empty is cleared when the slot is next looked up.
+ */
+static void wheel_add_timer(struct per_cpu_timers *cpu_timer, struct hv_timer *timer)
+{
+	uint64_t clk = cpu_timer->clk;
+	uint64_t expires = timer->timeout >> TIMER_WHEEL_SHIFT;
+	uint32_t level = 0U;
+	uint32_t shift = 0U;
+	uint16_t slot;
+
+	if (expires < clk) {
+		expires = clk;
+	}
+
+	while ((level < (TIMER_WHEEL_LEVELS - 1U)) && (((expires >> shift) - (clk >> shift)) >= TIMER_WHEEL_SIZE)) {
+		level++;
+		shift += TIMER_WHEEL_BITS;
+	}
+
+	if (((expires >> shift) - (clk >> shift)) >= TIMER_WHEEL_SIZE) {
+		/* beyond the wheel range, park it in the farthest slot, it is queued again when the slot cascades */
+		expires = ((clk >> shift) + TIMER_WHEEL_MASK) << shift;
+	}
+
+	slot = (uint16_t)((expires >> shift) & TIMER_WHEEL_MASK);
+	list_add_tail(&timer->node, &cpu_timer->wheel[level][slot]);
+	bitmap_set_nolock(slot, &cpu_timer->pending[level]);
+}
+
+/*
+ * find the first non-empty slot of @level at or after the current one
+ * return true and its distance from the current slot in @dist if there is one
+ */
+static bool wheel_next_slot(struct per_cpu_timers *cpu_timer, uint32_t level, uint16_t *dist)
+{
+	uint16_t pos = (uint16_t)((cpu_timer->clk >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK);
+	uint64_t pending = cpu_timer->pending[level];
+	uint16_t bit, slot;
+	bool found = false;
+
+	while (!found && (pending != 0UL)) {
+		/* rotate the bitmap to put the current slot at bit 0 */
+		if (pos != 0U) {
+			pending = (pending >> pos) | (pending << (TIMER_WHEEL_SIZE - pos));
+		}
+		bit = ffs64(pending);
+		slot = (uint16_t)((bit + pos) & TIMER_WHEEL_MASK);
+
+		if (list_empty(&cpu_timer->wheel[level][slot])) {
+			bitmap_clear_nolock(slot, &cpu_timer->pending[level]);
+			pending = cpu_timer->pending[level];
+		} else {
+			*dist = bit;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+/*
+ * return the wheel tick when the next non-empty slot of @first_level or
+ * above gets current, UINT64_MAX if there is none
+ */
+static uint64_t wheel_next_clk(struct per_cpu_timers *cpu_timer, uint32_t first_level)
+{
+	uint64_t next = UINT64_MAX, clk;
+	uint32_t level, shift;
+	uint16_t dist;
+
+	for (level = first_level; level < TIMER_WHEEL_LEVELS; level++) {
+		if (wheel_next_slot(cpu_timer, level, &dist)) {
+			shift = level * TIMER_WHEEL_BITS;
+			clk = ((cpu_timer->clk >> shift) + dist) << shift;
+			next = min(next, clk);
+		}
+	}
+
+	return next;
+}
+
+/* queue the timers of the higher level slots which get current at cpu_timer->clk again */
+static void wheel_cascade(struct per_cpu_timers *cpu_timer)
+{
+	struct list_head head;
+	struct list_head *pos, *n;
+	uint32_t level, shift;
+	uint16_t slot;
+
+	for (level = TIMER_WHEEL_LEVELS - 1U; level > 0U; level--) {
+		shift = level * TIMER_WHEEL_BITS;
+		slot = (uint16_t)((cpu_timer->clk >> shift) & TIMER_WHEEL_MASK);
+
+		if (!list_empty(&cpu_timer->wheel[level][slot])) {
+			INIT_LIST_HEAD(&head);
+			list_splice_init(&cpu_timer->wheel[level][slot], &head);
+			list_for_each_safe(pos, n, &head) {
+				list_del_init(pos);
+				wheel_add_timer(cpu_timer, container_of(pos, struct hv_timer, node));
+			}
+		}
+		bitmap_clear_nolock(slot, &cpu_timer->pending[level]);
+	}
+}
+
+static inline void update_physical_timer(struct per_cpu_timers *cpu_timer)
+{
+	struct list_head *pos;
+	struct hv_timer *timer;
+	uint64_t next_clk, deadline = UINT64_MAX;
+	uint16_t dist;
+
+	/* the earliest timer of the first non-empty level 0 slot */
+	if (wheel_next_slot(cpu_timer, 0U, &dist)) {
+		list_for_each(pos, &cpu_timer->wheel[0U][(cpu_timer->clk + dist) & TIMER_WHEEL_MASK]) {
+			timer = container_of(pos, struct hv_timer, node);
+			deadline = min(deadline, timer->timeout);
+		}
+	}
+
+	/* a cascade may move an earlier timer down to level 0, wake up for it */
+	next_clk = wheel_next_clk(cpu_timer, 1U);
+	if (next_clk != UINT64_MAX) {
+		deadline = min(deadline, max(next_clk, cpu_timer->clk) << TIMER_WHEEL_SHIFT);
+	}
+
+	if (deadline != UINT64_MAX) {
+		cpu_timer->deadline = deadline;
+		/* it is okay to program a expired time */
+		msr_write(MSR_IA32_TSC_DEADLINE, deadline);
+	} else {
+		cpu_timer->deadline = 0UL;
+	}
+}
+
+/*
+ * return true if the timer is earlier than the programmed deadline
+ */
+static bool local_add_timer(struct per_cpu_timers *cpu_timer,
+			struct hv_timer *timer)
+{
+	uint64_t now_clk;
+
+	/*
+	 * clk only moves when timers expire, so it is stale once the wheel has
+	 * been empty for a while. Move it to now before placing the timer, or
+	 * the timer would be parked and cascaded once per wheel range elapsed.
+	 */
+	if (wheel_next_clk(cpu_timer, 0U) == UINT64_MAX) {
+		now_clk = cpu_ticks() >> TIMER_WHEEL_SHIFT;
+		cpu_timer->clk = max(cpu_timer->clk, now_clk);
+	}
+
+	wheel_add_timer(cpu_timer, timer);
+
+	return ((cpu_timer->deadline == 0UL) || (timer->timeout < cpu_timer->deadline));
+}
+
+/*
+ * return a timer which is expired at @now, NULL if there is none
+ * the wheel is moved forward to the tick of @now on the way
+ */
+static struct hv_timer *get_expired_timer(struct per_cpu_timers *cpu_timer, uint64_t now)
+{
+	struct list_head *pos;
+	struct hv_timer *timer, *expired = NULL;
+	uint64_t now_clk = now >> TIMER_WHEEL_SHIFT;
+	uint64_t next_clk;
+
+	while (expired == NULL) {
+		list_for_each(pos, &cpu_timer->wheel[0U][cpu_timer->clk & TIMER_WHEEL_MASK]) {
+			timer = container_of(pos, struct hv_timer, node);
+			if (timer->timeout <= now) {
+				expired = timer;
+				break;
+			}
+		}
+
+		if ((expired == NULL) && (cpu_timer->clk < now_clk)) {
+			/* the current slot is drained, skip the empty slots in between */
+			next_clk = wheel_next_clk(cpu_timer, 0U);
+			cpu_timer->clk = min(max(next_clk, cpu_timer->clk + 1UL), now_clk);
+			wheel_cascade(cpu_timer);
+		} else {
+			break;
+		}
+	}
+
+	return expired;
+}
+
+static void init_percpu_timer(uint16_t pcpu_id)
+{
+	struct per_cpu_timers *cpu_timer;
+	uint32_t level, slot;
+
+	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
+	cpu_timer->clk = cpu_ticks() >> TIMER_WHEEL_SHIFT;
+	cpu_timer->deadline = 0UL;
+	for (level = 0U; level < TIMER_WHEEL_LEVELS; level++) {
+		cpu_timer->pending[level] = 0UL;
+		for (slot = 0U; slot < TIMER_WHEEL_SIZE; slot++) {
+			INIT_LIST_HEAD(&cpu_timer->wheel[level][slot]);
+		}
+	}
+}
+#else
 static inline void update_physical_timer(struct per_cpu_timers *cpu_timer)
 {
 	struct hv_timer *timer = NULL;
@@ -91,6 +309,32 @@ static bool local_add_timer(struct per_cpu_timers *cpu_timer,
 	return (prev == &cpu_timer->timer_list);
 }
 
+/*
+ * return the timer_list head if it is expired at @now, NULL otherwise
+ */
+static struct hv_timer *get_expired_timer(struct per_cpu_timers *cpu_timer, uint64_t now)
+{
+	struct hv_timer *timer = NULL;
+
+	if (!list_empty(&cpu_timer->timer_list)) {
+		timer = container_of((&cpu_timer->timer_list)->next, struct hv_timer, node);
+		if (timer->timeout > now) {
+			timer = NULL;
+		}
+	}
+
+	return timer;
+}
+
+static void init_percpu_timer(uint16_t pcpu_id)
+{
+	struct per_cpu_timers *cpu_timer;
+
+	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
+	INIT_LIST_HEAD(&cpu_timer->timer_list);
+}
+#endif
+
 int32_t add_timer(struct hv_timer *timer)
 {
 	struct per_cpu_timers *cpu_timer;
@@ -169,19 +413,10 @@ void del_timer(struct hv_timer *timer)
 	CPU_INT_ALL_RESTORE(rflags);
 }
 
-static void init_percpu_timer(uint16_t pcpu_id)
-{
-	struct per_cpu_timers *cpu_timer;
-
-	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
-	INIT_LIST_HEAD(&cpu_timer->timer_list);
-}
-
 static void timer_softirq(uint16_t pcpu_id)
 {
 	struct per_cpu_timers *cpu_timer;
 	struct hv_timer *timer;
-	const struct list_head *pos, *n;
 	uint32_t tries = MAX_TIMER_ACTIONS;
 	uint64_t current_tsc = cpu_ticks();
 
@@ -189,29 +424,29 @@ static void timer_softirq(uint16_t pcpu_id)
 	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
 
 	/* This is to make sure we are not blocked due to delay inside func()
-	 * force to exit irq handler after we serviced >31 timers
+	 * force to exit irq handler after we serviced MAX_TIMER_ACTIONS timers
 	 * caller used to local_add_timer() for periodic timer, if there is a delay
 	 * inside func(), it will infinitely loop here, because new added timer
 	 * already passed due to previously func()'s delay.
 	 */
-	list_for_each_safe(pos, n, &cpu_timer->timer_list) {
-		timer = container_of(pos, struct hv_timer, node);
+	while (tries != 0U) {
+		timer = get_expired_timer(cpu_timer, current_tsc);
+		if (timer == NULL) {
+			break;
+		}
+
 		/* timer expried */
 		tries--;
-		if ((timer->timeout <= current_tsc) && (tries != 0U)) {
-			del_timer(timer);
+		del_timer(timer);
 
-			run_timer(timer);
+		run_timer(timer);
 
-			if (timer->mode == TICK_MODE_PERIODIC) {
-				/* update periodic timer fire tsc */
-				timer->timeout += timer->period_in_cycle;
-				(void)local_add_timer(cpu_timer, timer);
-			} else {
-				timer->timeout = 0UL;
-			}
+		if (timer->mode == TICK_MODE_PERIODIC) {
+			/* update periodic timer fire tsc */
+			timer->timeout += timer->period_in_cycle;
+			(void)local_add_timer(cpu_timer, timer);
 		} else {
-			break;
+			timer->timeout = 0UL;
 		}
 	}
 
@@ -116,3 +116,36 @@ int32_t hcall_get_hw_info(struct acrn_vcpu *vcpu, __unused struct acrn_vm *targe
 	hw_info.cpu_num = get_pcpu_nums();
 	return copy_to_gpa(vcpu->vm, &hw_info, param1, sizeof(hw_info));
 }
+
+/**
+ * @brief Get the VM exit statistics of a vCPU of a VM
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param2 guest physical address. This gpa points to
+ *              struct acrn_vmexit_stats
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_vmexit_stats(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		__unused uint64_t param1, uint64_t param2)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	struct acrn_vcpu *target_vcpu;
+	uint16_t vcpu_id;
+	int32_t ret = -EINVAL;
+
+	/* only read the header, the statistics are copied from the vCPU directly */
+	if (!is_poweroff_vm(target_vm) && (copy_from_gpa(vm, &vcpu_id,
+			param2 + offsetof(struct acrn_vmexit_stats, vcpu_id), sizeof(vcpu_id)) == 0)) {
+		if (vcpu_id < target_vm->hw.created_vcpus) {
+			target_vcpu = vcpu_from_vid(target_vm, vcpu_id);
+			ret = copy_to_gpa(vm, target_vcpu->arch.exit_stats,
+				param2 + offsetof(struct acrn_vmexit_stats, reasons),
+				sizeof(target_vcpu->arch.exit_stats));
+		}
+	}
+
+	return ret;
+}
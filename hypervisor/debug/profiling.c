@@ -231,21 +231,15 @@ static void profiling_disable_pmu(void)
 static int32_t profiling_sbuf_put_variable(struct shared_buf *sbuf,
 					uint8_t *data, uint32_t size)
 {
-	uint32_t remaining_space, offset, next_tail;
-	void *to;
+	uint32_t pos;
 
 	/*
 	 * 1. check for null pointers and non-zero size
-	 * 2. check if enough room available in the buffer
-	 *     2a. if not, drop the sample, increment count of dropped samples,
-	 *         return
-	 *     2b. unless overwrite flag is enabled
-	 * 3. Continue if buffer has space for the sample
-	 * 4. Copy sample to buffer
-	 *     4a. Split variable sample to be copied if the sample is going to
-	 *         wrap around the buffer
-	 *     4b. Otherwise do a simple copy
-	 * 5. return number of bytes of data put in buffer
+	 * 2. reserve room for the sample in the buffer
+	 *     2a. if there is not enough room, drop the sample, the variable
+	 *         samples can't overwrite older ones at element boundaries
+	 * 3. Copy sample to buffer, split if it wraps around the buffer
+	 * 4. return number of bytes of data put in buffer
 	 */
 
 	if ((sbuf == NULL) || (data == NULL)) {
@@ -257,41 +251,14 @@ static int32_t profiling_sbuf_put_variable(struct shared_buf *sbuf,
 	}
 
 	stac();
-	if (sbuf->tail >= sbuf->head) {
-		remaining_space = sbuf->size - (sbuf->tail - sbuf->head);
-	} else {
-		remaining_space = sbuf->head - sbuf->tail;
-	}
-
-	if (size >= remaining_space) {
-		/* Only (remaining_space - 1) can be written to sbuf.
-		 * Since if the next_tail equals head, then it is assumed
-		 * that buffer is empty, not full
-		 */
+	pos = sbuf_reserve(sbuf, size, false);
+	if (pos == UINT32_MAX) {
 		clac();
 		return 0;
 	}
 
-	next_tail = sbuf_next_ptr(sbuf->tail, size, sbuf->size);
-
-	to = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->tail;
-
-	if (next_tail < sbuf->tail) { /* wrap-around */
-		offset = sbuf->size - sbuf->tail;
-		(void)memcpy_s(to, offset, data, offset);
-
-		/* 2nd part */
-		to = (void *)sbuf + SBUF_HEAD_SIZE;
-
-		if ((size - offset) > 0U) {
-			(void)memcpy_s(to, size - offset,
-				data + offset, size - offset);
-		}
-	} else {
-		(void)memcpy_s(to, size, data, size);
-	}
-
-	sbuf->tail = next_tail;
+	sbuf_copy_in(sbuf, pos, data, size);
+	sbuf_commit(sbuf, pos, size);
 	clac();
 
 	return (int32_t)size;
@@ -39,11 +39,13 @@ static int32_t shell_version(__unused int32_t argc, __unused char **argv);
 static int32_t shell_list_vm(__unused int32_t argc, __unused char **argv);
 static int32_t shell_list_vcpu(__unused int32_t argc, __unused char **argv);
 static int32_t shell_vcpu_dumpreg(int32_t argc, char **argv);
+static int32_t shell_vcpu_vmexit(int32_t argc, char **argv);
 static int32_t shell_dump_host_mem(int32_t argc, char **argv);
 static int32_t shell_dump_guest_mem(int32_t argc, char **argv);
 static int32_t shell_to_vm_console(int32_t argc, char **argv);
 static int32_t shell_show_cpu_int(__unused int32_t argc, __unused char **argv);
 static int32_t shell_show_ptdev_info(__unused int32_t argc, __unused char **argv);
+static int32_t shell_show_lockstat(__unused int32_t argc, __unused char **argv);
 static int32_t shell_show_vioapic_info(int32_t argc, char **argv);
 static int32_t shell_show_ioapic_info(__unused int32_t argc, __unused char **argv);
 static int32_t shell_loglevel(int32_t argc, char **argv);
@@ -83,6 +85,12 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str	= SHELL_CMD_VCPU_DUMPREG_HELP,
 		.fcn		= shell_vcpu_dumpreg,
 	},
+	{
+		.str		= SHELL_CMD_VCPU_VMEXIT,
+		.cmd_param	= SHELL_CMD_VCPU_VMEXIT_PARAM,
+		.help_str	= SHELL_CMD_VCPU_VMEXIT_HELP,
+		.fcn		= shell_vcpu_vmexit,
+	},
 	{
 		.str		= SHELL_CMD_DUMP_HOST_MEM,
 		.cmd_param	= SHELL_CMD_DUMP_HOST_MEM_PARAM,
@@ -113,6 +121,12 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str	= SHELL_CMD_PTDEV_HELP,
 		.fcn		= shell_show_ptdev_info,
 	},
+	{
+		.str		= SHELL_CMD_LOCKSTAT,
+		.cmd_param	= SHELL_CMD_LOCKSTAT_PARAM,
+		.help_str	= SHELL_CMD_LOCKSTAT_HELP,
+		.fcn		= shell_show_lockstat,
+	},
 	{
 		.str		= SHELL_CMD_VIOAPIC,
 		.cmd_param	= SHELL_CMD_VIOAPIC_PARAM,
@@ -1008,6 +1022,67 @@ out:
 	return status;
 }
 
+static int32_t shell_vcpu_vmexit(int32_t argc, char **argv)
+{
+	int32_t status = 0;
+	char temp_str[MAX_STR_SIZE];
+	uint16_t vm_id, vcpu_id, reason, i;
+	uint32_t len;
+	struct acrn_vm *vm;
+	const struct acrn_vmexit_reason_stats *stats;
+
+	/* User input invalidation */
+	if (argc != 3) {
+		shell_puts("Please enter cmd with <vm_id, vcpu_id>\r\n");
+		status = -EINVAL;
+		goto out;
+	}
+
+	status = strtol_deci(argv[1]);
+	if (status < 0) {
+		goto out;
+	}
+	vm_id = sanitize_vmid((uint16_t)status);
+	vcpu_id = (uint16_t)strtol_deci(argv[2]);
+
+	vm = get_vm_from_vmid(vm_id);
+	if (is_poweroff_vm(vm)) {
+		shell_puts("No vm found in the input <vm_id, vcpu_id>\r\n");
+		status = -EINVAL;
+		goto out;
+	}
+
+	if (vcpu_id >= vm->hw.created_vcpus) {
+		shell_puts("vcpu id is out of range\r\n");
+		status = -EINVAL;
+		goto out;
+	}
+
+	snprintf(temp_str, MAX_STR_SIZE, "\r\nREASON  COUNT         AVG CYCLES  HISTOGRAM (bucket n: < %lu << n cycles)\r\n",
+		1UL << ACRN_VMEXIT_HIST_SHIFT);
+	shell_puts(temp_str);
+
+	/* the counters are updated by the vCPU on its own pCPU, a snapshot is good enough here */
+	for (reason = 0U; reason < ACRN_VMEXIT_REASON_NUM; reason++) {
+		stats = &vcpu_from_vid(vm, vcpu_id)->arch.exit_stats[reason];
+		if (stats->count == 0UL) {
+			continue;
+		}
+
+		len = (uint32_t)snprintf(temp_str, MAX_STR_SIZE, "0x%02hx    %-13lu %-11lu", reason, stats->count,
+			stats->total_cycles / stats->count);
+		for (i = 0U; (i < ACRN_VMEXIT_HIST_NUM) && (len < MAX_STR_SIZE); i++) {
+			len += (uint32_t)snprintf(temp_str + len, MAX_STR_SIZE - len, " %lu", stats->hist[i]);
+		}
+		shell_puts(temp_str);
+		shell_puts("\r\n");
+	}
+	status = 0;
+
+out:
+	return status;
+}
+
 static int32_t shell_dump_host_mem(int32_t argc, char **argv)
 {
 	uint64_t *hva;
@@ -1321,6 +1396,44 @@ static int32_t shell_show_ptdev_info(__unused int32_t argc, __unused char **argv
 	return 0;
 }
 
+static void shell_puts_lock_stats(const char *name, int32_t vm_id, const struct lock_stats *stats)
+{
+	char temp_str[MAX_STR_SIZE];
+
+	if (vm_id < 0) {
+		snprintf(temp_str, MAX_STR_SIZE, "  -   %-12s %-16lu %-16lu %-16lu\r\n", name,
+			stats->acquired, stats->contended, stats->spin_cycles);
+	} else {
+		snprintf(temp_str, MAX_STR_SIZE, "  %-3d %-12s %-16lu %-16lu %-16lu\r\n", vm_id, name,
+			stats->acquired, stats->contended, stats->spin_cycles);
+	}
+	shell_puts(temp_str);
+}
+
+static int32_t shell_show_lockstat(__unused int32_t argc, __unused char **argv)
+{
+	struct acrn_vm *vm;
+	uint16_t vm_id;
+
+	/*
+	 * For the seqlocks, ACQUIRED counts the writers, CONTENDED the reads to retry
+	 * and SPIN_CYCLES the time the readers waited for the writers.
+	 */
+	shell_puts("\r\nVM_ID LOCK         ACQUIRED         CONTENDED        SPIN_CYCLES"
+		   "\r\n===== ============ ================ ================ ================\r\n");
+	shell_puts_lock_stats("ptdev", -1, &ptdev_lock.stats);
+
+	for (vm_id = 0U; vm_id < CONFIG_MAX_VM_NUM; vm_id++) {
+		vm = get_vm_from_vmid(vm_id);
+		if (!is_poweroff_vm(vm)) {
+			shell_puts_lock_stats("emul_mmio", (int32_t)vm_id, &vm->emul_mmio_lock.stats);
+			shell_puts_lock_stats("vpci", (int32_t)vm_id, &vm->vpci.lock.stats);
+		}
+	}
+
+	return 0;
+}
+
 static void get_vioapic_info(char *str_arg, size_t str_max, uint16_t vmid)
 {
 	char *str = str_arg;
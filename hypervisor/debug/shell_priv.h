@@ -63,6 +63,10 @@ struct shell {
 #define SHELL_CMD_VCPU_DUMPREG_PARAM	"<vm id, vcpu id>"
 #define SHELL_CMD_VCPU_DUMPREG_HELP	"Dump registers for a specific vCPU"
 
+#define SHELL_CMD_VCPU_VMEXIT		"vcpu_vmexit"
+#define SHELL_CMD_VCPU_VMEXIT_PARAM	"<vm id, vcpu id>"
+#define SHELL_CMD_VCPU_VMEXIT_HELP	"Show VM exit counts and log2 latency histograms (in TSC cycles) for a specific vCPU"
+
 #define SHELL_CMD_DUMP_HOST_MEM		"dump_host_mem"
 #define SHELL_CMD_DUMP_HOST_MEM_PARAM	"<addr, length>"
 #define SHELL_CMD_DUMP_HOST_MEM_HELP	"Dump host memory, starting at a given address(Hex), and for a given length (Dec in bytes)"
@@ -84,6 +88,10 @@ struct shell {
 #define SHELL_CMD_PTDEV_PARAM		NULL
 #define SHELL_CMD_PTDEV_HELP		"Show pass-through device information"
 
+#define SHELL_CMD_LOCKSTAT		"lockstat"
+#define SHELL_CMD_LOCKSTAT_PARAM	NULL
+#define SHELL_CMD_LOCKSTAT_HELP		"Show the contention statistics of the reader-writer and sequence locks"
+
 #define SHELL_CMD_REBOOT		"reboot"
 #define SHELL_CMD_REBOOT_PARAM		NULL
 #define SHELL_CMD_REBOOT_HELP		"Trigger a system reboot (immediately)"
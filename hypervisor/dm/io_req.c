@@ -8,6 +8,7 @@
 #include <errno.h>
 #include <logmsg.h>
 #include <sbuf.h>
+#include <hash.h>
 
 #define DBG_LEVEL_IOREQ	6U
 
@@ -63,20 +64,25 @@ void reset_vm_ioreqs(struct acrn_vm *vm)
 	}
 }
 
+static inline struct hlist_head *asyncio_hlist_head(struct acrn_vm *vm, uint32_t type, uint64_t addr)
+{
+	return &(vm->aiodesc_hlist_heads[hash64(addr + type, ASYNCIO_HASHBITS)]);
+}
+
 /**
- * @pre vm->asyncio_lock is held
+ * @pre vm->asyncio_lock is held for write
  */
 static bool asyncio_is_conflict(struct acrn_vm *vm,
 	const struct acrn_asyncio_info *async_info)
 {
-	struct list_head *pos;
+	struct hlist_node *pos;
 	struct asyncio_desc *p;
 	struct acrn_asyncio_info *info;
 	bool ret = false;
 
 	/* When either one's match_data is 0, the data matching will be skipped. */
-	list_for_each(pos, &vm->aiodesc_queue) {
-		p = container_of(pos, struct asyncio_desc, list);
+	hlist_for_each(pos, asyncio_hlist_head(vm, async_info->type, async_info->addr)) {
+		p = hlist_entry(pos, struct asyncio_desc, link);
 		info = &(p->asyncio_info);
 		if ((info->addr == async_info->addr) &&
 			(info->type == async_info->type) &&
@@ -98,7 +104,7 @@ int add_asyncio(struct acrn_vm *vm, const struct acrn_asyncio_info *async_info)
 	struct asyncio_desc *desc;
 
 	if (async_info->addr != 0UL) {
-		spinlock_obtain(&vm->asyncio_lock);
+		write_seqlock(&vm->asyncio_lock);
 		b_conflict = asyncio_is_conflict(vm, async_info);
 		if (!b_conflict) {
 			for (i = 0U; i < ACRN_ASYNCIO_MAX; i++) {
@@ -106,18 +112,18 @@ int add_asyncio(struct acrn_vm *vm, const struct acrn_asyncio_info *async_info)
 				if ((desc->asyncio_info.addr == 0UL) && (desc->asyncio_info.fd == 0UL)) {
 					(void)memcpy_s(&(desc->asyncio_info), sizeof(struct acrn_asyncio_info),
 						async_info, sizeof(struct acrn_asyncio_info));
-					INIT_LIST_HEAD(&(desc->list));
-					list_add(&(desc->list), &vm->aiodesc_queue);
+					hlist_add_head(&(desc->link),
+						asyncio_hlist_head(vm, async_info->type, async_info->addr));
 					ret = 0;
 					break;
 				}
 			}
-			spinlock_release(&vm->asyncio_lock);
+			write_sequnlock(&vm->asyncio_lock);
 			if (i == ACRN_ASYNCIO_MAX) {
 				pr_fatal("too much fastio, would not support!");
 			}
 		} else {
-			spinlock_release(&vm->asyncio_lock);
+			write_sequnlock(&vm->asyncio_lock);
 			pr_err("%s, already registered!", __func__);
 		}
 	} else {
@@ -134,7 +140,7 @@ int remove_asyncio(struct acrn_vm *vm, const struct acrn_asyncio_info *async_inf
 	struct acrn_asyncio_info *info;
 
 	if (async_info->addr != 0UL) {
-		spinlock_obtain(&vm->asyncio_lock);
+		write_seqlock(&vm->asyncio_lock);
 		for (i = 0U; i < ACRN_ASYNCIO_MAX; i++) {
 			desc = &(vm->aio_desc[i]);
 			info = &(desc->asyncio_info);
@@ -143,13 +149,13 @@ int remove_asyncio(struct acrn_vm *vm, const struct acrn_asyncio_info *async_inf
 					&& (info->fd == async_info->fd)
 					&& ((info->match_data == 0U) == (async_info->match_data == 0U))
 					&& (info->data == async_info->data)) {
-				list_del_init(&(desc->list));
+				hlist_del(&(desc->link));
 				memset(desc, 0, sizeof(vm->aio_desc[0]));
 				ret = 0;
 				break;
 			}
 		}
-		spinlock_release(&vm->asyncio_lock);
+		write_sequnlock(&vm->asyncio_lock);
 		if (i == ACRN_ASYNCIO_MAX) {
 			pr_fatal("Failed to find asyncio req on addr: %lx!", async_info->addr);
 		}
@@ -164,20 +170,32 @@ static inline bool has_complete_ioreq(const struct acrn_vcpu *vcpu)
 	return (get_io_req_state(vcpu->vm, vcpu->vcpu_id) == ACRN_IOREQ_STATE_COMPLETE);
 }
 
-static struct asyncio_desc *get_asyncio_desc(struct acrn_vcpu *vcpu, const struct io_request *io_req)
+/**
+ * @brief Find the asyncio descriptor matching \p io_req
+ *
+ * The lookup takes no lock, it is retried if a descriptor was added or
+ * removed meanwhile. The descriptors are never freed and a removed one is
+ * zeroed, so a concurrent walk stays within aio_desc[]; it is bounded in
+ * case it follows a descriptor moved to another bucket.
+ *
+ * @param fd Output, the eventfd of the matching descriptor
+ *
+ * @return true if \p io_req is an asyncio, otherwise false.
+ */
+static bool get_asyncio_fd(struct acrn_vcpu *vcpu, const struct io_request *io_req, uint64_t *fd)
 {
 	uint64_t addr = 0UL;
 	uint32_t type;
 	uint64_t value;
-	struct list_head *pos;
+	struct hlist_node *pos;
 	struct asyncio_desc *iter_desc;
 	struct acrn_asyncio_info *iter_info;
 	struct acrn_vm *vm = vcpu->vm;
-	struct asyncio_desc *ret = NULL;
-	struct shared_buf *sbuf =
-		(struct shared_buf *)vm->sw.asyncio_sbuf;
+	uint64_t match_fd = 0UL;
+	uint32_t seq, n;
+	bool found = false;
 
-	if (sbuf != NULL) {
+	if (vm->sw.asyncio_sbuf != NULL) {
 		switch (io_req->io_type) {
 		case ACRN_IOREQ_TYPE_PORTIO:
 			addr = io_req->reqs.pio_request.address;
@@ -195,43 +213,88 @@ static struct asyncio_desc *get_asyncio_desc(struct acrn_vcpu *vcpu, const struc
 		}
 
 		if (addr != 0UL) {
-			spinlock_obtain(&vm->asyncio_lock);
-				list_for_each(pos, &vm->aiodesc_queue) {
-					iter_desc = container_of(pos, struct asyncio_desc, list);
+			do {
+				seq = read_seqbegin(&vm->asyncio_lock);
+				found = false;
+				pos = asyncio_hlist_head(vm, type, addr)->first;
+				for (n = 0U; (pos != NULL) && (n < ACRN_ASYNCIO_MAX); n++) {
+					iter_desc = hlist_entry(pos, struct asyncio_desc, link);
 					iter_info = &(iter_desc->asyncio_info);
 					if ((iter_info->addr == addr) && (iter_info->type == type) &&
 						((iter_info->match_data == 0U) || (iter_info->data == value))) {
-						ret = iter_desc;
+						match_fd = iter_info->fd;
+						found = true;
 						break;
 					}
+					pos = pos->next;
 				}
-			spinlock_release(&vm->asyncio_lock);
+			} while (read_seqretry(&vm->asyncio_lock, seq));
+
+			if (found) {
+				*fd = match_fd;
+			}
 		}
 	}
 
-	return ret;
-
+	return found;
 }
+
+/**
+ * @brief Put \p asyncio_fd into the asyncio sbuf of the VM
+ *
+ * The vCPUs put into the sbuf without a lock. Each producer reserves an
+ * element by moving asyncio_resv_tail forward with cmpxchg, fills it, then
+ * waits for the producers which reserved earlier elements to publish theirs
+ * before moving the sbuf tail, so the Service VM never sees an element which
+ * is not filled yet. Nothing is dropped: if the sbuf is full, the vCPU waits
+ * for room, and this wait is counted once in the overrun_cnt of the sbuf
+ * header if the Service VM enabled it.
+ */
 static int acrn_insert_asyncio(struct acrn_vcpu *vcpu, const uint64_t asyncio_fd)
 {
 	struct acrn_vm *vm = vcpu->vm;
 	struct shared_buf *sbuf =
 		(struct shared_buf *)vm->sw.asyncio_sbuf;
+	uint32_t tail, next_tail;
+	bool reserved = false, waited = false;
 	int ret = -ENODEV;
 
 	if (sbuf != NULL) {
-		spinlock_obtain(&vm->asyncio_lock);
-		while (sbuf_put(sbuf, (uint8_t *)&asyncio_fd, sizeof(asyncio_fd)) == 0U) {
-			/* sbuf is full, try later.. */
-			spinlock_release(&vm->asyncio_lock);
-			asm_pause();
-			if (need_reschedule(pcpuid_from_vcpu(vcpu))) {
-				schedule();
+		stac();
+		while (!reserved) {
+			tail = *(volatile uint32_t *)&vm->sw.asyncio_resv_tail;
+			next_tail = sbuf_next_ptr(tail, sizeof(asyncio_fd), vm->sw.asyncio_sbuf_size);
+			if (next_tail == *(volatile uint32_t *)&sbuf->head) {
+				if (!waited) {
+					waited = true;
+					if ((sbuf->flags & OVERRUN_CNT_EN) != 0U) {
+						atomic_inc32(&sbuf->overrun_cnt);
+					}
+				}
+				/* sbuf is full, try later.. */
+				clac();
+				asm_pause();
+				if (need_reschedule(pcpuid_from_vcpu(vcpu))) {
+					schedule();
+				}
+				stac();
+			} else {
+				reserved = (atomic_cmpxchg32(&vm->sw.asyncio_resv_tail, tail, next_tail) == tail);
 			}
-			spinlock_obtain(&vm->asyncio_lock);
 		}
 
-		spinlock_release(&vm->asyncio_lock);
+		(void)memcpy_s((void *)sbuf + SBUF_HEAD_SIZE + tail, sizeof(asyncio_fd),
+			&asyncio_fd, sizeof(asyncio_fd));
+		/* make sure write data before publishing it */
+		cpu_write_memory_barrier();
+
+		while (*(volatile uint32_t *)&vm->sw.asyncio_pub_tail != tail) {
+			asm_pause();
+		}
+		sbuf->tail = next_tail;
+		*(volatile uint32_t *)&vm->sw.asyncio_pub_tail = next_tail;
+		clac();
+
 		arch_fire_hsm_interrupt();
 		ret = 0;
 	}
@@ -352,10 +415,18 @@ int init_asyncio(struct acrn_vm *vm, uint64_t *hva)
 
 	stac();
 	if (sbuf != NULL) {
-		if (sbuf->magic == SBUF_MAGIC) {
+		/* Only uint64_t eventfd elements are put, the ring may be of any size */
+		if ((sbuf->magic == SBUF_MAGIC) && (sbuf->ele_size == sizeof(uint64_t))
+				&& (sbuf->ele_num > 1U) && (sbuf->ele_num <= (SBUF_MAX_SIZE / sizeof(uint64_t)))
+				&& (sbuf->size == (sbuf->ele_num * sbuf->ele_size))
+				&& (sbuf->tail < sbuf->size) && ((sbuf->tail % sbuf->ele_size) == 0U)) {
+			vm->sw.asyncio_sbuf_size = sbuf->size;
+			vm->sw.asyncio_resv_tail = sbuf->tail;
+			vm->sw.asyncio_pub_tail = sbuf->tail;
+			(void)memset(vm->aio_desc, 0U, sizeof(vm->aio_desc));
+			(void)memset(vm->aiodesc_hlist_heads, 0U, sizeof(vm->aiodesc_hlist_heads));
+			seqlock_init(&vm->asyncio_lock);
 			vm->sw.asyncio_sbuf = sbuf;
-			INIT_LIST_HEAD(&vm->aiodesc_queue);
-			spinlock_init(&vm->asyncio_lock);
 			ret = 0;
 		}
 	}
@@ -569,6 +640,88 @@ static int32_t mmio_default_access_handler(struct io_request *io_req,
 	return 0;
 }
 
+/* the port IO lookup table stores an emul_pio index + 1 in a byte */
+#if EMUL_PIO_IDX_MAX > 255U
+#error "EMUL_PIO_IDX_MAX must be smaller than 256"
+#endif
+
+/**
+ * @brief Find the port I/O handler covering \p port by a linear scan
+ *
+ * The handler with the lowest index wins if several handlers cover \p port.
+ *
+ * @return The emul_pio index + 1 of the handler, or 0 if no handler covers \p port.
+ */
+static uint8_t scan_pio_handler(const struct acrn_vm *vm, uint16_t port)
+{
+	uint32_t idx;
+	uint8_t entry = 0U;
+
+	for (idx = 0U; idx < EMUL_PIO_IDX_MAX; idx++) {
+		if ((port >= vm->emul_pio[idx].port_start) && (port < vm->emul_pio[idx].port_end)) {
+			entry = (uint8_t)(idx + 1U);
+			break;
+		}
+	}
+
+	return entry;
+}
+
+/**
+ * @brief Find the port I/O handler covering \p port
+ *
+ * @return The handler, or NULL if no handler covers \p port.
+ */
+static struct vm_io_handler_desc *find_pio_handler(struct acrn_vm *vm, uint16_t port)
+{
+	uint8_t page = vm->emul_pio_dir[port >> EMUL_PIO_PAGE_SHIFT];
+	uint8_t entry = 0U;
+
+	if (page != 0U) {
+		entry = vm->emul_pio_pages[page - 1U][port & (EMUL_PIO_PAGE_PORTS - 1U)];
+	} else if (vm->emul_pio_table_full) {
+		entry = scan_pio_handler(vm, port);
+	} else {
+		/* no handler covers this page */
+	}
+
+	return (entry != 0U) ? &(vm->emul_pio[entry - 1U]) : NULL;
+}
+
+/**
+ * @brief Refresh the port I/O lookup table entries of ports [start, end)
+ *
+ * A page is populated for a port only when some handler covers it. If no
+ * page is left, the lookups of ports in unpopulated pages fall back to a
+ * linear scan.
+ */
+static void update_pio_table(struct acrn_vm *vm, uint32_t start, uint32_t end)
+{
+	uint32_t port, dir_idx;
+	uint8_t entry;
+
+	for (port = start; (port < end) && (port <= 0xFFFFU); port++) {
+		entry = scan_pio_handler(vm, (uint16_t)port);
+		dir_idx = port >> EMUL_PIO_PAGE_SHIFT;
+
+		if ((vm->emul_pio_dir[dir_idx] == 0U) && (entry != 0U)) {
+			if (vm->nr_emul_pio_pages < EMUL_PIO_PAGE_NUM) {
+				vm->nr_emul_pio_pages++;
+				vm->emul_pio_dir[dir_idx] = (uint8_t)vm->nr_emul_pio_pages;
+			} else if (!vm->emul_pio_table_full) {
+				pr_err("%s, vm[%d] no free lookup page for port 0x%x", __func__, vm->vm_id, port);
+				vm->emul_pio_table_full = true;
+			} else {
+				/* already fall back to linear scan */
+			}
+		}
+
+		if (vm->emul_pio_dir[dir_idx] != 0U) {
+			vm->emul_pio_pages[vm->emul_pio_dir[dir_idx] - 1U][port & (EMUL_PIO_PAGE_PORTS - 1U)] = entry;
+		}
+	}
+}
+
 /**
  * Try handling the given request by any port I/O handler registered in the
  * hypervisor.
@@ -584,7 +737,6 @@ hv_emulate_pio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 {
 	int32_t status = -ENODEV;
 	uint16_t port, size;
-	uint32_t idx;
 	struct acrn_vm *vm = vcpu->vm;
 	struct acrn_pio_request *pio_req = &io_req->reqs.pio_request;
 	struct vm_io_handler_desc *handler;
@@ -599,20 +751,14 @@ hv_emulate_pio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 	port = (uint16_t)pio_req->address;
 	size = (uint16_t)pio_req->size;
 
-	for (idx = 0U; idx < EMUL_PIO_IDX_MAX; idx++) {
-		handler = &(vm->emul_pio[idx]);
-
-		if ((port < handler->port_start) || (port >= handler->port_end)) {
-			continue;
-		}
-
+	handler = find_pio_handler(vm, port);
+	if (handler != NULL) {
 		if (handler->io_read != NULL) {
 			io_read = handler->io_read;
 		}
 		if (handler->io_write != NULL) {
 			io_write = handler->io_write;
 		}
-		break;
 	}
 
 	if ((pio_req->direction == ACRN_IOREQ_DIR_WRITE) && (io_write != NULL)) {
@@ -633,10 +779,142 @@ hv_emulate_pio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 	return status;
 }
 
+/**
+ * @brief Find the MMIO node overlapping the access [address, address + size)
+ *
+ * The sorted index is binary searched for the last node starting before the
+ * end of the access, then walked backwards as long as an earlier node may
+ * still overlap it, which is a single step unless registered ranges overlap.
+ *
+ * @param vm The VM whose MMIO nodes are searched
+ * @param address The starting address of the MMIO access
+ * @param size The number of bytes of the MMIO access
+ * @param node Output, a copy of the MMIO node found
+ *
+ * @pre vm->emul_mmio_lock is held, or the result is validated by read_seqretry
+ *
+ * @retval 0 The access completely falls in the range of \p node.
+ * @retval -ENODEV No MMIO node overlaps the access.
+ * @retval -EIO The access spans the boundary of \p node.
+ */
+static int32_t find_mmio_node_by_addr(const struct acrn_vm *vm,
+	uint64_t address, uint64_t size, struct mem_io_node *node)
+{
+	const struct mem_io_index *index = vm->emul_mmio_index;
+	const struct mem_io_node *mmio_node;
+	uint16_t lo = 0U, mid, hi = *(const volatile uint16_t *)&vm->nr_emul_mmio_regions;
+	int32_t status = -ENODEV;
+
+	/* A torn read during an update is caught by the caller, just keep in bounds */
+	if (hi > CONFIG_MAX_EMULATED_MMIO_REGIONS) {
+		hi = CONFIG_MAX_EMULATED_MMIO_REGIONS;
+	}
+
+	/* Find the first node starting at or beyond the end of the access */
+	while (lo < hi) {
+		mid = lo + ((hi - lo) >> 1U);
+		if (index[mid].range_start < (address + size)) {
+			lo = mid + 1U;
+		} else {
+			hi = mid;
+		}
+	}
+
+	while ((lo > 0U) && (index[lo - 1U].max_end > address)) {
+		lo--;
+		mmio_node = &(vm->emul_mmio[index[lo].node_idx]);
+		if (mmio_node->range_end > address) {
+			*node = *mmio_node;
+			if ((address >= node->range_start) && ((address + size) <= node->range_end)) {
+				status = 0;
+			} else {
+				status = -EIO;
+			}
+			break;
+		}
+	}
+
+	return status;
+}
+
+/**
+ * @brief Recompute the max_end of the MMIO index entries starting from \p pos
+ *
+ * @pre vm->emul_mmio_lock is held
+ */
+static void emul_mmio_index_update_max_end(struct acrn_vm *vm, uint16_t pos)
+{
+	struct mem_io_index *index = vm->emul_mmio_index;
+	uint64_t max_end = (pos > 0U) ? index[pos - 1U].max_end : 0UL;
+	uint64_t end;
+	uint16_t i;
+
+	for (i = pos; i < vm->nr_emul_mmio_regions; i++) {
+		end = vm->emul_mmio[index[i].node_idx].range_end;
+		if (end > max_end) {
+			max_end = end;
+		}
+		index[i].max_end = max_end;
+	}
+}
+
+/**
+ * @brief Insert the MMIO node emul_mmio[node_idx] into the sorted MMIO index
+ *
+ * @pre vm->emul_mmio_lock is held
+ * @pre vm->nr_emul_mmio_regions < CONFIG_MAX_EMULATED_MMIO_REGIONS
+ */
+static void emul_mmio_index_insert(struct acrn_vm *vm, uint16_t node_idx)
+{
+	struct mem_io_index *index = vm->emul_mmio_index;
+	uint64_t start = vm->emul_mmio[node_idx].range_start;
+	uint16_t pos = vm->nr_emul_mmio_regions;
+
+	while ((pos > 0U) && (index[pos - 1U].range_start > start)) {
+		index[pos] = index[pos - 1U];
+		pos--;
+	}
+	index[pos].range_start = start;
+	index[pos].node_idx = node_idx;
+	vm->nr_emul_mmio_regions++;
+
+	emul_mmio_index_update_max_end(vm, pos);
+}
+
+/**
+ * @brief Remove the MMIO node emul_mmio[node_idx] from the sorted MMIO index
+ *
+ * @pre vm->emul_mmio_lock is held
+ */
+static void emul_mmio_index_remove(struct acrn_vm *vm, uint16_t node_idx)
+{
+	struct mem_io_index *index = vm->emul_mmio_index;
+	uint16_t pos, i;
+
+	for (pos = 0U; pos < vm->nr_emul_mmio_regions; pos++) {
+		if (index[pos].node_idx == node_idx) {
+			break;
+		}
+	}
+
+	if (pos < vm->nr_emul_mmio_regions) {
+		for (i = pos; (i + 1U) < vm->nr_emul_mmio_regions; i++) {
+			index[i] = index[i + 1U];
+		}
+		vm->nr_emul_mmio_regions--;
+
+		emul_mmio_index_update_max_end(vm, pos);
+	}
+}
+
 /**
  * Use registered MMIO handlers on the given request if it falls in the range of
  * any of them.
  *
+ * The handler is looked up without taking vm->emul_mmio_lock, so vCPUs of the
+ * same VM do not serialize on it. The lock is only taken around the handlers
+ * registered with hold_lock.
+ *
  * @pre io_req->io_type == ACRN_IOREQ_TYPE_MMIO
  *
  * @retval 0 Successfully emulated by registered handlers.
@@ -646,58 +924,47 @@ hv_emulate_pio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 static int32_t
 hv_emulate_mmio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 {
-	int32_t status = -ENODEV;
-	bool hold_lock = true;
-	uint16_t idx;
-	uint64_t address, size, base, end;
+	int32_t status;
+	bool locked = false;
+	uint32_t seq;
+	uint64_t address, size;
+	struct acrn_vm *vm = vcpu->vm;
 	struct acrn_mmio_request *mmio_req = &io_req->reqs.mmio_request;
-	struct mem_io_node *mmio_handler = NULL;
-	hv_mem_io_handler_t read_write = NULL;
-	void *handler_private_data = NULL;
-
-	if (is_service_vm(vcpu->vm) || is_prelaunched_vm(vcpu->vm)) {
-		read_write = mmio_default_access_handler;
-	}
+	struct mem_io_node mmio_node;
 
 	address = mmio_req->address;
 	size = mmio_req->size;
 
-	spinlock_obtain(&vcpu->vm->emul_mmio_lock);
-	for (idx = 0U; idx <= vcpu->vm->nr_emul_mmio_regions; idx++) {
-		mmio_handler = &(vcpu->vm->emul_mmio[idx]);
-		if (mmio_handler->read_write != NULL) {
-			base = mmio_handler->range_start;
-			end = mmio_handler->range_end;
+	do {
+		seq = read_seqbegin(&vm->emul_mmio_lock);
+		status = find_mmio_node_by_addr(vm, address, size, &mmio_node);
+	} while (read_seqretry(&vm->emul_mmio_lock, seq));
 
-			if (((address + size) <= base) || (address >= end)) {
-				continue;
-			} else {
-				 if ((address >= base) && ((address + size) <= end)) {
-					hold_lock = mmio_handler->hold_lock;
-					read_write = mmio_handler->read_write;
-					handler_private_data = mmio_handler->handler_private_data;
-				} else {
-					pr_fatal("Err MMIO, address:0x%lx, size:%x", address, size);
-					status = -EIO;
-				}
-				break;
-			}
-		}
+	if ((status == 0) && mmio_node.hold_lock) {
+		/* The handler may not run concurrently with unregistration, so
+		 * look it up again with the lock held.
+		 */
+		read_seqlock_excl(&vm->emul_mmio_lock);
+		locked = true;
+		status = find_mmio_node_by_addr(vm, address, size, &mmio_node);
 	}
 
-	if ((status == -ENODEV) && (read_write != NULL)) {
-		/* This mmio_handler will never modify once register, so we don't
-		 * need to hold the lock when handling the MMIO access.
+	if (status == 0) {
+		/* Without hold_lock, the mmio_handler will never modify once
+		 * register, so it is called without holding the lock.
 		 */
-		if (!hold_lock) {
-			spinlock_release(&vcpu->vm->emul_mmio_lock);
-		}
-		status = read_write(io_req, handler_private_data);
-		if (!hold_lock) {
-			spinlock_obtain(&vcpu->vm->emul_mmio_lock);
+		status = mmio_node.read_write(io_req, mmio_node.handler_private_data);
+	} else if (status == -ENODEV) {
+		if (is_service_vm(vm) || is_prelaunched_vm(vm)) {
+			status = mmio_default_access_handler(io_req, NULL);
 		}
+	} else {
+		pr_fatal("Err MMIO, address:0x%lx, size:%x", address, size);
+	}
+
+	if (locked) {
+		read_sequnlock_excl(&vm->emul_mmio_lock);
 	}
-	spinlock_release(&vcpu->vm->emul_mmio_lock);
 
 	return status;
 }
@@ -726,7 +993,7 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
 {
 	int32_t status;
 	struct acrn_vm_config *vm_config;
-	struct asyncio_desc *aio_desc;
+	uint64_t asyncio_fd;
 
 	vm_config = get_vm_config(vcpu->vm->vm_id);
 
@@ -756,9 +1023,8 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
 		 *
 		 * ACRN insert request to HSM and inject upcall.
 		 */
-		aio_desc = get_asyncio_desc(vcpu, io_req);
-		if (aio_desc) {
-			status = acrn_insert_asyncio(vcpu, aio_desc->asyncio_info.fd);
+		if (get_asyncio_fd(vcpu, io_req, &asyncio_fd)) {
+			status = acrn_insert_asyncio(vcpu, asyncio_fd);
 		} else {
 			status = acrn_insert_request(vcpu, io_req);
 			if (status == 0) {
@@ -794,6 +1060,9 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
 void register_pio_emulation_handler(struct acrn_vm *vm, uint32_t pio_idx,
 		const struct vm_io_range *range, io_read_fn_t io_read_fn_ptr, io_write_fn_t io_write_fn_ptr)
 {
+	uint16_t old_start = vm->emul_pio[pio_idx].port_start;
+	uint16_t old_end = vm->emul_pio[pio_idx].port_end;
+
 	if (is_service_vm(vm)) {
 		deny_guest_pio_access(vm, range->base, range->len);
 	}
@@ -801,6 +1070,10 @@ void register_pio_emulation_handler(struct acrn_vm *vm, uint32_t pio_idx,
 	vm->emul_pio[pio_idx].port_end = range->base + range->len;
 	vm->emul_pio[pio_idx].io_read = io_read_fn_ptr;
 	vm->emul_pio[pio_idx].io_write = io_write_fn_ptr;
+
+	/* The ports of a re-registered index may fall back to another handler */
+	update_pio_table(vm, old_start, old_end);
+	update_pio_table(vm, range->base, (uint32_t)range->base + range->len);
 }
 
 /**
@@ -847,17 +1120,7 @@ static inline struct mem_io_node *find_match_mmio_node(struct acrn_vm *vm,
  */
 static inline struct mem_io_node *find_free_mmio_node(struct acrn_vm *vm)
 {
-	uint16_t idx;
-	struct mem_io_node *mmio_node = find_match_mmio_node(vm, 0UL, 0UL);
-
-	if (mmio_node != NULL) {
-		idx = (uint16_t)(uint64_t)(mmio_node - &(vm->emul_mmio[0U]));
-		if (vm->nr_emul_mmio_regions < idx) {
-			vm->nr_emul_mmio_regions = idx;
-		}
-	}
-
-	return mmio_node;
+	return find_match_mmio_node(vm, 0UL, 0UL);
 }
 
 /**
@@ -879,7 +1142,7 @@ void register_mmio_emulation_handler(struct acrn_vm *vm,
 
 	/* Ensure both a read/write handler and range check function exist */
 	if ((read_write != NULL) && (end > start)) {
-		spinlock_obtain(&vm->emul_mmio_lock);
+		write_seqlock(&vm->emul_mmio_lock);
 		mmio_node = find_free_mmio_node(vm);
 		if (mmio_node != NULL) {
 			/* Fill in information for this node */
@@ -888,8 +1151,9 @@ void register_mmio_emulation_handler(struct acrn_vm *vm,
 			mmio_node->handler_private_data = handler_private_data;
 			mmio_node->range_start = start;
 			mmio_node->range_end = end;
+			emul_mmio_index_insert(vm, (uint16_t)(mmio_node - &(vm->emul_mmio[0U])));
 		}
-		spinlock_release(&vm->emul_mmio_lock);
+		write_sequnlock(&vm->emul_mmio_lock);
 	}
 
 }
@@ -908,16 +1172,23 @@ void unregister_mmio_emulation_handler(struct acrn_vm *vm,
 {
 	struct mem_io_node *mmio_node;
 
-	spinlock_obtain(&vm->emul_mmio_lock);
+	write_seqlock(&vm->emul_mmio_lock);
 	mmio_node = find_match_mmio_node(vm, start, end);
 	if (mmio_node != NULL) {
+		emul_mmio_index_remove(vm, (uint16_t)(mmio_node - &(vm->emul_mmio[0U])));
 		(void)memset(mmio_node, 0U, sizeof(struct mem_io_node));
 	}
-	spinlock_release(&vm->emul_mmio_lock);
+	write_sequnlock(&vm->emul_mmio_lock);
 }
 
 void deinit_emul_io(struct acrn_vm *vm)
 {
 	(void)memset(vm->emul_mmio, 0U, sizeof(vm->emul_mmio));
+	(void)memset(vm->emul_mmio_index, 0U, sizeof(vm->emul_mmio_index));
+	vm->nr_emul_mmio_regions = 0U;
 	(void)memset(vm->emul_pio, 0U, sizeof(vm->emul_pio));
+	(void)memset(vm->emul_pio_dir, 0U, sizeof(vm->emul_pio_dir));
+	(void)memset(vm->emul_pio_pages, 0U, sizeof(vm->emul_pio_pages));
+	vm->nr_emul_pio_pages = 0U;
+	vm->emul_pio_table_full = false;
 }
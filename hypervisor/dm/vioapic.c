@@ -252,11 +252,14 @@ vioapic_indirect_read(struct acrn_single_vioapic *vioapic, uint32_t addr)
 				union ioapic_rte phys_rte = {};
 				DEFINE_INTX_SID(virt_sid, vioapic->rtbl[pin].bits.vector, INTX_CTLR_IOAPIC);
 
+				/* the entry is only valid under the lock */
+				read_lock(&ptdev_lock);
 				entry = find_ptirq_entry(PTDEV_INTR_INTX, &virt_sid, vioapic->vm);
 				if (entry != NULL) {
 					ioapic_get_rte(entry->allocated_pirq, &phys_rte);
 					vioapic->rtbl[pin].bits.remote_irr = phys_rte.bits.remote_irr;
 				}
+				read_unlock(&ptdev_lock);
 			}
 			ret = vioapic->rtbl[pin].u.lo_32;
 		}
@@ -392,14 +392,14 @@ int32_t create_ivshmem_vdev(struct acrn_vm *vm, struct acrn_vdev *dev)
 		if (strncmp(dev_config->shm_region_name, (char *)dev->args, sizeof(dev_config->shm_region_name)) == 0) {
 			struct ivshmem_shm_region *region = find_shm_region(dev_config->shm_region_name);
 			if ((region != NULL) && (region->size == dev->io_size[IVSHMEM_SHM_BAR])) {
-				spinlock_obtain(&vm->vpci.lock);
+				write_lock(&vm->vpci.lock);
 				dev_config->vbdf.value = (uint16_t) dev->slot;
 				dev_config->vbar_base[IVSHMEM_MMIO_BAR] = (uint64_t) dev->io_addr[IVSHMEM_MMIO_BAR];
 				dev_config->vbar_base[IVSHMEM_MSIX_BAR] = (uint64_t) dev->io_addr[IVSHMEM_MSIX_BAR];
 				dev_config->vbar_base[IVSHMEM_SHM_BAR] = (uint64_t) dev->io_addr[IVSHMEM_SHM_BAR];
 				dev_config->vbar_base[IVSHMEM_SHM_BAR] |= ((uint64_t) dev->io_addr[IVSHMEM_SHM_BAR + 1U]) << 32U;
 				vdev = vpci_init_vdev(&vm->vpci, dev_config, NULL);
-				spinlock_release(&vm->vpci.lock);
+				write_unlock(&vm->vpci.lock);
 				if (vdev != NULL) {
 					ret = 0;
 				}
@@ -424,9 +424,9 @@ int32_t destroy_ivshmem_vdev(struct pci_vdev *vdev)
 		vpci_update_one_vbar(vdev, i, 0U, NULL, ivshmem_vbar_unmap);
 	}
 
-	spinlock_obtain(&vpci->lock);
+	write_lock(&vpci->lock);
 	vpci_deinit_vdev(vdev);
-	spinlock_release(&vpci->lock);
+	write_unlock(&vpci->lock);
 
 	return 0;
 }
@@ -178,9 +178,9 @@ int32_t create_vmcs9900_vdev(struct acrn_vm *vm, struct acrn_vdev *dev)
 			dev_config->vbdf.value = (uint16_t) dev->slot;
 			dev_config->vbar_base[0] = (uint64_t) dev->io_addr[0];
 			dev_config->vbar_base[1] = (uint64_t) dev->io_addr[1];
-			spinlock_obtain(&vm->vpci.lock);
+			write_lock(&vm->vpci.lock);
 			vdev = vpci_init_vdev(&vm->vpci, dev_config, NULL);
-			spinlock_release(&vm->vpci.lock);
+			write_unlock(&vm->vpci.lock);
 			if (vdev != NULL) {
 				ret = 0;
 			}
@@ -206,9 +206,9 @@ int32_t destroy_vmcs9900_vdev(struct pci_vdev *vdev)
 
 	deinit_pci_vuart(vdev);
 
-	spinlock_obtain(&vpci->lock);
+	write_lock(&vpci->lock);
 	vpci_deinit_vdev(vdev);
-	spinlock_release(&vpci->lock);
+	write_unlock(&vpci->lock);
 
 	return 0;
 }
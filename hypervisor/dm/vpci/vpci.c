@@ -263,7 +263,7 @@ int32_t init_vpci(struct acrn_vm *vm)
 		register_pio_emulation_handler(vm, PCI_CFGDATA_PIO_IDX, &pci_cfgdata_range,
 			vpci_pio_cfgdata_read, vpci_pio_cfgdata_write);
 
-		spinlock_init(&vm->vpci.lock);
+		rwlock_init(&vm->vpci.lock);
 	}
 
 	return ret;
@@ -288,9 +288,9 @@ void deinit_vpci(struct acrn_vm *vm)
 			vdev->vdev_ops->deinit_vdev(vdev);
 
 			if (parent_vdev != NULL) {
-				spinlock_obtain(&parent_vdev->vpci->lock);
+				write_lock(&parent_vdev->vpci->lock);
 				parent_vdev->vdev_ops->init_vdev(parent_vdev);
-				spinlock_release(&parent_vdev->vpci->lock);
+				write_unlock(&parent_vdev->vpci->lock);
 			}
 		}
 	}
@@ -649,7 +649,7 @@ static int32_t vpci_read_cfg(struct acrn_vpci *vpci, union pci_bdf bdf,
 	int32_t ret = 0;
 	struct pci_vdev *vdev;
 
-	spinlock_obtain(&vpci->lock);
+	read_lock(&vpci->lock);
 	vdev = find_available_vdev(vpci, bdf);
 	if (vdev != NULL) {
 		ret = vdev->vdev_ops->read_vdev_cfg(vdev, offset, bytes, val);
@@ -663,7 +663,7 @@ static int32_t vpci_read_cfg(struct acrn_vpci *vpci, union pci_bdf bdf,
 			/* no action: e.g., PCI scan */
 		}
 	}
-	spinlock_release(&vpci->lock);
+	read_unlock(&vpci->lock);
 	return ret;
 }
 
@@ -676,7 +676,7 @@ static int32_t vpci_write_cfg(struct acrn_vpci *vpci, union pci_bdf bdf,
 	int32_t ret = 0;
 	struct pci_vdev *vdev;
 
-	spinlock_obtain(&vpci->lock);
+	write_lock(&vpci->lock);
 	vdev = find_available_vdev(vpci, bdf);
 	if (vdev != NULL) {
 		ret = vdev->vdev_ops->write_vdev_cfg(vdev, offset, bytes, val);
@@ -691,7 +691,7 @@ static int32_t vpci_write_cfg(struct acrn_vpci *vpci, union pci_bdf bdf,
 				bdf.bits.b, bdf.bits.d, bdf.bits.f, offset, val);
 		}
 	}
-	spinlock_release(&vpci->lock);
+	write_unlock(&vpci->lock);
 	return ret;
 }
 
@@ -807,7 +807,7 @@ int32_t vpci_assign_pcidev(struct acrn_vm *tgt_vm, struct acrn_pcidev *pcidev)
 
 	bdf.value = pcidev->phys_bdf;
 	service_vm = get_service_vm();
-	spinlock_obtain(&service_vm->vpci.lock);
+	write_lock(&service_vm->vpci.lock);
 	vdev_in_service_vm = pci_find_vdev(&service_vm->vpci, bdf);
 	if ((vdev_in_service_vm != NULL) && (vdev_in_service_vm->user == vdev_in_service_vm) &&
 			(vdev_in_service_vm->pdev != NULL) &&
@@ -827,7 +827,7 @@ int32_t vpci_assign_pcidev(struct acrn_vm *tgt_vm, struct acrn_pcidev *pcidev)
 
 		vpci = &(tgt_vm->vpci);
 
-		spinlock_obtain(&tgt_vm->vpci.lock);
+		write_lock(&tgt_vm->vpci.lock);
 		vdev = vpci_init_vdev(vpci, vdev_in_service_vm->pci_dev_config, vdev_in_service_vm->phyfun);
 		if (vdev != NULL) {
 			pci_vdev_write_vcfg(vdev, PCIR_INTERRUPT_LINE, 1U, pcidev->intr_line);
@@ -864,7 +864,7 @@ int32_t vpci_assign_pcidev(struct acrn_vm *tgt_vm, struct acrn_pcidev *pcidev)
 				tgt_vm->vm_id);
 			ret = -EFAULT;
 		}
-		spinlock_release(&tgt_vm->vpci.lock);
+		write_unlock(&tgt_vm->vpci.lock);
 	} else {
 		pr_fatal("%s, can't find PCI device %x:%x.%x for vm[%d] %x:%x.%x\n", __func__,
 			pcidev->phys_bdf >> 8U, (pcidev->phys_bdf >> 3U) & 0x1fU, pcidev->phys_bdf & 0x7U,
@@ -872,7 +872,7 @@ int32_t vpci_assign_pcidev(struct acrn_vm *tgt_vm, struct acrn_pcidev *pcidev)
 			pcidev->virt_bdf >> 8U, (pcidev->virt_bdf >> 3U) & 0x1fU, pcidev->virt_bdf & 0x7U);
 		ret = -ENODEV;
 	}
-	spinlock_release(&service_vm->vpci.lock);
+	write_unlock(&service_vm->vpci.lock);
 
 	return ret;
 }
@@ -897,14 +897,14 @@ int32_t vpci_deassign_pcidev(struct acrn_vm *tgt_vm, struct acrn_pcidev *pcidev)
 		vpci = vdev->vpci;
 		parent_vdev = vdev->parent_user;
 
-		spinlock_obtain(&vpci->lock);
+		write_lock(&vpci->lock);
 		vpci_deinit_vdev(vdev);
-		spinlock_release(&vpci->lock);
+		write_unlock(&vpci->lock);
 
 		if (parent_vdev != NULL) {
-			spinlock_obtain(&parent_vdev->vpci->lock);
+			write_lock(&parent_vdev->vpci->lock);
 			parent_vdev->vdev_ops->init_vdev(parent_vdev);
-			spinlock_release(&parent_vdev->vpci->lock);
+			write_unlock(&parent_vdev->vpci->lock);
 		}
 	} else {
 		pr_fatal("%s, can't find PCI device %x:%x.%x for vm[%d] %x:%x.%x\n", __func__,
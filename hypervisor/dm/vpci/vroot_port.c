@@ -140,9 +140,9 @@ int32_t create_vrp(struct acrn_vm *vm, struct acrn_vdev *dev)
 			dev_config->vrp_max_payload = vrp_config->max_payload;
 			dev_config->vdev_ops = &vrp_ops;
 
-			spinlock_obtain(&vm->vpci.lock);
+			write_lock(&vm->vpci.lock);
 			vdev = vpci_init_vdev(&vm->vpci, dev_config, NULL);
-			spinlock_release(&vm->vpci.lock);
+			write_unlock(&vm->vpci.lock);
 			if (vdev == NULL) {
 				pr_err("%s: failed to create virtual root port\n", __func__);
 				ret = -EFAULT;
@@ -162,9 +162,9 @@ int32_t destroy_vrp(struct pci_vdev *vdev)
 {
 	struct acrn_vpci *vpci = vdev->vpci;
 
-	spinlock_obtain(&vpci->lock);
+	write_lock(&vpci->lock);
 	vpci_deinit_vdev(vdev);
-	spinlock_release(&vpci->lock);
+	write_unlock(&vpci->lock);
 
 	return 0;
 }
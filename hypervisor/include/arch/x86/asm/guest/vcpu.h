@@ -273,6 +273,7 @@ struct acrn_vcpu_arch {
 
 	/* VCPU context state information */
 	uint32_t exit_reason;
+	uint64_t exit_tsc;	/* TSC of the last VM exit, 0 before the first VM entry */
 	uint32_t idt_vectoring_info;
 	uint64_t exit_qualification;
 	uint32_t proc_vm_exec_ctrls;
@@ -291,6 +292,9 @@ struct acrn_vcpu_arch {
 	/* EOI_EXIT_BITMAP buffer, for the bitmap update */
 	uint64_t eoi_exit_bitmap[EOI_EXIT_BITMAP_SIZE >> 6U];
 
+	/* VM exit latency statistics, see update_vmexit_stats() */
+	struct acrn_vmexit_reason_stats exit_stats[ACRN_VMEXIT_REASON_NUM];
+
 	/* Keylocker */
 	struct iwkey IWKey;
 	bool cr4_kl_enabled;
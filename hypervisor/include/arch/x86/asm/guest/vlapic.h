@@ -42,6 +42,26 @@
 
 #define VLAPIC_MAXLVT_INDEX	APIC_LVT_CMCI
 
+#define VLAPIC_APICID_HASH_BITS	7U
+#define VLAPIC_APICID_HASH_SIZE	(1U << VLAPIC_APICID_HASH_BITS)
+
+/*
+ * Per-VM index of the vLAPICs, used to find the destination vCPUs of an
+ * interrupt without walking every vCPU of the VM:
+ * - apicid_hash: open addressing hash table from APIC ID to vCPU ID
+ * - flat: vCPUs in xAPIC flat model, per bit of the logical APIC ID
+ * - cluster: vCPUs in xAPIC cluster model, per cluster and logical ID bit
+ * - x2apic: vCPUs in x2APIC mode whose LDR is derived from their x2APIC ID
+ * - x2apic_other: vCPUs in x2APIC mode with any other LDR
+ */
+struct vlapic_dest_map {
+	uint16_t apicid_hash[VLAPIC_APICID_HASH_SIZE];
+	uint64_t flat[8];
+	uint64_t cluster[16][4];
+	uint64_t x2apic;
+	uint64_t x2apic_other;
+};
+
 struct vlapic_timer {
 	struct hv_timer timer;
 	uint32_t mode;
@@ -83,6 +103,13 @@ struct acrn_vlapic {
 	 */
 	uint32_t	svr_last;
 	uint32_t	lvt_last[VLAPIC_MAXLVT_INDEX + 1];
+
+	/*
+	 * Logical destination model and logical APIC ID under which this
+	 * vLAPIC is currently published in the per-VM vlapic_dest_map.
+	 */
+	uint32_t	dest_map_model;
+	uint32_t	dest_map_ldr;
 } __aligned(PAGE_SIZE);
 
 
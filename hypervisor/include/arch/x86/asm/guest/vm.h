@@ -15,6 +15,7 @@
 
 #include <asm/lib/bits.h>
 #include <asm/lib/spinlock.h>
+#include <asm/lib/seqlock.h>
 #include <asm/pgtable.h>
 #include <asm/guest/vcpu.h>
 #include <vioapic.h>
@@ -72,6 +73,9 @@ struct vm_sw_info {
 	/* HVA to IO shared page */
 	void *io_shared_page;
 	void *asyncio_sbuf;
+	uint32_t asyncio_sbuf_size;	/* size of the asyncio sbuf data area, validated at setup */
+	uint32_t asyncio_resv_tail;	/* asyncio sbuf tail reserved by the producers */
+	uint32_t asyncio_pub_tail;	/* asyncio sbuf tail published to the Service VM */
 	void *vm_event_sbuf;
 	/* If enable IO completion polling mode */
 	bool is_polling_ioreq;
@@ -120,6 +124,7 @@ struct vm_arch {
 	struct acrn_hyperv hyperv;
 #endif
 	enum vm_vlapic_mode vlapic_mode; /* Represents vLAPIC mode across vCPUs*/
+	struct vlapic_dest_map vlapic_dest_map; /* Interrupt destination lookup of the vLAPICs */
 
 	/*
 	 * Keylocker spec 4.5:
@@ -146,8 +151,8 @@ struct acrn_vm {
 	enum vm_state state;	/* VM state */
 	struct acrn_vuart vuart[MAX_VUART_NUM_PER_VM];		/* Virtual UART */
 	struct asyncio_desc	aio_desc[ACRN_ASYNCIO_MAX];
-	struct list_head aiodesc_queue;
-	spinlock_t asyncio_lock; /* Spin-lock used to protect asyncio add/remove for a VM */
+	struct hlist_head aiodesc_hlist_heads[ASYNCIO_HASHSIZE];	/* asyncio_desc hashed by type and addr */
+	seqlock_t asyncio_lock; /* Serializes the asyncio add/remove of a VM, lookups take no lock */
 	spinlock_t vm_event_lock;
 
 	enum vpic_wire_mode wire_mode;
@@ -159,11 +164,19 @@ struct acrn_vm {
 	spinlock_t wbinvd_lock;		/* Spin-lock used to serialize wbinvd emulation */
 	spinlock_t vlapic_mode_lock;	/* Spin-lock used to protect vlapic_mode modifications for a VM */
 	spinlock_t ept_lock;	/* Spin-lock used to protect ept add/modify/remove for a VM */
-	spinlock_t emul_mmio_lock;	/* Used to protect emulation mmio_node concurrent access for a VM */
+	seqlock_t emul_mmio_lock;	/* Used to protect emulation mmio_node concurrent access for a VM */
 	uint16_t nr_emul_mmio_regions;	/* the emulated mmio_region number */
 	struct mem_io_node emul_mmio[CONFIG_MAX_EMULATED_MMIO_REGIONS];
+	/* Registered emul_mmio nodes, sorted by range_start */
+	struct mem_io_index emul_mmio_index[CONFIG_MAX_EMULATED_MMIO_REGIONS];
 
 	struct vm_io_handler_desc emul_pio[EMUL_PIO_IDX_MAX];
+	/* Port IO lookup directory, each entry holds a page index + 1, or 0 if no page is populated */
+	uint8_t emul_pio_dir[EMUL_PIO_DIR_ENTRIES];
+	/* Port IO lookup pages, each entry holds an emul_pio index + 1, or 0 if no handler covers the port */
+	uint8_t emul_pio_pages[EMUL_PIO_PAGE_NUM][EMUL_PIO_PAGE_PORTS];
+	uint16_t nr_emul_pio_pages;	/* the number of populated port IO lookup pages */
+	bool emul_pio_table_full;	/* some port is not in the lookup table, lookups fall back to a linear scan */
 
 	char name[MAX_VM_NAME_LEN];
 	struct secure_world_control sworld_control;
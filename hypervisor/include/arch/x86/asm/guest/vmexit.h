@@ -13,6 +13,7 @@ struct vm_exit_dispatch {
 };
 
 int32_t vmexit_handler(struct acrn_vcpu *vcpu);
+void update_vmexit_stats(struct acrn_vcpu *vcpu);
 int32_t vmcall_vmexit_handler(struct acrn_vcpu *vcpu);
 int32_t cpuid_vmexit_handler(struct acrn_vcpu *vcpu);
 int32_t rdmsr_vmexit_handler(struct acrn_vcpu *vcpu);
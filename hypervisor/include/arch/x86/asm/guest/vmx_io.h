@@ -28,6 +28,18 @@
 #define PIO_RESET_REG_IDX		(CF9_PIO_IDX + 1U)
 #define SLEEP_CTL_PIO_IDX		(PIO_RESET_REG_IDX + 1U)
 #define EMUL_PIO_IDX_MAX		(SLEEP_CTL_PIO_IDX + 1U)
+
+/*
+ * Emulated port IO lookup table: the 64K port space is split into pages of
+ * 256 ports, a page is only populated when some handler covers one of its
+ * ports. Each port entry of a page is a byte holding a fixed emul_pio index
+ * + 1, so EMUL_PIO_IDX_MAX must stay below 256. The table speeds up the
+ * dispatch only, handlers still take the fixed slots above.
+ */
+#define EMUL_PIO_PAGE_SHIFT		8U
+#define EMUL_PIO_PAGE_PORTS		(1U << EMUL_PIO_PAGE_SHIFT)
+#define EMUL_PIO_DIR_ENTRIES		(0x10000U >> EMUL_PIO_PAGE_SHIFT)
+#define EMUL_PIO_PAGE_NUM		EMUL_PIO_IDX_MAX
 /**
  * @brief The handler of VM exits on I/O instructions
  *
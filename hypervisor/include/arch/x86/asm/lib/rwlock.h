@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef RWLOCK_H
+#define RWLOCK_H
+
+#include <types.h>
+#include <rtl.h>
+#include <asm/cpu.h>
+#include <asm/tsc.h>
+#include <asm/lib/atomic.h>
+#include <asm/lib/bits.h>
+
+/**
+ * Contention statistics of a lock, they are only collected in debug builds.
+ */
+struct lock_stats {
+	uint64_t acquired;	/**< number of acquisitions */
+	uint64_t contended;	/**< acquisitions that had to wait */
+	uint64_t spin_cycles;	/**< TSC cycles spent waiting */
+};
+
+/**
+ * @brief Start timing the wait for a lock, on the first failed attempt only
+ */
+static inline uint64_t lock_spin_begin(uint64_t spin_start)
+{
+#ifdef HV_DEBUG
+	return (spin_start == 0UL) ? rdtsc() : spin_start;
+#else
+	(void)spin_start;
+	return 0UL;
+#endif
+}
+
+/**
+ * @brief Account one acquisition, which waited since spin_start if it is not 0
+ */
+static inline void lock_stats_acquired(struct lock_stats *stats, uint64_t spin_start)
+{
+#ifdef HV_DEBUG
+	atomic_inc64(&stats->acquired);
+	if (spin_start != 0UL) {
+		atomic_inc64(&stats->contended);
+		(void)atomic_xadd64((int64_t *)&stats->spin_cycles, (int64_t)(rdtsc() - spin_start));
+	}
+#else
+	(void)stats;
+	(void)spin_start;
+#endif
+}
+
+/* cnt of rwlock_t: the number of readers, and the writer state in the top bits */
+#define RWLOCK_WRITER		31U	/* bit set while a writer holds the lock */
+#define RWLOCK_WRITER_WAITING	30U	/* bit set while a writer waits, new readers wait too */
+#define RWLOCK_WRITER_MASK	((1U << RWLOCK_WRITER) | (1U << RWLOCK_WRITER_WAITING))
+
+/**
+ * Reader-writer spinlock. The readers share the lock, a writer holds it
+ * exclusively. A waiting writer stops new readers from taking the lock, so
+ * the writers are not starved by a stream of readers.
+ */
+typedef struct _rwlock {
+	uint32_t cnt;
+	struct lock_stats stats;
+} rwlock_t;
+
+static inline void rwlock_init(rwlock_t *lock)
+{
+	(void)memset(lock, 0U, sizeof(rwlock_t));
+}
+
+static inline void read_lock(rwlock_t *lock)
+{
+	uint32_t cnt;
+	uint64_t spin_start = 0UL;
+	bool locked = false;
+
+	while (!locked) {
+		cnt = *(volatile uint32_t *)&lock->cnt;
+		if ((cnt & RWLOCK_WRITER_MASK) == 0U) {
+			locked = (atomic_cmpxchg32(&lock->cnt, cnt, cnt + 1U) == cnt);
+		}
+		if (!locked) {
+			spin_start = lock_spin_begin(spin_start);
+			asm_pause();
+		}
+	}
+	lock_stats_acquired(&lock->stats, spin_start);
+}
+
+static inline void read_unlock(rwlock_t *lock)
+{
+	atomic_dec32(&lock->cnt);
+}
+
+static inline void write_lock(rwlock_t *lock)
+{
+	uint32_t cnt;
+	uint64_t spin_start = 0UL;
+	bool locked = false;
+
+	while (!locked) {
+		cnt = *(volatile uint32_t *)&lock->cnt;
+		if ((cnt & ~(1U << RWLOCK_WRITER_WAITING)) == 0U) {
+			/* no reader nor writer, the waiting bit of other writers is cleared */
+			locked = (atomic_cmpxchg32(&lock->cnt, cnt, 1U << RWLOCK_WRITER) == cnt);
+		} else if ((cnt & (1U << RWLOCK_WRITER_WAITING)) == 0U) {
+			bitmap32_set_lock(RWLOCK_WRITER_WAITING, &lock->cnt);
+		} else {
+			/* wait for the readers and the writer to leave */
+		}
+		if (!locked) {
+			spin_start = lock_spin_begin(spin_start);
+			asm_pause();
+		}
+	}
+	lock_stats_acquired(&lock->stats, spin_start);
+}
+
+static inline void write_unlock(rwlock_t *lock)
+{
+	bitmap32_clear_lock(RWLOCK_WRITER, &lock->cnt);
+}
+
+#define read_lock_irqsave(lock, p_rflags)		\
+	do {						\
+		CPU_INT_ALL_DISABLE(p_rflags);		\
+		read_lock(lock);			\
+	} while (0)
+
+#define read_unlock_irqrestore(lock, rflags)		\
+	do {						\
+		read_unlock(lock);			\
+		CPU_INT_ALL_RESTORE(rflags);		\
+	} while (0)
+
+#define write_lock_irqsave(lock, p_rflags)		\
+	do {						\
+		CPU_INT_ALL_DISABLE(p_rflags);		\
+		write_lock(lock);			\
+	} while (0)
+
+#define write_unlock_irqrestore(lock, rflags)		\
+	do {						\
+		write_unlock(lock);			\
+		CPU_INT_ALL_RESTORE(rflags);		\
+	} while (0)
+
+#endif /* RWLOCK_H */
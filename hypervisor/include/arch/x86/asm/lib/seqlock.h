@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <types.h>
+#include <rtl.h>
+#include <asm/cpu.h>
+#include <asm/lib/spinlock.h>
+#include <asm/lib/rwlock.h>
+
+/**
+ * Sequence lock. The writers are serialized by a spinlock and make the
+ * sequence count odd while they update the data. The readers take no lock:
+ * they read the data between read_seqbegin() and read_seqretry(), and read
+ * it again if a writer updated it meanwhile.
+ *
+ * In its stats, acquired counts the writers, contended counts the reads to
+ * retry and spin_cycles the time readers waited for writers.
+ */
+typedef struct _seqlock {
+	spinlock_t lock;
+	uint32_t seq;
+	struct lock_stats stats;
+} seqlock_t;
+
+static inline void seqlock_init(seqlock_t *sl)
+{
+	(void)memset(sl, 0U, sizeof(seqlock_t));
+}
+
+/**
+ * @brief Begin a lockless read of the data protected by \p sl
+ *
+ * @return The sequence count to be passed to read_seqretry
+ */
+static inline uint32_t read_seqbegin(seqlock_t *sl)
+{
+	uint32_t seq;
+	uint64_t spin_start = 0UL;
+
+	seq = *(const volatile uint32_t *)&sl->seq;
+	while ((seq & 1U) != 0U) {
+		spin_start = lock_spin_begin(spin_start);
+		asm_pause();
+		seq = *(const volatile uint32_t *)&sl->seq;
+	}
+#ifdef HV_DEBUG
+	if (spin_start != 0UL) {
+		(void)atomic_xadd64((int64_t *)&sl->stats.spin_cycles, (int64_t)(rdtsc() - spin_start));
+	}
+#endif
+	cpu_compiler_barrier();
+
+	return seq;
+}
+
+/**
+ * @brief Check whether a writer updated the data since read_seqbegin
+ *
+ * @return true if the data read since read_seqbegin may be inconsistent
+ */
+static inline bool read_seqretry(seqlock_t *sl, uint32_t seq)
+{
+	bool retry;
+
+	cpu_compiler_barrier();
+	retry = (*(const volatile uint32_t *)&sl->seq != seq);
+#ifdef HV_DEBUG
+	if (retry) {
+		atomic_inc64(&sl->stats.contended);
+	}
+#endif
+	return retry;
+}
+
+static inline void write_seqlock(seqlock_t *sl)
+{
+	spinlock_obtain(&sl->lock);
+	*(volatile uint32_t *)&sl->seq = sl->seq + 1U;
+	cpu_write_memory_barrier();
+	lock_stats_acquired(&sl->stats, 0UL);
+}
+
+static inline void write_sequnlock(seqlock_t *sl)
+{
+	cpu_write_memory_barrier();
+	*(volatile uint32_t *)&sl->seq = sl->seq + 1U;
+	spinlock_release(&sl->lock);
+}
+
+/**
+ * @brief Lock out the writers without making the readers retry
+ */
+static inline void read_seqlock_excl(seqlock_t *sl)
+{
+	spinlock_obtain(&sl->lock);
+}
+
+static inline void read_sequnlock_excl(seqlock_t *sl)
+{
+	spinlock_release(&sl->lock);
+}
+
+#define write_seqlock_irqsave(sl, p_rflags)		\
+	do {						\
+		CPU_INT_ALL_DISABLE(p_rflags);		\
+		write_seqlock(sl);			\
+	} while (0)
+
+#define write_sequnlock_irqrestore(sl, rflags)		\
+	do {						\
+		write_sequnlock(sl);			\
+		CPU_INT_ALL_RESTORE(rflags);		\
+	} while (0)
+
+#endif /* SEQLOCK_H */
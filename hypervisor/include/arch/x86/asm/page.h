@@ -95,6 +95,25 @@ struct page {
 	uint8_t contents[PAGE_SIZE]; /**< A 4-KByte page in the memory. */
 } __aligned(PAGE_SIZE);
 
+#define PAGE_MAGAZINE_SIZE	16U	/**< Max pages cached by one physical CPU for a page pool. */
+#define PAGE_MAGAZINE_BATCH	8U	/**< Pages moved between a magazine and its page pool at once. */
+
+/**
+ * @brief Data structure that caches pages of a page pool for one physical CPU.
+ *
+ * All the pages in a magazine are zeroed and marked as allocated in the bitmap of the page pool.
+ *
+ * @consistency N/A
+ * @alignment N/A
+ *
+ * @remark N/A
+ */
+struct page_magazine {
+	spinlock_t lock; /**< Only contended when another physical CPU steals pages from this magazine. */
+	uint32_t count; /**< The number of cached pages. */
+	struct page *pages[PAGE_MAGAZINE_SIZE]; /**< The cached pages. */
+};
+
 /**
  * @brief Data structure that contains a pool of memory pages.
  *
@@ -118,20 +137,77 @@ struct page_pool {
          * The bitmap is a data structure that represents the allocation status of each page in the pool. Each bit in
          * the bitmap corresponds to a page in the pool. If the bit is set to 1, the page is allocated; otherwise, the
          * page is free. The bitmap is used to track the allocation status of each page in the pool.
+         *
+         * The memory it points to shall be page_pool_bitmap_size() bytes, the summary bitmaps follow the bitmap.
          */
         uint64_t *bitmap;
         uint64_t bitmap_size; /**< The number of bitmap. */
-        uint64_t last_hint_id; /**< The last bitmap ID that is used to allocate a page. */
+        /**
+         * @brief A pointer to the summary bitmaps of the pool.
+         *
+         * The first level has one bit per bitmap word, set if that word has a free page. The second level follows
+         * it and has one bit per first level word, set if that word is not zero. So a free page is found with a few
+         * bit scans instead of walking the bitmap.
+         */
+        uint64_t *summary;
+        uint64_t summary_size; /**< The number of first level summary words. */
         /**
          * @brief A pointer to the dummy page
          *
          * This is used when there's no page available in the pool.
          */
         struct page *dummy_page;
+        bool pcpu_cache; /**< Whether pages are allocated and freed through the per physical CPU magazines. */
+        struct page_magazine magazine[MAX_PCPU_NUM]; /**< The per physical CPU magazines. */
 };
 
+/**
+ * @brief Get the size of the bitmap memory of a page pool.
+ *
+ * @param[in] page_num The number of pages in the pool, a multiple of 64.
+ *
+ * @return The size in bytes of the bitmap plus its summary bitmaps.
+ */
+static inline uint64_t page_pool_bitmap_size(uint64_t page_num)
+{
+	uint64_t bitmap_words = page_num >> 6U;
+	uint64_t summary_words = (bitmap_words + 63UL) >> 6U;
+
+	return (bitmap_words + summary_words + ((summary_words + 63UL) >> 6U)) * sizeof(uint64_t);
+}
+
+/**
+ * @brief Initialize a page pool, all its pages become free.
+ *
+ * @param[inout] pool The page pool, its start_page, bitmap, bitmap_size, dummy_page and pcpu_cache shall be set.
+ *
+ * @pre pool != NULL
+ */
+void init_page_pool(struct page_pool *pool);
 struct page *alloc_page(struct page_pool *pool);
 void free_page(struct page_pool *pool, struct page *page);
+
+/**
+ * @brief Allocate zeroed pages from a page pool with the pool lock taken once.
+ *
+ * Unlike alloc_page(), the per physical CPU magazines and the dummy page are not used.
+ *
+ * @param[in] pool The page pool.
+ * @param[out] pages The allocated pages.
+ * @param[in] num The number of pages to allocate.
+ *
+ * @return The number of pages allocated, less than \p num if the pool runs out of pages.
+ */
+uint32_t alloc_pages(struct page_pool *pool, struct page **pages, uint32_t num);
+
+/**
+ * @brief Free pages to a page pool with the pool lock taken once.
+ *
+ * @param[in] pool The page pool.
+ * @param[in] pages The pages to free.
+ * @param[in] num The number of pages to free.
+ */
+void free_pages(struct page_pool *pool, struct page * const *pages, uint32_t num);
 #endif /* PAGE_H */
 
 /**
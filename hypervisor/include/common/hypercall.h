@@ -217,6 +217,23 @@ int32_t hcall_set_ioreq_buffer(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm
  */
 int32_t hcall_notify_ioreq_finish(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief notify a batch of requests done
+ *
+ * Notify the requestor VCPUs for the completion of their ioreqs with one
+ * hypercall. The function will return -1 if the target VM does not exist
+ * or the bitmap names a VCPU the target VM does not have.
+ *
+ * @param vcpu not used
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 not used
+ * @param param2 bitmap of the requestor VCPU IDs, bit n for VCPU n
+ *
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_notify_ioreq_finish_batch(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm,
+		uint64_t param1, uint64_t param2);
+
 /**
  * @brief setup ept memory mapping for multi regions
  *
@@ -595,6 +612,20 @@ int32_t hcall_get_hw_info(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uin
  */
 int32_t hcall_profiling_ops(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 
+/**
+ * @brief Get the VM exit statistics of a vCPU of a VM.
+ *
+ * @param vcpu Pointer to vCPU that initiates the hypercall
+ * @param target_vm Pointer to target VM data structure
+ * @param param1 relative vmid to service vm
+ * @param param2 guest physical address. This gpa points to data structure of
+ *              acrn_vmexit_stats
+ *
+ * @pre is_service_vm(vcpu->vm)
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_vmexit_stats(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
+
 int32_t hcall_create_vcpu(struct acrn_vcpu *vcpu, struct acrn_vm *target_vm, uint64_t param1, uint64_t param2);
 /**
  * @}
@@ -8,6 +8,7 @@
 #define PTDEV_H
 #include <list.h>
 #include <asm/lib/spinlock.h>
+#include <asm/lib/rwlock.h>
 #include <timer.h>
 #include <vacpi.h>
 
@@ -152,7 +153,7 @@ static inline bool is_entry_active(const struct ptirq_remapping_info *entry)
 }
 
 extern struct ptirq_remapping_info ptirq_entries[CONFIG_MAX_PT_IRQ_ENTRIES];
-extern spinlock_t ptdev_lock;
+extern rwlock_t ptdev_lock;
 
 /**
  * @file ptdev.h
@@ -19,6 +19,13 @@
  */
 uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data, uint32_t max_len);
 uint32_t sbuf_put_many(struct shared_buf *sbuf, uint32_t elem_size, uint8_t *data, uint32_t data_size);
+/**
+ *@pre sbuf != NULL
+ *@pre called between stac() and clac()
+ */
+uint32_t sbuf_reserve(struct shared_buf *sbuf, uint32_t len, bool overwrite);
+void sbuf_copy_in(struct shared_buf *sbuf, uint32_t pos, const void *data, uint32_t len);
+void sbuf_commit(struct shared_buf *sbuf, uint32_t pos, uint32_t len);
 int32_t sbuf_share_setup(uint16_t cpu_id, uint32_t sbuf_id, uint64_t *hva);
 void sbuf_reset(void);
 uint32_t sbuf_next_ptr(uint32_t pos, uint32_t span, uint32_t scope);
@@ -27,11 +27,31 @@ enum tick_mode {
 	TICK_MODE_PERIODIC,	/**< periodic mode */
 };
 
+#ifdef CONFIG_TIMER_WHEEL_ENABLED
+/*
+ * One wheel tick is 2^TIMER_WHEEL_SHIFT TSC cycles. Each level has 64 slots
+ * (one bit per slot in a uint64_t bitmap) and each level is 64 times coarser
+ * than the one below, so 4 levels cover 2^34 TSC cycles ahead.
+ */
+#define TIMER_WHEEL_SHIFT	10U
+#define TIMER_WHEEL_BITS	6U
+#define TIMER_WHEEL_SIZE	(1U << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK	(TIMER_WHEEL_SIZE - 1U)
+#define TIMER_WHEEL_LEVELS	4U
+#endif
+
 /**
  * @brief Definition of timers for per-cpu
  */
 struct per_cpu_timers {
+#ifdef CONFIG_TIMER_WHEEL_ENABLED
+	uint64_t clk;			/**< wheel tick the slots are relative to */
+	uint64_t deadline;		/**< TSC deadline last programmed, 0 if none */
+	uint64_t pending[TIMER_WHEEL_LEVELS];	/**< bitmap of slots which may hold timers */
+	struct list_head wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];	/**< runtime active timers */
+#else
 	struct list_head timer_list;	/**< it's for runtime active timer list */
+#endif
 };
 
 /**
@@ -40,9 +40,12 @@ struct io_request {
 	} reqs;
 };
 
+#define ASYNCIO_HASHBITS	6U
+#define ASYNCIO_HASHSIZE	(1U << ASYNCIO_HASHBITS)
+
 struct asyncio_desc {
 	struct acrn_asyncio_info asyncio_info;
-	struct list_head list;
+	struct hlist_node link;
 };
 
 /**
@@ -174,6 +177,32 @@ struct mem_io_node {
 	uint64_t range_end;
 };
 
+/**
+ * @brief Structure for one entry of the sorted MMIO handler index
+ *
+ * The entries are kept sorted by \p range_start so that the MMIO handler
+ * covering a given address can be found by binary search.
+ */
+struct mem_io_index {
+
+	/**
+	 * @brief The starting address of the MMIO node this entry refers to
+	 */
+	uint64_t range_start;
+
+	/**
+	 * @brief The largest range_end among this entry and all entries before it
+	 *
+	 * It bounds the backward walk when registered ranges overlap.
+	 */
+	uint64_t max_end;
+
+	/**
+	 * @brief The index of the MMIO node in emul_mmio[]
+	 */
+	uint16_t node_idx;
+};
+
 /* External Interfaces */
 
 /**
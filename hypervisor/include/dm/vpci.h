@@ -30,11 +30,17 @@
 #define VPCI_H_
 
 #include <asm/lib/spinlock.h>
+#include <asm/lib/rwlock.h>
 #include <lib/util.h>
 #include <pci.h>
 #include <list.h>
 
-#define VDEV_LIST_HASHBITS 4U
+/*
+ * Size the vdev hash to hold the default CONFIG_MAX_PCI_DEV_NUM (96)
+ * vdevs, SR-IOV VFs included, at a load factor below one, so that
+ * config space dispatch stays at about one bucket entry per lookup.
+ */
+#define VDEV_LIST_HASHBITS 7U
 #define VDEV_LIST_HASHSIZE (1U << VDEV_LIST_HASHBITS)
 
 struct pci_vbar {
@@ -172,7 +178,7 @@ struct pci_mmio_res {
 };
 
 struct acrn_vpci {
-	spinlock_t lock;
+	rwlock_t lock;		/* config space reads share the lock, the others are exclusive */
 	union pci_cfg_addr_reg addr;
 	struct pci_mmcfg_region pci_mmcfg;
 	struct pci_mmio_res res32; 	/* 32-bit mmio start/end address */
@@ -610,6 +610,47 @@ struct acrn_intr_monitor {
 #define INTR_CMD_GET_DATA 0U
 #define INTR_CMD_DELAY_INT 1U
 
+/** number of basic VM exit reasons, up to LOADIWKEY (0x45) */
+#define ACRN_VMEXIT_REASON_NUM	70U
+/** number of log2 buckets of the VM exit latency histogram */
+#define ACRN_VMEXIT_HIST_NUM	16U
+/**
+ * bucket 0 counts latencies below (1 << ACRN_VMEXIT_HIST_SHIFT) TSC cycles,
+ * bucket n counts [1 << (ACRN_VMEXIT_HIST_SHIFT + n - 1), 1 << (ACRN_VMEXIT_HIST_SHIFT + n)),
+ * the last bucket also counts everything above.
+ */
+#define ACRN_VMEXIT_HIST_SHIFT	9U
+
+/**
+ * @brief VM exit statistics of one exit reason
+ *
+ * The latency is measured from the VM exit to the next VM entry of the vCPU,
+ * in TSC cycles.
+ */
+struct acrn_vmexit_reason_stats {
+	/** number of VM exits */
+	uint64_t count;
+	/** sum of the latencies */
+	uint64_t total_cycles;
+	/** log2 latency histogram */
+	uint64_t hist[ACRN_VMEXIT_HIST_NUM];
+} __aligned(8);
+
+/**
+ * @brief Info to get the VM exit statistics of a vCPU
+ *
+ * the parameter for HC_VM_VMEXIT_STATS hypercall
+ */
+struct acrn_vmexit_stats {
+	/** the vCPU to get statistics of, set by the caller */
+	uint16_t vcpu_id;
+	/** Reserved */
+	uint16_t reserved[3];
+
+	/** statistics indexed by the basic VM exit reason */
+	struct acrn_vmexit_reason_stats reasons[ACRN_VMEXIT_REASON_NUM];
+} __aligned(8);
+
 /*
  * PRE_LAUNCHED_VM is launched by ACRN hypervisor, with LAPIC_PT;
  * Service VM is launched by ACRN hypervisor, without LAPIC_PT;
@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Cost of a virtio-gpu TRANSFER_TO_HOST_2D, the copy from the guest backing
+ * store to the host image done by virtio_gpu_cmd_transfer_to_host_2d() in
+ * devicemodel/hw/pci/virtio/virtio_gpu.c:
+ *
+ * - "rescan": each row walks the backing iovecs from the first one, which
+ *   was done before the offset index was introduced.
+ * - "index": each row binary searches the offsets of the iovecs indexed at
+ *   attach_backing time, and a full-width transfer is a single copy.
+ *
+ * The backing store is made of 4KB pages in a shuffled order, as the guest
+ * allocates them, so each page is one iovec.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#define PAGE_SIZE	4096U
+#define BPP		4U
+
+struct rect {
+	const char *name;
+	uint32_t x, y, width, height;
+};
+
+struct resource {
+	uint32_t width, height, stride;
+	uint32_t iovcnt;
+	struct iovec *iov;
+	uint64_t *iov_offset;
+	void *pages;
+	void *image;
+};
+
+/* Copy of virtio_gpu_index_backing() */
+static void
+index_backing(struct resource *r2d)
+{
+	uint64_t offset = 0;
+	uint32_t i;
+
+	for (i = 0; i < r2d->iovcnt; i++) {
+		r2d->iov_offset[i] = offset;
+		if (r2d->iov[i].iov_base)
+			offset += r2d->iov[i].iov_len;
+	}
+}
+
+/* Copy of virtio_gpu_copy_from_backing() */
+static size_t
+copy_from_backing(struct resource *r2d, uint64_t offset, void *dst, size_t len)
+{
+	uint32_t lo, hi, mid, i;
+	uint64_t in;
+	size_t done = 0, bytes;
+
+	if ((r2d->iov == NULL) || (r2d->iovcnt == 0))
+		return 0;
+
+	lo = 0;
+	hi = r2d->iovcnt - 1;
+	while (lo < hi) {
+		mid = lo + (hi - lo + 1) / 2;
+		if (r2d->iov_offset[mid] <= offset)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	for (i = lo; (i < r2d->iovcnt) && (done < len); i++) {
+		if ((r2d->iov[i].iov_base == NULL) || (r2d->iov[i].iov_len == 0))
+			continue;
+		if (offset + done < r2d->iov_offset[i])
+			break;
+		in = offset + done - r2d->iov_offset[i];
+		if (in >= r2d->iov[i].iov_len)
+			continue;
+		bytes = ((len - done) < (r2d->iov[i].iov_len - in)) ?
+			(len - done) : (r2d->iov[i].iov_len - in);
+		memcpy(dst + done, r2d->iov[i].iov_base + in, bytes);
+		done += bytes;
+	}
+	return done;
+}
+
+/* The transfer loop of virtio_gpu_cmd_transfer_to_host_2d() */
+static void
+transfer_index(struct resource *r2d, const struct rect *r, uint64_t offset)
+{
+	uint32_t dst_offset, stride = r2d->stride, h;
+
+	if ((r->x == 0) && (r->width * BPP == stride)) {
+		dst_offset = r->y * stride;
+		copy_from_backing(r2d, offset, r2d->image + dst_offset, (size_t)stride * r->height);
+	} else {
+		for (h = 0; h < r->height; h++) {
+			dst_offset = (r->y + h) * stride + (r->x * BPP);
+			copy_from_backing(r2d, offset + (uint64_t)stride * h,
+					r2d->image + dst_offset, r->width * BPP);
+		}
+	}
+}
+
+/* The transfer loop before the offset index */
+static void
+transfer_rescan(struct resource *r2d, const struct rect *r, uint64_t offset)
+{
+	uint32_t src_offset, dst_offset, stride = r2d->stride, h;
+	void *dst, *src;
+	int i, done, bytes, total;
+
+	for (h = 0; h < r->height; h++) {
+		src_offset = offset + stride * h;
+		dst_offset = (r->y + h) * stride + (r->x * BPP);
+		dst = r2d->image + dst_offset;
+		done = 0;
+		total = r->width * BPP;
+		for (i = 0; i < (int)r2d->iovcnt; i++) {
+			if ((r2d->iov[i].iov_base == 0) || (r2d->iov[i].iov_len == 0))
+				continue;
+
+			if (src_offset < r2d->iov[i].iov_len) {
+				src = r2d->iov[i].iov_base + src_offset;
+				bytes = ((total - done) < (int)(r2d->iov[i].iov_len - src_offset)) ?
+					 (total - done) : (int)(r2d->iov[i].iov_len - src_offset);
+				memcpy((dst + done), src, bytes);
+				src_offset = 0;
+				done += bytes;
+				if (done >= total)
+					break;
+			} else {
+				src_offset -= r2d->iov[i].iov_len;
+			}
+		}
+	}
+}
+
+static void
+setup(struct resource *r2d, uint32_t width, uint32_t height)
+{
+	uint32_t i, j, tmp, *order;
+	size_t size;
+
+	r2d->width = width;
+	r2d->height = height;
+	r2d->stride = width * BPP;
+	size = (size_t)r2d->stride * height;
+	r2d->iovcnt = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	r2d->iov = malloc(r2d->iovcnt * (sizeof(struct iovec) + sizeof(uint64_t)));
+	order = malloc(r2d->iovcnt * sizeof(*order));
+	if ((r2d->iov == NULL) || (order == NULL)
+			|| posix_memalign(&r2d->pages, PAGE_SIZE, (size_t)r2d->iovcnt * PAGE_SIZE)
+			|| posix_memalign(&r2d->image, 64, size)) {
+		perror("alloc");
+		exit(EXIT_FAILURE);
+	}
+	r2d->iov_offset = (uint64_t *)(r2d->iov + r2d->iovcnt);
+
+	for (i = 0; i < r2d->iovcnt; i++)
+		order[i] = i;
+	for (i = r2d->iovcnt - 1; i > 0; i--) {
+		j = rand() % (i + 1);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	for (i = 0; i < r2d->iovcnt; i++) {
+		r2d->iov[i].iov_base = r2d->pages + (size_t)order[i] * PAGE_SIZE;
+		r2d->iov[i].iov_len = PAGE_SIZE;
+		memset(r2d->iov[i].iov_base, i, PAGE_SIZE);
+	}
+	free(order);
+
+	index_backing(r2d);
+}
+
+static void
+teardown(struct resource *r2d)
+{
+	free(r2d->image);
+	free(r2d->pages);
+	free(r2d->iov);
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static unsigned int nr_loops = 50U;
+
+/* Return the average time of one transfer of @r, in us */
+static double
+run(void (*transfer)(struct resource *, const struct rect *, uint64_t),
+	struct resource *r2d, const struct rect *r)
+{
+	uint64_t offset = (uint64_t)r->y * r2d->stride + r->x * BPP;
+	uint64_t start;
+	unsigned int i;
+
+	transfer(r2d, r, offset);
+	start = now_ns();
+	for (i = 0; i < nr_loops; i++)
+		transfer(r2d, r, offset);
+
+	return (double)(now_ns() - start) / nr_loops / 1000.0;
+}
+
+static void
+bench(const char *mode, uint32_t width, uint32_t height)
+{
+	const struct rect rects[] = {
+		{ "full frame", 0, 0, width, height },
+		{ "full-width band", 0, height / 2, width, 64 },
+		{ "window 640x480", width / 4, height / 4, 640, 480 },
+		{ "cursor 64x64", width / 2, height / 2, 64, 64 },
+	};
+	struct resource r2d;
+	void *ref;
+	size_t size;
+	double t_rescan, t_index;
+	unsigned int i;
+
+	setup(&r2d, width, height);
+	size = (size_t)r2d.stride * height;
+	ref = malloc(size);
+	if (ref == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("\n%s, %u backing pages\n", mode, r2d.iovcnt);
+	printf("%16s %14s %14s %8s\n", "rectangle", "rescan us/op", "index us/op", "speedup");
+	for (i = 0; i < sizeof(rects) / sizeof(rects[0]); i++) {
+		memset(r2d.image, 0, size);
+		t_rescan = run(transfer_rescan, &r2d, &rects[i]);
+		memcpy(ref, r2d.image, size);
+		memset(r2d.image, 0, size);
+		t_index = run(transfer_index, &r2d, &rects[i]);
+		if (memcmp(ref, r2d.image, size) != 0) {
+			fprintf(stderr, "%s: the two transfers differ\n", rects[i].name);
+			exit(EXIT_FAILURE);
+		}
+		printf("%16s %14.1f %14.1f %7.1fx\n", rects[i].name, t_rescan, t_index, t_rescan / t_index);
+	}
+
+	free(ref);
+	teardown(&r2d);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n transfers per rectangle]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_loops = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nr_loops == 0U)
+		usage(argv[0]);
+
+	srand(1);
+	printf("%u transfers per rectangle, 32bpp\n", nr_loops);
+	bench("1080p", 1920, 1080);
+	bench("4K", 3840, 2160);
+
+	return 0;
+}
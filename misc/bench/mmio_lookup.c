@@ -0,0 +1,308 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Lookup of the emulated MMIO region of an access, as hv_emulate_mmio() in
+ * hypervisor/dm/io_req.c does it on every MMIO vmexit handled by the
+ * hypervisor:
+ *
+ * - "linear": the scan of emul_mmio[] done with emul_mmio_lock held, which
+ *   was used before the sorted index was introduced.
+ * - "index": find_mmio_node_by_addr() binary searching emul_mmio_index[],
+ *   validated by the emul_mmio_lock sequence count.
+ *
+ * With more than one thread, all threads look up the same VM, like the vCPUs
+ * of one VM do.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#define MAX_EMULATED_MMIO_REGIONS	128U
+#define NR_ADDRS			4096U
+
+struct mem_io_node {
+	void *read_write;
+	void *handler_private_data;
+	uint64_t range_start;
+	uint64_t range_end;
+	bool hold_lock;
+};
+
+struct mem_io_index {
+	uint64_t range_start;
+	uint64_t max_end;
+	uint16_t node_idx;
+};
+
+struct vm {
+	uint32_t lock;			/* spinlock, or sequence count */
+	uint16_t nr_emul_mmio_regions;
+	struct mem_io_node emul_mmio[MAX_EMULATED_MMIO_REGIONS];
+	struct mem_io_index emul_mmio_index[MAX_EMULATED_MMIO_REGIONS];
+} __attribute__((aligned(64)));
+
+static struct vm the_vm;
+static uint64_t addrs[NR_ADDRS];
+static uint64_t nr_lookups = 2000000UL;
+static volatile bool go;
+
+static inline void cpu_relax(void)
+{
+	__asm__ __volatile__ ("pause" ::: "memory");
+}
+
+static inline void spinlock_obtain(uint32_t *lock)
+{
+	while (__atomic_exchange_n(lock, 1U, __ATOMIC_ACQUIRE) != 0U) {
+		while (__atomic_load_n(lock, __ATOMIC_RELAXED) != 0U)
+			cpu_relax();
+	}
+}
+
+static inline void spinlock_release(uint32_t *lock)
+{
+	__atomic_store_n(lock, 0U, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t read_seqbegin(const uint32_t *seq)
+{
+	uint32_t s;
+
+	while (((s = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1U) != 0U)
+		cpu_relax();
+	return s;
+}
+
+static inline bool read_seqretry(const uint32_t *seq, uint32_t start)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(seq, __ATOMIC_RELAXED) != start;
+}
+
+static int32_t linear_lookup(struct vm *vm, uint64_t address, uint64_t size,
+	struct mem_io_node *node)
+{
+	struct mem_io_node *mmio_node;
+	int32_t status = -ENODEV;
+	uint16_t idx;
+
+	spinlock_obtain(&vm->lock);
+	for (idx = 0U; idx < vm->nr_emul_mmio_regions; idx++) {
+		mmio_node = &(vm->emul_mmio[idx]);
+		if (mmio_node->read_write == NULL)
+			continue;
+		if (((address + size) <= mmio_node->range_start) || (address >= mmio_node->range_end))
+			continue;
+		*node = *mmio_node;
+		status = ((address >= node->range_start) && ((address + size) <= node->range_end)) ? 0 : -EIO;
+		break;
+	}
+	spinlock_release(&vm->lock);
+
+	return status;
+}
+
+/* Copy of find_mmio_node_by_addr() */
+static int32_t find_mmio_node_by_addr(const struct vm *vm, uint64_t address, uint64_t size,
+	struct mem_io_node *node)
+{
+	const struct mem_io_index *index = vm->emul_mmio_index;
+	const struct mem_io_node *mmio_node;
+	uint16_t lo = 0U, mid, hi = *(const volatile uint16_t *)&vm->nr_emul_mmio_regions;
+	int32_t status = -ENODEV;
+
+	if (hi > MAX_EMULATED_MMIO_REGIONS)
+		hi = MAX_EMULATED_MMIO_REGIONS;
+
+	while (lo < hi) {
+		mid = lo + ((hi - lo) >> 1U);
+		if (index[mid].range_start < (address + size))
+			lo = mid + 1U;
+		else
+			hi = mid;
+	}
+
+	while ((lo > 0U) && (index[lo - 1U].max_end > address)) {
+		lo--;
+		mmio_node = &(vm->emul_mmio[index[lo].node_idx]);
+		if (mmio_node->range_end > address) {
+			*node = *mmio_node;
+			status = ((address >= node->range_start) && ((address + size) <= node->range_end)) ? 0 : -EIO;
+			break;
+		}
+	}
+
+	return status;
+}
+
+static int32_t index_lookup(struct vm *vm, uint64_t address, uint64_t size,
+	struct mem_io_node *node)
+{
+	int32_t status;
+	uint32_t seq;
+
+	do {
+		seq = read_seqbegin(&vm->lock);
+		status = find_mmio_node_by_addr(vm, address, size, node);
+	} while (read_seqretry(&vm->lock, seq));
+
+	return status;
+}
+
+/*
+ * Register @n regions of 4KB, 64KB apart like BARs, in a shuffled order so
+ * the linear scan does not find low addresses first. The index is built
+ * sorted, as emul_mmio_index_insert() keeps it.
+ */
+static void setup_vm(struct vm *vm, uint16_t n)
+{
+	uint16_t order[MAX_EMULATED_MMIO_REGIONS];
+	uint16_t i, j, tmp;
+	uint64_t max_end = 0UL;
+
+	memset(vm, 0, sizeof(*vm));
+	for (i = 0U; i < n; i++)
+		order[i] = i;
+	for (i = n - 1U; i > 0U; i--) {
+		j = (uint16_t)(rand() % (i + 1U));
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	for (i = 0U; i < n; i++) {
+		vm->emul_mmio[i].read_write = (void *)setup_vm;
+		vm->emul_mmio[i].range_start = 0xc0000000UL + order[i] * 0x10000UL;
+		vm->emul_mmio[i].range_end = vm->emul_mmio[i].range_start + 0x1000UL;
+		vm->emul_mmio_index[order[i]].range_start = vm->emul_mmio[i].range_start;
+		vm->emul_mmio_index[order[i]].node_idx = i;
+	}
+	for (i = 0U; i < n; i++) {
+		if (vm->emul_mmio[vm->emul_mmio_index[i].node_idx].range_end > max_end)
+			max_end = vm->emul_mmio[vm->emul_mmio_index[i].node_idx].range_end;
+		vm->emul_mmio_index[i].max_end = max_end;
+	}
+	vm->nr_emul_mmio_regions = n;
+
+	for (i = 0U; i < NR_ADDRS; i++)
+		addrs[i] = 0xc0000000UL + (rand() % n) * 0x10000UL + (rand() % 0x400) * 4UL;
+}
+
+typedef int32_t (*lookup_fn)(struct vm *, uint64_t, uint64_t, struct mem_io_node *);
+
+struct worker {
+	pthread_t thread;
+	lookup_fn lookup;
+	uint64_t ns;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	struct mem_io_node node;
+	uint64_t i, start;
+
+	while (!__atomic_load_n(&go, __ATOMIC_ACQUIRE))
+		cpu_relax();
+
+	start = now_ns();
+	for (i = 0UL; i < nr_lookups; i++) {
+		if (w->lookup(&the_vm, addrs[i % NR_ADDRS], 4UL, &node) != 0) {
+			fprintf(stderr, "lookup of 0x%lx failed\n", addrs[i % NR_ADDRS]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	w->ns = now_ns() - start;
+
+	return NULL;
+}
+
+/* Return the average cost of one lookup, in ns */
+static double run(lookup_fn lookup, int nr_threads)
+{
+	struct worker *workers;
+	uint64_t total = 0UL;
+	int i;
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (workers == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+
+	go = false;
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].lookup = lookup;
+		if (pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]) != 0) {
+			fprintf(stderr, "cannot create thread %d\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+	__atomic_store_n(&go, true, __ATOMIC_RELEASE);
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		total += workers[i].ns;
+	}
+	free(workers);
+
+	return (double)total / nr_threads / nr_lookups;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-t threads] [-n lookups per thread]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint16_t counts[] = { 4U, 8U, 16U, 32U, 64U, 128U };
+	int nr_threads = 1;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:n:h")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'n':
+			nr_lookups = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if ((nr_threads <= 0) || (nr_lookups == 0UL))
+		usage(argv[0]);
+
+	srand(1);
+	printf("%d thread(s), %lu lookups each\n", nr_threads, nr_lookups);
+	printf("%8s %14s %14s\n", "regions", "linear ns/op", "index ns/op");
+	for (i = 0U; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		setup_vm(&the_vm, counts[i]);
+		printf("%8u %14.1f %14.1f\n", counts[i],
+			run(linear_lookup, nr_threads), run(index_lookup, nr_threads));
+	}
+
+	return 0;
+}
@@ -0,0 +1,495 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Per-pCPU timer queue of the hypervisor, hypervisor/common/timer.c, with both
+ * of its backends:
+ *
+ * - "list": the sorted timer_list, the default.
+ * - "wheel": the hierarchical timing wheel of CONFIG_TIMER_WHEEL_ENABLED.
+ *
+ * The TSC is simulated: each softirq pass runs at the deadline the previous
+ * one programmed. For a number of periodic timers armed on the pCPU, it
+ * reports the distribution, in host TSC cycles, of:
+ *
+ * - insert: local_add_timer() of a timer in the queue already loaded.
+ * - softirq: one timer_softirq() pass, which expires the due timers, re-arms
+ *   them and programs the next deadline.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#define MAX_TIMER_ACTIONS	32U
+
+/* the simulated TSC runs at 2GHz, timers have periods from 500us to 20ms */
+#define TSC_KHZ			2000000UL
+#define MIN_PERIOD		(500UL * TSC_KHZ / 1000UL)
+#define MAX_PERIOD		(20UL * TSC_KHZ)
+
+#define TIMER_WHEEL_SHIFT	10U
+#define TIMER_WHEEL_BITS	6U
+#define TIMER_WHEEL_SIZE	(1U << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK	(TIMER_WHEEL_SIZE - 1U)
+#define TIMER_WHEEL_LEVELS	4U
+
+#define min(a, b)	(((a) < (b)) ? (a) : (b))
+#define max(a, b)	(((a) > (b)) ? (a) : (b))
+#define container_of(ptr, type, member) \
+	((type *)(void *)((char *)(ptr) - __builtin_offsetof(type, member)))
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define list_for_each(pos, head) \
+	for ((pos) = (head)->next; (pos) != (head); (pos) = (pos)->next)
+#define list_for_each_safe(pos, n, head) \
+	for ((pos) = (head)->next, (n) = (pos)->next; (pos) != (head); (pos) = (n), (n) = (pos)->next)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline bool list_empty(const struct list_head *head)
+{
+	return head->next == head;
+}
+
+static inline void list_insert(struct list_head *new, struct list_head *prev, struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	prev->next = new;
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	list_insert(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	list_insert(new, head->prev, head);
+}
+
+static inline void list_del_init(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	entry->prev->next = entry->next;
+	INIT_LIST_HEAD(entry);
+}
+
+static inline void list_splice_init(struct list_head *list, struct list_head *head)
+{
+	struct list_head *first = list->next, *last = list->prev, *at = head->next;
+
+	if (!list_empty(list)) {
+		first->prev = head;
+		head->next = first;
+		last->next = at;
+		at->prev = last;
+		INIT_LIST_HEAD(list);
+	}
+}
+
+struct hv_timer {
+	struct list_head node;
+	uint64_t timeout;
+	uint64_t period_in_cycle;
+};
+
+struct per_cpu_timers {
+	/* list backend */
+	struct list_head timer_list;
+	/* wheel backend */
+	uint64_t clk;
+	uint64_t deadline;
+	uint64_t pending[TIMER_WHEEL_LEVELS];
+	struct list_head wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+};
+
+static uint64_t tsc_deadline;
+
+static inline void msr_write_tsc_deadline(uint64_t deadline)
+{
+	*(volatile uint64_t *)&tsc_deadline = deadline;
+}
+
+/* Copy of the list backend */
+
+static void list_update_physical_timer(struct per_cpu_timers *cpu_timer)
+{
+	struct hv_timer *timer;
+
+	if (!list_empty(&cpu_timer->timer_list)) {
+		timer = container_of((&cpu_timer->timer_list)->next, struct hv_timer, node);
+		msr_write_tsc_deadline(timer->timeout);
+	}
+}
+
+static bool list_local_add_timer(struct per_cpu_timers *cpu_timer, struct hv_timer *timer)
+{
+	struct list_head *pos, *prev;
+	struct hv_timer *tmp;
+	uint64_t tsc = timer->timeout;
+
+	prev = &cpu_timer->timer_list;
+	list_for_each(pos, &cpu_timer->timer_list) {
+		tmp = container_of(pos, struct hv_timer, node);
+		if (tmp->timeout < tsc) {
+			prev = &tmp->node;
+		} else {
+			break;
+		}
+	}
+
+	list_add(&timer->node, prev);
+
+	return (prev == &cpu_timer->timer_list);
+}
+
+static struct hv_timer *list_get_expired_timer(struct per_cpu_timers *cpu_timer, uint64_t now)
+{
+	struct hv_timer *timer = NULL;
+
+	if (!list_empty(&cpu_timer->timer_list)) {
+		timer = container_of((&cpu_timer->timer_list)->next, struct hv_timer, node);
+		if (timer->timeout > now) {
+			timer = NULL;
+		}
+	}
+
+	return timer;
+}
+
+static void list_init_percpu_timer(struct per_cpu_timers *cpu_timer, __attribute__((unused)) uint64_t now)
+{
+	INIT_LIST_HEAD(&cpu_timer->timer_list);
+}
+
+/* Copy of the wheel backend */
+
+static void wheel_add_timer(struct per_cpu_timers *cpu_timer, struct hv_timer *timer)
+{
+	uint64_t clk = cpu_timer->clk;
+	uint64_t expires = timer->timeout >> TIMER_WHEEL_SHIFT;
+	uint32_t level = 0U;
+	uint32_t shift = 0U;
+	uint16_t slot;
+
+	if (expires < clk) {
+		expires = clk;
+	}
+
+	while ((level < (TIMER_WHEEL_LEVELS - 1U)) && (((expires >> shift) - (clk >> shift)) >= TIMER_WHEEL_SIZE)) {
+		level++;
+		shift += TIMER_WHEEL_BITS;
+	}
+
+	if (((expires >> shift) - (clk >> shift)) >= TIMER_WHEEL_SIZE) {
+		expires = ((clk >> shift) + TIMER_WHEEL_MASK) << shift;
+	}
+
+	slot = (uint16_t)((expires >> shift) & TIMER_WHEEL_MASK);
+	list_add_tail(&timer->node, &cpu_timer->wheel[level][slot]);
+	cpu_timer->pending[level] |= 1UL << slot;
+}
+
+static bool wheel_next_slot(struct per_cpu_timers *cpu_timer, uint32_t level, uint16_t *dist)
+{
+	uint16_t pos = (uint16_t)((cpu_timer->clk >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK);
+	uint64_t pending = cpu_timer->pending[level];
+	uint16_t bit, slot;
+	bool found = false;
+
+	while (!found && (pending != 0UL)) {
+		if (pos != 0U) {
+			pending = (pending >> pos) | (pending << (TIMER_WHEEL_SIZE - pos));
+		}
+		bit = (uint16_t)__builtin_ctzll(pending);
+		slot = (uint16_t)((bit + pos) & TIMER_WHEEL_MASK);
+
+		if (list_empty(&cpu_timer->wheel[level][slot])) {
+			cpu_timer->pending[level] &= ~(1UL << slot);
+			pending = cpu_timer->pending[level];
+		} else {
+			*dist = bit;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+static uint64_t wheel_next_clk(struct per_cpu_timers *cpu_timer, uint32_t first_level)
+{
+	uint64_t next = UINT64_MAX, clk;
+	uint32_t level, shift;
+	uint16_t dist;
+
+	for (level = first_level; level < TIMER_WHEEL_LEVELS; level++) {
+		if (wheel_next_slot(cpu_timer, level, &dist)) {
+			shift = level * TIMER_WHEEL_BITS;
+			clk = ((cpu_timer->clk >> shift) + dist) << shift;
+			next = min(next, clk);
+		}
+	}
+
+	return next;
+}
+
+static void wheel_cascade(struct per_cpu_timers *cpu_timer)
+{
+	struct list_head head;
+	struct list_head *pos, *n;
+	uint32_t level, shift;
+	uint16_t slot;
+
+	for (level = TIMER_WHEEL_LEVELS - 1U; level > 0U; level--) {
+		shift = level * TIMER_WHEEL_BITS;
+		slot = (uint16_t)((cpu_timer->clk >> shift) & TIMER_WHEEL_MASK);
+
+		if (!list_empty(&cpu_timer->wheel[level][slot])) {
+			INIT_LIST_HEAD(&head);
+			list_splice_init(&cpu_timer->wheel[level][slot], &head);
+			list_for_each_safe(pos, n, &head) {
+				list_del_init(pos);
+				wheel_add_timer(cpu_timer, container_of(pos, struct hv_timer, node));
+			}
+		}
+		cpu_timer->pending[level] &= ~(1UL << slot);
+	}
+}
+
+static void wheel_update_physical_timer(struct per_cpu_timers *cpu_timer)
+{
+	struct list_head *pos;
+	struct hv_timer *timer;
+	uint64_t next_clk, deadline = UINT64_MAX;
+	uint16_t dist;
+
+	if (wheel_next_slot(cpu_timer, 0U, &dist)) {
+		list_for_each(pos, &cpu_timer->wheel[0U][(cpu_timer->clk + dist) & TIMER_WHEEL_MASK]) {
+			timer = container_of(pos, struct hv_timer, node);
+			deadline = min(deadline, timer->timeout);
+		}
+	}
+
+	next_clk = wheel_next_clk(cpu_timer, 1U);
+	if (next_clk != UINT64_MAX) {
+		deadline = min(deadline, max(next_clk, cpu_timer->clk) << TIMER_WHEEL_SHIFT);
+	}
+
+	if (deadline != UINT64_MAX) {
+		cpu_timer->deadline = deadline;
+		msr_write_tsc_deadline(deadline);
+	} else {
+		cpu_timer->deadline = 0UL;
+	}
+}
+
+static bool wheel_local_add_timer(struct per_cpu_timers *cpu_timer, struct hv_timer *timer)
+{
+	wheel_add_timer(cpu_timer, timer);
+
+	return ((cpu_timer->deadline == 0UL) || (timer->timeout < cpu_timer->deadline));
+}
+
+static struct hv_timer *wheel_get_expired_timer(struct per_cpu_timers *cpu_timer, uint64_t now)
+{
+	struct list_head *pos;
+	struct hv_timer *timer, *expired = NULL;
+	uint64_t now_clk = now >> TIMER_WHEEL_SHIFT;
+	uint64_t next_clk;
+
+	while (expired == NULL) {
+		list_for_each(pos, &cpu_timer->wheel[0U][cpu_timer->clk & TIMER_WHEEL_MASK]) {
+			timer = container_of(pos, struct hv_timer, node);
+			if (timer->timeout <= now) {
+				expired = timer;
+				break;
+			}
+		}
+
+		if ((expired == NULL) && (cpu_timer->clk < now_clk)) {
+			next_clk = wheel_next_clk(cpu_timer, 0U);
+			cpu_timer->clk = min(max(next_clk, cpu_timer->clk + 1UL), now_clk);
+			wheel_cascade(cpu_timer);
+		} else {
+			break;
+		}
+	}
+
+	return expired;
+}
+
+static void wheel_init_percpu_timer(struct per_cpu_timers *cpu_timer, uint64_t now)
+{
+	uint32_t level, slot;
+
+	cpu_timer->clk = now >> TIMER_WHEEL_SHIFT;
+	cpu_timer->deadline = 0UL;
+	for (level = 0U; level < TIMER_WHEEL_LEVELS; level++) {
+		cpu_timer->pending[level] = 0UL;
+		for (slot = 0U; slot < TIMER_WHEEL_SIZE; slot++) {
+			INIT_LIST_HEAD(&cpu_timer->wheel[level][slot]);
+		}
+	}
+}
+
+struct backend {
+	const char *name;
+	void (*init)(struct per_cpu_timers *cpu_timer, uint64_t now);
+	bool (*add)(struct per_cpu_timers *cpu_timer, struct hv_timer *timer);
+	struct hv_timer *(*get_expired)(struct per_cpu_timers *cpu_timer, uint64_t now);
+	void (*update)(struct per_cpu_timers *cpu_timer);
+};
+
+static const struct backend backends[] = {
+	{ "list", list_init_percpu_timer, list_local_add_timer, list_get_expired_timer, list_update_physical_timer },
+	{ "wheel", wheel_init_percpu_timer, wheel_local_add_timer, wheel_get_expired_timer, wheel_update_physical_timer },
+};
+
+static struct per_cpu_timers cpu_timer;
+static uint64_t nr_passes = 100000UL;
+
+static uint64_t rand_period(void)
+{
+	return MIN_PERIOD + ((((uint64_t)rand() << 31) | (uint64_t)rand()) % (MAX_PERIOD - MIN_PERIOD));
+}
+
+/* Mirror of timer_softirq() at the simulated TSC @now */
+static void softirq(const struct backend *b, uint64_t now)
+{
+	struct hv_timer *timer;
+	uint32_t tries = MAX_TIMER_ACTIONS;
+
+	while (tries != 0U) {
+		timer = b->get_expired(&cpu_timer, now);
+		if (timer == NULL) {
+			break;
+		}
+		tries--;
+		list_del_init(&timer->node);
+		timer->timeout += timer->period_in_cycle;
+		(void)b->add(&cpu_timer, timer);
+	}
+	b->update(&cpu_timer);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void print_dist(const char *backend, const char *op, uint64_t *samples, uint64_t n)
+{
+	qsort(samples, n, sizeof(*samples), cmp_u64);
+	printf("%8s %8s %10lu %10lu %10lu %10lu\n", backend, op,
+		samples[n / 2UL], samples[n * 99UL / 100UL], samples[n * 999UL / 1000UL], samples[n - 1UL]);
+}
+
+static void run(const struct backend *b, struct hv_timer *timers, uint32_t nr_timers,
+	uint64_t *insert, uint64_t *pass)
+{
+	struct hv_timer probe;
+	uint64_t now = 1UL << 32, t0;
+	uint64_t i;
+	uint32_t j;
+
+	srand(nr_timers);
+	b->init(&cpu_timer, now);
+	for (j = 0U; j < nr_timers; j++) {
+		timers[j].period_in_cycle = rand_period();
+		timers[j].timeout = now + timers[j].period_in_cycle;
+		INIT_LIST_HEAD(&timers[j].node);
+		if (b->add(&cpu_timer, &timers[j])) {
+			b->update(&cpu_timer);
+		}
+	}
+	INIT_LIST_HEAD(&probe.node);
+
+	for (i = 0UL; i < nr_passes; i++) {
+		/* the timer interrupt fires at the programmed deadline */
+		now = max(now, tsc_deadline);
+
+		t0 = __rdtsc();
+		softirq(b, now);
+		pass[i] = __rdtsc() - t0;
+
+		/* a one-shot timer armed and cancelled in between, like a vLAPIC timer */
+		probe.timeout = now + rand_period();
+		t0 = __rdtsc();
+		if (b->add(&cpu_timer, &probe)) {
+			b->update(&cpu_timer);
+		}
+		insert[i] = __rdtsc() - t0;
+		list_del_init(&probe.node);
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n softirq passes]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	static const uint32_t counts[] = { 8U, 32U, 128U, 512U };
+	struct hv_timer *timers;
+	uint64_t *insert, *pass;
+	unsigned int i, k;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_passes = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nr_passes == 0UL)
+		usage(argv[0]);
+
+	timers = calloc(counts[sizeof(counts) / sizeof(counts[0]) - 1U], sizeof(*timers));
+	insert = calloc(nr_passes, sizeof(*insert));
+	pass = calloc(nr_passes, sizeof(*pass));
+	if ((timers == NULL) || (insert == NULL) || (pass == NULL)) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+
+	printf("%lu softirq passes, latencies in host TSC cycles\n", nr_passes);
+	for (i = 0U; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		printf("\n%u periodic timers\n", counts[i]);
+		printf("%8s %8s %10s %10s %10s %10s\n", "backend", "op", "p50", "p99", "p99.9", "max");
+		for (k = 0U; k < sizeof(backends) / sizeof(backends[0]); k++) {
+			run(&backends[k], timers, counts[i], insert, pass);
+			print_dist(backends[k].name, "insert", insert, nr_passes);
+			print_dist(backends[k].name, "softirq", pass, nr_passes);
+		}
+	}
+
+	free(pass);
+	free(insert);
+	free(timers);
+
+	return 0;
+}
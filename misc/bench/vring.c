@@ -0,0 +1,586 @@
+/*
+ * Copyright (C) 2026 Intel Corporation.
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+/*
+ * Descriptors per second through a virtqueue, with the split and the packed
+ * ring layouts of devicemodel/hw/pci/virtio/virtio.c.
+ *
+ * A driver thread adds chains of direct descriptors and reclaims the used
+ * ones, as the Linux virtio_ring driver does. A device thread pops them with
+ * copies of vq_getchain(), vq_relchain() and vq_endchains(). Both poll, no
+ * notification or interrupt is sent, and the buffers are never touched, so
+ * only the cost of the ring itself is measured: that includes the cache
+ * lines bouncing between the two threads, which is where the layouts differ.
+ * The two threads are pinned to CPUs 0 and 1. With -s, or when there is a
+ * single CPU, both sides run in turn on one thread instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/uio.h>
+
+#define QSIZE				256U
+#define MAX_CHAIN			8U
+
+#define VRING_DESC_F_NEXT		1U
+#define VRING_DESC_F_WRITE		2U
+#define VRING_AVAIL_F_NO_INTERRUPT	1U
+#define VRING_PACKED_DESC_F_AVAIL	7U
+#define VRING_PACKED_DESC_F_USED	15U
+#define VRING_PACKED_EVENT_FLAG_DISABLE	1U
+
+#define atomic_thread_fence()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+struct vring_desc {
+	uint64_t addr;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+};
+
+struct vring_avail {
+	uint16_t flags;
+	uint16_t idx;
+	uint16_t ring[QSIZE];
+};
+
+struct vring_used_elem {
+	uint32_t id;
+	uint32_t len;
+};
+
+struct vring_used {
+	uint16_t flags;
+	uint16_t idx;
+	struct vring_used_elem ring[QSIZE];
+};
+
+struct vring_packed_desc {
+	uint64_t addr;
+	uint32_t len;
+	uint16_t id;
+	uint16_t flags;
+};
+
+struct vring_packed_desc_event {
+	uint16_t off_wrap;
+	uint16_t flags;
+};
+
+/* The shared rings, each part on its own pages as a guest driver lays them out */
+static volatile struct vring_desc *desc;
+static volatile struct vring_avail *avail;
+static volatile struct vring_used *used;
+static volatile struct vring_packed_desc *pdesc;
+static volatile struct vring_packed_desc_event *driver_event;
+
+/* The device side, the fields of struct virtio_vq_info used here */
+struct virtio_vq_info {
+	uint16_t qsize;
+	uint16_t last_avail;
+	uint16_t save_used;
+	bool avail_wrap;
+	uint16_t used_idx;
+	bool used_wrap;
+	uint16_t save_used_wrap;
+	uint16_t chain_ndesc[2U * QSIZE];
+} __attribute__((aligned(64)));
+
+/* The driver side */
+struct driver {
+	uint16_t num_free;
+	uint16_t free_head;
+	uint16_t free_next[QSIZE];
+	/* split */
+	uint16_t avail_idx;
+	uint16_t last_used;
+	/* packed */
+	uint16_t next_avail;
+	bool avail_wrap;
+	uint16_t next_used;
+	bool used_wrap;
+	uint16_t chain_len[QSIZE];
+} __attribute__((aligned(64)));
+
+static struct virtio_vq_info the_vq;
+static struct driver drv;
+static unsigned int chain_len = 1U;
+static uint64_t nr_chains = 2000000UL;
+static uint64_t nr_interrupts;
+
+static inline void cpu_relax(void)
+{
+	__asm__ __volatile__ ("pause" ::: "memory");
+}
+
+/* Guest addresses are used as they are, nothing is mapped */
+static inline int
+_vq_record(int i, uint64_t addr, uint32_t len, uint16_t vd_flags,
+	   struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	if (i >= n_iov)
+		return -1;
+	iov[i].iov_base = (void *)addr;
+	iov[i].iov_len = len;
+	if (flags != NULL)
+		flags[i] = vd_flags;
+	return 0;
+}
+
+/* Device, split layout: copies of vq_getchain(), vq_relchain(), vq_endchains() */
+
+static int
+split_getchain(struct virtio_vq_info *vq, uint16_t *pidx, struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	volatile struct vring_desc *vdir;
+	u_int ndesc, idx, next;
+	int i;
+
+	idx = vq->last_avail;
+	ndesc = (uint16_t)((u_int)avail->idx - idx);
+	if (ndesc == 0)
+		return 0;
+	if (ndesc > vq->qsize)
+		return -1;
+
+	*pidx = next = avail->ring[idx & (vq->qsize - 1)];
+	vq->last_avail++;
+
+	for (i = 0; i < (int)MAX_CHAIN; next = vdir->next) {
+		if (next >= vq->qsize)
+			return -1;
+		vdir = &desc[next];
+		if (_vq_record(i, vdir->addr, vdir->len, vdir->flags, iov, n_iov, flags))
+			return -1;
+		i++;
+		if ((vdir->flags & VRING_DESC_F_NEXT) == 0)
+			return i;
+	}
+	return -1;
+}
+
+static void
+split_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
+{
+	volatile struct vring_used_elem *vue;
+	uint16_t uidx, mask;
+
+	mask = vq->qsize - 1;
+	uidx = used->idx;
+	vue = &used->ring[uidx++ & mask];
+	vue->id = idx;
+	vue->len = iolen;
+	used->idx = uidx;
+}
+
+static void
+split_endchains(struct virtio_vq_info *vq)
+{
+	uint16_t new_idx, old_idx;
+
+	atomic_thread_fence();
+	old_idx = vq->save_used;
+	vq->save_used = new_idx = used->idx;
+	if ((new_idx != old_idx) && !(avail->flags & VRING_AVAIL_F_NO_INTERRUPT))
+		nr_interrupts++;
+}
+
+/* Device, packed layout: copies of vq_getchain_packed(), vq_relchain(), vq_endchains_packed() */
+
+static inline bool
+vq_packed_desc_avail(struct virtio_vq_info *vq, uint16_t idx, bool wrap)
+{
+	uint16_t flags = pdesc[idx].flags;
+
+	return (!!(flags & (1 << VRING_PACKED_DESC_F_AVAIL)) == wrap) &&
+		(!!(flags & (1 << VRING_PACKED_DESC_F_USED)) != wrap);
+}
+
+static int
+packed_getchain(struct virtio_vq_info *vq, uint16_t *pidx, struct iovec *iov, int n_iov, uint16_t *flags)
+{
+	volatile struct vring_packed_desc *vd;
+	uint16_t idx, ndesc, vd_flags;
+	bool err = false;
+	int i = 0;
+
+	if (!vq_packed_desc_avail(vq, vq->last_avail, vq->avail_wrap))
+		return 0;
+
+	atomic_thread_fence();
+
+	for (ndesc = 0; ndesc < vq->qsize; ) {
+		idx = vq->last_avail;
+		vd = &pdesc[idx];
+		vd_flags = vd->flags;
+		*pidx = vd->id;
+
+		ndesc++;
+		if (++vq->last_avail == vq->qsize) {
+			vq->last_avail = 0;
+			vq->avail_wrap = !vq->avail_wrap;
+		}
+
+		if (!err) {
+			if (_vq_record(i, vd->addr, vd->len, vd_flags, iov, n_iov, flags))
+				err = true;
+			i++;
+		}
+
+		if ((vd_flags & VRING_DESC_F_NEXT) == 0) {
+			if (*pidx < vq->qsize)
+				vq->chain_ndesc[*pidx] = ndesc;
+			else
+				err = true;
+			vq->chain_ndesc[vq->qsize + idx] = ndesc;
+			return err ? -1 : i;
+		}
+	}
+	return -1;
+}
+
+static void
+packed_relchain(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen)
+{
+	volatile struct vring_packed_desc *vd;
+
+	vd = &pdesc[vq->used_idx];
+	vd->id = idx;
+	vd->len = iolen;
+	atomic_thread_fence();
+	vd->flags = vq->used_wrap ?
+		((1 << VRING_PACKED_DESC_F_AVAIL) | (1 << VRING_PACKED_DESC_F_USED)) : 0;
+
+	vq->used_idx += (idx < vq->qsize) ? vq->chain_ndesc[idx] : 1;
+	if (vq->used_idx >= vq->qsize) {
+		vq->used_idx -= vq->qsize;
+		vq->used_wrap = !vq->used_wrap;
+	}
+}
+
+static void
+packed_endchains(struct virtio_vq_info *vq)
+{
+	uint16_t old_idx, new_idx;
+	bool old_wrap;
+
+	atomic_thread_fence();
+	old_idx = vq->save_used;
+	old_wrap = vq->save_used_wrap;
+	vq->save_used = new_idx = vq->used_idx;
+	vq->save_used_wrap = vq->used_wrap;
+	if (((new_idx != old_idx) || (old_wrap != vq->used_wrap))
+			&& (driver_event->flags != VRING_PACKED_EVENT_FLAG_DISABLE))
+		nr_interrupts++;
+}
+
+/* Driver, split layout */
+
+static bool
+split_add(struct driver *d)
+{
+	uint16_t head, id, k;
+
+	if (d->num_free < chain_len)
+		return false;
+
+	head = id = d->free_head;
+	for (k = 0U; k < chain_len; k++) {
+		desc[id].addr = 0x100000000UL + id * 4096UL;
+		desc[id].len = 4096U;
+		desc[id].flags = ((k + 1U) < chain_len) ? VRING_DESC_F_NEXT : VRING_DESC_F_WRITE;
+		desc[id].next = d->free_next[id];
+		id = d->free_next[id];
+	}
+	d->free_head = id;
+	d->num_free -= chain_len;
+
+	avail->ring[d->avail_idx & (QSIZE - 1U)] = head;
+	__atomic_store_n(&avail->idx, ++d->avail_idx, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static uint64_t
+split_reclaim(struct driver *d)
+{
+	uint16_t used_idx = __atomic_load_n(&used->idx, __ATOMIC_ACQUIRE);
+	uint16_t head, tail, k;
+	uint64_t n = 0UL;
+
+	while (d->last_used != used_idx) {
+		head = tail = used->ring[d->last_used & (QSIZE - 1U)].id;
+		for (k = 1U; k < chain_len; k++)
+			tail = d->free_next[tail];
+		d->free_next[tail] = d->free_head;
+		d->free_head = head;
+		d->num_free += chain_len;
+		d->last_used++;
+		n++;
+	}
+
+	return n;
+}
+
+/* Driver, packed layout */
+
+static bool
+packed_add(struct driver *d)
+{
+	uint16_t id, head, head_flags = 0U, flags, k;
+
+	if (d->num_free < chain_len)
+		return false;
+
+	id = d->free_head;
+	d->free_head = d->free_next[id];
+	d->chain_len[id] = chain_len;
+
+	head = d->next_avail;
+	for (k = 0U; k < chain_len; k++) {
+		pdesc[d->next_avail].addr = 0x100000000UL + d->next_avail * 4096UL;
+		pdesc[d->next_avail].len = 4096U;
+		pdesc[d->next_avail].id = id;
+		flags = ((k + 1U) < chain_len) ? VRING_DESC_F_NEXT : VRING_DESC_F_WRITE;
+		flags |= d->avail_wrap ? (1U << VRING_PACKED_DESC_F_AVAIL) : (1U << VRING_PACKED_DESC_F_USED);
+		if (k == 0U)
+			head_flags = flags;
+		else
+			pdesc[d->next_avail].flags = flags;
+		if (++d->next_avail == QSIZE) {
+			d->next_avail = 0U;
+			d->avail_wrap = !d->avail_wrap;
+		}
+	}
+	d->num_free -= chain_len;
+
+	__atomic_store_n(&pdesc[head].flags, head_flags, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static uint64_t
+packed_reclaim(struct driver *d)
+{
+	uint16_t flags, id;
+	uint64_t n = 0UL;
+
+	for (;;) {
+		flags = __atomic_load_n(&pdesc[d->next_used].flags, __ATOMIC_ACQUIRE);
+		if ((!!(flags & (1U << VRING_PACKED_DESC_F_USED)) != d->used_wrap)
+				|| (!!(flags & (1U << VRING_PACKED_DESC_F_AVAIL)) != d->used_wrap))
+			break;
+		id = pdesc[d->next_used].id;
+		d->next_used += d->chain_len[id];
+		if (d->next_used >= QSIZE) {
+			d->next_used -= QSIZE;
+			d->used_wrap = !d->used_wrap;
+		}
+		d->num_free += d->chain_len[id];
+		d->free_next[id] = d->free_head;
+		d->free_head = id;
+		n++;
+	}
+
+	return n;
+}
+
+struct layout {
+	const char *name;
+	int (*getchain)(struct virtio_vq_info *vq, uint16_t *pidx, struct iovec *iov, int n_iov, uint16_t *flags);
+	void (*relchain)(struct virtio_vq_info *vq, uint16_t idx, uint32_t iolen);
+	void (*endchains)(struct virtio_vq_info *vq);
+	bool (*add)(struct driver *d);
+	uint64_t (*reclaim)(struct driver *d);
+};
+
+static const struct layout layouts[] = {
+	{ "split", split_getchain, split_relchain, split_endchains, split_add, split_reclaim },
+	{ "packed", packed_getchain, packed_relchain, packed_endchains, packed_add, packed_reclaim },
+};
+
+static void *rings;
+
+static void
+reset(void)
+{
+	uint16_t i;
+
+	memset(rings, 0, 4U * 4096U + QSIZE * sizeof(struct vring_packed_desc));
+	memset(&the_vq, 0, sizeof(the_vq));
+	memset(&drv, 0, sizeof(drv));
+
+	the_vq.qsize = QSIZE;
+	the_vq.avail_wrap = true;
+	the_vq.used_wrap = true;
+	the_vq.save_used_wrap = true;
+
+	drv.num_free = QSIZE;
+	for (i = 0U; i < QSIZE; i++)
+		drv.free_next[i] = (i + 1U) % QSIZE;
+	drv.avail_wrap = true;
+	drv.used_wrap = true;
+}
+
+/* Pop and complete what is available, return the number of chains */
+static uint64_t
+device_pass(const struct layout *l)
+{
+	struct iovec iov[MAX_CHAIN];
+	uint16_t flags[MAX_CHAIN];
+	uint16_t idx;
+	uint64_t n = 0UL;
+	int ret;
+
+	while ((ret = l->getchain(&the_vq, &idx, iov, MAX_CHAIN, flags)) != 0) {
+		if (ret < 0) {
+			fprintf(stderr, "%s: bad chain\n", l->name);
+			exit(EXIT_FAILURE);
+		}
+		l->relchain(&the_vq, idx, iov[ret - 1].iov_len);
+		n++;
+	}
+	if (n != 0UL)
+		l->endchains(&the_vq);
+
+	return n;
+}
+
+static void
+pin(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) != 0)
+		perror("sched_setaffinity");
+}
+
+static void *
+device_thread(void *arg)
+{
+	const struct layout *l = arg;
+	uint64_t done = 0UL, n;
+
+	pin(1);
+
+	while (done < nr_chains) {
+		n = device_pass(l);
+		if (n == 0UL)
+			cpu_relax();
+		done += n;
+	}
+
+	return NULL;
+}
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* Return the number of descriptors per second */
+static double
+run(const struct layout *l, bool single)
+{
+	pthread_t thread;
+	uint64_t sent = 0UL, reclaimed = 0UL, start;
+
+	reset();
+	start = now_ns();
+	if (single) {
+		while (reclaimed < nr_chains) {
+			while ((sent < nr_chains) && l->add(&drv))
+				sent++;
+			(void)device_pass(l);
+			reclaimed += l->reclaim(&drv);
+		}
+	} else {
+		if (pthread_create(&thread, NULL, device_thread, (void *)l) != 0) {
+			fprintf(stderr, "cannot create the device thread\n");
+			exit(EXIT_FAILURE);
+		}
+		while (reclaimed < nr_chains) {
+			while ((sent < nr_chains) && l->add(&drv))
+				sent++;
+			reclaimed += l->reclaim(&drv);
+			cpu_relax();
+		}
+		pthread_join(thread, NULL);
+	}
+
+	return (double)nr_chains * chain_len * 1e9 / (double)(now_ns() - start);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-s] [-c descriptors per chain] [-n chains]\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	bool single = false;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "sc:n:h")) != -1) {
+		switch (opt) {
+		case 's':
+			single = true;
+			break;
+		case 'c':
+			chain_len = atoi(optarg);
+			break;
+		case 'n':
+			nr_chains = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if ((chain_len == 0U) || (chain_len > MAX_CHAIN) || (nr_chains == 0UL))
+		usage(argv[0]);
+	if (!single && (sysconf(_SC_NPROCESSORS_ONLN) < 2)) {
+		printf("a single CPU is online, running the driver and the device on one thread\n");
+		single = true;
+	}
+	if (!single)
+		pin(0);
+
+	if (posix_memalign(&rings, 4096U, 4U * 4096U + QSIZE * sizeof(struct vring_packed_desc)) != 0) {
+		perror("posix_memalign");
+		return EXIT_FAILURE;
+	}
+	desc = rings;
+	avail = (void *)((char *)rings + 4096U);
+	used = (void *)((char *)rings + 2U * 4096U);
+	driver_event = (void *)((char *)rings + 3U * 4096U);
+	pdesc = (void *)((char *)rings + 4U * 4096U);
+
+	printf("queue size %u, %u descriptor(s) per chain, %lu chains, %s\n", QSIZE, chain_len,
+		nr_chains, single ? "one thread" : "driver and device threads");
+	for (i = 0U; i < sizeof(layouts) / sizeof(layouts[0]); i++)
+		printf("%8s %10.2f Mdesc/s\n", layouts[i].name, run(&layouts[i], single) / 1e6);
+
+	free(rings);
+
+	return 0;
+}
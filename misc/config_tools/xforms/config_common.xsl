@@ -79,6 +79,10 @@
       <xsl:with-param name="value" select="'y'" />
     </xsl:call-template>
 
+    <xsl:call-template name="boolean-by-key">
+      <xsl:with-param name="key" select="'TIMER_WHEEL_ENABLED'" />
+    </xsl:call-template>
+
     <xsl:call-template name="boolean-by-key">
       <xsl:with-param name="key" select="'SERVICE_VM_SUPERVISOR_ENABLED'" />
     </xsl:call-template>
@@ -20,6 +20,8 @@
 #include <string.h>
 #include <signal.h>
 #include <numa.h>
+#include <poll.h>
+#include <sys/eventfd.h>
 
 #include "acrntrace.h"
 
@@ -30,7 +32,7 @@ static int exiting = 0;
 
 /* for opt */
 static uint64_t period = 10000;
-static const char optString[] = "i:hcrt:a:";
+static const char optString[] = "i:hcrot:a:";
 static const char dev_prefix[] = "acrn_trace_";
 
 static uint32_t flags = FLAG_CLEAR_BUF;
@@ -44,13 +46,14 @@ static struct bitmask *cpu_bitmask = NULL;
 static void display_usage(void)
 {
 	printf("acrntrace - tool to collect ACRN trace data\n"
-	       "[Usage] acrntrace [-i period] [-t max_time] [-ch]\n\n"
+	       "[Usage] acrntrace [-i period] [-t max_time] [-chro]\n\n"
 	       "[Options]\n"
 	       "\t-h: print this message\n"
 	       "\t-i: period_in_ms: specify polling interval [1-999]\n"
 	       "\t-t: max time to capture trace data (in second)\n"
 	       "\t-c: clear the buffered old data (deprecated)\n"
 	       "\t-r: capture the buffered old data instead of clearing it\n"
+	       "\t-o: overwrite the oldest data instead of dropping new data when a buffer is full\n"
 	       "\t-a: cpu-set: only capture the trace data on these configured cpu-set\n");
 }
 
@@ -127,6 +130,9 @@ static int parse_opt(int argc, char *argv[])
 		case 'r':
 			flags &= ~FLAG_CLEAR_BUF;
 			break;
+		case 'o':
+			flags |= FLAG_OVERWRITE;
+			break;
 		case 'a':
 			cpu_bitmask = numa_parse_cpustring_all(optarg);
 			break;
@@ -220,27 +226,49 @@ static int create_trace_file_dir(char *dir)
 /* function executed in each consumer thread */
 static void reader_fn(param_t * param)
 {
-	int ret;
+	int ret, timeout;
 	int fd = param->trace_fd;
 	shared_buf_t *sbuf = param->sbuf;
+	struct pollfd pfd = { .fd = param->exit_fd, .events = POLLIN };
 
 	pr_dbg("reader thread[%lu] created for FILE*[0x%p]\n",
 	       pthread_self(), fp);
 
-	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
-
 	/* Clear the old data in sbuf */
 	if (flags & FLAG_CLEAR_BUF)
 		sbuf_clear_buffered(sbuf);
 
+	/* keep the latest trace data when the buffer overflows, and count the drops */
+	if (flags & FLAG_OVERWRITE)
+		sbuf_add_flags(sbuf, OVERWRITE_EN | OVERRUN_CNT_EN);
+	else
+		sbuf_clear_flags(sbuf, OVERWRITE_EN);
+
 	while (1) {
-		do {
-			ret = sbuf_write(fd, sbuf);
-		} while (ret > 0);
+		ret = sbuf_write_batch(fd, sbuf);
+
+		/*
+		 * The trace device has no notification, so wait for one period
+		 * unless the buffer filled over the drain watermark since the last
+		 * round, or was overwritten while it was drained. A write error is
+		 * retried after one period. destory_reader() wakes us up through
+		 * exit_fd, which is checked on every round.
+		 */
+		if ((ret == -EAGAIN) || (ret >= (int)(sbuf->size / DRAIN_WATERMARK)))
+			timeout = 0;
+		else
+			timeout = period / 1000;
 
-		usleep(period);
+		if (poll(&pfd, 1, timeout) > 0)
+			break;
 	}
+
+	/* flush what is left before exiting */
+	(void)sbuf_write_batch(fd, sbuf);
+
+	if (flags & FLAG_OVERWRITE)
+		pr_info("%u trace entries overwritten on device %u\n",
+			sbuf->overrun_cnt, param->devid);
 }
 
 static int create_reader(reader_struct * reader, uint32_t dev_id)
@@ -253,6 +281,13 @@ static int create_reader(reader_struct * reader, uint32_t dev_id)
 
 	reader->param.devid = dev_id;
 
+	reader->param.exit_fd = eventfd(0, EFD_CLOEXEC);
+	if (reader->param.exit_fd < 0) {
+		pr_err("Failed to create eventfd for %s, err %d\n", reader->dev_name, errno);
+		reader->param.exit_fd = 0;
+		return -1;
+	}
+
 	reader->dev_fd = open(reader->dev_name, O_RDWR);
 	if (reader->dev_fd < 0) {
 		pr_err("Failed to open %s, err %d\n", reader->dev_name, errno);
@@ -297,14 +332,22 @@ static int create_reader(reader_struct * reader, uint32_t dev_id)
 
 static void destory_reader(reader_struct * reader)
 {
+	uint64_t val = 1;
+
 	if (reader->thrd) {
-		pthread_cancel(reader->thrd);
+		if (write(reader->param.exit_fd, &val, sizeof(val)) != sizeof(val))
+			pthread_cancel(reader->thrd);
 		if (pthread_join(reader->thrd, NULL) != 0)
 			pr_err("failed to cancel thread[%lu]\n", reader->thrd);
 		else
 			reader->thrd = 0;
 	}
 
+	if (reader->param.exit_fd) {
+		close(reader->param.exit_fd);
+		reader->param.exit_fd = 0;
+	}
+
 	if (reader->param.sbuf) {
 		munmap(reader->param.sbuf, MMAP_SIZE);
 		reader->param.sbuf = NULL;
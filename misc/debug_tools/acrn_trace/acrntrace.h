@@ -23,6 +23,8 @@
 #define DEV_PATH_LEN		20
 #define TIME_STR_LEN		16
 #define CMD_MAX_LEN		48
+/* drain again without waiting once a round gets 1/DRAIN_WATERMARK of the sbuf */
+#define DRAIN_WATERMARK		4
 
 #define pr_fmt(fmt)             "acrntrace: " fmt
 #define pr_info(fmt, ...)       printf(pr_fmt(fmt), ##__VA_ARGS__)
@@ -38,9 +40,11 @@
  * flags:
  * FLAG_TO_REL   - resources need to be release
  * FLAG_CLEAR_BUF - to clear buffered old data
+ * FLAG_OVERWRITE - to let the hypervisor overwrite the oldest data when full
  */
 #define FLAG_TO_REL		(1UL << 0)
 #define FLAG_CLEAR_BUF		(1UL << 1)
+#define FLAG_OVERWRITE		(1UL << 2)
 
 #define foreach_dev(dev_id)                                       \
         for ((dev_id) = 0; (dev_id) < (dev_cnt); (dev_id)++)
@@ -74,6 +78,7 @@ typedef struct {
 	uint32_t devid;
 	int exit_flag;
 	int trace_fd;
+	int exit_fd;
 	shared_buf_t *sbuf;
 	pthread_mutex_t *sbuf_lock;
 } param_t;
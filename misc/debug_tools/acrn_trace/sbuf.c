@@ -9,6 +9,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <sys/uio.h>
 #include "sbuf.h"
 #include <errno.h>
 
@@ -25,9 +26,27 @@ static inline uint32_t sbuf_next_ptr(uint32_t pos,
 	return pos;
 }
 
+/*
+ * Consume the data from @head to @new_head. In overwrite mode the hypervisor
+ * moves the head too when it drops the oldest elements, so the head is only
+ * moved if the hypervisor did not, it must never go backwards.
+ * Return false if the data read from @head was overwritten meanwhile.
+ */
+static bool sbuf_consume(shared_buf_t *sbuf, uint32_t head, uint32_t new_head)
+{
+	if ((sbuf->flags & OVERWRITE_EN) == 0) {
+		__atomic_store_n(&sbuf->head, new_head, __ATOMIC_RELEASE);
+		return true;
+	}
+
+	return __atomic_compare_exchange_n(&sbuf->head, &head, new_head, false,
+			__ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
 int sbuf_get(shared_buf_t *sbuf, uint8_t *data)
 {
 	const void *from;
+	uint32_t head;
 
 	if ((sbuf == NULL) || (data == NULL))
 		return -EINVAL;
@@ -37,11 +56,13 @@ int sbuf_get(shared_buf_t *sbuf, uint8_t *data)
 		return 0;
 	}
 
-	from = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->head;
+	head = sbuf->head;
+	from = (void *)sbuf + SBUF_HEAD_SIZE + head;
 
 	memcpy(data, from, sbuf->ele_size);
 
-	sbuf->head = sbuf_next_ptr(sbuf->head, sbuf->ele_size, sbuf->size);
+	if (!sbuf_consume(sbuf, head, sbuf_next_ptr(head, sbuf->ele_size, sbuf->size)))
+		return -EAGAIN;
 
 	return sbuf->ele_size;
 }
@@ -49,6 +70,7 @@ int sbuf_get(shared_buf_t *sbuf, uint8_t *data)
 int sbuf_write(int fd, shared_buf_t *sbuf)
 {
 	const void *start;
+	uint32_t head;
 	int written;
 
 	if (sbuf == NULL)
@@ -58,7 +80,8 @@ int sbuf_write(int fd, shared_buf_t *sbuf)
 		return 0;
 	}
 
-	start = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->head;
+	head = sbuf->head;
+	start = (void *)sbuf + SBUF_HEAD_SIZE + head;
         written = write(fd, start, sbuf->ele_size);
 	if (written != sbuf->ele_size) {
 		printf("Failed to write: ret %d (ele_size %d), errno %d\n",
@@ -66,11 +89,96 @@ int sbuf_write(int fd, shared_buf_t *sbuf)
 		return -1;
 	}
 
-	sbuf->head = sbuf_next_ptr(sbuf->head, sbuf->ele_size, sbuf->size);
+	(void)sbuf_consume(sbuf, head, sbuf_next_ptr(head, sbuf->ele_size, sbuf->size));
 
 	return sbuf->ele_size;
 }
 
+/*
+ * Write all the elements available in sbuf to fd with one writev(), taking
+ * them in place from the mapped buffer. At most two spans are written when
+ * the data wraps around the end of the buffer.
+ * Return the number of bytes consumed, -1 if not all could be written, or
+ * -EAGAIN if the hypervisor overwrote the data meanwhile, which is dropped
+ * from fd then.
+ */
+int sbuf_write_batch(int fd, shared_buf_t *sbuf)
+{
+	struct iovec iov[2];
+	uint32_t head, tail, len, done, partial;
+	ssize_t written;
+	off_t start, pos;
+	int iovcnt;
+
+	if (sbuf == NULL)
+		return -EINVAL;
+
+	head = sbuf->head;
+	/* pairs with the barrier between data and tail update in the producer */
+	tail = __atomic_load_n(&sbuf->tail, __ATOMIC_ACQUIRE);
+	if (head == tail)
+		return 0;
+
+	iov[0].iov_base = (void *)sbuf + SBUF_HEAD_SIZE + head;
+	if (tail > head) {
+		iov[0].iov_len = tail - head;
+		iovcnt = 1;
+	} else {
+		iov[0].iov_len = sbuf->size - head;
+		iov[1].iov_base = (void *)sbuf + SBUF_HEAD_SIZE;
+		iov[1].iov_len = tail;
+		iovcnt = (tail != 0) ? 2 : 1;
+	}
+	len = iov[0].iov_len + ((iovcnt == 2) ? iov[1].iov_len : 0);
+
+	start = lseek(fd, 0, SEEK_CUR);
+	done = 0;
+	while (done < len) {
+		written = writev(fd, iov, iovcnt);
+		if (written <= 0) {
+			if ((written < 0) && (errno == EINTR))
+				continue;
+			printf("Failed to write: ret %ld (len %u), errno %d\n",
+				written, len - done, (written < 0) ? errno : 0);
+			break;
+		}
+
+		done += written;
+		/* skip what is written for a short write */
+		while ((iovcnt > 0) && ((size_t)written >= iov[0].iov_len)) {
+			written -= iov[0].iov_len;
+			iov[0] = iov[1];
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov[0].iov_base += written;
+			iov[0].iov_len -= written;
+		}
+	}
+
+	/*
+	 * Only consume whole elements. The bytes of an element written in
+	 * part are cut from the file, they are written again with the whole
+	 * element on the next call.
+	 */
+	partial = done % sbuf->ele_size;
+	if (partial != 0) {
+		pos = lseek(fd, -(off_t)partial, SEEK_CUR);
+		if ((pos < 0) || (ftruncate(fd, pos) < 0))
+			printf("Failed to drop a partial trace entry, errno %d\n", errno);
+		done -= partial;
+	}
+	if (!sbuf_consume(sbuf, head, sbuf_next_ptr(head, done, sbuf->size))) {
+		/* the data written may be torn, the next call starts from the new head */
+		if ((start < 0) || (lseek(fd, start, SEEK_SET) < 0) || (ftruncate(fd, start) < 0))
+			printf("Failed to drop overwritten trace data, errno %d\n", errno);
+		printf("Trace data overwritten while it was written out, dropped\n");
+		return -EAGAIN;
+	}
+
+	return (done < len) ? -1 : (int)done;
+}
+
 int sbuf_clear_buffered(shared_buf_t *sbuf)
 {
 	if (sbuf == NULL)
@@ -30,6 +30,9 @@ header file.
 /* TODO: Revisit PARAM_LEN and see if size can be reduced */
 #define PARAM_LEN	256
 
+/* exit reasons in a DM_VMEXIT_STATS ack, the message must fit in 4KiB */
+#define VMEXIT_STATS_MSG_REASONS	20
+
 struct mngr_msg {
 	unsigned long long magic;	/* Make sure you get a mngr_msg */
 	unsigned int msgid;
@@ -49,6 +52,20 @@ struct mngr_msg {
 		/* ack of DM_QUERY */
 		int state;
 
+		/*
+		 * req and ack of DM_VMEXIT_STATS, err overlaps the err above.
+		 * The ack carries the most frequent exit reasons of the vCPU,
+		 * by decreasing count.
+		 */
+		struct vmexit_stats_msg {
+			int err;
+			unsigned short vcpu_id;
+			unsigned short nr_seen;	/* exit reasons with a non-zero count */
+			unsigned short nr;	/* exit reasons in reason[] and stats[] */
+			unsigned short reason[VMEXIT_STATS_MSG_REASONS];
+			struct acrn_vmexit_reason_stats stats[VMEXIT_STATS_MSG_REASONS];
+		} vmexit_stats;
+
 		/* req of ACRND_TIMER */
 		struct req_acrnd_timer {
 			char name[MAX_VM_NAME_LEN];
@@ -96,6 +113,7 @@ enum dm_msgid {
 	DM_RESUME,		/* Resume this UOS from suspend state */
 	DM_QUERY,		/* Ask power state of this UOS */
 	DM_BLKRESCAN,		/* Rescan virtio-blk device for any changes in UOS */
+	DM_VMEXIT_STATS,	/* Get VM exit statistics of a vCPU */
 	DM_MAX,
 };
 
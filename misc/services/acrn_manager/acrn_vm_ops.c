@@ -409,6 +409,25 @@ int resume_vm(const char *vmname, unsigned reason)
 	return ack.data.err;
 }
 
+int vmexit_stats_vm(const char *vmname, unsigned short vcpu_id, struct vmexit_stats_msg *stats)
+{
+	struct mngr_msg req;
+	struct mngr_msg ack;
+
+	req.magic = MNGR_MSG_MAGIC;
+	req.msgid = DM_VMEXIT_STATS;
+	req.timestamp = time(NULL);
+	req.data.vmexit_stats.vcpu_id = vcpu_id;
+
+	ack.data.vmexit_stats.err = -1;
+	send_msg(vmname, &req, &ack);
+
+	if (!ack.data.vmexit_stats.err)
+		*stats = ack.data.vmexit_stats;
+
+	return ack.data.vmexit_stats.err;
+}
+
 int blkrescan_vm(const char *vmname, char *devargs)
 {
 	struct mngr_msg req;
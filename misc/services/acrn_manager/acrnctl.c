@@ -34,6 +34,7 @@
 #define ADD_DESC       "Add one virtual machine with SCRIPTS and OPTIONS"
 #define RESET_DESC     "Stop and then start virtual machine VM_NAME"
 #define BLKRESCAN_DESC  "Rescan virtio-blk device attached to a virtual machine"
+#define VMEXIT_DESC     "Show VM exit counts and latency histograms of a vCPU of VM_NAME"
 
 #define VM_NAME (1)
 #define CMD_ARGS (2)
@@ -427,6 +428,47 @@ static int acrnctl_do_blkrescan(int argc, char *argv[])
 	return 0;
 }
 
+static int acrnctl_do_vmexit(int argc, char *argv[])
+{
+	struct vmmngr_struct *s;
+	struct vmexit_stats_msg msg;
+	struct acrn_vmexit_reason_stats *stats;
+	unsigned short vcpu_id;
+	int i, j;
+
+	s = vmmngr_find(argv[VM_NAME]);
+	if (!s) {
+		printf("can't find %s\n", argv[VM_NAME]);
+		return -1;
+	}
+	if (s->state != VM_STARTED) {
+		printf("%s is in %s state but should be in %s state for vmexit\n",
+			argv[VM_NAME], state_str[s->state], state_str[VM_STARTED]);
+		return -1;
+	}
+
+	vcpu_id = strtoul(argv[CMD_ARGS], NULL, 0);
+	if (vmexit_stats_vm(argv[VM_NAME], vcpu_id, &msg)) {
+		printf("Unable to get VM exit statistics of vcpu %u\n", vcpu_id);
+		return -1;
+	}
+
+	printf("%-8s%-16s%-12s%s (bucket n: < %u << n TSC cycles)\n", "REASON", "COUNT",
+		"AVG CYCLES", "HISTOGRAM", 1U << ACRN_VMEXIT_HIST_SHIFT);
+	for (i = 0; i < msg.nr; i++) {
+		stats = &msg.stats[i];
+		printf("0x%02x    %-16llu%-12llu", msg.reason[i], (unsigned long long)stats->count,
+			(unsigned long long)(stats->total_cycles / stats->count));
+		for (j = 0; j < ACRN_VMEXIT_HIST_NUM; j++)
+			printf(" %llu", (unsigned long long)stats->hist[j]);
+		printf("\n");
+	}
+	if (msg.nr_seen > msg.nr)
+		printf("%u less frequent exit reasons not shown\n", msg.nr_seen - msg.nr);
+
+	return 0;
+}
+
 static int acrnctl_do_stop(int argc, char *argv[])
 {
 	struct vmmngr_struct *s;
@@ -641,6 +683,18 @@ static int valid_blkrescan_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 	return 0;
 }
 
+static int valid_vmexit_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
+{
+	char df_opt[] = "VM_NAME VCPU_ID";
+
+	if (argc != 3 || !strcmp(argv[1], "help")) {
+		printf("acrnctl %s %s\n", cmd->cmd, df_opt);
+		return -1;
+	}
+
+	return 0;
+}
+
 static int valid_add_args(struct acrnctl_cmd *cmd, int argc, char *argv[])
 {
 	char df_opt[32] = "launch_scripts options";
@@ -683,6 +737,7 @@ struct acrnctl_cmd acmds[] = {
 	ACMD("add", acrnctl_do_add, ADD_DESC, valid_add_args),
 	ACMD("reset", acrnctl_do_reset, RESET_DESC, df_valid_args),
 	ACMD("blkrescan", acrnctl_do_blkrescan, BLKRESCAN_DESC, valid_blkrescan_args),
+	ACMD("vmexit", acrnctl_do_vmexit, VMEXIT_DESC, valid_vmexit_args),
 };
 
 #define NCMD	(sizeof(acmds)/sizeof(struct acrnctl_cmd))